@@ -0,0 +1,542 @@
+// ==========================================================================
+// Scene Ray Queries
+// ==========================================================================
+
+#include "Accelerator.h"
+#include "BinaryStream.h"
+
+using namespace std;
+using namespace glm;
+
+// --------------------------------------------------------------------------
+
+namespace
+{
+	// mesh BVH intersector recording the nearest triangle hit under the
+	// scene-wide id it has in one instance
+	struct MeshClosestHit
+	{
+		const Mesh  &mesh;
+		PrimitiveId firstId;
+		Hit         &hit;
+
+		MeshClosestHit(const Mesh &m, PrimitiveId first, Hit &h) : mesh(m), firstId(first), hit(h) {}
+
+		bool operator()(int triangle, Ray &ray)
+		{
+			const Triangle &tri = mesh.triangles[triangle];
+			float t, u, v;
+			if (!IntersectTriangle(mesh.vertices[tri.v[0]], mesh.vertices[tri.v[1]],
+			                       mesh.vertices[tri.v[2]], ray, t, u, v))
+				return false;
+			ray.tMax = t;
+			hit.t = t;
+			hit.primitive = firstId + triangle;
+			hit.u = u;
+			hit.v = v;
+			return false;
+		}
+	};
+
+	// mesh BVH intersector stopping at the first triangle hit
+	struct MeshAnyHit
+	{
+		const Mesh  &mesh;
+		PrimitiveId firstId;
+		PrimitiveId &occluder;
+
+		MeshAnyHit(const Mesh &m, PrimitiveId first, PrimitiveId &o) : mesh(m), firstId(first), occluder(o) {}
+
+		bool operator()(int triangle, Ray &ray)
+		{
+			const Triangle &tri = mesh.triangles[triangle];
+			float t, u, v;
+			if (!IntersectTriangle(mesh.vertices[tri.v[0]], mesh.vertices[tri.v[1]],
+			                       mesh.vertices[tri.v[2]], ray, t, u, v))
+				return false;
+			occluder = firstId + triangle;
+			return true;
+		}
+	};
+
+	// box around a transformed box; an empty box becomes the point the
+	// transform takes the origin to, so it still has a place in the BVH
+	AABB TransformBounds(const AABB &box, const mat4 &transform)
+	{
+		AABB result;
+		if (box.Empty())
+		{
+			result.Extend(vec3(transform[3]));
+			return result;
+		}
+		for (int corner = 0; corner < 8; ++corner)
+		{
+			vec3 p((corner & 1) ? box.upper.x : box.lower.x,
+			       (corner & 2) ? box.upper.y : box.lower.y,
+			       (corner & 4) ? box.upper.z : box.lower.z);
+			result.Extend(vec3(transform * vec4(p, 1.f)));
+		}
+		return result;
+	}
+
+	void MeshBounds(const Mesh &mesh, vector<AABB> &bounds)
+	{
+		bounds.resize(mesh.triangles.size());
+		for (size_t i = 0; i < mesh.triangles.size(); ++i)
+		{
+			const Triangle &tri = mesh.triangles[i];
+			bounds[i] = AABB();
+			for (int k = 0; k < 3; ++k)
+				bounds[i].Extend(mesh.vertices[tri.v[k]]);
+		}
+	}
+
+	void BuildWide(const BVH &bvh, BVHLayout layout, WideBVH<4> &bvh4, WideBVH<8> &bvh8)
+	{
+		bvh4.Clear();
+		bvh8.Clear();
+		if (layout == BVH_WIDE4)
+			bvh4.Build(bvh);
+		else if (layout == BVH_WIDE8)
+			bvh8.Build(bvh);
+	}
+
+	void ResizePacked(PackedPrimitives &packed, size_t n)
+	{
+		vector<float> *arrays[] = { &packed.x0, &packed.y0, &packed.z0,
+		                            &packed.e1x, &packed.e1y, &packed.e1z,
+		                            &packed.e2x, &packed.e2y, &packed.e2z };
+		for (int i = 0; i < 9; ++i)
+			arrays[i]->assign(n, 0.f);
+		packed.id.assign(n, -1);
+		packed.kind.assign(n, char(PACKED_TRIANGLE));
+	}
+
+	void PackEntry(PackedPrimitives &packed, size_t i, const vec3 &p0, const vec3 &e1,
+	               const vec3 &e2)
+	{
+		packed.x0[i] = p0.x;   packed.y0[i] = p0.y;   packed.z0[i] = p0.z;
+		packed.e1x[i] = e1.x;  packed.e1y[i] = e1.y;  packed.e1z[i] = e1.z;
+		packed.e2x[i] = e2.x;  packed.e2y[i] = e2.y;  packed.e2z[i] = e2.z;
+	}
+}
+
+// --------------------------------------------------------------------------
+// Scene BVH intersectors. Bounded primitives are tested directly; an
+// instance hands the ray on to its mesh's BVH in the mesh's frame, where
+// distances along the ray are unchanged, so the shortened ray comes back
+// ready to prune the rest of the scene BVH.
+
+// records the nearest primitive hit
+struct Accelerator::ClosestHit
+{
+	const Accelerator   &accelerator;
+	const Scene         &scene;
+	Hit                 &hit;
+	int                 steps;      // nodes visited in mesh BVHs
+
+	ClosestHit(const Accelerator &a, Hit &h)
+		: accelerator(a), scene(*a.m_scene), hit(h), steps(0) {}
+
+	bool operator()(int item, Ray &ray)
+	{
+		if (item < scene.BoundedCount())
+		{
+			scene.IntersectPrimitive(item, ray, hit);
+			return false;
+		}
+
+		const Instance &instance = scene.instances[item - scene.BoundedCount()];
+		Ray local = instance.ToObject(ray);
+		MeshClosestHit inner(scene.meshes[instance.mesh],
+		                     scene.FirstInstanced() + instance.offset, hit);
+		steps += accelerator.TraverseMesh(instance.mesh, local, inner);
+		ray.tMax = local.tMax;
+		return false;
+	}
+};
+
+// stops at the first primitive hit
+struct Accelerator::AnyHit
+{
+	const Accelerator   &accelerator;
+	const Scene         &scene;
+	PrimitiveId         &occluder;
+	int                 steps;
+
+	AnyHit(const Accelerator &a, PrimitiveId &o)
+		: accelerator(a), scene(*a.m_scene), occluder(o), steps(0) {}
+
+	bool operator()(int item, Ray &ray)
+	{
+		if (item < scene.BoundedCount())
+		{
+			Hit hit;
+			Ray r = ray;
+			if (!scene.IntersectPrimitive(item, r, hit))
+				return false;
+			occluder = item;
+			return true;
+		}
+
+		const Instance &instance = scene.instances[item - scene.BoundedCount()];
+		Ray local = instance.ToObject(ray);
+		MeshAnyHit inner(scene.meshes[instance.mesh],
+		                 scene.FirstInstanced() + instance.offset, occluder);
+		steps += accelerator.TraverseMesh(instance.mesh, local, inner);
+		return occluder >= 0;
+	}
+};
+
+// --------------------------------------------------------------------------
+
+void PackedPrimitives::Build(const Scene &scene, const vector<int> &order)
+{
+	size_t n = order.size();
+	ResizePacked(*this, n);
+	for (size_t i = 0; i < n; ++i)
+	{
+		int item = order[i];
+		if (scene.IsTriangle(item))
+		{
+			const Triangle &tri = scene.triangles[item];
+			const vec3 &p0 = scene.vertices[tri.v[0]];
+			PackEntry(*this, i, p0, scene.vertices[tri.v[1]] - p0, scene.vertices[tri.v[2]] - p0);
+			id[i] = item;
+		}
+		else if (item < scene.BoundedCount())
+		{
+			const Sphere &s = scene.spheres[item - scene.triangles.size()];
+			PackEntry(*this, i, s.centre, vec3(s.radius, 0.f, 0.f), vec3(0.f));
+			id[i] = item;
+			kind[i] = PACKED_SPHERE;
+		}
+		else
+		{
+			id[i] = item - scene.BoundedCount();
+			kind[i] = PACKED_INSTANCE;
+		}
+	}
+}
+
+void PackedPrimitives::Build(const Mesh &mesh, const vector<int> &order)
+{
+	size_t n = order.size();
+	ResizePacked(*this, n);
+	for (size_t i = 0; i < n; ++i)
+	{
+		const Triangle &tri = mesh.triangles[order[i]];
+		const vec3 &p0 = mesh.vertices[tri.v[0]];
+		PackEntry(*this, i, p0, mesh.vertices[tri.v[1]] - p0, mesh.vertices[tri.v[2]] - p0);
+		id[i] = order[i];
+	}
+}
+
+size_t PackedPrimitives::MemoryBytes() const
+{
+	return (x0.capacity() + y0.capacity() + z0.capacity() + e1x.capacity() + e1y.capacity() +
+	        e1z.capacity() + e2x.capacity() + e2y.capacity() + e2z.capacity()) * sizeof(float) +
+	       id.capacity() * sizeof(int) + kind.capacity();
+}
+
+void PackedPrimitives::Save(BinaryWriter &writer) const
+{
+	const vector<float> *arrays[] = { &x0, &y0, &z0, &e1x, &e1y, &e1z, &e2x, &e2y, &e2z };
+	for (int i = 0; i < 9; ++i)
+		writer.WriteVector(*arrays[i]);
+	writer.WriteVector(id);
+	writer.WriteVector(kind);
+}
+
+bool PackedPrimitives::Load(BinaryReader &reader, size_t count)
+{
+	vector<float> *arrays[] = { &x0, &y0, &z0, &e1x, &e1y, &e1z, &e2x, &e2y, &e2z };
+	bool valid = true;
+	for (int i = 0; i < 9; ++i)
+		valid = valid && reader.ReadVector(*arrays[i]) && arrays[i]->size() == count;
+	return valid && reader.ReadVector(id) && id.size() == count &&
+	       reader.ReadVector(kind) && kind.size() == count;
+}
+
+// --------------------------------------------------------------------------
+
+const char *BVHLayoutName(BVHLayout layout)
+{
+	switch (layout)
+	{
+	case BVH_WIDE4: return "wide4";
+	case BVH_WIDE8: return "wide8";
+	default:        return "binary";
+	}
+}
+
+bool ParseBVHLayout(const string &name, BVHLayout &layout)
+{
+	const BVHLayout layouts[] = { BVH_BINARY, BVH_WIDE4, BVH_WIDE8 };
+	for (int i = 0; i < 3; ++i)
+		if (name == BVHLayoutName(layouts[i]))
+		{
+			layout = layouts[i];
+			return true;
+		}
+	return false;
+}
+
+// --------------------------------------------------------------------------
+
+void Accelerator::Build(const Scene &scene, BVHLayout layout)
+{
+	m_scene = &scene;
+	m_layout = layout;
+
+	// bottom level: one hierarchy per mesh, however often it is placed
+	m_meshes.assign(scene.meshes.size(), MeshHierarchy());
+	vector<AABB> bounds;
+	for (size_t m = 0; m < scene.meshes.size(); ++m)
+	{
+		MeshBounds(scene.meshes[m], bounds);
+		BuildLevel(m_meshes[m], scene.meshes[m], bounds);
+	}
+
+	// top level: the bounded primitives, then one box per instance
+	TopBounds(bounds);
+	m_bvh.Build(bounds);
+	m_builtCost = m_bvh.Cost();
+	m_packed.Build(scene, m_bvh.Indices());
+	BuildWide(m_bvh, layout, m_bvh4, m_bvh8);
+}
+
+bool Accelerator::Refit(bool meshesMoved, float maxCostGrowth)
+{
+	if (!m_scene) return true;
+	const Scene &scene = *m_scene;
+
+	// added or removed primitives need new trees
+	bool sameCounts = m_meshes.size() == scene.meshes.size() &&
+		m_bvh.Indices().size() == size_t(scene.BoundedCount()) + scene.instances.size();
+	for (size_t m = 0; sameCounts && m < m_meshes.size(); ++m)
+		sameCounts = m_meshes[m].bvh.Indices().size() == scene.meshes[m].triangles.size();
+	if (!sameCounts)
+	{
+		Build(scene, m_layout);
+		return false;
+	}
+
+	bool refitted = true;
+	vector<AABB> bounds;
+	if (meshesMoved)
+		for (size_t m = 0; m < m_meshes.size(); ++m)
+		{
+			MeshHierarchy &level = m_meshes[m];
+			MeshBounds(scene.meshes[m], bounds);
+			if (level.bvh.Refit(bounds) > maxCostGrowth * level.builtCost)
+			{
+				BuildLevel(level, scene.meshes[m], bounds);
+				refitted = false;
+				continue;
+			}
+			level.packed.Build(scene.meshes[m], level.bvh.Indices());
+			BuildWide(level.bvh, m_layout, level.bvh4, level.bvh8);
+		}
+
+	// the wide trees are collapsed again rather than refit: collapsing
+	// takes one pass over the binary tree, so it costs about what a refit
+	// would, and follows the binary tree's new boxes when picking children
+	TopBounds(bounds);
+	if (m_bvh.Refit(bounds) > maxCostGrowth * m_builtCost)
+	{
+		m_bvh.Build(bounds);
+		m_builtCost = m_bvh.Cost();
+		refitted = false;
+	}
+	m_packed.Build(scene, m_bvh.Indices());
+	BuildWide(m_bvh, m_layout, m_bvh4, m_bvh8);
+	return refitted;
+}
+
+void Accelerator::BuildLevel(MeshHierarchy &level, const Mesh &mesh,
+                             const vector<AABB> &bounds) const
+{
+	level.bvh.Build(bounds);
+	level.builtCost = level.bvh.Cost();
+	level.packed.Build(mesh, level.bvh.Indices());
+	BuildWide(level.bvh, m_layout, level.bvh4, level.bvh8);
+}
+
+void Accelerator::TopBounds(vector<AABB> &bounds) const
+{
+	const Scene &scene = *m_scene;
+	int bounded = scene.BoundedCount();
+	bounds.resize(bounded + scene.instances.size());
+	for (int i = 0; i < bounded; ++i)
+		bounds[i] = scene.Bounds(i);
+	for (size_t i = 0; i < scene.instances.size(); ++i)
+	{
+		const Instance &instance = scene.instances[i];
+		bounds[bounded + i] = TransformBounds(m_meshes[instance.mesh].bvh.Bounds(),
+		                                      instance.toWorld);
+	}
+}
+
+void Accelerator::Save(BinaryWriter &writer) const
+{
+	writer.Write(int32_t(m_layout));
+	writer.Write(m_builtCost);
+	m_bvh.Save(writer);
+	m_bvh4.Save(writer);
+	m_bvh8.Save(writer);
+	m_packed.Save(writer);
+	writer.Write(uint64_t(m_meshes.size()));
+	for (size_t m = 0; m < m_meshes.size(); ++m)
+	{
+		const MeshHierarchy &level = m_meshes[m];
+		writer.Write(level.builtCost);
+		level.bvh.Save(writer);
+		level.bvh4.Save(writer);
+		level.bvh8.Save(writer);
+		level.packed.Save(writer);
+	}
+}
+
+bool Accelerator::Load(BinaryReader &reader, const Scene &scene)
+{
+	m_scene = &scene;
+	size_t entries = size_t(scene.BoundedCount()) + scene.instances.size();
+	int32_t layout = 0;
+	uint64_t meshCount = 0;
+	bool valid = reader.Read(layout) && layout >= BVH_BINARY && layout <= BVH_WIDE8 &&
+	             reader.Read(m_builtCost) &&
+	             m_bvh.Load(reader, entries) && m_bvh4.Load(reader, entries) &&
+	             m_bvh8.Load(reader, entries) && m_packed.Load(reader, entries) &&
+	             reader.Read(meshCount) && meshCount == scene.meshes.size();
+	m_layout = BVHLayout(layout);
+
+	// packed ids are followed without checks while tracing
+	size_t triangles = scene.triangles.size();
+	for (size_t i = 0; valid && i < entries; ++i)
+	{
+		int id = m_packed.id[i];
+		switch (m_packed.kind[i])
+		{
+		case PACKED_TRIANGLE: valid = id >= 0 && size_t(id) < triangles; break;
+		case PACKED_SPHERE:   valid = size_t(id) >= triangles && id < scene.BoundedCount(); break;
+		case PACKED_INSTANCE: valid = id >= 0 && size_t(id) < scene.instances.size(); break;
+		default:              valid = false;
+		}
+	}
+
+	if (valid)
+		m_meshes.assign(scene.meshes.size(), MeshHierarchy());
+	for (size_t m = 0; valid && m < m_meshes.size(); ++m)
+	{
+		MeshHierarchy &level = m_meshes[m];
+		size_t count = scene.meshes[m].triangles.size();
+		valid = reader.Read(level.builtCost) && level.bvh.Load(reader, count) &&
+		        level.bvh4.Load(reader, count) && level.bvh8.Load(reader, count) &&
+		        level.packed.Load(reader, count);
+		for (size_t i = 0; valid && i < count; ++i)
+			valid = level.packed.kind[i] == PACKED_TRIANGLE && level.packed.id[i] >= 0 &&
+			        size_t(level.packed.id[i]) < count;
+	}
+
+	if (!valid)
+		*this = Accelerator();
+	return valid;
+}
+
+size_t Accelerator::NodeCount() const
+{
+	size_t count = m_bvh.Nodes().size();
+	for (size_t i = 0; i < m_meshes.size(); ++i)
+		count += m_meshes[i].bvh.Nodes().size();
+	return count;
+}
+
+size_t Accelerator::MemoryBytes() const
+{
+	size_t bytes = m_bvh.MemoryBytes() + m_bvh4.MemoryBytes() + m_bvh8.MemoryBytes() +
+	               m_packed.MemoryBytes();
+	for (size_t i = 0; i < m_meshes.size(); ++i)
+		bytes += m_meshes[i].bvh.MemoryBytes() + m_meshes[i].bvh4.MemoryBytes() +
+		         m_meshes[i].bvh8.MemoryBytes() + m_meshes[i].packed.MemoryBytes();
+	return bytes;
+}
+
+template <class Intersector>
+int Accelerator::Traverse(Ray &ray, Intersector &intersect) const
+{
+	switch (m_layout)
+	{
+	case BVH_WIDE4: return m_bvh4.Traverse(ray, intersect);
+	case BVH_WIDE8: return m_bvh8.Traverse(ray, intersect);
+	default:        return m_bvh.Traverse(ray, intersect);
+	}
+}
+
+template <class Intersector>
+int Accelerator::TraverseMesh(int mesh, Ray &ray, Intersector &intersect) const
+{
+	const MeshHierarchy &level = m_meshes[mesh];
+	switch (m_layout)
+	{
+	case BVH_WIDE4: return level.bvh4.Traverse(ray, intersect);
+	case BVH_WIDE8: return level.bvh8.Traverse(ray, intersect);
+	default:        return level.bvh.Traverse(ray, intersect);
+	}
+}
+
+bool Accelerator::Intersect(const Ray &ray, Hit &hit) const
+{
+	hit = Hit();
+	if (!m_scene) return false;
+
+	Ray r = ray;
+	ClosestHit closest(*this, hit);
+	Traverse(r, closest);
+
+	// planes are unbounded, so they are never part of the hierarchy
+	for (int i = m_scene->BoundedCount(); i < m_scene->FirstInstanced(); ++i)
+		m_scene->IntersectPrimitive(i, r, hit);
+
+	return hit.Valid();
+}
+
+bool Accelerator::Occluded(const Ray &ray, PrimitiveId &occluder) const
+{
+	occluder = -1;
+	if (!m_scene) return false;
+
+	// planes first: they are few, and one test can settle the whole query
+	Ray r = ray;
+	Hit hit;
+	for (int i = m_scene->BoundedCount(); i < m_scene->FirstInstanced(); ++i)
+		if (m_scene->IntersectPrimitive(i, r, hit))
+		{
+			occluder = i;
+			return true;
+		}
+
+	AnyHit any(*this, occluder);
+	Traverse(r, any);
+	return occluder >= 0;
+}
+
+int Accelerator::TraversalSteps(const Ray &ray, bool anyHit) const
+{
+	if (!m_scene) return 0;
+
+	Ray r = ray;
+	Hit hit;
+	PrimitiveId occluder = -1;
+	if (anyHit)
+	{
+		AnyHit any(*this, occluder);
+		int steps = Traverse(r, any);
+		return steps + any.steps;
+	}
+	ClosestHit closest(*this, hit);
+	int steps = Traverse(r, closest);
+	return steps + closest.steps;
+}
+
+// --------------------------------------------------------------------------
@@ -0,0 +1,169 @@
+// ==========================================================================
+// Scene Ray Queries
+//  - owns the BVH over a scene's triangles and spheres
+//  - answers closest-hit queries against the BVH plus the unbounded planes,
+//    one ray at a time or for whole packets of coherent rays
+//  - single rays can walk either the binary tree or a 4- or 8-wide tree
+//    collapsed from it; packets always use the binary tree
+//
+// Instanced geometry makes this a two-level structure. Every mesh gets a
+// BVH of its own, built once however often it is placed, and the scene
+// BVH holds each instance as a single box. Rays reaching an instance's
+// leaf are moved into the mesh's frame and carry on down the mesh BVH, so
+// memory and build time follow the unique geometry, not the placed copies.
+//
+// For animation, Refit() updates the boxes of both levels to moved
+// geometry without rebuilding, until the refit trees' SAH cost has grown
+// too far past that of a fresh build. A built structure can be saved to a
+// compiled scene cache and loaded back instead of being built again.
+// ==========================================================================
+#ifndef ACCELERATOR_H
+#define ACCELERATOR_H
+
+#include <string>
+#include <vector>
+#include "Scene.h"
+#include "BVH.h"
+#include "WideBVH.h"
+#include "Packet.h"
+
+// --------------------------------------------------------------------------
+// Primitive data copied out in BVH leaf order with one array per component,
+// so the primitives of a leaf are contiguous and the packet kernels can
+// broadcast them straight into SIMD registers
+
+enum PackedKind
+{
+	PACKED_TRIANGLE,
+	PACKED_SPHERE,
+	PACKED_INSTANCE     // only the id is set, to the instance index
+};
+
+struct PackedPrimitives
+{
+	std::vector<float>  x0, y0, z0;     // triangle corner 0, or sphere centre
+	std::vector<float>  e1x, e1y, e1z;  // triangle edge 0->1; e1x is a sphere's radius
+	std::vector<float>  e2x, e2y, e2z;  // triangle edge 0->2
+	std::vector<int>    id;             // scene primitive id, or triangle in the mesh
+	std::vector<char>   kind;           // a PackedKind
+
+	// entries of the scene BVH: bounded primitives, then instances
+	void Build(const Scene &scene, const std::vector<int> &order);
+	// triangles of a mesh
+	void Build(const Mesh &mesh, const std::vector<int> &order);
+
+	size_t MemoryBytes() const;
+
+	void Save(BinaryWriter &writer) const;
+	// reads count entries; ids are checked by the Accelerator
+	bool Load(BinaryReader &reader, size_t count);
+};
+
+// --------------------------------------------------------------------------
+
+// a refit tree this many times costlier than when it was built is rebuilt
+const float DEFAULT_MAX_COST_GROWTH = 1.5f;
+
+// hierarchy used for single-ray queries
+enum BVHLayout
+{
+	BVH_BINARY,
+	BVH_WIDE4,
+	BVH_WIDE8
+};
+
+// the 8-wide tree only pays off when a node test is one AVX instruction
+#ifdef SIMD_AVX
+const BVHLayout DEFAULT_BVH_LAYOUT = BVH_WIDE8;
+#else
+const BVHLayout DEFAULT_BVH_LAYOUT = BVH_WIDE4;
+#endif
+
+// "binary", "wide4" or "wide8", the names layouts are chosen by
+const char *BVHLayoutName(BVHLayout layout);
+// false, leaving layout as it was, for any other name
+bool ParseBVHLayout(const std::string &name, BVHLayout &layout);
+
+// the bottom level of the structure, shared by every instance of a mesh
+struct MeshHierarchy
+{
+	BVH                 bvh;
+	WideBVH<4>          bvh4;
+	WideBVH<8>          bvh8;
+	PackedPrimitives    packed;
+	float               builtCost;  // SAH cost when last built
+};
+
+class Accelerator
+{
+	const Scene        *m_scene;
+	BVHLayout           m_layout;
+	BVH                 m_bvh;      // over bounded primitives and instances
+	WideBVH<4>          m_bvh4;
+	WideBVH<8>          m_bvh8;
+	PackedPrimitives    m_packed;
+	float               m_builtCost;
+	std::vector<MeshHierarchy> m_meshes;
+
+	struct ClosestHit;
+	struct AnyHit;
+
+	template <class Intersector>
+	int Traverse(Ray &ray, Intersector &intersect) const;
+	template <class Intersector>
+	int TraverseMesh(int mesh, Ray &ray, Intersector &intersect) const;
+
+	void BuildLevel(MeshHierarchy &level, const Mesh &mesh,
+	                const std::vector<AABB> &bounds) const;
+	// boxes of the scene BVH's entries: bounded primitives, then instances
+	void TopBounds(std::vector<AABB> &bounds) const;
+
+public:
+	Accelerator() : m_scene(0), m_layout(DEFAULT_BVH_LAYOUT), m_builtCost(0.f) {}
+
+	// (re)builds the hierarchy; the scene must outlive this object and must
+	// not change without another call to Build()
+	void Build(const Scene &scene, BVHLayout layout = DEFAULT_BVH_LAYOUT);
+
+	// Brings the hierarchy up to date after instance transforms or the
+	// bounded primitives changed, keeping the trees' structure; mesh trees
+	// are refit too when meshesMoved is set. The primitive counts must be
+	// unchanged, or everything is rebuilt. A tree whose SAH cost grows
+	// past maxCostGrowth times its cost when built is rebuilt on its own.
+	// Returns false when anything was rebuilt.
+	bool Refit(bool meshesMoved = false, float maxCostGrowth = DEFAULT_MAX_COST_GROWTH);
+
+	// finds the closest hit along the ray, returning false on a miss
+	bool Intersect(const Ray &ray, Hit &hit) const;
+
+	// any-hit query for shadow rays: true as soon as anything is found in
+	// the ray's interval, with the blocking primitive written to occluder
+	bool Occluded(const Ray &ray, PrimitiveId &occluder) const;
+
+	// finds the closest hit of every ray in a packet of N = 4, 8 or 16 rays;
+	// rays that miss get an invalid hit
+	template <int N>
+	void IntersectPacket(const RayPacket<N> &packet, Hit *hits) const;
+
+	// number of hierarchy nodes a closest-hit (or any-hit) query for the
+	// ray visits, for profiling
+	int TraversalSteps(const Ray &ray, bool anyHit = false) const;
+
+	const Scene *GetScene() const { return m_scene; }
+	BVHLayout Layout() const { return m_layout; }
+	const BVH &Hierarchy() const { return m_bvh; }
+
+	// binary BVH nodes over both levels
+	size_t NodeCount() const;
+	// heap memory held by the trees and packed primitives of both levels
+	size_t MemoryBytes() const;
+
+	// writes the built structure to a compiled scene cache, or reads it
+	// back for the scene it was built over, which must outlive this object;
+	// data that doesn't fit the scene fails the load and clears everything
+	void Save(BinaryWriter &writer) const;
+	bool Load(BinaryReader &reader, const Scene &scene);
+};
+
+// --------------------------------------------------------------------------
+#endif // ACCELERATOR_H
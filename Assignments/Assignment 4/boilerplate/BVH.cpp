@@ -0,0 +1,363 @@
+// ==========================================================================
+// Bounding Volume Hierarchy
+//
+// Splits are chosen by binning primitive centroids into a fixed number of
+// buckets along each axis and evaluating the surface area heuristic at
+// every bucket boundary, which keeps the build O(n log n) while giving
+// trees close to a full SAH sweep.
+//
+// The depth first layout keeps every subtree in a contiguous run of nodes
+// with children after their parent, so a run refits bottom up by walking
+// it backwards. A parallel refit splits the tree into a few dozen runs,
+// refits them on separate threads, then finishes the handful of nodes
+// above them.
+// ==========================================================================
+
+#include "BVH.h"
+#include "BinaryStream.h"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+using namespace std;
+using namespace glm;
+
+// --------------------------------------------------------------------------
+
+namespace
+{
+	const int   BIN_COUNT = 16;
+
+	// relative costs of visiting a node and testing a primitive
+	const float TRAVERSAL_COST = 1.f;
+	const float INTERSECTION_COST = 1.f;
+
+	struct Bin
+	{
+		AABB    bounds;
+		int     count;
+		Bin() : count(0) {}
+	};
+
+	int BinIndex(float centroid, float lower, float scale)
+	{
+		int bin = int((centroid - lower) * scale);
+		return std::min(std::max(bin, 0), BIN_COUNT - 1);
+	}
+
+	// smaller trees refit faster than threads start
+	const int PARALLEL_REFIT_NODES = 1 << 14;
+
+	// subtrees handed to each refit thread, to even out their sizes
+	const int REFIT_RANGES_PER_THREAD = 4;
+
+	// nodes [begin, end) of the depth first array, holding one whole subtree
+	struct NodeRange
+	{
+		int     begin, end;
+	};
+}
+
+struct BVH::BuildPrimitive
+{
+	AABB    bounds;
+	vec3    centroid;
+	int     index;
+};
+
+// --------------------------------------------------------------------------
+
+void BVH::Clear()
+{
+	m_nodes.clear();
+	m_indices.clear();
+}
+
+size_t BVH::MemoryBytes() const
+{
+	return m_nodes.capacity() * sizeof(BVHNode) + m_indices.capacity() * sizeof(int);
+}
+
+void BVH::Build(const vector<AABB> &bounds, int maxLeafSize)
+{
+	Clear();
+	if (bounds.empty()) return;
+
+	vector<BuildPrimitive> primitives(bounds.size());
+	for (size_t i = 0; i < bounds.size(); ++i)
+	{
+		primitives[i].bounds = bounds[i];
+		primitives[i].centroid = bounds[i].Centroid();
+		primitives[i].index = int(i);
+	}
+
+	m_nodes.reserve(2 * bounds.size());
+	BuildRecursive(primitives, 0, int(primitives.size()), 0, std::max(maxLeafSize, 1));
+
+	m_indices.resize(primitives.size());
+	for (size_t i = 0; i < primitives.size(); ++i)
+		m_indices[i] = primitives[i].index;
+}
+
+float BVH::Refit(const vector<AABB> &bounds, int threadCount)
+{
+	if (m_nodes.empty()) return 0.f;
+	int n = int(m_nodes.size());
+	if (threadCount <= 0)
+		threadCount = std::max(int(thread::hardware_concurrency()), 1);
+
+	double cost;
+	if (threadCount == 1 || n < PARALLEL_REFIT_NODES)
+		cost = RefitRange(bounds, 0, n);
+	else
+	{
+		// split the largest subtree until there are enough of them; the
+		// nodes split along the way are the top of the tree
+		vector<NodeRange> ranges(1);
+		ranges[0].begin = 0;
+		ranges[0].end = n;
+		vector<int> top;
+		while (int(ranges.size()) < REFIT_RANGES_PER_THREAD * threadCount)
+		{
+			size_t largest = 0;
+			for (size_t i = 1; i < ranges.size(); ++i)
+				if (ranges[i].end - ranges[i].begin > ranges[largest].end - ranges[largest].begin)
+					largest = i;
+			NodeRange range = ranges[largest];
+			const BVHNode &node = m_nodes[range.begin];
+			if (node.IsLeaf()) break;
+
+			top.push_back(range.begin);
+			NodeRange left = { range.begin + 1, node.offset };
+			NodeRange right = { node.offset, range.end };
+			ranges[largest] = left;
+			ranges.push_back(right);
+		}
+
+		vector<double> costs(ranges.size(), 0.0);
+		atomic<int> next(0);
+		auto work = [&]() {
+			int i;
+			while ((i = next++) < int(ranges.size()))
+				costs[i] = RefitRange(bounds, ranges[i].begin, ranges[i].end);
+		};
+		vector<thread> workers;
+		for (int i = 1; i < threadCount; ++i)
+			workers.push_back(thread(work));
+		work();
+		for (size_t i = 0; i < workers.size(); ++i)
+			workers[i].join();
+
+		// split nodes come after their ancestors in the list, so going
+		// backwards finishes children before parents
+		cost = 0.0;
+		for (size_t i = 0; i < costs.size(); ++i)
+			cost += costs[i];
+		for (int i = int(top.size()) - 1; i >= 0; --i)
+		{
+			BVHNode &node = m_nodes[top[i]];
+			AABB box(m_nodes[top[i] + 1].lower, m_nodes[top[i] + 1].upper);
+			box.Extend(AABB(m_nodes[node.offset].lower, m_nodes[node.offset].upper));
+			node.lower = box.lower;
+			node.upper = box.upper;
+			cost += TRAVERSAL_COST * box.SurfaceArea();
+		}
+	}
+
+	float area = Bounds().SurfaceArea();
+	return area > 0.f ? float(cost / area) : 0.f;
+}
+
+double BVH::RefitRange(const vector<AABB> &bounds, int begin, int end)
+{
+	double cost = 0.0;
+	for (int i = end - 1; i >= begin; --i)
+	{
+		BVHNode &node = m_nodes[i];
+		AABB box;
+		if (node.IsLeaf())
+		{
+			for (int k = node.offset; k < node.offset + node.count; ++k)
+				box.Extend(bounds[m_indices[k]]);
+			cost += INTERSECTION_COST * node.count * box.SurfaceArea();
+		}
+		else
+		{
+			box = AABB(m_nodes[i + 1].lower, m_nodes[i + 1].upper);
+			box.Extend(AABB(m_nodes[node.offset].lower, m_nodes[node.offset].upper));
+			cost += TRAVERSAL_COST * box.SurfaceArea();
+		}
+		node.lower = box.lower;
+		node.upper = box.upper;
+	}
+	return cost;
+}
+
+float BVH::Cost() const
+{
+	float area = Bounds().SurfaceArea();
+	if (area <= 0.f) return 0.f;
+
+	double cost = 0.0;
+	for (size_t i = 0; i < m_nodes.size(); ++i)
+	{
+		const BVHNode &node = m_nodes[i];
+		float nodeArea = AABB(node.lower, node.upper).SurfaceArea();
+		cost += node.IsLeaf() ? INTERSECTION_COST * node.count * nodeArea
+		                      : TRAVERSAL_COST * nodeArea;
+	}
+	return float(cost / area);
+}
+
+AABB BVH::Bounds() const
+{
+	if (m_nodes.empty()) return AABB();
+	return AABB(m_nodes[0].lower, m_nodes[0].upper);
+}
+
+void BVH::Save(BinaryWriter &writer) const
+{
+	writer.WriteVector(m_nodes);
+	writer.WriteVector(m_indices);
+}
+
+bool BVH::Load(BinaryReader &reader, size_t primitiveCount)
+{
+	Clear();
+	bool valid = reader.ReadVector(m_nodes) && reader.ReadVector(m_indices) &&
+	             m_indices.size() == primitiveCount && m_nodes.empty() == (primitiveCount == 0);
+	for (size_t i = 0; valid && i < m_indices.size(); ++i)
+		valid = m_indices[i] >= 0 && size_t(m_indices[i]) < primitiveCount;
+
+	// children follow their parent, so depths fill in front to back
+	vector<int> depth(m_nodes.size(), 1);
+	for (size_t i = 0; valid && i < m_nodes.size(); ++i)
+	{
+		const BVHNode &node = m_nodes[i];
+		valid = depth[i] <= MAX_DEPTH;
+		if (node.IsLeaf())
+			valid = valid && node.offset >= 0 &&
+			        size_t(node.offset) + size_t(node.count) <= m_indices.size();
+		else if (valid)
+		{
+			valid = node.count == 0 && i + 1 < m_nodes.size() &&
+			        node.offset > int(i) + 1 && size_t(node.offset) < m_nodes.size();
+			if (valid)
+				depth[i + 1] = depth[node.offset] = depth[i] + 1;
+		}
+	}
+	if (!valid)
+		Clear();
+	return valid;
+}
+
+// --------------------------------------------------------------------------
+
+int BVH::BuildRecursive(vector<BuildPrimitive> &primitives, int begin, int end,
+                        int depth, int maxLeafSize)
+{
+	int nodeIndex = int(m_nodes.size());
+	m_nodes.push_back(BVHNode());
+
+	AABB bounds, centroidBounds;
+	for (int i = begin; i < end; ++i)
+	{
+		bounds.Extend(primitives[i].bounds);
+		centroidBounds.Extend(primitives[i].centroid);
+	}
+	m_nodes[nodeIndex].lower = bounds.lower;
+	m_nodes[nodeIndex].upper = bounds.upper;
+
+	int count = end - begin;
+	if (count == 1 || depth >= MAX_DEPTH - 1)
+	{
+		m_nodes[nodeIndex].offset = begin;
+		m_nodes[nodeIndex].count = count;
+		return nodeIndex;
+	}
+
+	// find the cheapest bucket boundary over all three axes
+	float leafCost = INTERSECTION_COST * count;
+	float bestCost = FLT_MAX;
+	int bestAxis = -1, bestSplit = 0;
+	float area = bounds.SurfaceArea();
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		float lower = centroidBounds.lower[axis];
+		float extent = centroidBounds.upper[axis] - lower;
+		if (extent <= 0.f) continue;
+		float scale = BIN_COUNT / extent;
+
+		Bin bins[BIN_COUNT];
+		for (int i = begin; i < end; ++i)
+		{
+			Bin &bin = bins[BinIndex(primitives[i].centroid[axis], lower, scale)];
+			bin.bounds.Extend(primitives[i].bounds);
+			++bin.count;
+		}
+
+		// sweep from the right to accumulate areas of the right partitions
+		float rightArea[BIN_COUNT];
+		int rightCount[BIN_COUNT];
+		AABB box;
+		int n = 0;
+		for (int b = BIN_COUNT - 1; b > 0; --b)
+		{
+			box.Extend(bins[b].bounds);
+			n += bins[b].count;
+			rightArea[b] = box.SurfaceArea();
+			rightCount[b] = n;
+		}
+
+		// then sweep from the left, evaluating each boundary
+		box = AABB();
+		n = 0;
+		for (int b = 1; b < BIN_COUNT; ++b)
+		{
+			box.Extend(bins[b - 1].bounds);
+			n += bins[b - 1].count;
+			if (n == 0 || rightCount[b] == 0) continue;
+			float cost = TRAVERSAL_COST + INTERSECTION_COST *
+				(box.SurfaceArea() * n + rightArea[b] * rightCount[b]) / area;
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				bestAxis = axis;
+				bestSplit = b;
+			}
+		}
+	}
+
+	if (count <= maxLeafSize && bestCost >= leafCost)
+	{
+		m_nodes[nodeIndex].offset = begin;
+		m_nodes[nodeIndex].count = count;
+		return nodeIndex;
+	}
+
+	int middle;
+	if (bestAxis >= 0)
+	{
+		float lower = centroidBounds.lower[bestAxis];
+		float scale = BIN_COUNT / (centroidBounds.upper[bestAxis] - lower);
+		BuildPrimitive *split = std::partition(&primitives[begin], &primitives[0] + end,
+			[=](const BuildPrimitive &p) {
+				return BinIndex(p.centroid[bestAxis], lower, scale) < bestSplit;
+			});
+		middle = int(split - &primitives[0]);
+	}
+	else
+	{
+		// all centroids coincide, so no bucket split exists: halve the range
+		middle = (begin + end) / 2;
+	}
+
+	BuildRecursive(primitives, begin, middle, depth + 1, maxLeafSize);
+	int right = BuildRecursive(primitives, middle, end, depth + 1, maxLeafSize);
+	m_nodes[nodeIndex].offset = right;
+	m_nodes[nodeIndex].count = 0;
+	return nodeIndex;
+}
+
+// --------------------------------------------------------------------------
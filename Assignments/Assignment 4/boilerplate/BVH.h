@@ -0,0 +1,148 @@
+// ==========================================================================
+// Bounding Volume Hierarchy
+//  - binary BVH built top-down with the binned surface area heuristic
+//  - nodes are stored depth first in one array: the left child of an
+//    interior node directly follows it, and the node records its right child
+//  - a built tree can be refit to moved primitives, keeping its structure,
+//    with independent subtrees updated in parallel
+//
+// The hierarchy only knows about primitive bounds. Traversal takes an
+// intersector functor, so the same tree serves closest-hit and any-hit
+// queries over whatever primitives the caller indexed.
+// ==========================================================================
+#ifndef BVH_H
+#define BVH_H
+
+#include <vector>
+#include <utility>
+#include "Geometry.h"
+
+class BinaryWriter;
+class BinaryReader;
+
+// --------------------------------------------------------------------------
+
+struct BVHNode
+{
+	glm::vec3 lower;
+	int     offset;     // leaf: first entry in the index array
+	                    // interior: array position of the right child
+	glm::vec3 upper;
+	int     count;      // number of primitives in a leaf, 0 for interior nodes
+
+	bool IsLeaf() const { return count > 0; }
+};
+
+class BVH
+{
+	std::vector<BVHNode>    m_nodes;
+	std::vector<int>        m_indices;
+
+	struct BuildPrimitive;
+	int BuildRecursive(std::vector<BuildPrimitive> &primitives, int begin,
+	                   int end, int depth, int maxLeafSize);
+
+	// refits the subtree stored in nodes [begin, end), returning its part
+	// of the SAH cost before the division by the root's area
+	double RefitRange(const std::vector<AABB> &bounds, int begin, int end);
+
+public:
+	// traversal keeps a fixed stack, so the builder caps the tree depth
+	static const int MAX_DEPTH = 64;
+
+	// builds the hierarchy over primitives 0..n-1 with the given bounds
+	void Build(const std::vector<AABB> &bounds, int maxLeafSize = 4);
+	void Clear();
+
+	// Recomputes every box from new bounds for the same primitives, bottom
+	// up, leaving the tree's structure alone. Large trees are split into
+	// subtrees refit on threadCount threads (every hardware thread for zero
+	// or less). Returns the refit tree's Cost().
+	float Refit(const std::vector<AABB> &bounds, int threadCount = 0);
+
+	// surface area heuristic cost of the tree: the expected cost, in node
+	// visits and primitive tests, of a ray through the root box; a refit
+	// tree only gets worse than a fresh build as its primitives move apart
+	float Cost() const;
+
+	// writes the tree to a compiled scene cache, or reads one back; a read
+	// tree is checked to index primitives 0..primitiveCount-1 and to stay
+	// within the traversal stack, so a damaged cache can't crash traversal
+	void Save(BinaryWriter &writer) const;
+	bool Load(BinaryReader &reader, size_t primitiveCount);
+
+	bool Empty() const { return m_nodes.empty(); }
+	AABB Bounds() const;
+	size_t MemoryBytes() const;
+	const std::vector<BVHNode> &Nodes() const { return m_nodes; }
+	const std::vector<int> &Indices() const { return m_indices; }
+
+	// Visits the leaves whose boxes the ray passes through, nearest child
+	// first. The intersector is called as
+	//
+	//      bool intersect(int primitive, Ray &ray)
+	//
+	// and should shrink ray.tMax when it records a hit, which prunes the
+	// rest of the traversal. Returning true stops the traversal at once.
+	// Returns the number of nodes visited, for profiling.
+	template <class Intersector>
+	int Traverse(Ray &ray, Intersector &intersect) const;
+};
+
+// --------------------------------------------------------------------------
+
+template <class Intersector>
+int BVH::Traverse(Ray &ray, Intersector &intersect) const
+{
+	if (m_nodes.empty()) return 0;
+
+	glm::vec3 invDirection = 1.f / ray.direction;
+	float tEntry;
+	if (!IntersectAABB(m_nodes[0].lower, m_nodes[0].upper, ray.origin,
+	                   invDirection, ray.tMin, ray.tMax, tEntry))
+		return 1;
+
+	int stack[MAX_DEPTH];
+	int top = 0;
+	int index = 0;
+	int steps = 0;
+	while (true)
+	{
+		const BVHNode &node = m_nodes[index];
+		++steps;
+		if (node.IsLeaf())
+		{
+			for (int i = 0; i < node.count; ++i)
+				if (intersect(m_indices[node.offset + i], ray))
+					return steps;
+		}
+		else
+		{
+			// descend into the nearer child and defer the other one
+			int near = index + 1, far = node.offset;
+			float tNear, tFar;
+			bool hitNear = IntersectAABB(m_nodes[near].lower, m_nodes[near].upper,
+			                             ray.origin, invDirection, ray.tMin, ray.tMax, tNear);
+			bool hitFar = IntersectAABB(m_nodes[far].lower, m_nodes[far].upper,
+			                            ray.origin, invDirection, ray.tMin, ray.tMax, tFar);
+			if (hitNear && hitFar)
+			{
+				if (tFar < tNear) std::swap(near, far);
+				stack[top++] = far;
+				index = near;
+				continue;
+			}
+			if (hitNear || hitFar)
+			{
+				index = hitNear ? near : far;
+				continue;
+			}
+		}
+
+		if (top == 0) return steps;
+		index = stack[--top];
+	}
+}
+
+// --------------------------------------------------------------------------
+#endif // BVH_H
@@ -0,0 +1,54 @@
+// ==========================================================================
+// Binary Streams
+// ==========================================================================
+
+#include "BinaryStream.h"
+
+#include <zlib.h>
+
+using namespace std;
+
+// --------------------------------------------------------------------------
+
+uint32_t LayoutSignature(const uint32_t *sizes, size_t count)
+{
+	const uint32_t byteOrder = 0x01020304u;
+	uLong crc = crc32(0L, reinterpret_cast<const Bytef *>(&byteOrder), sizeof(byteOrder));
+	crc = crc32(crc, reinterpret_cast<const Bytef *>(sizes), uInt(count * sizeof(uint32_t)));
+	return uint32_t(crc);
+}
+
+void WriteHeader(BinaryWriter &writer, const char (&magic)[8], uint32_t version,
+                 uint32_t layout)
+{
+	writer.Write(magic);
+	writer.Write(version);
+	writer.Write(layout);
+}
+
+bool ReadHeader(BinaryReader &reader, const char (&magic)[8], uint32_t version,
+                uint32_t layout)
+{
+	char readMagic[8] = { 0 };
+	uint32_t readVersion = 0, readLayout = 0;
+	reader.Read(readMagic);
+	reader.Read(readVersion);
+	reader.Read(readLayout);
+	return !reader.Failed() && memcmp(readMagic, magic, sizeof(magic)) == 0 &&
+	       readVersion == version && readLayout == layout;
+}
+
+bool ReplaceFile(const string &part, const string &target)
+{
+	if (rename(part.c_str(), target.c_str()) == 0)
+		return true;
+
+	// renaming over an existing file fails on some systems
+	remove(target.c_str());
+	if (rename(part.c_str(), target.c_str()) == 0)
+		return true;
+	remove(part.c_str());
+	return false;
+}
+
+// --------------------------------------------------------------------------
@@ -0,0 +1,173 @@
+// ==========================================================================
+// Binary Streams
+//  - flat, pointer-free dumps of plain structs and of vectors of them, as
+//    stored in compiled scene caches and render checkpoints
+//  - arrays start at multiples of 16 bytes, so a mapped file keeps the
+//    alignment the data had in memory
+//  - every file starts with a header of an eight byte magic naming what it
+//    holds, the version of its format and a signature of the struct layouts
+//    it dumps, and is read only when all three match
+//  - files are written beside their final name and moved over it once
+//    complete, so a reader never sees half of one
+//
+// The bytes are written as they are in memory, so a stream is only read
+// back by a build with the same struct layouts and byte order, which is
+// what the layout signature checks.
+// ==========================================================================
+#ifndef BINARYSTREAM_H
+#define BINARYSTREAM_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// --------------------------------------------------------------------------
+
+class BinaryWriter
+{
+	FILE       *m_file;
+	uint64_t    m_offset;
+	bool        m_failed;
+
+	void Bytes(const void *data, size_t size)
+	{
+		if (size > 0 && fwrite(data, 1, size, m_file) != size)
+			m_failed = true;
+		m_offset += size;
+	}
+
+	void Align()
+	{
+		static const char zeros[16] = { 0 };
+		Bytes(zeros, size_t((16 - m_offset % 16) % 16));
+	}
+
+public:
+	explicit BinaryWriter(FILE *file) : m_file(file), m_offset(0), m_failed(false) {}
+
+	template <class T>
+	void Write(const T &value)
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "only plain data can be written");
+		Bytes(&value, sizeof(T));
+	}
+
+	template <class T>
+	void WriteVector(const std::vector<T> &values)
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "only plain data can be written");
+		Write(uint64_t(values.size()));
+		Align();
+		Bytes(values.data(), values.size() * sizeof(T));
+	}
+
+	void WriteString(const std::string &text)
+	{
+		Write(uint64_t(text.size()));
+		Bytes(text.data(), text.size());
+	}
+
+	bool Failed() const { return m_failed; }
+};
+
+// --------------------------------------------------------------------------
+
+// reads from memory, usually a mapped file; reading past the end fails the
+// stream rather than the program, and every later read fails too
+class BinaryReader
+{
+	const char *m_data;
+	size_t      m_size;
+	size_t      m_offset;
+	bool        m_failed;
+
+	const char *Bytes(size_t size)
+	{
+		if (m_failed || size > m_size - m_offset)
+		{
+			m_failed = true;
+			return 0;
+		}
+		const char *bytes = m_data + m_offset;
+		m_offset += size;
+		return bytes;
+	}
+
+	void Align()
+	{
+		Bytes((16 - m_offset % 16) % 16);
+	}
+
+	// element counts too large to fit in what is left of the data
+	bool Fits(uint64_t count, size_t size)
+	{
+		if (!m_failed && count > (m_size - m_offset) / size)
+			m_failed = true;
+		return !m_failed;
+	}
+
+public:
+	BinaryReader(const char *data, size_t size)
+		: m_data(data), m_size(size), m_offset(0), m_failed(false) {}
+
+	template <class T>
+	bool Read(T &value)
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "only plain data can be read");
+		const char *bytes = Bytes(sizeof(T));
+		if (bytes)
+			memcpy(&value, bytes, sizeof(T));
+		return bytes != 0;
+	}
+
+	template <class T>
+	bool ReadVector(std::vector<T> &values)
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "only plain data can be read");
+		uint64_t count = 0;
+		Read(count);
+		Align();
+		if (!Fits(count, sizeof(T)))
+			return false;
+		values.resize(size_t(count));
+		const char *bytes = Bytes(size_t(count) * sizeof(T));
+		if (bytes && count > 0)
+			memcpy(values.data(), bytes, size_t(count) * sizeof(T));
+		return bytes != 0;
+	}
+
+	bool ReadString(std::string &text)
+	{
+		uint64_t size = 0;
+		if (!Read(size) || !Fits(size, 1))
+			return false;
+		const char *bytes = Bytes(size_t(size));
+		text.assign(bytes, size_t(size));
+		return true;
+	}
+
+	bool Failed() const { return m_failed; }
+	bool AtEnd() const { return m_offset == m_size; }
+};
+
+// --------------------------------------------------------------------------
+
+// signature of the byte order and of the sizes of the structs a file holds
+// as raw bytes
+uint32_t LayoutSignature(const uint32_t *sizes, size_t count);
+
+void WriteHeader(BinaryWriter &writer, const char (&magic)[8], uint32_t version,
+                 uint32_t layout);
+// false unless the header read matches all three
+bool ReadHeader(BinaryReader &reader, const char (&magic)[8], uint32_t version,
+                uint32_t layout);
+
+// moves the complete file part over target, which may exist; part is
+// removed if that fails
+bool ReplaceFile(const std::string &part, const std::string &target);
+
+// --------------------------------------------------------------------------
+#endif // BINARYSTREAM_H
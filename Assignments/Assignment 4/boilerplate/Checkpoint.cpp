@@ -0,0 +1,354 @@
+// ==========================================================================
+// Render Checkpoints
+//
+// File layout, a binary stream (see BinaryStream.h) after its header:
+//
+//      render   signature, width, height, tile size, samples per pixel
+//      state    samples done in each tile, then the pixel sums or colours
+// ==========================================================================
+
+#include "Checkpoint.h"
+#include "BinaryStream.h"
+#include "ImageBuffer.h"
+#include "MappedFile.h"
+#include "SceneCache.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <iostream>
+#include <thread>
+#include <zlib.h>
+
+using namespace std;
+using namespace glm;
+
+// --------------------------------------------------------------------------
+
+namespace
+{
+	const char MAGIC[8] = { 'A', '4', 'C', 'H', 'K', 'P', 'T', '\0' };
+
+	// Uniform renders are traced at most this many samples per pixel at a
+	// time, so an interrupted render loses at most that many from each
+	// tile. Passes only cost a copy of the tile's sums each.
+	const int CHECKPOINT_SAMPLES = 16;
+
+	// every struct written as raw bytes
+	uint32_t StructLayout()
+	{
+		const uint32_t sizes[] = { sizeof(vec3), sizeof(int32_t) };
+		return LayoutSignature(sizes, sizeof(sizes) / sizeof(sizes[0]));
+	}
+
+	template <class T>
+	void AddToSignature(uLong &crc, const T &value)
+	{
+		crc = crc32(crc, reinterpret_cast<const Bytef *>(&value), sizeof(T));
+	}
+
+	int TilesAcross(int width, int tileSize) { return (width + tileSize - 1) / tileSize; }
+
+	// index of a tile in a checkpoint, row by row from the bottom
+	int TileIndex(const Tile &tile, int width, int tileSize)
+	{
+		return tile.y / tileSize * TilesAcross(width, tileSize) + tile.x / tileSize;
+	}
+}
+
+std::atomic<bool> CheckpointedRenderer::s_interrupted(false);
+
+// --------------------------------------------------------------------------
+
+uint32_t RenderSignature(const RayTracer &tracer, const Scene &scene, int width, int height)
+{
+	uLong crc = crc32(0L, Z_NULL, 0);
+	AddToSignature(crc, int32_t(width));
+	AddToSignature(crc, int32_t(height));
+
+	// field by field, since padding between them holds anything
+	const Camera &camera = tracer.camera;
+	AddToSignature(crc, camera.position);
+	AddToSignature(crc, camera.orientation);
+	AddToSignature(crc, camera.fieldOfView);
+
+	const RenderSettings &settings = tracer.settings;
+	AddToSignature(crc, settings.maxDepth);
+	AddToSignature(crc, settings.ambient);
+	AddToSignature(crc, settings.background);
+	AddToSignature(crc, settings.packetSize);
+	AddToSignature(crc, settings.samplesPerPixel);
+	AddToSignature(crc, settings.adaptive);
+	AddToSignature(crc, settings.contrastThreshold);
+	AddToSignature(crc, settings.errorThreshold);
+	AddToSignature(crc, settings.lightSamples);
+	AddToSignature(crc, settings.manyLights);
+	AddToSignature(crc, settings.pathTracing);
+	AddToSignature(crc, settings.rouletteDepth);
+	AddToSignature(crc, settings.causticPhotons);
+	AddToSignature(crc, settings.causticNeighbours);
+	AddToSignature(crc, settings.causticRadius);
+	AddToSignature(crc, settings.irradianceCaching);
+	AddToSignature(crc, settings.irradianceSamples);
+	AddToSignature(crc, settings.irradianceAccuracy);
+	AddToSignature(crc, settings.wavefront);
+
+	// the scene as read from its files; one that can't be read signs as
+	// empty, and matches no render of it
+	AddToSignature(crc, uint32_t(scene.sourceFiles.size()));
+	for (size_t i = 0; i < scene.sourceFiles.size(); ++i)
+	{
+		uint64_t size = 0;
+		uint32_t fileCrc = 0;
+		FileChecksum(scene.sourceFiles[i], size, fileCrc);
+		AddToSignature(crc, size);
+		AddToSignature(crc, fileCrc);
+	}
+	return uint32_t(crc);
+}
+
+bool SaveCheckpoint(const string &fileName, const RenderCheckpoint &checkpoint)
+{
+	string partFile = fileName + ".part";
+	FILE *file = fopen(partFile.c_str(), "wb");
+	if (!file)
+		return false;
+
+	BinaryWriter writer(file);
+	WriteHeader(writer, MAGIC, CHECKPOINT_VERSION, StructLayout());
+	writer.Write(checkpoint.signature);
+	writer.Write(checkpoint.width);
+	writer.Write(checkpoint.height);
+	writer.Write(checkpoint.tileSize);
+	writer.Write(checkpoint.samplesPerPixel);
+	writer.WriteVector(checkpoint.tileSamples);
+	writer.WriteVector(checkpoint.pixels);
+
+	bool ok = !writer.Failed();
+	ok = fclose(file) == 0 && ok;
+	if (!ok)
+	{
+		remove(partFile.c_str());
+		return false;
+	}
+	return ReplaceFile(partFile, fileName);
+}
+
+bool LoadCheckpoint(const string &fileName, RenderCheckpoint &checkpoint)
+{
+	MappedFile file;
+	if (!file.Open(fileName))
+		return false;
+
+	BinaryReader reader(file.Data(), file.Size());
+	if (!ReadHeader(reader, MAGIC, CHECKPOINT_VERSION, StructLayout()))
+		return false;
+
+	RenderCheckpoint read;
+	reader.Read(read.signature);
+	reader.Read(read.width);
+	reader.Read(read.height);
+	reader.Read(read.tileSize);
+	reader.Read(read.samplesPerPixel);
+	reader.ReadVector(read.tileSamples);
+	reader.ReadVector(read.pixels);
+	if (reader.Failed() || !reader.AtEnd() || read.width <= 0 || read.height <= 0 ||
+	    read.tileSize <= 0 || read.samplesPerPixel <= 0 ||
+	    read.pixels.size() != size_t(read.width) * read.height ||
+	    read.tileSamples.size() != size_t(TilesAcross(read.width, read.tileSize)) *
+	                               TilesAcross(read.height, read.tileSize))
+		return false;
+	for (size_t i = 0; i < read.tileSamples.size(); ++i)
+		if (read.tileSamples[i] < 0 || read.tileSamples[i] > read.samplesPerPixel)
+			return false;
+
+	checkpoint.signature = read.signature;
+	checkpoint.width = read.width;
+	checkpoint.height = read.height;
+	checkpoint.tileSize = read.tileSize;
+	checkpoint.samplesPerPixel = read.samplesPerPixel;
+	checkpoint.tileSamples.swap(read.tileSamples);
+	checkpoint.pixels.swap(read.pixels);
+	return true;
+}
+
+// --------------------------------------------------------------------------
+
+bool CheckpointedRenderer::Render(const RayTracer &tracer, const Scene &scene, ImageBuffer &image,
+                                  int tileSize, int threadCount, const string &checkpointFile,
+                                  double interval, bool resume)
+{
+	m_checkpoints = 0;
+	m_resumedSamples = 0.0;
+	int width = image.Width(), height = image.Height();
+	tileSize = std::max(tileSize, 1);
+
+	RenderCheckpoint &state = m_state;
+	state.signature = RenderSignature(tracer, scene, width, height);
+	state.width = width;
+	state.height = height;
+	state.tileSize = tileSize;
+	state.samplesPerPixel = tracer.settings.samplesPerPixel;
+	state.tileSamples.assign(size_t(TilesAcross(width, tileSize)) * TilesAcross(height, tileSize), 0);
+	state.pixels.assign(size_t(width) * height, vec3(0.f));
+
+	if (resume)
+	{
+		RenderCheckpoint saved;
+		if (!LoadCheckpoint(checkpointFile, saved))
+			cout << "No checkpoint to resume from in " << checkpointFile << ", starting over" << endl;
+		else if (saved.signature != state.signature || saved.width != width ||
+		         saved.height != height || saved.tileSize != tileSize ||
+		         saved.samplesPerPixel != state.samplesPerPixel)
+			cout << "Checkpoint " << checkpointFile << " is of another render, starting over" << endl;
+		else
+		{
+			state.tileSamples.swap(saved.tileSamples);
+			state.pixels.swap(saved.pixels);
+			for (int y = 0; y < height; y += tileSize)
+				for (int x = 0; x < width; x += tileSize)
+				{
+					Tile tile = { x, y, std::min(tileSize, width - x), std::min(tileSize, height - y), 0 };
+					m_resumedSamples += double(state.tileSamples[TileIndex(tile, width, tileSize)]) *
+					                    tile.width * tile.height;
+				}
+			m_resumedSamples /= double(width) * height;
+		}
+	}
+
+	// the sample passes of a progressive render, kept short
+	m_passes.clear();
+	if (!AddSamplePasses(tracer.settings, CHECKPOINT_SAMPLES, m_passes))
+	{
+		RenderPass whole = { 1, 0, 0, false };
+		m_passes.push_back(whole);
+	}
+
+	// the writer waits out each interval, or until told to stop
+	mutex stopLock;
+	condition_variable stopped;
+	bool stop = false;
+	bool failed = false;
+	thread writer([&]() {
+		RenderCheckpoint snapshot;
+		unique_lock<mutex> lock(stopLock);
+		while (interval > 0.0 &&
+		       !stopped.wait_for(lock, chrono::duration<double>(interval), [&]() { return stop; }))
+		{
+			lock.unlock();
+			Snapshot(snapshot);
+			bool saved = SaveCheckpoint(checkpointFile, snapshot);
+			lock.lock();
+			if (saved)
+				++m_checkpoints;
+			else if (!failed)
+			{
+				cout << "ERROR: Could not write checkpoint " << checkpointFile << endl;
+				failed = true;
+			}
+		}
+	});
+
+	m_contexts.assign(threadCount > 0 ? threadCount : TileScheduler::HardwareThreads(),
+	                  TraceContext());
+	TileScheduler scheduler;
+	scheduler.Start(width, height, tileSize, int(m_contexts.size()),
+		[this, &tracer](const Tile &tile, int thread) {
+			if (!s_interrupted)
+				RenderTile(tracer, tile, thread);
+		}, int(m_passes.size()));
+	scheduler.Wait();
+
+	{
+		lock_guard<mutex> lock(stopLock);
+		stop = true;
+	}
+	stopped.notify_one();
+	writer.join();
+
+	// an interrupted render keeps everything it did
+	if (s_interrupted)
+	{
+		if (SaveCheckpoint(checkpointFile, m_state))
+			++m_checkpoints;
+		else
+			cout << "ERROR: Could not write checkpoint " << checkpointFile << endl;
+		return false;
+	}
+
+	image.SetTile(0, 0, width, height, &m_state.pixels[0]);
+	return true;
+}
+
+void CheckpointedRenderer::Snapshot(RenderCheckpoint &snapshot)
+{
+	// all but the tiles are set before the render starts
+	int width = m_state.width, height = m_state.height, tileSize = m_state.tileSize;
+	snapshot.signature = m_state.signature;
+	snapshot.width = width;
+	snapshot.height = height;
+	snapshot.tileSize = tileSize;
+	snapshot.samplesPerPixel = m_state.samplesPerPixel;
+	snapshot.tileSamples.resize(m_state.tileSamples.size());
+	snapshot.pixels.resize(m_state.pixels.size());
+
+	// a tile's samples and pixels are written together under the lock, so
+	// each tile is copied as it was at one moment
+	for (int y = 0; y < height; y += tileSize)
+		for (int x = 0; x < width; x += tileSize)
+		{
+			Tile tile = { x, y, std::min(tileSize, width - x), std::min(tileSize, height - y), 0 };
+			int index = TileIndex(tile, width, tileSize);
+			lock_guard<mutex> lock(m_lock);
+			snapshot.tileSamples[index] = m_state.tileSamples[index];
+			for (int j = 0; j < tile.height; ++j)
+				std::copy(&m_state.pixels[(y + j) * width + x],
+				          &m_state.pixels[(y + j) * width + x] + tile.width,
+				          &snapshot.pixels[(y + j) * width + x]);
+		}
+}
+
+void CheckpointedRenderer::RenderTile(const RayTracer &tracer, const Tile &tile, int thread)
+{
+	int width = m_state.width, height = m_state.height;
+	int samples = m_state.samplesPerPixel;
+	int index = TileIndex(tile, width, m_state.tileSize);
+	int done;
+	{
+		lock_guard<mutex> lock(m_lock);
+		done = m_state.tileSamples[index];
+	}
+
+	// the samples of this pass the checkpoint doesn't hold yet; a pass
+	// adding no samples traces the whole render
+	RenderPass pass = m_passes[tile.pass];
+	int last = pass.sampleCount > 0 ? pass.firstSample + pass.sampleCount : samples;
+	if (done >= last)
+		return;
+
+	TraceContext &context = m_contexts[thread];
+	vector<vec3> colours;
+	if (pass.sampleCount == 0)
+		tracer.RenderTile(tile, width, height, colours, context);
+	else
+	{
+		// only this thread writes the tile's pixels, so they can be read
+		// without the lock; the writer thread only ever reads them
+		pass.sampleCount = last - std::max(pass.firstSample, done);
+		pass.firstSample = last - pass.sampleCount;
+		AccumulateTile(tracer, tile, width, height, pass, m_state.pixels, colours, context);
+
+		if (last == samples)
+			for (size_t i = 0; i < colours.size(); ++i)
+				colours[i] /= float(samples);
+	}
+
+	lock_guard<mutex> lock(m_lock);
+	for (int j = 0; j < tile.height; ++j)
+		std::copy(&colours[j * tile.width], &colours[j * tile.width] + tile.width,
+		          &m_state.pixels[(tile.y + j) * width + tile.x]);
+	m_state.tileSamples[index] = last;
+}
+
+// --------------------------------------------------------------------------
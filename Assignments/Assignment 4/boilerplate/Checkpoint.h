@@ -0,0 +1,109 @@
+// ==========================================================================
+// Render Checkpoints
+//  - renders an image tile by tile in passes of a few samples per pixel,
+//    keeping each tile's running sums and the samples they hold
+//  - a background thread writes all of it to a checkpoint file every so
+//    often; tracing only waits for the sums to be copied, never for the
+//    disk
+//  - a render started from a checkpoint skips what it holds and carries on
+//    from there, and ends with the image an uninterrupted render gives,
+//    bit for bit
+//
+// Nothing random needs saving: every sample's random stream is seeded from
+// its pixel and its index in the pixel's sequence, so the samples still to
+// come are the same whenever they are traced. The running sums are saved
+// as they are in memory, and later samples are added to them in the same
+// order as in one go. The exception is the irradiance cache, which is not
+// saved: its records are made again after a resume and can fall
+// elsewhere.
+//
+// A checkpoint records a signature of the scene files, camera, settings
+// and image size, and is only resumed from by a render they all match.
+// ==========================================================================
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include "Progressive.h"
+#include "RayTracer.h"
+#include "TileScheduler.h"
+
+class ImageBuffer;
+class Scene;
+
+// --------------------------------------------------------------------------
+
+const uint32_t CHECKPOINT_VERSION = 1;
+
+// What a render has done so far. Tiles are numbered row by row from the
+// bottom, as the tile scheduler makes them; a tile's pixels hold the sums
+// of its samples while it is unfinished, and its final colours after.
+struct RenderCheckpoint
+{
+	uint32_t    signature;
+	int32_t     width, height;
+	int32_t     tileSize;
+	int32_t     samplesPerPixel;
+	std::vector<int32_t>   tileSamples;    // samples per pixel done in each tile
+	std::vector<glm::vec3> pixels;
+
+	RenderCheckpoint() : signature(0), width(0), height(0), tileSize(0), samplesPerPixel(0) {}
+};
+
+// signature of everything that decides a render's pixels
+uint32_t RenderSignature(const RayTracer &tracer, const Scene &scene, int width, int height);
+
+// written to a temporary file that is renamed over the checkpoint once
+// complete, so a crash mid-write leaves the last checkpoint whole
+bool SaveCheckpoint(const std::string &fileName, const RenderCheckpoint &checkpoint);
+bool LoadCheckpoint(const std::string &fileName, RenderCheckpoint &checkpoint);
+
+class CheckpointedRenderer
+{
+public:
+	CheckpointedRenderer() : m_checkpoints(0), m_resumedSamples(0) {}
+
+	// Renders the whole of image, blocking until done, on threadCount
+	// threads, every hardware thread if zero or less. With resume set, the
+	// render carries on from checkpointFile when it holds a checkpoint of
+	// this same render. A checkpoint is written every interval seconds,
+	// and once more if the render is interrupted, in which case the image
+	// is left as it was and false returned.
+	bool Render(const RayTracer &tracer, const Scene &scene, ImageBuffer &image,
+	            int tileSize, int threadCount, const std::string &checkpointFile,
+	            double interval, bool resume);
+
+	// stops the render running in any thread, keeping what it has done;
+	// only sets a lock-free flag, so it is safe from a signal handler
+	static void Interrupt() { s_interrupted = true; }
+	static bool Interrupted() { return s_interrupted; }
+
+	const std::vector<TraceContext> &Contexts() const { return m_contexts; }
+	int CheckpointsWritten() const { return m_checkpoints; }
+	// samples per pixel, over the whole image, taken from the checkpoint
+	double ResumedSamples() const { return m_resumedSamples; }
+
+private:
+	RenderCheckpoint            m_state;
+	std::mutex                  m_lock;     // guards m_state
+	std::vector<RenderPass>     m_passes;
+	std::vector<TraceContext>   m_contexts;
+	int                         m_checkpoints;
+	double                      m_resumedSamples;
+
+	static std::atomic<bool>    s_interrupted;
+
+	// traces what a pass adds to a tile, unless the checkpoint holds it
+	void RenderTile(const RayTracer &tracer, const Tile &tile, int thread);
+	// copies the state a tile at a time, holding the lock for one tile's
+	// rows only, so threads finishing tiles meanwhile hardly wait
+	void Snapshot(RenderCheckpoint &snapshot);
+};
+
+// --------------------------------------------------------------------------
+#endif // CHECKPOINT_H
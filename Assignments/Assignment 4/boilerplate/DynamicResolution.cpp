@@ -0,0 +1,136 @@
+// ==========================================================================
+// Dynamic Resolution
+// ==========================================================================
+
+#include "DynamicResolution.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include "ImageBuffer.h"
+
+using namespace std;
+using namespace glm;
+
+// --------------------------------------------------------------------------
+
+namespace
+{
+	// where a first motion starts, a sixteenth of the pixels
+	const float FIRST_SCALE = 0.25f;
+
+	// a single frame far off the target, such as one held up by the rest
+	// of the system, moves the scale by no more than this factor
+	const float MAX_STEP = 2.f;
+
+	// reduced size of one side of the image, at least a pixel
+	int Reduced(int size, float scale)
+	{
+		return std::max(1, std::min(size, int(size * scale + 0.5f)));
+	}
+}
+
+// --------------------------------------------------------------------------
+
+DynamicResolution::DynamicResolution(double targetSeconds, float minScale)
+	: m_target(targetSeconds), m_minScale(glm::clamp(minScale, 0.01f, 1.f)),
+	  m_scale(std::max(FIRST_SCALE, m_minScale)), m_frameTime(0.0)
+{}
+
+void DynamicResolution::RenderFrame(RayTracer &tracer, ImageBuffer &image, int tileSize)
+{
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	int width = image.Width(), height = image.Height();
+	int tracedWidth = Reduced(width, m_scale), tracedHeight = Reduced(height, m_scale);
+
+	// the camera's field of view spans the image whatever its size, so the
+	// smaller image shows the same view
+	RenderSettings settings = tracer.settings;
+	tracer.settings.samplesPerPixel = 1;
+	tracer.settings.adaptive = false;
+	m_traced.resize(size_t(tracedWidth) * tracedHeight);
+	m_renderer.Start(tracer, tracedWidth, tracedHeight, tileSize, 0,
+		[this, tracedWidth](const Tile &tile, const vec3 *colours) {
+			for (int j = 0; j < tile.height; ++j)
+				std::copy(colours + j * tile.width, colours + (j + 1) * tile.width,
+				          &m_traced[(tile.y + j) * tracedWidth + tile.x]);
+		}, false);
+	m_renderer.Wait();
+	tracer.settings = settings;
+
+	if (tracedWidth == width && tracedHeight == height)
+		image.SetTile(0, 0, width, height, &m_traced[0]);
+	else
+	{
+		ScaleImage(m_traced, tracedWidth, tracedHeight, m_scaled, width, height);
+		image.SetTile(0, 0, width, height, &m_scaled[0]);
+	}
+
+	m_frameTime = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	float step = float(std::sqrt(m_target / std::max(m_frameTime, 1e-6)));
+	step = glm::clamp(step, 1.f / MAX_STEP, MAX_STEP);
+	m_scale = glm::clamp(0.5f * (m_scale + m_scale * step), m_minScale, 1.f);
+}
+
+// --------------------------------------------------------------------------
+
+void ScaleImage(const vector<vec3> &pixels, int width, int height,
+                vector<vec3> &scaled, int scaledWidth, int scaledHeight)
+{
+	// the source column and weight of each scaled column, worked out once
+	vector<int> column(scaledWidth), next(scaledWidth);
+	vector<float> across(scaledWidth);
+	float sx = float(width) / scaledWidth, sy = float(height) / scaledHeight;
+	for (int x = 0; x < scaledWidth; ++x)
+	{
+		float u = glm::clamp((x + 0.5f) * sx - 0.5f, 0.f, float(width - 1));
+		column[x] = std::min(int(u), std::max(width - 2, 0));
+		next[x] = std::min(column[x] + 1, width - 1);
+		across[x] = u - column[x];
+	}
+
+	// Scaling is separable: each source row is scaled across once, into
+	// one of two rows kept for the pair of source rows the current scaled
+	// row lies between, and each scaled pixel is then a single blend of
+	// those two.
+	vector<vec3> rows[2] = { vector<vec3>(scaledWidth), vector<vec3>(scaledWidth) };
+	int held[2] = { -1, -1 };
+	auto scaleRow = [&](int row, vector<vec3> &out) {
+		const vec3 *source = &pixels[size_t(row) * width];
+		for (int x = 0; x < scaledWidth; ++x)
+		{
+			const vec3 &a = source[column[x]], &b = source[next[x]];
+			out[x] = a + (b - a) * across[x];
+		}
+	};
+
+	scaled.resize(size_t(scaledWidth) * scaledHeight);
+	for (int y = 0; y < scaledHeight; ++y)
+	{
+		float v = glm::clamp((y + 0.5f) * sy - 0.5f, 0.f, float(height - 1));
+		int row = std::min(int(v), std::max(height - 2, 0));
+		int rowAbove = std::min(row + 1, height - 1);
+		float up = v - row;
+		if (held[0] != row)
+		{
+			if (held[1] == row)
+				rows[0].swap(rows[1]);
+			else
+				scaleRow(row, rows[0]);
+			held[0] = row;
+			held[1] = -1;
+		}
+		if (held[1] != rowAbove)
+		{
+			scaleRow(rowAbove, rows[1]);
+			held[1] = rowAbove;
+		}
+
+		const vec3 *below = &rows[0][0], *above = &rows[1][0];
+		vec3 *out = &scaled[size_t(y) * scaledWidth];
+		for (int x = 0; x < scaledWidth; ++x)
+			out[x] = below[x] + (above[x] - below[x]) * up;
+	}
+}
+
+// --------------------------------------------------------------------------
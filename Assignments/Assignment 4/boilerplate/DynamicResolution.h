@@ -0,0 +1,65 @@
+// ==========================================================================
+// Dynamic Resolution
+//  - renders frames for a moving camera at a reduced internal resolution,
+//    one sample per pixel, and scales them up bilinearly to fill the image
+//  - picks the resolution from the time the last frames took, so frames
+//    take about the target time however costly the view in front of the
+//    camera is
+//
+// Frame time grows with the pixels traced, the square of the scale, so the
+// scale that would have met the target is the last one times the square
+// root of target over time taken. The scale moves halfway there each frame,
+// which settles in a few frames without swinging back and forth on noisy
+// timings, and is kept from one motion to the next.
+//
+// Once the camera stops, the caller starts a full progressive render,
+// which converges to the full resolution and samples per pixel.
+// ==========================================================================
+#ifndef DYNAMICRESOLUTION_H
+#define DYNAMICRESOLUTION_H
+
+#include <vector>
+#include <glm/glm.hpp>
+#include "RayTracer.h"
+#include "Progressive.h"
+
+class ImageBuffer;
+
+// --------------------------------------------------------------------------
+
+class DynamicResolution
+{
+public:
+	// aims for frames of targetSeconds each, at no less than minScale of
+	// the full width and height
+	explicit DynamicResolution(double targetSeconds, float minScale = 0.125f);
+
+	// Traces the tracer's view at the current scale and fills the whole of
+	// image with it, blocking until done, then adjusts the scale for the
+	// next frame. The tracer's settings are changed to one sample per pixel
+	// for the frame and put back afterward.
+	void RenderFrame(RayTracer &tracer, ImageBuffer &image, int tileSize);
+
+	// fraction of the full width and height the next frame is traced at
+	float Scale() const { return m_scale; }
+	// seconds the last frame took, tracing and scaling up
+	double FrameTime() const { return m_frameTime; }
+
+private:
+	double      m_target;
+	float       m_minScale;
+	float       m_scale;
+	double      m_frameTime;
+
+	ProgressiveRenderer     m_renderer;
+	std::vector<glm::vec3>  m_traced;       // at the reduced resolution
+	std::vector<glm::vec3>  m_scaled;       // at the image's
+};
+
+// bilinear scaling of a width x height image, rows from the bottom, to a
+// scaledWidth x scaledHeight one; pixel centres line up, and edges clamp
+void ScaleImage(const std::vector<glm::vec3> &pixels, int width, int height,
+                std::vector<glm::vec3> &scaled, int scaledWidth, int scaledHeight);
+
+// --------------------------------------------------------------------------
+#endif // DYNAMICRESOLUTION_H
@@ -0,0 +1,187 @@
+// ==========================================================================
+// Ray Tracing Geometry Support
+//  - rays, hit records and axis-aligned bounding boxes
+//  - ray intersection routines for spheres, planes, triangles and boxes
+//  - orthonormal frames around a direction, for sampling directions
+//
+// These are kept inline in a header because every acceleration structure
+// and the shading code call them from their innermost loops.
+// ==========================================================================
+#ifndef GEOMETRY_H
+#define GEOMETRY_H
+
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+// --------------------------------------------------------------------------
+// A ray is the half line origin + t * direction for t in (tMin, tMax). The
+// intersection routines shrink tMax as closer hits are found.
+
+struct Ray
+{
+	glm::vec3 origin;
+	glm::vec3 direction;
+	float   tMin, tMax;
+
+	Ray() : origin(0.f), direction(0.f, 0.f, -1.f), tMin(0.f), tMax(FLT_MAX)
+	{}
+	Ray(const glm::vec3 &o, const glm::vec3 &d, float tmin = 0.f, float tmax = FLT_MAX)
+		: origin(o), direction(d), tMin(tmin), tMax(tmax)
+	{}
+
+	glm::vec3 At(float t) const { return origin + t * direction; }
+};
+
+// offset along the normal that keeps rays leaving a surface from hitting it
+// again; every ray traced on from a hit starts this far off the surface
+const float SURFACE_EPSILON = 1e-4f;
+
+// Scene-wide primitive id. Every placed copy of an instanced triangle has
+// an id of its own, so a scene of many instances of large meshes runs past
+// what an int holds.
+typedef int64_t PrimitiveId;
+
+// record of the closest intersection found along a ray
+struct Hit
+{
+	float   t;
+	PrimitiveId primitive;  // scene primitive id, or -1 if nothing was hit
+	float   u, v;       // barycentric coordinates of a triangle hit
+
+	Hit() : t(FLT_MAX), primitive(-1), u(0.f), v(0.f)
+	{}
+
+	bool Valid() const { return primitive >= 0; }
+};
+
+// --------------------------------------------------------------------------
+// Axis-aligned bounding box, empty (inverted) when default constructed
+
+struct AABB
+{
+	glm::vec3 lower, upper;
+
+	AABB() : lower(FLT_MAX), upper(-FLT_MAX)
+	{}
+	AABB(const glm::vec3 &l, const glm::vec3 &u) : lower(l), upper(u)
+	{}
+
+	void Extend(const glm::vec3 &p)
+	{
+		lower = glm::min(lower, p);
+		upper = glm::max(upper, p);
+	}
+	void Extend(const AABB &box)
+	{
+		lower = glm::min(lower, box.lower);
+		upper = glm::max(upper, box.upper);
+	}
+
+	bool Empty() const { return lower.x > upper.x; }
+	glm::vec3 Centroid() const { return 0.5f * (lower + upper); }
+	glm::vec3 Extent() const { return upper - lower; }
+
+	float SurfaceArea() const
+	{
+		if (Empty()) return 0.f;
+		glm::vec3 e = upper - lower;
+		return 2.f * (e.x * e.y + e.y * e.z + e.z * e.x);
+	}
+
+	int LongestAxis() const
+	{
+		glm::vec3 e = upper - lower;
+		if (e.x > e.y && e.x > e.z) return 0;
+		return e.y > e.z ? 1 : 2;
+	}
+};
+
+// --------------------------------------------------------------------------
+// Ray/primitive intersection tests. Each returns true only for a hit inside
+// the ray's (tMin, tMax) interval and writes the hit distance to t.
+
+// slab test against a box, given the reciprocal of the ray direction
+inline bool IntersectAABB(const glm::vec3 &lower, const glm::vec3 &upper,
+                          const glm::vec3 &origin, const glm::vec3 &invDirection,
+                          float tMin, float tMax, float &tEntry)
+{
+	glm::vec3 t0 = (lower - origin) * invDirection;
+	glm::vec3 t1 = (upper - origin) * invDirection;
+	glm::vec3 tNear = glm::min(t0, t1);
+	glm::vec3 tFar = glm::max(t0, t1);
+	tMin = glm::max(tMin, glm::max(tNear.x, glm::max(tNear.y, tNear.z)));
+	tMax = glm::min(tMax, glm::min(tFar.x, glm::min(tFar.y, tFar.z)));
+	tEntry = tMin;
+	return tMin <= tMax;
+}
+
+// Moller-Trumbore test, returning the barycentrics of p1 and p2 in u and v
+inline bool IntersectTriangle(const glm::vec3 &p0, const glm::vec3 &p1,
+                              const glm::vec3 &p2, const Ray &ray,
+                              float &t, float &u, float &v)
+{
+	glm::vec3 e1 = p1 - p0;
+	glm::vec3 e2 = p2 - p0;
+	glm::vec3 pvec = glm::cross(ray.direction, e2);
+	float det = glm::dot(e1, pvec);
+	if (std::fabs(det) < 1e-12f) return false;
+	float invDet = 1.f / det;
+
+	glm::vec3 tvec = ray.origin - p0;
+	u = glm::dot(tvec, pvec) * invDet;
+	if (u < 0.f || u > 1.f) return false;
+
+	glm::vec3 qvec = glm::cross(tvec, e1);
+	v = glm::dot(ray.direction, qvec) * invDet;
+	if (v < 0.f || u + v > 1.f) return false;
+
+	t = glm::dot(e2, qvec) * invDet;
+	return t > ray.tMin && t < ray.tMax;
+}
+
+inline bool IntersectSphere(const glm::vec3 &centre, float radius,
+                            const Ray &ray, float &t)
+{
+	glm::vec3 oc = ray.origin - centre;
+	float a = glm::dot(ray.direction, ray.direction);
+	float b = glm::dot(oc, ray.direction);
+	float c = glm::dot(oc, oc) - radius * radius;
+	float discriminant = b * b - a * c;
+	if (discriminant < 0.f) return false;
+
+	// take the nearer root unless it lies behind the start of the ray
+	float root = std::sqrt(discriminant);
+	t = (-b - root) / a;
+	if (t <= ray.tMin)
+		t = (-b + root) / a;
+	return t > ray.tMin && t < ray.tMax;
+}
+
+inline bool IntersectPlane(const glm::vec3 &normal, const glm::vec3 &point,
+                           const Ray &ray, float &t)
+{
+	float denominator = glm::dot(normal, ray.direction);
+	if (std::fabs(denominator) < 1e-12f) return false;
+	t = glm::dot(point - ray.origin, normal) / denominator;
+	return t > ray.tMin && t < ray.tMax;
+}
+
+// --------------------------------------------------------------------------
+// two unit vectors completing a unit direction to a right-handed frame,
+// without branching on the direction (Duff et al. 2017)
+
+inline void OrthonormalBasis(const glm::vec3 &direction, glm::vec3 &tangent,
+                             glm::vec3 &bitangent)
+{
+	float sign = std::copysign(1.f, direction.z);
+	float a = -1.f / (sign + direction.z);
+	float b = direction.x * direction.y * a;
+	tangent = glm::vec3(1.f + sign * direction.x * direction.x * a, sign * b,
+	                    -sign * direction.x);
+	bitangent = glm::vec3(b, sign + direction.y * direction.y * a, -direction.y);
+}
+
+// --------------------------------------------------------------------------
+#endif // GEOMETRY_H
@@ -18,17 +18,25 @@
 #include "ImageBuffer.h"
 
 #include <iostream>
+#include <cstring>
 #include <glm/common.hpp>
 #include <algorithm>
 
 // --------------------------------------------------------------------------
 // Set these defines to choose which image library to use for saving image
 // files to disk. Obviously, you shouldn't set both!
+//  - USE_PARALLEL_PNG compresses bands of rows on every core with zlib,
+//    without making a second copy of the image
 
 //#define USE_IMAGEMAGICK
 //#define USE_FREEIMAGE
-#define USE_STB
+//#define USE_STB
+#define USE_PARALLEL_PNG
 
+#ifdef USE_PARALLEL_PNG
+#include "PngWriter.h"
+#include "Simd.h"
+#endif
 #ifdef USE_STB
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include <stb_image_write.h>
@@ -40,33 +48,90 @@
 #include <FreeImage.h>
 #endif
 
+#ifndef HEADLESS
 #ifndef LAB_LINUX
 #include <glad/glad.h>
 #else
 #define GLFW_INCLUDE_GLCOREARB
 #define GL_GLEXT_PROTOTYPES
 #endif
+#endif
 
 using namespace std;
 using namespace glm;
 
 // --------------------------------------------------------------------------
 
+namespace
+{
+#ifdef USE_PARALLEL_PNG
+    // 8-bit RGB of a row of colours, as 255 * clamp(c, 0, 1) truncated
+    // like the other image libraries get it, sixteen channels at a time
+    void QuantizeRow(const vec3 *colours, int width, unsigned char *rgb)
+    {
+        const float *channels = &colours[0].x;
+        int count = width * 3, i = 0;
+    #ifdef SIMD_SSE
+        __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.f), scale = _mm_set1_ps(255.f);
+        for (; i + 16 <= count; i += 16)
+        {
+            // max() returns its second operand for NaN, so NaN becomes 0
+            __m128i q[4];
+            for (int k = 0; k < 4; ++k)
+            {
+                __m128 c = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(channels + i + 4 * k), zero), one);
+                q[k] = _mm_cvttps_epi32(_mm_mul_ps(c, scale));
+            }
+            __m128i bytes = _mm_packus_epi16(_mm_packs_epi32(q[0], q[1]),
+                                             _mm_packs_epi32(q[2], q[3]));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(rgb + i), bytes);
+        }
+    #endif
+        for (; i < count; ++i)
+            rgb[i] = (unsigned char) (255 * clamp(channels[i], 0.f, 1.f));
+    }
+#endif
+
+    // IEEE half precision from single precision, rounding to nearest;
+    // values too small for a normal half become zero
+    unsigned short FloatToHalf(float value)
+    {
+        unsigned bits;
+        memcpy(&bits, &value, sizeof(bits));
+        unsigned sign = (bits >> 16) & 0x8000u;
+        int exponent = int((bits >> 23) & 0xffu) - 127 + 15;
+        unsigned mantissa = bits & 0x7fffffu;
+
+        if (exponent <= 0)
+            return (unsigned short) sign;
+        if (exponent >= 31)     // overflow becomes infinity, NaN stays NaN
+            return (unsigned short) (sign | 0x7c00u | (exponent == 143 && mantissa ? 0x200u : 0u));
+
+        // a carry out of the mantissa correctly bumps the exponent
+        unsigned half = sign | (unsigned(exponent) << 10) | (mantissa >> 13);
+        if (mantissa & 0x1000u)
+            ++half;
+        return (unsigned short) half;
+    }
+}
+
+// --------------------------------------------------------------------------
+
 ImageBuffer::ImageBuffer()
     : m_textureName(0), m_framebufferObject(0),
-      m_width(0), m_height(0), m_modified(false), destroyed(false)
+      m_width(0), m_height(0), m_displayFormat(DISPLAY_RGBA8),
+      m_nextPixelBuffer(0), m_modified(false), destroyed(false)
 {
+    for (int i = 0; i < PIXEL_BUFFERS; ++i)
+    {
+        m_pixelBuffers[i] = 0;
+        m_uploadFences[i] = 0;
+    }
 }
 
 ImageBuffer::~ImageBuffer()
 {
-    if(!destroyed)
-    {
-        if (m_framebufferObject)    
-            glDeleteFramebuffers(1, &m_framebufferObject);
-        if (m_textureName)
-            glDeleteTextures(1, &m_textureName);
-    }
+    Destroy();
 }
 
 void ImageBuffer::ResetModified()
@@ -76,15 +141,46 @@ void ImageBuffer::ResetModified()
     m_modifiedUpper = 0;
 }
 
+int ImageBuffer::DisplayPixelSize() const
+{
+    return m_displayFormat == DISPLAY_RGBA16F ? 8 : 4;
+}
+
+void ImageBuffer::ConvertForDisplay(const vec3 *colours, int count,
+                                    unsigned char *pixels) const
+{
+    if (m_displayFormat == DISPLAY_RGBA16F)
+    {
+        for (int i = 0; i < count; ++i)
+        {
+            unsigned short half[4] = { FloatToHalf(colours[i].r), FloatToHalf(colours[i].g),
+                                       FloatToHalf(colours[i].b), FloatToHalf(1.f) };
+            memcpy(pixels + 8 * i, half, sizeof(half));
+        }
+        return;
+    }
+
+    for (int i = 0; i < count; ++i)
+    {
+        vec3 c = clamp(colours[i], 0.f, 1.f) * 255.f + 0.5f;
+        pixels[4 * i]     = (unsigned char) c.r;
+        pixels[4 * i + 1] = (unsigned char) c.g;
+        pixels[4 * i + 2] = (unsigned char) c.b;
+        pixels[4 * i + 3] = 255;
+    }
+}
+
 // --------------------------------------------------------------------------
 
-bool ImageBuffer::Initialize()
+bool ImageBuffer::Initialize(int width, int height)
 {
-    // retrieve the current viewport size
-    GLint viewport[4];
-    glGetIntegerv(GL_VIEWPORT, viewport);
-    m_width = viewport[2];
-    m_height = viewport[3];
+    if (width <= 0 || height <= 0)
+    {
+        cout << "ImageBuffer ERROR: Invalid image size " << width << "x" << height << endl;
+        return false;
+    }
+    m_width = width;
+    m_height = height;
 
     // allocate image data
     m_imageData.resize(m_width * m_height);
@@ -95,16 +191,47 @@ bool ImageBuffer::Initialize()
             float c = 0.2f + ((p & 1) ? 0.1f : 0.0f);
             m_imageData[k] = vec3(c);
         }
+    ResetModified();
+    destroyed = false;
+    return true;
+}
+
+#ifndef HEADLESS
+bool ImageBuffer::Initialize(DisplayFormat format)
+{
+    // retrieve the current viewport size
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    if (!Initialize(viewport[2], viewport[3]))
+        return false;
+
+    // allocate the display copy of the image
+    m_displayFormat = format;
+    m_displayData.resize(size_t(m_width) * m_height * DisplayPixelSize());
+    ConvertForDisplay(&m_imageData[0], m_width * m_height, &m_displayData[0]);
+    GLenum internalFormat = format == DISPLAY_RGBA16F ? GL_RGBA16F : GL_RGBA8;
+    GLenum type = format == DISPLAY_RGBA16F ? GL_HALF_FLOAT : GL_UNSIGNED_BYTE;
 
     // allocate texture object
     if (!m_textureName)
         glGenTextures(1, &m_textureName);
     glBindTexture(GL_TEXTURE_RECTANGLE, m_textureName);
-    glTexImage2D(GL_TEXTURE_RECTANGLE, 0, GL_RGB, m_width, m_height, 0, GL_RGB,
-                 GL_FLOAT, &m_imageData[0]);
+    glTexImage2D(GL_TEXTURE_RECTANGLE, 0, internalFormat, m_width, m_height, 0, GL_RGBA,
+                 type, &m_displayData[0]);
     glBindTexture(GL_TEXTURE_RECTANGLE, 0);
     ResetModified();
 
+    // allocate the pixel buffer objects used for uploads
+    if (!m_pixelBuffers[0])
+        glGenBuffers(PIXEL_BUFFERS, m_pixelBuffers);
+    for (int i = 0; i < PIXEL_BUFFERS; ++i)
+    {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pixelBuffers[i]);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, m_displayData.size(), 0, GL_STREAM_DRAW);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    m_nextPixelBuffer = 0;
+
     // allocate framebuffer object
     if (!m_framebufferObject)
         glGenFramebuffers(1, &m_framebufferObject);
@@ -120,15 +247,30 @@ bool ImageBuffer::Initialize()
 
     return status == GL_FRAMEBUFFER_COMPLETE;
 }
+#endif
 
 bool ImageBuffer::Destroy()
 {
     if(!destroyed)
     {
+#ifndef HEADLESS
         if (m_framebufferObject)    
             glDeleteFramebuffers(1, &m_framebufferObject);
         if (m_textureName)
             glDeleteTextures(1, &m_textureName);
+        for (int i = 0; i < PIXEL_BUFFERS; ++i)
+            if (m_uploadFences[i])
+                glDeleteSync(m_uploadFences[i]);
+        if (m_pixelBuffers[0])
+            glDeleteBuffers(PIXEL_BUFFERS, m_pixelBuffers);
+#endif
+        m_framebufferObject = 0;
+        m_textureName = 0;
+        for (int i = 0; i < PIXEL_BUFFERS; ++i)
+        {
+            m_pixelBuffers[i] = 0;
+            m_uploadFences[i] = 0;
+        }
         destroyed = true;
     }
     return destroyed;
@@ -136,38 +278,117 @@ bool ImageBuffer::Destroy()
 
 // --------------------------------------------------------------------------
 
+void ImageBuffer::MarkModified(int lower, int upper)
+{
+    m_modified = true;
+    m_modifiedLower = std::min(m_modifiedLower, lower);
+    m_modifiedUpper = std::max(m_modifiedUpper, upper);
+}
+
 void ImageBuffer::SetPixel(int x, int y, vec3 colour)
 {
+    unsigned char pixel[8];
+    ConvertForDisplay(&colour, 1, pixel);
+
+    lock_guard<mutex> guard(m_mutex);
     int index = y * m_width + x;
     m_imageData[index] = colour;
+    if (!m_displayData.empty())
+        memcpy(&m_displayData[size_t(index) * DisplayPixelSize()], pixel, DisplayPixelSize());
 
     // mark that something was changed
-    m_modified = true;
-    m_modifiedLower = std::min(m_modifiedLower, y);
-    m_modifiedUpper = std::max(m_modifiedUpper, y+1);
+    MarkModified(y, y+1);
+}
+
+void ImageBuffer::SetTile(int x, int y, int width, int height, const vec3 *colours)
+{
+    // convert on the calling thread, so the lock is only held for copying
+    int pixelSize = DisplayPixelSize();
+    vector<unsigned char> pixels;
+    if (!m_displayData.empty())
+    {
+        pixels.resize(size_t(width) * height * pixelSize);
+        ConvertForDisplay(colours, width * height, &pixels[0]);
+    }
+
+    lock_guard<mutex> guard(m_mutex);
+    for (int row = 0; row < height; ++row)
+    {
+        std::copy(colours + row * width, colours + (row + 1) * width,
+                  &m_imageData[(y + row) * m_width + x]);
+        if (!pixels.empty())
+            memcpy(&m_displayData[(size_t(y + row) * m_width + x) * pixelSize],
+                   &pixels[size_t(row) * width * pixelSize], size_t(width) * pixelSize);
+    }
+
+    MarkModified(y, y+height);
 }
 
 // --------------------------------------------------------------------------
 
+#ifndef HEADLESS
 void ImageBuffer::Render()
 {
     if (!m_framebufferObject) return;
 
-    // check for modifications to the image data and update texture as needed
-    if (m_modified)
+    // the next pixel buffer in the ring is free once the driver has read
+    // it; if it hasn't yet, the changes wait for a later frame
+    GLsync &fence = m_uploadFences[m_nextPixelBuffer];
+    bool bufferFree = true;
+    if (fence)
     {
-        int sizeY = m_modifiedUpper - m_modifiedLower;
-        int index = m_modifiedLower * m_width;
+        GLenum status = glClientWaitSync(fence, 0, 0);
+        bufferFree = status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED;
+        if (bufferFree)
+        {
+            glDeleteSync(fence);
+            fence = 0;
+        }
+    }
+
+    // check for modifications to the image data and update texture as needed,
+    // holding the lock only while the changed rows are copied
+    int lower = 0, rows = 0;
+    if (bufferFree)
+    {
+        lock_guard<mutex> guard(m_mutex);
+        if (m_modified)
+        {
+            lower = m_modifiedLower;
+            rows = m_modifiedUpper - m_modifiedLower;
+            size_t rowSize = size_t(m_width) * DisplayPixelSize();
+
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pixelBuffers[m_nextPixelBuffer]);
+            void *mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, lower * rowSize,
+                                            rows * rowSize,
+                                            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT |
+                                            GL_MAP_UNSYNCHRONIZED_BIT);
+            if (mapped)
+            {
+                memcpy(mapped, &m_displayData[lower * rowSize], rows * rowSize);
+                ResetModified();
+            }
+            else
+                rows = 0;
+        }
+    }
 
-        // bind texture and copy only the rows that have been changed
+    if (rows > 0)
+    {
+        // bind texture and copy only the rows that have been changed; the
+        // source is the bound buffer, so this returns without waiting
+        size_t offset = size_t(lower) * m_width * DisplayPixelSize();
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
         glBindTexture(GL_TEXTURE_RECTANGLE, m_textureName);
-        glTexSubImage2D(GL_TEXTURE_RECTANGLE, 0, 0, m_modifiedLower, m_width,
-                        sizeY, GL_RGB, GL_FLOAT, &m_imageData[index]);
+        glTexSubImage2D(GL_TEXTURE_RECTANGLE, 0, 0, lower, m_width, rows, GL_RGBA,
+                        m_displayFormat == DISPLAY_RGBA16F ? GL_HALF_FLOAT : GL_UNSIGNED_BYTE,
+                        reinterpret_cast<const void *>(offset));
         glBindTexture(GL_TEXTURE_RECTANGLE, 0);
 
-        // mark that we've updated the texture
-        ResetModified();
+        fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        m_nextPixelBuffer = (m_nextPixelBuffer + 1) % PIXEL_BUFFERS;
     }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
 
     // bind the framebuffer object with our texture in it and copy to screen
     glBindFramebuffer(GL_READ_FRAMEBUFFER, m_framebufferObject);
@@ -176,6 +397,7 @@ void ImageBuffer::Render()
                       GL_COLOR_BUFFER_BIT, GL_NEAREST);
     glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
 }
+#endif
 
 // --------------------------------------------------------------------------
 
@@ -252,6 +474,14 @@ bool ImageBuffer::SaveToFile(const string &imageFileName)
 		return true;
 	#endif
 
+	#ifdef USE_PARALLEL_PNG
+		// PNG rows run from the top of the image down
+		return WritePng(imageFileName, m_width, m_height,
+			[this](int y, unsigned char *rgb) {
+				QuantizeRow(&m_imageData[(m_height - 1 - y) * m_width], m_width, rgb);
+			});
+	#endif
+
 	#ifdef USE_STB
 	const unsigned numComponents = 3; //RGB
 	unsigned char* pixels = new unsigned char[m_width*m_height*numComponents];
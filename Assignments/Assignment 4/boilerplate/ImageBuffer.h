@@ -15,8 +15,12 @@
 
 #include <vector>
 #include <string>
+#include <mutex>
 #include <glm/vec3.hpp>
 
+// Define HEADLESS to build without OpenGL, for programs that only render
+// images to files; Render() and the viewport-sized Initialize() go away.
+#ifndef HEADLESS
 // Specify that we want the OpenGL core profile before including GLFW headers
 #ifndef LAB_LINUX
 #include <glad/glad.h>
@@ -25,11 +29,28 @@
 #define GL_GLEXT_PROTOTYPES
 #endif
 #include <GLFW/glfw3.h>
+#else
+typedef unsigned int GLuint;
+typedef struct __GLsync *GLsync;
+#endif
 
 // --------------------------------------------------------------------------
 // This class encapsulates functionality for setting pixel colours in an
 // image memory buffer, copying the buffer into an OpenGL window for display,
 // and saving the buffer to disk as an image file.
+//
+// The full precision colours are kept for saving only. Pixels are also
+// converted, by the threads that set them, into a compact copy for display,
+// which reaches the texture through a ring of pixel buffer objects: the GL
+// thread copies changed rows into a free buffer and the driver uploads it
+// asynchronously, so neither side waits on the other.
+
+// pixel format of the displayed copy of the image
+enum DisplayFormat
+{
+    DISPLAY_RGBA8,      // 4 bytes per pixel, clamped to [0,1]
+    DISPLAY_RGBA16F     // 8 bytes per pixel, keeps values above 1
+};
 
 class ImageBuffer
 {
@@ -41,10 +62,30 @@ class ImageBuffer
     int     m_width, m_height;
     std::vector<glm::vec3> m_imageData;
 
+    // display copy of the image, allocated only with an OpenGL context
+    DisplayFormat m_displayFormat;
+    std::vector<unsigned char> m_displayData;
+
+    // pixel buffer objects used in turn for texture uploads, each with a
+    // fence that signals when the driver has finished reading it
+    static const int PIXEL_BUFFERS = 3;
+    GLuint  m_pixelBuffers[PIXEL_BUFFERS];
+    GLsync  m_uploadFences[PIXEL_BUFFERS];
+    int     m_nextPixelBuffer;
+
     // state variables to keep track of modified region
     bool    m_modified;
     int     m_modifiedLower, m_modifiedUpper;
 
+    // guards the pixel data and modified region, which render threads
+    // write while the GL thread uploads them
+    std::mutex m_mutex;
+
+    void MarkModified(int lower, int upper);
+    int DisplayPixelSize() const;
+    void ConvertForDisplay(const glm::vec3 *colours, int count,
+                           unsigned char *pixels) const;
+
     void ResetModified();
     bool destroyed;
 
@@ -56,9 +97,15 @@ public:
     int Width() const  { return m_width; }
     int Height() const { return m_height; }
 
+#ifndef HEADLESS
     // call this after your OpenGL context is all set up to create an image
     // buffer that matches the size of your viewport
-    bool Initialize();
+    bool Initialize(DisplayFormat format = DISPLAY_RGBA8);
+#endif
+
+    // create an image buffer of the given size with no OpenGL texture, for
+    // rendering straight to a file; needs no OpenGL context
+    bool Initialize(int width, int height);
     bool Destroy();
 
     // set a pixel in this image buffer to a specified colour:
@@ -66,8 +113,15 @@ public:
     //  - colour is RGB given as floating point numbers in the range [0,1]
     void SetPixel(int x, int y, glm::vec3 colour);
 
+    // copy a block of width x height colours, stored row by row from the
+    // bottom, into the image with its bottom-left corner at (x, y)
+    //  - safe to call from any number of threads at once
+    void SetTile(int x, int y, int width, int height, const glm::vec3 *colours);
+
+#ifndef HEADLESS
     // call this in your render function to copy this image onto your screen
     void Render();
+#endif
 
     // call this at the end of your render to save the image to file
     bool SaveToFile(const std::string &imageFileName);
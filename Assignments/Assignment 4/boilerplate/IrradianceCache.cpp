@@ -0,0 +1,233 @@
+// ==========================================================================
+// Irradiance Cache
+//
+// A record at accuracy a serves the points within a * radius of it, so it
+// goes into every node that sphere overlaps, at the first level whose
+// nodes are no wider than the sphere. A lookup walks down the nodes
+// holding its point and tests every record it meets on the way.
+// ==========================================================================
+
+#include "IrradianceCache.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+using namespace glm;
+
+// --------------------------------------------------------------------------
+
+namespace
+{
+	// deep enough for records a few millionths of the scene across
+	const int MAX_OCTREE_DEPTH = 20;
+
+	// records are skipped for points this far in front of them, relative
+	// to their radius, which would see light the record's surface doesn't
+	const float FRONT_TOLERANCE = 0.01f;
+}
+
+struct IrradianceCache::Entry
+{
+	const IrradianceRecord *record;
+	Entry  *next;
+};
+
+struct IrradianceCache::Node
+{
+	std::atomic<Node*>  children[8];
+	std::atomic<Entry*> records;
+
+	Node() : records(nullptr)
+	{
+		for (int i = 0; i < 8; ++i)
+			children[i] = nullptr;
+	}
+};
+
+// --------------------------------------------------------------------------
+
+IrradianceCache::IrradianceCache()
+	: m_root(new Node), m_centre(0.f), m_halfSize(1.f), m_outside(nullptr),
+	  m_owned(nullptr), m_size(0), m_accuracy(0.25f)
+{}
+
+IrradianceCache::~IrradianceCache()
+{
+	Release();
+}
+
+void IrradianceCache::Free(Node *node)
+{
+	if (!node) return;
+	for (int i = 0; i < 8; ++i)
+		Free(node->children[i]);
+	for (Entry *entry = node->records; entry; )
+	{
+		Entry *next = entry->next;
+		delete entry;
+		entry = next;
+	}
+	delete node;
+}
+
+void IrradianceCache::Release()
+{
+	Free(m_root);
+	m_root = nullptr;
+	for (Entry *entry = m_outside; entry; )
+	{
+		Entry *next = entry->next;
+		delete entry;
+		entry = next;
+	}
+	for (Entry *entry = m_owned; entry; )
+	{
+		Entry *next = entry->next;
+		delete entry->record;
+		delete entry;
+		entry = next;
+	}
+	m_outside = nullptr;
+	m_owned = nullptr;
+	m_size = 0;
+}
+
+void IrradianceCache::Reset(const AABB &bounds, float accuracy)
+{
+	Release();
+	m_root = new Node;
+	m_accuracy = accuracy;
+	if (bounds.Empty())
+	{
+		m_centre = vec3(0.f);
+		m_halfSize = 1.f;
+	}
+	else
+	{
+		vec3 extent = bounds.Extent();
+		m_centre = bounds.Centroid();
+		m_halfSize = std::max(0.5f * std::max(extent.x, std::max(extent.y, extent.z)), 1e-3f);
+	}
+}
+
+// --------------------------------------------------------------------------
+
+void IrradianceCache::Push(std::atomic<Entry*> &list, const IrradianceRecord *record)
+{
+	Entry *entry = new Entry;
+	entry->record = record;
+	entry->next = list.load(memory_order_relaxed);
+	while (!list.compare_exchange_weak(entry->next, entry, memory_order_release,
+	                                   memory_order_relaxed))
+		;
+}
+
+void IrradianceCache::Add(const IrradianceRecord &record)
+{
+	const IrradianceRecord *stored = new IrradianceRecord(record);
+	Push(m_owned, stored);
+	++m_size;
+
+	vec3 offset = abs(record.position - m_centre);
+	if (offset.x > m_halfSize || offset.y > m_halfSize || offset.z > m_halfSize)
+		Push(m_outside, stored);
+	else
+		Insert(m_root, m_centre, m_halfSize, stored, 0);
+}
+
+void IrradianceCache::Insert(Node *node, const vec3 &centre, float halfSize,
+                             const IrradianceRecord *record, int depth)
+{
+	float influence = m_accuracy * record->radius;
+	if (halfSize <= influence || depth == MAX_OCTREE_DEPTH)
+	{
+		Push(node->records, record);
+		return;
+	}
+
+	float quarter = 0.5f * halfSize;
+	for (int i = 0; i < 8; ++i)
+	{
+		vec3 childCentre = centre + quarter * vec3(i & 1 ? 1.f : -1.f, i & 2 ? 1.f : -1.f,
+		                                           i & 4 ? 1.f : -1.f);
+		vec3 gap = max(abs(record->position - childCentre) - vec3(quarter), vec3(0.f));
+		if (dot(gap, gap) > influence * influence)
+			continue;
+
+		// whichever thread makes a missing child first wins; the others
+		// take the one it made
+		Node *child = node->children[i].load(memory_order_acquire);
+		if (!child)
+		{
+			Node *made = new Node;
+			if (node->children[i].compare_exchange_strong(child, made, memory_order_acq_rel))
+				child = made;
+			else
+				delete made;
+		}
+		Insert(child, childCentre, quarter, record, depth + 1);
+	}
+}
+
+// --------------------------------------------------------------------------
+
+namespace
+{
+	// Ward's weight of a record at a point, zero when it doesn't apply
+	float Weight(const IrradianceRecord &record, const vec3 &position, const vec3 &normal,
+	             float accuracy)
+	{
+		vec3 offset = position - record.position;
+		float facing = dot(normal, record.normal);
+		if (facing <= 0.f ||
+		    dot(offset, 0.5f * (normal + record.normal)) < -FRONT_TOLERANCE * record.radius)
+			return 0.f;
+		float error = length(offset) / record.radius + std::sqrt(std::max(1.f - facing, 0.f));
+		return error < accuracy ? 1.f / std::max(error, 1e-6f) : 0.f;
+	}
+}
+
+bool IrradianceCache::Interpolate(const vec3 &position, const vec3 &normal,
+                                  vec3 &irradiance) const
+{
+	vec3 sum(0.f);
+	float weights = 0.f;
+	auto gather = [&](const Entry *entry) {
+		for (; entry; entry = entry->next)
+		{
+			const IrradianceRecord &record = *entry->record;
+			float weight = Weight(record, position, normal, m_accuracy);
+			if (weight <= 0.f) continue;
+			vec3 value = record.irradiance +
+			             cross(record.normal, normal) * record.rotational +
+			             (position - record.position) * record.translational;
+			sum += weight * max(value, vec3(0.f));
+			weights += weight;
+		}
+	};
+
+	gather(m_outside.load(memory_order_acquire));
+	vec3 centre = m_centre;
+	float halfSize = m_halfSize;
+	vec3 offset = abs(position - centre);
+	const Node *node = offset.x <= halfSize && offset.y <= halfSize && offset.z <= halfSize ?
+	                   m_root : nullptr;
+	while (node)
+	{
+		gather(node->records.load(memory_order_acquire));
+		int child = (position.x > centre.x ? 1 : 0) | (position.y > centre.y ? 2 : 0) |
+		            (position.z > centre.z ? 4 : 0);
+		halfSize *= 0.5f;
+		centre += halfSize * vec3(child & 1 ? 1.f : -1.f, child & 2 ? 1.f : -1.f,
+		                          child & 4 ? 1.f : -1.f);
+		node = node->children[child].load(memory_order_acquire);
+	}
+
+	if (weights <= 0.f)
+		return false;
+	irradiance = sum / weights;
+	return true;
+}
+
+// --------------------------------------------------------------------------
@@ -0,0 +1,84 @@
+// ==========================================================================
+// Irradiance Cache
+//  - sparse records of the indirect light arriving at diffuse surfaces,
+//    each sampled once over its hemisphere and then reused by the shading
+//    points around it
+//  - records carry rotational and translational gradients (Ward and
+//    Heckbert 1992), so neighbours extrapolate from them to first order
+//    instead of averaging flat values
+//  - an octree over the records, holding each in the nodes its sphere of
+//    influence overlaps, at the level that sphere fits
+//
+// Render threads look records up and add new ones at once, without locks:
+// octree children and the record lists of nodes are only ever added, by
+// compare-and-swap, and a record is complete before it is linked in, so a
+// lookup sees any record either whole or not at all. Records made by one
+// thread serve the others from then on. Which thread gets to a region
+// first decides where its records lie, so renders on several threads can
+// differ slightly from run to run.
+// ==========================================================================
+#ifndef IRRADIANCECACHE_H
+#define IRRADIANCECACHE_H
+
+#include <atomic>
+#include <glm/glm.hpp>
+#include "Geometry.h"
+
+// --------------------------------------------------------------------------
+
+struct IrradianceRecord
+{
+	glm::vec3 position;
+	glm::vec3 normal;
+	glm::vec3 irradiance;   // mean incoming radiance, cosine weighted
+	float   radius;         // harmonic mean distance to the surroundings
+	glm::mat3 rotational;   // column c: gradient of channel c as the normal turns
+	glm::mat3 translational;    // column c: gradient along the surface
+};
+
+class IrradianceCache
+{
+	struct Entry;
+	struct Node;
+
+	Node               *m_root;
+	glm::vec3           m_centre;       // of the root cube
+	float               m_halfSize;
+	std::atomic<Entry*> m_outside;      // records off the root cube
+	std::atomic<Entry*> m_owned;        // every record, for freeing
+	std::atomic<int>    m_size;
+	float               m_accuracy;
+
+	void Insert(Node *node, const glm::vec3 &centre, float halfSize,
+	            const IrradianceRecord *record, int depth);
+	static void Push(std::atomic<Entry*> &list, const IrradianceRecord *record);
+	static void Free(Node *node);
+	void Release();
+
+	IrradianceCache(const IrradianceCache &);
+	IrradianceCache &operator=(const IrradianceCache &);
+
+public:
+	IrradianceCache();
+	~IrradianceCache();
+
+	// drops every record and makes a root cube around bounds; records are
+	// used where they are at most accuracy times their radius away, or
+	// turned by a like angle. Must not run at the same time as anything else.
+	void Reset(const AABB &bounds, float accuracy);
+
+	// safe alongside other calls but Reset
+	void Add(const IrradianceRecord &record);
+
+	// irradiance at a point, extrapolated from the records near enough;
+	// false when there are none
+	bool Interpolate(const glm::vec3 &position, const glm::vec3 &normal,
+	                 glm::vec3 &irradiance) const;
+
+	int Size() const { return m_size; }
+	float Accuracy() const { return m_accuracy; }
+	float CubeSize() const { return 2.f * m_halfSize; }
+};
+
+// --------------------------------------------------------------------------
+#endif // IRRADIANCECACHE_H
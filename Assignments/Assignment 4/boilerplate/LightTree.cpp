@@ -0,0 +1,173 @@
+// ==========================================================================
+// Light Tree
+//
+// Walking down the tree takes a single random number: after each choice
+// it is rescaled to [0,1) within the part of the interval that was chosen,
+// which keeps a fresh uniform number for the next level. A float carries
+// 24 bits, enough for the dozen or so levels over thousands of lights.
+// ==========================================================================
+
+#include "LightTree.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+using namespace glm;
+
+// --------------------------------------------------------------------------
+
+void LightTree::Clear()
+{
+	m_nodes.clear();
+	m_lights.clear();
+	m_power.clear();
+}
+
+void LightTree::Build(const vector<Light> &lights)
+{
+	Clear();
+	if (lights.empty()) return;
+
+	m_lights.resize(lights.size());
+	for (size_t i = 0; i < lights.size(); ++i)
+		m_lights[i] = int(i);
+	m_nodes.reserve(2 * lights.size());
+	BuildRecursive(lights, 0, int(lights.size()));
+
+	m_power.resize(lights.size());
+	for (size_t i = 0; i < lights.size(); ++i)
+	{
+		const vec3 &colour = lights[m_lights[i]].colour;
+		m_power[i] = std::max(colour.r + colour.g + colour.b, 0.f);
+	}
+}
+
+int LightTree::BuildRecursive(const vector<Light> &lights, int begin, int end)
+{
+	int nodeIndex = int(m_nodes.size());
+	m_nodes.push_back(LightNode());
+
+	AABB bounds;
+	float power = 0.f, falloff = 0.f;
+	for (int i = begin; i < end; ++i)
+	{
+		const Light &light = lights[m_lights[i]];
+		bounds.Extend(light.position);
+		power += std::max(light.colour.r + light.colour.g + light.colour.b, 0.f);
+		falloff = light.falloff > 0.f ? std::max(falloff, light.falloff) : INFINITY;
+	}
+
+	LightNode node;
+	node.lower = bounds.lower;
+	node.upper = bounds.upper;
+	node.power = power;
+	node.falloff = falloff;
+
+	vec3 extent = bounds.Extent();
+	int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+	if (end - begin == 1 || extent[axis] <= 0.f)
+	{
+		node.offset = begin;
+		node.count = end - begin;
+		m_nodes[nodeIndex] = node;
+		return nodeIndex;
+	}
+
+	int middle = (begin + end) / 2;
+	nth_element(m_lights.begin() + begin, m_lights.begin() + middle, m_lights.begin() + end,
+		[&](int a, int b) { return lights[a].position[axis] < lights[b].position[axis]; });
+
+	node.count = 0;
+	BuildRecursive(lights, begin, middle);
+	node.offset = BuildRecursive(lights, middle, end);
+	m_nodes[nodeIndex] = node;
+	return nodeIndex;
+}
+
+// --------------------------------------------------------------------------
+
+float LightTree::Importance(const LightNode &node, const vec3 &position,
+                            const vec3 &normal) const
+{
+	vec3 toCentre = 0.5f * (node.lower + node.upper) - position;
+	float radius = 0.5f * length(node.upper - node.lower);
+	float distance2 = dot(toCentre, toCentre);
+
+	// the node lies within the cone from the point around the direction to
+	// its centre with half angle asin(radius / distance); the cosine with
+	// the normal is at most that at the cone's nearest edge
+	float cosBound = 1.f;
+	if (distance2 > radius * radius)
+	{
+		float distance = sqrt(distance2);
+		float cosTheta = dot(normal, toCentre) / distance;
+		float sinHalf = radius / distance;
+		float cosHalf = sqrt(std::max(1.f - sinHalf * sinHalf, 0.f));
+		if (cosTheta < cosHalf)
+		{
+			float sinTheta = sqrt(std::max(1.f - cosTheta * cosTheta, 0.f));
+			cosBound = cosTheta * cosHalf + sinTheta * sinHalf;
+		}
+		if (cosBound <= 0.f)
+			return 0.f;
+	}
+
+	float attenuation = 1.f;
+	if (node.falloff < INFINITY)
+		attenuation = 1.f / (1.f + std::max(distance2, radius * radius) /
+		                           (node.falloff * node.falloff));
+	return node.power * cosBound * attenuation;
+}
+
+int LightTree::Sample(const vec3 &position, const vec3 &normal, float random,
+                      float &probability) const
+{
+	probability = 0.f;
+	if (m_nodes.empty() || Importance(m_nodes[0], position, normal) <= 0.f)
+		return -1;
+
+	probability = 1.f;
+	int index = 0;
+	while (!m_nodes[index].IsLeaf())
+	{
+		int left = index + 1, right = m_nodes[index].offset;
+		float leftImportance = Importance(m_nodes[left], position, normal);
+		float rightImportance = Importance(m_nodes[right], position, normal);
+		float total = leftImportance + rightImportance;
+		if (total <= 0.f)
+			return -1;
+
+		float pLeft = leftImportance / total;
+		if (random < pLeft)
+		{
+			random = std::min(random / pLeft, 0.99999994f);
+			probability *= pLeft;
+			index = left;
+		}
+		else
+		{
+			random = std::min((random - pLeft) / (1.f - pLeft), 0.99999994f);
+			probability *= 1.f - pLeft;
+			index = right;
+		}
+	}
+
+	// lights sharing a leaf share a position, so power alone tells them apart
+	const LightNode &leaf = m_nodes[index];
+	if (leaf.power <= 0.f)
+		return -1;
+	float target = random * leaf.power;
+	int chosen = -1;
+	for (int i = leaf.offset; i < leaf.offset + leaf.count; ++i)
+	{
+		if (m_power[i] <= 0.f) continue;
+		chosen = i;
+		target -= m_power[i];
+		if (target < 0.f) break;
+	}
+	probability *= m_power[chosen] / leaf.power;
+	return m_lights[chosen];
+}
+
+// --------------------------------------------------------------------------
@@ -0,0 +1,65 @@
+// ==========================================================================
+// Light Tree
+//  - binary hierarchy over a scene's point lights, split at the median of
+//    the longest axis, with the total power and largest falloff distance of
+//    the lights under every node
+//  - picks one light for a shading point by walking down the tree,
+//    choosing each child with probability proportional to an estimate of
+//    how much its lights could add there, so a few shadow rays stand in
+//    for thousands of lights
+//
+// The estimate for a node takes its power, the falloff at the distance of
+// its centre (no nearer than its radius), and a bound on the cosine with
+// the surface normal over a cone around the node. The cosine bound is
+// exact for a single light and never zero while any light under the node
+// is in front of the surface, so every light that can light a point has a
+// chance to be picked and the sampling stays unbiased.
+// ==========================================================================
+#ifndef LIGHTTREE_H
+#define LIGHTTREE_H
+
+#include <vector>
+#include <glm/glm.hpp>
+#include "Scene.h"
+
+// --------------------------------------------------------------------------
+
+struct LightNode
+{
+	glm::vec3 lower;
+	int     offset;     // leaf: first entry in the light array
+	                    // interior: array position of the right child
+	glm::vec3 upper;
+	int     count;      // lights in a leaf, 0 for interior nodes
+	float   power;      // sum of the lights' colour components
+	float   falloff;    // largest falloff distance, infinite if any light has none
+
+	bool IsLeaf() const { return count > 0; }
+};
+
+class LightTree
+{
+	std::vector<LightNode>  m_nodes;
+	std::vector<int>        m_lights;   // scene light indices in leaf order
+	std::vector<float>      m_power;    // power of each entry of m_lights
+
+	int BuildRecursive(const std::vector<Light> &lights, int begin, int end);
+	float Importance(const LightNode &node, const glm::vec3 &position,
+	                 const glm::vec3 &normal) const;
+
+public:
+	// lights at one position share a leaf, which can't be split further
+	void Build(const std::vector<Light> &lights);
+	void Clear();
+
+	bool Empty() const { return m_nodes.empty(); }
+
+	// Picks a light for a surface point from a uniform random number in
+	// [0,1), returning its scene index and the probability it had of being
+	// picked, or -1 when no light is in front of the surface.
+	int Sample(const glm::vec3 &position, const glm::vec3 &normal, float random,
+	           float &probability) const;
+};
+
+// --------------------------------------------------------------------------
+#endif // LIGHTTREE_H
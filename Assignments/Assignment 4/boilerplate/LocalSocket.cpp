@@ -0,0 +1,236 @@
+// ==========================================================================
+// Local Socket
+// ==========================================================================
+
+#include "LocalSocket.h"
+
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#ifndef _WIN32
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+// --------------------------------------------------------------------------
+
+namespace
+{
+	// longest line accepted; a peer sending more is cut off
+	const size_t MAX_LINE = 1 << 16;
+
+#ifndef _WIN32
+	// fills in the address of a socket file, false if the path is too long
+	bool SocketAddress(const string &path, sockaddr_un &address)
+	{
+		memset(&address, 0, sizeof(address));
+		address.sun_family = AF_UNIX;
+		if (path.empty() || path.size() >= sizeof(address.sun_path))
+		{
+			cout << "ERROR: Socket path \"" << path << "\" is empty or too long" << endl;
+			return false;
+		}
+		memcpy(address.sun_path, path.c_str(), path.size());
+		return true;
+	}
+#endif
+}
+
+// --------------------------------------------------------------------------
+
+vector<string> SplitWords(const string &line)
+{
+	// inside quotes, a backslash keeps the character after it
+	vector<string> words;
+	size_t i = 0, size = line.size();
+	for (;;)
+	{
+		while (i < size && isspace((unsigned char)line[i]))
+			++i;
+		if (i == size)
+			return words;
+		string word;
+		if (line[i] == '"')
+		{
+			for (++i; i < size && line[i] != '"'; ++i)
+				word += line[i] == '\\' && i + 1 < size ? line[++i] : line[i];
+			if (i < size)
+				++i;
+		}
+		else
+		{
+			for (; i < size && !isspace((unsigned char)line[i]); ++i)
+				word += line[i];
+		}
+		words.push_back(word);
+	}
+}
+
+string QuoteWord(const string &word)
+{
+	if (!word.empty() && word.find_first_of(" \t\"\\") == string::npos)
+		return word;
+	string quoted = "\"";
+	for (size_t i = 0; i < word.size(); ++i)
+	{
+		if (word[i] == '"' || word[i] == '\\')
+			quoted += '\\';
+		quoted += word[i];
+	}
+	return quoted + '"';
+}
+
+// --------------------------------------------------------------------------
+
+#ifndef _WIN32
+
+bool LocalSocket::Listen(const string &path)
+{
+	Close();
+	sockaddr_un address;
+	if (!SocketAddress(path, address))
+		return false;
+
+	// a socket file nobody answers on is left over from a server that
+	// died, and is in the way of bind
+	LocalSocket probe;
+	if (probe.Connect(path))
+	{
+		cout << "ERROR: A server is already listening on " << path << endl;
+		return false;
+	}
+	unlink(path.c_str());
+
+	m_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (m_fd < 0 ||
+	    bind(m_fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 ||
+	    listen(m_fd, 16) != 0)
+	{
+		cout << "ERROR: Could not listen on " << path << ": " << strerror(errno) << endl;
+		Close();
+		return false;
+	}
+	m_path = path;
+	return true;
+}
+
+bool LocalSocket::Connect(const string &path)
+{
+	Close();
+	sockaddr_un address;
+	if (!SocketAddress(path, address))
+		return false;
+	m_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (m_fd < 0 || connect(m_fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0)
+	{
+		Close();
+		return false;
+	}
+	return true;
+}
+
+bool LocalSocket::Accept(LocalSocket &client, int timeoutMs)
+{
+	pollfd waiting;
+	waiting.fd = m_fd;
+	waiting.events = POLLIN;
+	waiting.revents = 0;
+	if (m_fd < 0 || poll(&waiting, 1, timeoutMs) <= 0)
+		return false;
+	int fd = accept(m_fd, 0, 0);
+	if (fd < 0)
+		return false;
+	client.Close();
+	client.m_fd = fd;
+	return true;
+}
+
+bool LocalSocket::ReadLine(string &line)
+{
+	size_t end;
+	while ((end = m_buffer.find('\n')) == string::npos)
+	{
+		if (m_fd < 0 || m_buffer.size() > MAX_LINE)
+			return false;
+		char chunk[4096];
+		ssize_t read = recv(m_fd, chunk, sizeof(chunk), 0);
+		if (read < 0 && errno == EINTR)
+			continue;
+		if (read <= 0)
+			return false;
+		m_buffer.append(chunk, size_t(read));
+	}
+	line.assign(m_buffer, 0, end);
+	m_buffer.erase(0, end + 1);
+	if (!line.empty() && line[line.size() - 1] == '\r')
+		line.resize(line.size() - 1);
+	return true;
+}
+
+bool LocalSocket::WriteLine(const string &text)
+{
+	lock_guard<mutex> guard(m_writeLock);
+	string message = text + '\n';
+	const char *data = message.data();
+	size_t left = message.size();
+	while (left > 0 && m_fd >= 0)
+	{
+		ssize_t sent = send(m_fd, data, left, 0);
+		if (sent < 0 && errno == EINTR)
+			continue;
+		if (sent <= 0)
+			return false;
+		data += sent;
+		left -= size_t(sent);
+	}
+	return left == 0;
+}
+
+void LocalSocket::Shutdown()
+{
+	lock_guard<mutex> guard(m_writeLock);
+	if (m_fd >= 0)
+		shutdown(m_fd, SHUT_RDWR);
+}
+
+void LocalSocket::Close()
+{
+	lock_guard<mutex> guard(m_writeLock);
+	if (m_fd >= 0)
+		close(m_fd);
+	if (!m_path.empty())
+		unlink(m_path.c_str());
+	m_fd = -1;
+	m_path.clear();
+	m_buffer.clear();
+}
+
+#else
+
+bool LocalSocket::Listen(const string &)
+{
+	cout << "ERROR: Local sockets are not supported on this platform" << endl;
+	return false;
+}
+
+bool LocalSocket::Connect(const string &)
+{
+	cout << "ERROR: Local sockets are not supported on this platform" << endl;
+	return false;
+}
+
+bool LocalSocket::Accept(LocalSocket &, int)  { return false; }
+bool LocalSocket::ReadLine(string &)          { return false; }
+bool LocalSocket::WriteLine(const string &)   { return false; }
+void LocalSocket::Shutdown()                  {}
+void LocalSocket::Close()                     { m_fd = -1; }
+
+#endif
+
+// --------------------------------------------------------------------------
@@ -0,0 +1,60 @@
+// ==========================================================================
+// Local Socket
+//  - a stream socket bound to a path on this machine (a Unix domain
+//    socket), for talking to a render server running alongside
+//  - messages are lines of text, read and written whole, of words split at
+//    spaces; words holding spaces or quotes go in double quotes
+//  - not available on Windows, where opening one fails with an error
+// ==========================================================================
+#ifndef LOCALSOCKET_H
+#define LOCALSOCKET_H
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+// --------------------------------------------------------------------------
+
+class LocalSocket
+{
+	int         m_fd;
+	std::string m_path;         // file bound by Listen, removed on Close
+	std::string m_buffer;       // read but not yet returned by ReadLine
+	std::mutex  m_writeLock;    // also keeps m_fd from closing mid-write
+
+	LocalSocket(const LocalSocket &);
+	LocalSocket &operator=(const LocalSocket &);
+
+public:
+	LocalSocket() : m_fd(-1) {}
+	~LocalSocket() { Close(); }
+
+	// listens for connections on path; a socket file left behind by a
+	// server that is no longer running is replaced, a live one is not
+	bool Listen(const std::string &path);
+	bool Connect(const std::string &path);
+
+	// waits up to timeoutMs for a connection and opens client on it;
+	// returns false on timeout or error
+	bool Accept(LocalSocket &client, int timeoutMs);
+
+	// next line, without its newline; false once the other end has closed
+	// the connection or Shutdown was called
+	bool ReadLine(std::string &line);
+	// sends text and a newline; safe to call from several threads at once
+	bool WriteLine(const std::string &text);
+
+	// ends the connection both ways, waking a thread blocked in ReadLine,
+	// but keeps the socket open until Close
+	void Shutdown();
+	void Close();
+	bool IsOpen() const { return m_fd >= 0; }
+};
+
+// words of a line, unquoted
+std::vector<std::string> SplitWords(const std::string &line);
+// word as written in a line, quoted if it must be
+std::string QuoteWord(const std::string &word);
+
+// --------------------------------------------------------------------------
+#endif // LOCALSOCKET_H
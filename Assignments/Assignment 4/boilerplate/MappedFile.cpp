@@ -0,0 +1,73 @@
+// ==========================================================================
+// Read-Only File Mapping
+// ==========================================================================
+
+#include "MappedFile.h"
+
+#include <cstdio>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+// --------------------------------------------------------------------------
+
+bool MappedFile::Open(const string &fileName)
+{
+	Close();
+#ifndef _WIN32
+	int fd = open(fileName.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat info;
+	bool ok = fstat(fd, &info) == 0;
+	m_size = ok ? size_t(info.st_size) : 0;
+	if (ok && m_size > 0)
+	{
+		void *data = mmap(0, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		ok = data != MAP_FAILED;
+		if (ok)
+		{
+			madvise(data, m_size, MADV_SEQUENTIAL);
+			m_data = static_cast<const char *>(data);
+			m_mapped = true;
+		}
+	}
+	close(fd);
+	if (!ok)
+		m_size = 0;
+	return ok;
+#else
+	FILE *file = fopen(fileName.c_str(), "rb");
+	if (!file)
+		return false;
+	char buffer[1 << 16];
+	size_t read;
+	while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0)
+		m_copy.insert(m_copy.end(), buffer, buffer + read);
+	bool ok = !ferror(file);
+	fclose(file);
+	m_data = m_copy.data();
+	m_size = m_copy.size();
+	return ok;
+#endif
+}
+
+void MappedFile::Close()
+{
+#ifndef _WIN32
+	if (m_mapped)
+		munmap(const_cast<char *>(m_data), m_size);
+#endif
+	m_data = 0;
+	m_size = 0;
+	m_mapped = false;
+	vector<char>().swap(m_copy);
+}
+
+// --------------------------------------------------------------------------
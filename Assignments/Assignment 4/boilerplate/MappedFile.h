@@ -0,0 +1,39 @@
+// ==========================================================================
+// Read-Only File Mapping
+//  - maps a whole file into memory for reading, so large files are paged
+//    in as they are read rather than copied up front
+//  - falls back to reading the file into memory where mmap isn't available
+// ==========================================================================
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <string>
+#include <vector>
+
+// --------------------------------------------------------------------------
+
+class MappedFile
+{
+	const char         *m_data;
+	size_t              m_size;
+	bool                m_mapped;
+	std::vector<char>   m_copy;
+
+	MappedFile(const MappedFile &);
+	MappedFile &operator=(const MappedFile &);
+
+public:
+	MappedFile() : m_data(0), m_size(0), m_mapped(false) {}
+	~MappedFile() { Close(); }
+
+	// maps fileName, closing any file mapped before; an empty file opens
+	// with no data
+	bool Open(const std::string &fileName);
+	void Close();
+
+	const char *Data() const { return m_data; }
+	size_t Size() const { return m_size; }
+};
+
+// --------------------------------------------------------------------------
+#endif // MAPPEDFILE_H
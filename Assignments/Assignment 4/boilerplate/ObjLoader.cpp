@@ -0,0 +1,468 @@
+// ==========================================================================
+// Wavefront OBJ Import
+// ==========================================================================
+
+#include "ObjLoader.h"
+#include "MappedFile.h"
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace glm;
+
+namespace
+{
+	// chunks are at least this large, so small files parse on one thread
+	const size_t MIN_CHUNK_BYTES = 1 << 20;
+	const int CHUNKS_PER_THREAD = 4;
+
+	// ----------------------------------------------------------------------
+	// Number scanning; strtof and friends check the locale and handle forms
+	// OBJ files never use, and dominate the load time
+
+	inline bool IsBlank(char c)
+	{
+		return c == ' ' || c == '\t' || c == '\r';
+	}
+
+	inline bool IsDigit(char c)
+	{
+		return unsigned(c - '0') < 10u;
+	}
+
+	inline void SkipBlanks(const char *&p, const char *end)
+	{
+		while (p < end && IsBlank(*p))
+			++p;
+	}
+
+	double PowerOfTen(int exponent)
+	{
+		static const double table[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7,
+		                                1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+		                                1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+		int magnitude = std::abs(exponent);
+		double power = magnitude <= 22 ? table[magnitude] : pow(10.0, double(magnitude));
+		return exponent < 0 ? 1.0 / power : power;
+	}
+
+	// reads [sign] digits [. digits] [e [sign] digits]; the first 19
+	// significant digits are kept, which is far more than a float holds
+	bool ScanFloat(const char *&p, const char *end, float &value)
+	{
+		bool negative = false;
+		if (p < end && (*p == '-' || *p == '+'))
+			negative = *p++ == '-';
+
+		uint64_t mantissa = 0;
+		int digits = 0, exponent = 0;
+		bool any = false;
+		for (; p < end && IsDigit(*p); ++p, any = true)
+		{
+			if (digits < 19)
+			{
+				mantissa = mantissa * 10 + unsigned(*p - '0');
+				digits += mantissa != 0;
+			}
+			else
+				++exponent;
+		}
+		if (p < end && *p == '.')
+			for (++p; p < end && IsDigit(*p); ++p, any = true)
+				if (digits < 19)
+				{
+					mantissa = mantissa * 10 + unsigned(*p - '0');
+					digits += mantissa != 0;
+					--exponent;
+				}
+		if (!any)
+			return false;
+
+		if (p < end && (*p == 'e' || *p == 'E'))
+		{
+			++p;
+			bool negativeExponent = false;
+			if (p < end && (*p == '-' || *p == '+'))
+				negativeExponent = *p++ == '-';
+			if (p == end || !IsDigit(*p))
+				return false;
+			int written = 0;
+			for (; p < end && IsDigit(*p); ++p)
+				written = std::min(written * 10 + (*p - '0'), 10000);
+			exponent += negativeExponent ? -written : written;
+		}
+
+		double magnitude = mantissa == 0 ? 0.0 : double(mantissa) * PowerOfTen(exponent);
+		value = float(negative ? -magnitude : magnitude);
+		return true;
+	}
+
+	// vertex numbers past the range of an int fail, which suits meshes
+	// whose triangles hold unsigned vertex numbers
+	bool ScanInt(const char *&p, const char *end, int &value)
+	{
+		bool negative = false;
+		if (p < end && (*p == '-' || *p == '+'))
+			negative = *p++ == '-';
+		if (p == end || !IsDigit(*p))
+			return false;
+		long long magnitude = 0;
+		for (; p < end && IsDigit(*p); ++p)
+			if ((magnitude = magnitude * 10 + (*p - '0')) > INT_MAX)
+				return false;
+		value = int(negative ? -magnitude : magnitude);
+		return true;
+	}
+
+	// ----------------------------------------------------------------------
+	// Parsing, chunk by chunk
+
+	struct ObjChunk
+	{
+		const char         *begin;
+		const char         *end;
+
+		vector<vec3>        positions;
+		// three corners per triangle: vertex numbers counted from zero
+		// across the file, or, for the corners listed in relative, counted
+		// from the first vertex of this chunk
+		vector<int>         corners;
+		vector<uint32_t>    relative;
+
+		size_t              lines;
+		size_t              errorLine;  // zero when the chunk parsed cleanly
+		const char         *error;
+	};
+
+	bool ParseFace(const char *p, const char *end, ObjChunk &chunk)
+	{
+		int first = 0, previous = 0;
+		bool firstRelative = false, previousRelative = false;
+		int count = 0;
+		for (;;)
+		{
+			SkipBlanks(p, end);
+			if (p == end)
+				break;
+
+			int index;
+			if (!ScanInt(p, end, index) || index == 0)
+				return false;
+			// texture and normal indices ride along as /vt/vn
+			while (p < end && !IsBlank(*p))
+				++p;
+
+			bool relative = index < 0;
+			int corner = relative ? int(chunk.positions.size()) + index : index - 1;
+			if (count >= 2)
+			{
+				uint32_t at = uint32_t(chunk.corners.size());
+				chunk.corners.push_back(first);
+				chunk.corners.push_back(previous);
+				chunk.corners.push_back(corner);
+				if (firstRelative)    chunk.relative.push_back(at);
+				if (previousRelative) chunk.relative.push_back(at + 1);
+				if (relative)         chunk.relative.push_back(at + 2);
+			}
+			if (count == 0)
+			{
+				first = corner;
+				firstRelative = relative;
+			}
+			previous = corner;
+			previousRelative = relative;
+			++count;
+		}
+		return count >= 3;
+	}
+
+	void ParseChunk(ObjChunk &chunk)
+	{
+		const char *p = chunk.begin;
+		while (p < chunk.end)
+		{
+			const char *lineEnd = static_cast<const char *>(memchr(p, '\n', chunk.end - p));
+			if (!lineEnd)
+				lineEnd = chunk.end;
+			++chunk.lines;
+
+			SkipBlanks(p, lineEnd);
+			bool ok = true;
+			if (lineEnd - p >= 2 && p[0] == 'v' && IsBlank(p[1]))
+			{
+				p += 2;
+				vec3 position;
+				for (int i = 0; i < 3 && ok; ++i)
+				{
+					SkipBlanks(p, lineEnd);
+					ok = ScanFloat(p, lineEnd, position[i]);
+				}
+				if (ok)
+					chunk.positions.push_back(position);
+				else
+					chunk.error = "expected three coordinates";
+			}
+			else if (lineEnd - p >= 2 && p[0] == 'f' && IsBlank(p[1]))
+			{
+				ok = ParseFace(p + 2, lineEnd, chunk);
+				if (!ok)
+					chunk.error = "expected three or more vertex numbers";
+			}
+
+			if (!ok)
+			{
+				chunk.errorLine = chunk.lines;
+				return;
+			}
+			p = lineEnd + 1;
+		}
+	}
+
+	// ----------------------------------------------------------------------
+
+	// runs work(0) ... work(count - 1), the calling thread taking part
+	void RunParallel(int count, const function<void(int)> &work)
+	{
+		vector<thread> workers;
+		for (int i = 1; i < count; ++i)
+			workers.push_back(thread(work, i));
+		work(0);
+		for (size_t i = 0; i < workers.size(); ++i)
+			workers[i].join();
+	}
+
+	inline uint32_t PositionHash(const vec3 &position)
+	{
+		uint32_t bits[3];
+		memcpy(bits, &position, sizeof(bits));
+		uint32_t hash = bits[0] * 0x9e3779b1u;
+		hash = (hash ^ (hash >> 15) ^ bits[1]) * 0x85ebca77u;
+		hash = (hash ^ (hash >> 13) ^ bits[2]) * 0xc2b2ae3du;
+		return hash ^ (hash >> 16);
+	}
+
+	// points every vertex at the first one at its position, keeping one
+	// of each in order; returns the new number of every old vertex
+	vector<unsigned> WeldVertices(vector<vec3> &vertices, int threadCount)
+	{
+		size_t count = vertices.size();
+		vector<unsigned> remap(count);
+
+		// +0 and -0 are one position; adding zero turns -0 into +0
+		vector<uint32_t> hashes(count);
+		RunParallel(threadCount, [&](int t) {
+			for (size_t i = count * t / threadCount; i < count * (t + 1) / threadCount; ++i)
+			{
+				vertices[i] += vec3(0.f);
+				hashes[i] = PositionHash(vertices[i]);
+			}
+		});
+
+		// thread t owns the positions whose hash is t modulo the thread
+		// count, with an open addressing table of its own; scanning in
+		// order finds the first vertex at every position
+		RunParallel(threadCount, [&](int t) {
+			size_t owned = count / threadCount + 1;
+			size_t capacity = 16;
+			while (capacity < 2 * owned)
+				capacity *= 2;
+			vector<unsigned> table(capacity, ~0u);
+			for (size_t i = 0; i < count; ++i)
+			{
+				uint32_t hash = hashes[i];
+				if (int(hash % unsigned(threadCount)) != t)
+					continue;
+				size_t slot = (hash / unsigned(threadCount)) & (capacity - 1);
+				for (;; slot = (slot + 1) & (capacity - 1))
+				{
+					unsigned found = table[slot];
+					if (found == ~0u)
+					{
+						table[slot] = unsigned(i);
+						remap[i] = unsigned(i);
+						break;
+					}
+					if (hashes[found] == hash && vertices[found] == vertices[i])
+					{
+						remap[i] = found;
+						break;
+					}
+				}
+			}
+		});
+
+		// first occurrences come before their copies, so one pass in order
+		// numbers the kept vertices and moves them down into place
+		unsigned kept = 0;
+		for (size_t i = 0; i < count; ++i)
+		{
+			if (remap[i] == i)
+			{
+				vertices[kept] = vertices[i];
+				remap[i] = kept++;
+			}
+			else
+				remap[i] = remap[remap[i]];
+		}
+		vertices.resize(kept);
+		vertices.shrink_to_fit();
+		return remap;
+	}
+}
+
+// --------------------------------------------------------------------------
+
+bool LoadObj(const string &fileName, Mesh &mesh, int material, int threadCount)
+{
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	mesh.vertices.clear();
+	mesh.triangles.clear();
+
+	MappedFile file;
+	if (!file.Open(fileName))
+	{
+		cout << "OBJ ERROR: Could not read " << fileName << endl;
+		return false;
+	}
+
+	if (threadCount <= 0)
+		threadCount = std::max(int(thread::hardware_concurrency()), 1);
+
+	// cut the file into chunks, each ending just after a line break
+	size_t size = file.Size();
+	const char *data = file.Data();
+	size_t chunkCount = std::max<size_t>(std::min<size_t>(
+		size / MIN_CHUNK_BYTES, size_t(threadCount) * CHUNKS_PER_THREAD), 1);
+	vector<ObjChunk> chunks;
+	const char *begin = data;
+	for (size_t i = 1; i <= chunkCount && begin < data + size; ++i)
+	{
+		const char *end = data + size * i / chunkCount;
+		if (end < begin)
+			end = begin;
+		const char *lineEnd = i == chunkCount ? 0 :
+			static_cast<const char *>(memchr(end, '\n', data + size - end));
+		end = lineEnd ? lineEnd + 1 : data + size;
+
+		ObjChunk chunk;
+		chunk.begin = begin;
+		chunk.end = end;
+		chunk.lines = 0;
+		chunk.errorLine = 0;
+		chunk.error = 0;
+		chunks.push_back(chunk);
+		begin = end;
+	}
+
+	threadCount = std::min(threadCount, std::max(int(chunks.size()), 1));
+	RunParallel(threadCount, [&](int t) {
+		for (size_t i = t; i < chunks.size(); i += threadCount)
+			ParseChunk(chunks[i]);
+	});
+
+	// vertex and triangle numbers where each chunk's own begin
+	vector<size_t> firstVertex(chunks.size() + 1, 0), firstTriangle(chunks.size() + 1, 0);
+	size_t line = 0;
+	for (size_t i = 0; i < chunks.size(); ++i)
+	{
+		if (chunks[i].errorLine)
+		{
+			cout << "OBJ ERROR (" << fileName << ", line " << line + chunks[i].errorLine
+			     << "): " << chunks[i].error << endl;
+			return false;
+		}
+		line += chunks[i].lines;
+		firstVertex[i + 1] = firstVertex[i] + chunks[i].positions.size();
+		firstTriangle[i + 1] = firstTriangle[i] + chunks[i].corners.size() / 3;
+	}
+	size_t vertexCount = firstVertex.back();
+	size_t triangleCount = firstTriangle.back();
+	if (vertexCount >= size_t(~0u))
+	{
+		cout << "OBJ ERROR: " << fileName << " has too many vertices" << endl;
+		return false;
+	}
+
+	// gather the chunks into the mesh, freeing each once it is copied
+	mesh.vertices.resize(vertexCount);
+	mesh.triangles.resize(triangleCount);
+	vector<char> outOfRange(chunks.size(), 0);
+	RunParallel(threadCount, [&](int t) {
+		for (size_t i = t; i < chunks.size(); i += threadCount)
+		{
+			ObjChunk &chunk = chunks[i];
+			copy(chunk.positions.begin(), chunk.positions.end(),
+			     mesh.vertices.begin() + firstVertex[i]);
+			vector<vec3>().swap(chunk.positions);
+
+			// relative lists its corners in order
+			size_t nextRelative = 0;
+			Triangle *triangle = &mesh.triangles[firstTriangle[i]];
+			for (size_t j = 0; j < chunk.corners.size(); j += 3, ++triangle)
+			{
+				for (int k = 0; k < 3; ++k)
+				{
+					int64_t corner = chunk.corners[j + k];
+					if (nextRelative < chunk.relative.size() && chunk.relative[nextRelative] == j + k)
+					{
+						corner += int64_t(firstVertex[i]);
+						++nextRelative;
+					}
+					if (corner < 0 || corner >= int64_t(vertexCount))
+						outOfRange[i] = 1;
+					triangle->v[k] = unsigned(corner);
+				}
+				triangle->material = material;
+			}
+			vector<int>().swap(chunk.corners);
+			vector<uint32_t>().swap(chunk.relative);
+		}
+	});
+	if (find(outOfRange.begin(), outOfRange.end(), 1) != outOfRange.end())
+	{
+		cout << "OBJ ERROR: " << fileName << " has faces using missing vertices" << endl;
+		mesh.vertices.clear();
+		mesh.triangles.clear();
+		return false;
+	}
+
+	// weld, then drop the triangles that lost their area to it
+	vector<unsigned> remap = WeldVertices(mesh.vertices, threadCount);
+	RunParallel(threadCount, [&](int t) {
+		for (size_t i = triangleCount * t / threadCount; i < triangleCount * (t + 1) / threadCount; ++i)
+			for (int k = 0; k < 3; ++k)
+				mesh.triangles[i].v[k] = remap[mesh.triangles[i].v[k]];
+	});
+	vector<unsigned>().swap(remap);
+
+	size_t kept = 0;
+	for (size_t i = 0; i < triangleCount; ++i)
+	{
+		const Triangle &triangle = mesh.triangles[i];
+		if (triangle.v[0] != triangle.v[1] && triangle.v[1] != triangle.v[2] &&
+		    triangle.v[2] != triangle.v[0])
+			mesh.triangles[kept++] = triangle;
+	}
+	mesh.triangles.resize(kept);
+	mesh.triangles.shrink_to_fit();
+
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	size_t bytes = mesh.vertices.size() * sizeof(vec3) + mesh.triangles.size() * sizeof(Triangle);
+	cout << "OBJ loaded " << fileName << ": " << mesh.triangles.size() << " triangles, "
+	     << mesh.vertices.size() << " vertices (" << vertexCount - mesh.vertices.size()
+	     << " welded, " << triangleCount - kept << " degenerate triangles dropped) in "
+	     << seconds << " s, " << (kept ? double(bytes) / kept : 0.0) << " bytes per triangle"
+	     << endl;
+	return true;
+}
+
+// --------------------------------------------------------------------------
@@ -0,0 +1,34 @@
+// ==========================================================================
+// Wavefront OBJ Import
+//  - reads the triangles of an OBJ file into a Mesh, the indexed triangle
+//    store the BVH builder takes as it is
+//  - the file is mapped into memory and cut at line breaks into chunks
+//    that threads parse at once, with a hand-written number scanner
+//  - corners at identical positions are welded into one vertex, and the
+//    triangles this leaves with repeated corners are dropped
+//
+// Polygons are split into fans around their first corner. Texture
+// coordinates, normals, groups, smoothing and materials are skipped; every
+// triangle gets the material passed in.
+//
+// Memory: the mesh keeps 12 bytes per vertex and 16 per triangle, 22 bytes
+// per triangle for a closed mesh, which has about half as many vertices as
+// triangles. Loading takes the most while the parsed chunks are gathered
+// into the mesh; the mapped file's pages the system can drop at will.
+// ==========================================================================
+#ifndef OBJLOADER_H
+#define OBJLOADER_H
+
+#include <string>
+#include "Scene.h"
+
+// --------------------------------------------------------------------------
+
+// replaces the mesh's vertices and triangles with those of the file, on
+// threadCount threads (every hardware thread for zero or less); on failure
+// an error is printed and the mesh is left empty
+bool LoadObj(const std::string &fileName, Mesh &mesh, int material = 0,
+             int threadCount = 0);
+
+// --------------------------------------------------------------------------
+#endif // OBJLOADER_H
@@ -0,0 +1,307 @@
+// ==========================================================================
+// Ray Packets
+//
+// Packet traversal of the binary BVH. Each packet is processed as one or
+// two SIMD-wide chunks of rays; a node is entered when any ray of the
+// packet enters its box, and children are visited in order of the nearest
+// entry distance over the packet. At an instance the whole packet moves
+// into the mesh's frame and walks the mesh BVH the same way.
+//
+// Lanes hold 32 bits, fewer than scene-wide primitive ids take, so a lane
+// keeps the id of a hit outside any instance, or else the triangle's index
+// in its mesh together with the instance, and the scene-wide id is only
+// made up once the packet is done.
+// ==========================================================================
+
+#include "Accelerator.h"
+
+using namespace std;
+using namespace glm;
+
+// --------------------------------------------------------------------------
+
+namespace
+{
+	const float DETERMINANT_EPSILON = 1e-12f;
+
+	// the rays of one SIMD chunk with their current closest hits
+	template <class F>
+	struct RayChunk
+	{
+		F   ox, oy, oz;
+		F   dx, dy, dz;
+		F   idx, idy, idz;      // reciprocal direction for box tests
+		F   tMin, tMax;
+		F   primitive;          // hit primitive ids, carried as raw bits
+		F   instance;           // instance of each hit, or -1, as raw bits
+		F   u, v;
+	};
+
+	template <class F, int N>
+	void LoadChunk(const RayPacket<N> &packet, int offset, RayChunk<F> &c)
+	{
+		c.ox = F::Load(packet.ox + offset);
+		c.oy = F::Load(packet.oy + offset);
+		c.oz = F::Load(packet.oz + offset);
+		c.dx = F::Load(packet.dx + offset);
+		c.dy = F::Load(packet.dy + offset);
+		c.dz = F::Load(packet.dz + offset);
+		c.idx = F(1.f) / c.dx;
+		c.idy = F(1.f) / c.dy;
+		c.idz = F(1.f) / c.dz;
+		c.tMin = F::Load(packet.tMin + offset);
+		c.tMax = F::Load(packet.tMax + offset);
+		c.primitive = F::FromBits(-1);
+		c.instance = F::FromBits(-1);
+		c.u = F(0.f);
+		c.v = F(0.f);
+	}
+
+	// returns the mask of rays entering the box, and their entry distances
+	template <class F>
+	F IntersectBox(const RayChunk<F> &c, const BVHNode &node, F &tEntry)
+	{
+		F tx0 = (F(node.lower.x) - c.ox) * c.idx, tx1 = (F(node.upper.x) - c.ox) * c.idx;
+		F ty0 = (F(node.lower.y) - c.oy) * c.idy, ty1 = (F(node.upper.y) - c.oy) * c.idy;
+		F tz0 = (F(node.lower.z) - c.oz) * c.idz, tz1 = (F(node.upper.z) - c.oz) * c.idz;
+		F tNear = Max(Max(Min(tx0, tx1), Min(ty0, ty1)), Max(Min(tz0, tz1), c.tMin));
+		F tFar = Min(Min(Max(tx0, tx1), Max(ty0, ty1)), Min(Max(tz0, tz1), c.tMax));
+		tEntry = tNear;
+		return tNear <= tFar;
+	}
+
+	// moves the rays of a chunk by an affine transform, summing in the order
+	// glm does for the single ray version
+	template <class F>
+	void TransformChunk(RayChunk<F> &c, const mat4 &m)
+	{
+		F ox = c.ox, oy = c.oy, oz = c.oz;
+		c.ox = (F(m[0][0]) * ox + F(m[1][0]) * oy) + (F(m[2][0]) * oz + F(m[3][0]));
+		c.oy = (F(m[0][1]) * ox + F(m[1][1]) * oy) + (F(m[2][1]) * oz + F(m[3][1]));
+		c.oz = (F(m[0][2]) * ox + F(m[1][2]) * oy) + (F(m[2][2]) * oz + F(m[3][2]));
+
+		F dx = c.dx, dy = c.dy, dz = c.dz;
+		c.dx = F(m[0][0]) * dx + F(m[1][0]) * dy + F(m[2][0]) * dz;
+		c.dy = F(m[0][1]) * dx + F(m[1][1]) * dy + F(m[2][1]) * dz;
+		c.dz = F(m[0][2]) * dx + F(m[1][2]) * dy + F(m[2][2]) * dz;
+		c.idx = F(1.f) / c.dx;
+		c.idy = F(1.f) / c.dy;
+		c.idz = F(1.f) / c.dz;
+	}
+
+	// Moller-Trumbore against one triangle broadcast across the lanes; the
+	// triangles of a mesh are hit in the given instance, those of the scene
+	// in none, -1
+	template <class F>
+	void IntersectTriangles(RayChunk<F> &c, const PackedPrimitives &p, int i, int instance)
+	{
+		F e1x(p.e1x[i]), e1y(p.e1y[i]), e1z(p.e1z[i]);
+		F e2x(p.e2x[i]), e2y(p.e2y[i]), e2z(p.e2z[i]);
+
+		F px = c.dy * e2z - c.dz * e2y;
+		F py = c.dz * e2x - c.dx * e2z;
+		F pz = c.dx * e2y - c.dy * e2x;
+		F det = e1x * px + e1y * py + e1z * pz;
+		F invDet = F(1.f) / det;
+
+		F tx = c.ox - F(p.x0[i]), ty = c.oy - F(p.y0[i]), tz = c.oz - F(p.z0[i]);
+		F u = (tx * px + ty * py + tz * pz) * invDet;
+
+		F qx = ty * e1z - tz * e1y;
+		F qy = tz * e1x - tx * e1z;
+		F qz = tx * e1y - ty * e1x;
+		F v = (c.dx * qx + c.dy * qy + c.dz * qz) * invDet;
+		F t = (e2x * qx + e2y * qy + e2z * qz) * invDet;
+
+		F zero(0.f);
+		F mask = (Abs(det) >= F(DETERMINANT_EPSILON)) & (u >= zero) & (v >= zero) &
+		         (u + v <= F(1.f)) & (t > c.tMin) & (t < c.tMax);
+		if (None(mask)) return;
+
+		c.tMax = Select(mask, t, c.tMax);
+		c.u = Select(mask, u, c.u);
+		c.v = Select(mask, v, c.v);
+		c.primitive = Select(mask, F::FromBits(p.id[i]), c.primitive);
+		c.instance = Select(mask, F::FromBits(instance), c.instance);
+	}
+
+	template <class F>
+	void IntersectSpheres(RayChunk<F> &c, const PackedPrimitives &p, int i)
+	{
+		F r(p.e1x[i]);
+		F ocx = c.ox - F(p.x0[i]), ocy = c.oy - F(p.y0[i]), ocz = c.oz - F(p.z0[i]);
+		F a = c.dx * c.dx + c.dy * c.dy + c.dz * c.dz;
+		F b = ocx * c.dx + ocy * c.dy + ocz * c.dz;
+		F cc = ocx * ocx + ocy * ocy + ocz * ocz - r * r;
+		F discriminant = b * b - a * cc;
+		F root = Sqrt(Max(discriminant, F(0.f)));
+		F t0 = (-b - root) / a;
+		F t1 = (-b + root) / a;
+		F t = Select(t0 > c.tMin, t0, t1);
+
+		F mask = (discriminant >= F(0.f)) & (t > c.tMin) & (t < c.tMax);
+		if (None(mask)) return;
+
+		c.tMax = Select(mask, t, c.tMax);
+		c.u = Select(mask, F(0.f), c.u);
+		c.v = Select(mask, F(0.f), c.v);
+		c.primitive = Select(mask, F::FromBits(p.id[i]), c.primitive);
+		c.instance = Select(mask, F::FromBits(-1), c.instance);
+	}
+
+	template <class F>
+	void IntersectPlanes(RayChunk<F> &c, const Plane &plane, int id)
+	{
+		F nx(plane.normal.x), ny(plane.normal.y), nz(plane.normal.z);
+		F denominator = nx * c.dx + ny * c.dy + nz * c.dz;
+		F t = ((F(plane.point.x) - c.ox) * nx + (F(plane.point.y) - c.oy) * ny +
+		       (F(plane.point.z) - c.oz) * nz) / denominator;
+
+		F mask = (Abs(denominator) >= F(DETERMINANT_EPSILON)) & (t > c.tMin) & (t < c.tMax);
+		if (None(mask)) return;
+
+		c.tMax = Select(mask, t, c.tMax);
+		c.u = Select(mask, F(0.f), c.u);
+		c.v = Select(mask, F(0.f), c.v);
+		c.primitive = Select(mask, F::FromBits(id), c.primitive);
+		c.instance = Select(mask, F::FromBits(-1), c.instance);
+	}
+
+	// Walks a BVH with every chunk of a packet. Leaves hold the primitives
+	// of packed, whose triangles are hit in the given instance, -1 for the
+	// scene BVH; instances, found only in the scene BVH, take the chunks
+	// down their mesh's BVH.
+	template <class F, int CHUNKS>
+	void TraversePacket(RayChunk<F> *chunks, const BVH &bvh, const PackedPrimitives &packed,
+	                    int instanceIndex, const Scene &scene,
+	                    const vector<MeshHierarchy> &meshes)
+	{
+		const vector<BVHNode> &nodes = bvh.Nodes();
+		int stack[BVH::MAX_DEPTH];
+		int top = 0;
+		for (int c = 0; c < CHUNKS && top == 0 && !nodes.empty(); ++c)
+		{
+			F tEntry;
+			if (Any(IntersectBox(chunks[c], nodes[0], tEntry)))
+				stack[top++] = 0;
+		}
+
+		while (top > 0)
+		{
+			int index = stack[--top];
+			const BVHNode &node = nodes[index];
+			if (node.IsLeaf())
+			{
+				for (int i = node.offset; i < node.offset + node.count; ++i)
+				{
+					if (packed.kind[i] == PACKED_INSTANCE)
+					{
+						// only the hit records carry over, the rays go back
+						// to the scene's frame afterwards
+						const Instance &instance = scene.instances[packed.id[i]];
+						const MeshHierarchy &level = meshes[instance.mesh];
+						RayChunk<F> world[CHUNKS];
+						for (int c = 0; c < CHUNKS; ++c)
+						{
+							world[c] = chunks[c];
+							TransformChunk(chunks[c], instance.toObject);
+						}
+						TraversePacket<F, CHUNKS>(chunks, level.bvh, level.packed, packed.id[i],
+						                          scene, meshes);
+						for (int c = 0; c < CHUNKS; ++c)
+						{
+							RayChunk<F> &r = chunks[c];
+							r.ox = world[c].ox;     r.oy = world[c].oy;     r.oz = world[c].oz;
+							r.dx = world[c].dx;     r.dy = world[c].dy;     r.dz = world[c].dz;
+							r.idx = world[c].idx;   r.idy = world[c].idy;   r.idz = world[c].idz;
+						}
+						continue;
+					}
+
+					for (int c = 0; c < CHUNKS; ++c)
+					{
+						if (packed.kind[i] == PACKED_SPHERE)
+							IntersectSpheres(chunks[c], packed, i);
+						else
+							IntersectTriangles(chunks[c], packed, i, instanceIndex);
+					}
+				}
+				continue;
+			}
+
+			// a child is visited if any ray enters it; the nearer one, judged
+			// by the first entry over the packet, is pushed last so it pops
+			// first
+			int near = index + 1, far = node.offset;
+			float tNear = INFINITY, tFar = INFINITY;
+			for (int c = 0; c < CHUNKS; ++c)
+			{
+				F entry;
+				F mask = IntersectBox(chunks[c], nodes[near], entry);
+				tNear = std::min(tNear, ReduceMin(mask, entry));
+				mask = IntersectBox(chunks[c], nodes[far], entry);
+				tFar = std::min(tFar, ReduceMin(mask, entry));
+			}
+			if (tFar < tNear)
+			{
+				std::swap(near, far);
+				std::swap(tNear, tFar);
+			}
+			if (tFar < INFINITY) stack[top++] = far;
+			if (tNear < INFINITY) stack[top++] = near;
+		}
+	}
+}
+
+// --------------------------------------------------------------------------
+
+template <int N>
+void Accelerator::IntersectPacket(const RayPacket<N> &packet, Hit *hits) const
+{
+	typedef typename PacketTraits<N>::Float F;
+	const int CHUNKS = PacketTraits<N>::Chunks;
+
+	RayChunk<F> chunks[CHUNKS];
+	for (int c = 0; c < CHUNKS; ++c)
+		LoadChunk(packet, c * F::Width, chunks[c]);
+
+	TraversePacket<F, CHUNKS>(chunks, m_bvh, m_packed, -1, *m_scene, m_meshes);
+
+	// planes are unbounded, so every ray tests every plane
+	for (int i = m_scene->BoundedCount(); i < m_scene->FirstInstanced(); ++i)
+		for (int c = 0; c < CHUNKS; ++c)
+			IntersectPlanes(chunks[c], m_scene->planes[i - m_scene->BoundedCount()], i);
+
+	for (int c = 0; c < CHUNKS; ++c)
+	{
+		const int W = F::Width;
+		alignas(32) float t[W], u[W], v[W];
+		alignas(32) int primitive[W], instance[W];
+		chunks[c].tMax.Store(t);
+		chunks[c].u.Store(u);
+		chunks[c].v.Store(v);
+		chunks[c].primitive.StoreBits(primitive);
+		chunks[c].instance.StoreBits(instance);
+		for (int i = 0; i < W; ++i)
+		{
+			Hit &hit = hits[c * W + i];
+			hit = Hit();
+			if (primitive[i] >= 0)
+			{
+				hit.t = t[i];
+				hit.primitive = primitive[i];
+				if (instance[i] >= 0)
+					hit.primitive += m_scene->FirstInstanced() +
+					                 m_scene->instances[instance[i]].offset;
+				hit.u = u[i];
+				hit.v = v[i];
+			}
+		}
+	}
+}
+
+template void Accelerator::IntersectPacket<4>(const RayPacket<4> &, Hit *) const;
+template void Accelerator::IntersectPacket<8>(const RayPacket<8> &, Hit *) const;
+template void Accelerator::IntersectPacket<16>(const RayPacket<16> &, Hit *) const;
+
+// --------------------------------------------------------------------------
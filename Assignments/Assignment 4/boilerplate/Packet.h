@@ -0,0 +1,71 @@
+// ==========================================================================
+// Ray Packets
+//  - bundles of 4, 8 or 16 rays stored as structure of arrays, so the
+//    packet kernels can load one coordinate of every ray with a single
+//    SIMD instruction
+//
+// Packets are meant for coherent rays such as primary rays through
+// neighbouring pixels. The whole packet walks the BVH together, visiting a
+// node if any of its rays do, which amortizes node fetches and box tests
+// over all of its rays.
+// ==========================================================================
+#ifndef PACKET_H
+#define PACKET_H
+
+#include "Geometry.h"
+#include "Simd.h"
+
+// --------------------------------------------------------------------------
+
+template <int N>
+struct RayPacket
+{
+	static const int Size = N;
+
+	alignas(32) float ox[N], oy[N], oz[N];
+	alignas(32) float dx[N], dy[N], dz[N];
+	alignas(32) float tMin[N], tMax[N];
+
+	void Set(int i, const Ray &ray)
+	{
+		ox[i] = ray.origin.x;    oy[i] = ray.origin.y;    oz[i] = ray.origin.z;
+		dx[i] = ray.direction.x; dy[i] = ray.direction.y; dz[i] = ray.direction.z;
+		tMin[i] = ray.tMin;
+		tMax[i] = ray.tMax;
+	}
+
+	// an inactive ray has an empty interval, so it fails every test
+	void Disable(int i)
+	{
+		Set(i, Ray(glm::vec3(0.f), glm::vec3(0.f, 0.f, -1.f), 0.f, -1.f));
+	}
+
+	Ray Get(int i) const
+	{
+		return Ray(glm::vec3(ox[i], oy[i], oz[i]), glm::vec3(dx[i], dy[i], dz[i]),
+		           tMin[i], tMax[i]);
+	}
+};
+
+// SIMD vector used to process a packet: 4-wide for 4-ray packets and
+// 8-wide (AVX when available) for the larger ones
+template <int N> struct PacketTraits
+{
+	typedef vfloat8 Float;
+	static const int Chunks = N / 8;
+};
+template <> struct PacketTraits<4>
+{
+	typedef vfloat4 Float;
+	static const int Chunks = 1;
+};
+
+// pixel footprint of a packet of primary rays
+inline void PacketFootprint(int size, int &width, int &height)
+{
+	width = size >= 8 ? 4 : 2;
+	height = size / width;
+}
+
+// --------------------------------------------------------------------------
+#endif // PACKET_H
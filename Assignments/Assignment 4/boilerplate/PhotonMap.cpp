@@ -0,0 +1,315 @@
+// ==========================================================================
+// Caustic Photon Map
+//
+// Photons are aimed at the cone around a light that holds the bounding
+// sphere of every reflective triangle and sphere, with the solid angle of
+// the cone folded into their power, so almost none are wasted on matte
+// surfaces. A reflective plane or instanced mesh has no useful bounds, and
+// then photons go out in every direction.
+// ==========================================================================
+
+#include "PhotonMap.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <thread>
+
+using namespace std;
+using namespace glm;
+
+// --------------------------------------------------------------------------
+
+namespace
+{
+	// mirror bounces a photon may take before it is dropped
+	const int MAX_PHOTON_BOUNCES = 16;
+
+	// smaller ranges build faster than threads start
+	const int PARALLEL_BUILD_PHOTONS = 1 << 15;
+
+	// the tracer's hash (from the PCG family), giving each photon a
+	// random stream of its own so the map doesn't depend on threads
+	unsigned Hash(unsigned x)
+	{
+		unsigned state = x * 747796405u + 2891336453u;
+		unsigned word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+		return (word >> 22u) ^ word;
+	}
+
+	float NextRandom(unsigned &state)
+	{
+		state = Hash(state);
+		return (state >> 8) * (1.f / 16777216.f);
+	}
+
+	int ThreadCount(int threadCount)
+	{
+		if (threadCount <= 0)
+			threadCount = int(thread::hardware_concurrency());
+		return std::max(threadCount, 1);
+	}
+
+	// bounds of every reflective triangle and sphere, and whether there is
+	// a reflective plane or instanced triangle, which could be anywhere
+	void ReflectiveBounds(const Scene &scene, AABB &bounds, bool &anywhere)
+	{
+		anywhere = false;
+		for (int id = 0; id < scene.BoundedCount(); ++id)
+			if (scene.materials[scene.MaterialOf(id)].reflectance > 0.f)
+				bounds.Extend(scene.Bounds(id));
+		for (size_t i = 0; i < scene.planes.size(); ++i)
+			if (scene.materials[scene.planes[i].material].reflectance > 0.f)
+				anywhere = true;
+		for (size_t i = 0; i < scene.instances.size() && !anywhere; ++i)
+		{
+			const Mesh &mesh = scene.meshes[scene.instances[i].mesh];
+			for (size_t t = 0; t < mesh.triangles.size() && !anywhere; ++t)
+				if (scene.materials[mesh.triangles[t].material].reflectance > 0.f)
+					anywhere = true;
+		}
+	}
+
+	// cone of directions from a light, uniform over its solid angle
+	struct EmissionCone
+	{
+		glm::vec3 axis, tangent, bitangent;
+		float   cosMax;
+		float   solidAngle;
+		float   probability;    // of a photon coming from this light
+	};
+}
+
+// --------------------------------------------------------------------------
+
+void EmitCausticPhotons(const Scene &scene, const Accelerator &accelerator, int count,
+                        int threadCount, vector<Photon> &photons)
+{
+	photons.clear();
+	AABB targets;
+	bool anywhere;
+	ReflectiveBounds(scene, targets, anywhere);
+	if (targets.Empty() && !anywhere)
+		return;
+
+	float totalPower = 0.f;
+	for (size_t i = 0; i < scene.lights.size(); ++i)
+	{
+		const vec3 &colour = scene.lights[i].colour;
+		totalPower += std::max(colour.r + colour.g + colour.b, 0.f);
+	}
+	if (count <= 0 || totalPower <= 0.f)
+		return;
+
+	vec3 centre = targets.Centroid();
+	float radius = anywhere ? 0.f : 0.5f * length(targets.Extent());
+	vector<EmissionCone> cones(scene.lights.size());
+	vector<float> cumulative(scene.lights.size());
+	float sum = 0.f;
+	for (size_t i = 0; i < scene.lights.size(); ++i)
+	{
+		const Light &light = scene.lights[i];
+		EmissionCone &cone = cones[i];
+		float power = std::max(light.colour.r + light.colour.g + light.colour.b, 0.f);
+		cone.probability = power / totalPower;
+		sum += cone.probability;
+		cumulative[i] = sum;
+
+		vec3 toCentre = centre - light.position;
+		float distance = length(toCentre);
+		cone.axis = distance > 0.f ? toCentre / distance : vec3(0.f, 0.f, -1.f);
+		cone.cosMax = anywhere || distance <= radius ? -1.f :
+		              std::sqrt(1.f - (radius / distance) * (radius / distance));
+		cone.solidAngle = 6.2831853f * (1.f - cone.cosMax);
+		OrthonormalBasis(cone.axis, cone.tangent, cone.bitangent);
+	}
+
+	threadCount = ThreadCount(threadCount);
+	vector< vector<Photon> > found(threadCount);
+	vector<thread> workers;
+	auto work = [&](int t) {
+		for (int i = int(int64_t(count) * t / threadCount);
+		     i < int(int64_t(count) * (t + 1) / threadCount); ++i)
+		{
+			// lights are stratified over the photon indices, by power
+			float position = (i + 0.5f) / count;
+			int l = int(lower_bound(cumulative.begin(), cumulative.end(), position) -
+			            cumulative.begin());
+			l = std::min(l, int(cumulative.size()) - 1);
+			const EmissionCone &cone = cones[l];
+			if (cone.probability <= 0.f)
+				continue;
+			const Light &light = scene.lights[l];
+
+			unsigned random = Hash(unsigned(i) * 2654435761u);
+			float cosTheta = 1.f - NextRandom(random) * (1.f - cone.cosMax);
+			float sinTheta = std::sqrt(std::max(1.f - cosTheta * cosTheta, 0.f));
+			float phi = 6.2831853f * NextRandom(random);
+			vec3 direction = sinTheta * std::cos(phi) * cone.tangent +
+			                 sinTheta * std::sin(phi) * cone.bitangent + cosTheta * cone.axis;
+			vec3 power = light.colour * cone.solidAngle / (float(count) * cone.probability);
+
+			Ray ray(light.position, direction);
+			for (int bounce = 0; bounce < MAX_PHOTON_BOUNCES; ++bounce)
+			{
+				Hit hit;
+				if (!accelerator.Intersect(ray, hit))
+					break;
+				vec3 p = ray.At(hit.t);
+				vec3 n = scene.Normal(hit.primitive, p);
+				if (dot(n, direction) > 0.f)
+					n = -n;
+
+				// the photon density falls with the square of distance,
+				// which the power makes up for, leaving the light's falloff
+				if (bounce == 0)
+					power *= hit.t * hit.t * light.Attenuation(hit.t);
+				else
+				{
+					Photon photon = { p, 0, power, direction };
+					found[t].push_back(photon);
+				}
+
+				// mirrors pass photons on as often as they reflect light
+				const Material &material = scene.materials[scene.MaterialOf(hit.primitive)];
+				if (material.reflectance <= 0.f || NextRandom(random) >= material.reflectance)
+					break;
+				direction = reflect(direction, n);
+				ray = Ray(p + SURFACE_EPSILON * n, direction);
+			}
+		}
+	};
+	for (int t = 1; t < threadCount; ++t)
+		workers.push_back(thread(work, t));
+	work(0);
+	for (size_t i = 0; i < workers.size(); ++i)
+		workers[i].join();
+
+	for (int t = 0; t < threadCount; ++t)
+		photons.insert(photons.end(), found[t].begin(), found[t].end());
+}
+
+// --------------------------------------------------------------------------
+
+void PhotonMap::Clear()
+{
+	m_photons.clear();
+	m_photons.shrink_to_fit();
+	m_emitted = 0;
+}
+
+void PhotonMap::Build(vector<Photon> &photons, int emitted, int threadCount)
+{
+	m_photons.swap(photons);
+	photons.clear();
+	m_emitted = emitted;
+
+	int depth = 0;
+	while ((1 << depth) < ThreadCount(threadCount))
+		++depth;
+	BuildRange(0, int(m_photons.size()), depth);
+}
+
+void PhotonMap::BuildRange(int begin, int end, int parallelDepth)
+{
+	if (begin >= end)
+		return;
+
+	AABB bounds;
+	for (int i = begin; i < end; ++i)
+		bounds.Extend(m_photons[i].position);
+	vec3 extent = bounds.Extent();
+	int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+
+	int middle = (begin + end) / 2;
+	nth_element(m_photons.begin() + begin, m_photons.begin() + middle, m_photons.begin() + end,
+		[axis](const Photon &a, const Photon &b) { return a.position[axis] < b.position[axis]; });
+	m_photons[middle].axis = axis;
+
+	// the two halves share nothing, so the upper levels split across threads
+	if (parallelDepth > 0 && end - begin > PARALLEL_BUILD_PHOTONS)
+	{
+		thread left(&PhotonMap::BuildRange, this, begin, middle, parallelDepth - 1);
+		BuildRange(middle + 1, end, parallelDepth - 1);
+		left.join();
+	}
+	else
+	{
+		BuildRange(begin, middle, 0);
+		BuildRange(middle + 1, end, 0);
+	}
+}
+
+// --------------------------------------------------------------------------
+
+void PhotonMap::Search(int begin, int end, const vec3 &position, int count, float &radius2,
+                       vector<NearPhoton> &nearest) const
+{
+	if (begin >= end)
+		return;
+	int middle = (begin + end) / 2;
+	const Photon &photon = m_photons[middle];
+
+	// the side of the split holding the position first, since it shrinks
+	// the radius soonest, and the other only if the radius reaches across
+	float delta = position[photon.axis] - photon.position[photon.axis];
+	if (delta < 0.f)
+	{
+		Search(begin, middle, position, count, radius2, nearest);
+		if (delta * delta < radius2)
+			Search(middle + 1, end, position, count, radius2, nearest);
+	}
+	else
+	{
+		Search(middle + 1, end, position, count, radius2, nearest);
+		if (delta * delta < radius2)
+			Search(begin, middle, position, count, radius2, nearest);
+	}
+
+	vec3 offset = photon.position - position;
+	float distance2 = dot(offset, offset);
+	if (distance2 >= radius2)
+		return;
+
+	// max-heap on distance: once full, the farthest makes way and the
+	// search radius closes in to the new farthest
+	NearPhoton near = { distance2, middle };
+	if (int(nearest.size()) == count)
+	{
+		pop_heap(nearest.begin(), nearest.end());
+		nearest.back() = near;
+	}
+	else
+		nearest.push_back(near);
+	push_heap(nearest.begin(), nearest.end());
+	if (int(nearest.size()) == count)
+		radius2 = nearest.front().distance2;
+}
+
+vec3 PhotonMap::Density(const vec3 &position, const vec3 &normal, int count, float maxRadius,
+                        vector<NearPhoton> &nearest) const
+{
+	nearest.clear();
+	if (m_photons.empty() || count <= 0)
+		return vec3(0.f);
+	float radius2 = maxRadius * maxRadius;
+	Search(0, int(m_photons.size()), position, count, radius2, nearest);
+	if (nearest.empty() || radius2 <= 0.f)
+		return vec3(0.f);
+
+	// cone filter, weighing photons down to zero at the search radius,
+	// which keeps the edges of caustics sharp; it takes away two thirds
+	// of a uniform disc's weight
+	float radius = std::sqrt(radius2);
+	vec3 power(0.f);
+	for (size_t i = 0; i < nearest.size(); ++i)
+	{
+		const Photon &photon = m_photons[nearest[i].index];
+		if (dot(photon.direction, normal) >= 0.f)
+			continue;
+		power += (1.f - std::sqrt(nearest[i].distance2) / radius) * photon.power;
+	}
+	return power * (3.f / (3.14159265f * radius2));
+}
+
+// --------------------------------------------------------------------------
@@ -0,0 +1,82 @@
+// ==========================================================================
+// Caustic Photon Map
+//  - photons shot from the point lights toward the reflective objects,
+//    spread over threads, and kept where they land after one or more
+//    mirror bounces: the light that reaches a surface only by way of a
+//    mirror, which tracing from the eye can't find from a point light
+//  - a balanced kd-tree over the photons, stored implicitly in one array
+//    and built with its upper subtrees split across threads
+//  - k-nearest-neighbour density estimates with a cone filter, giving the
+//    caustic light arriving at a surface point
+//
+// Photon power is kept in the units of light colours, so the diffuse
+// colour times a density estimate is the light a surface reflects, just as
+// in the direct shading. The tracer's lights need not fade with distance,
+// so a photon's power is set where it first lands to give the irradiance
+// the direct shading would there; past that, mirrors spread and focus it
+// as they would real light.
+// ==========================================================================
+#ifndef PHOTONMAP_H
+#define PHOTONMAP_H
+
+#include <vector>
+#include <glm/glm.hpp>
+#include "Scene.h"
+#include "Accelerator.h"
+
+// --------------------------------------------------------------------------
+
+struct Photon
+{
+	glm::vec3 position;
+	int     axis;           // kd-tree splitting axis at this photon
+	glm::vec3 power;
+	glm::vec3 direction;    // of travel when the photon landed
+};
+
+// a photon found by a neighbour search, in the search's max-heap
+struct NearPhoton
+{
+	float   distance2;
+	int     index;
+
+	bool operator<(const NearPhoton &other) const { return distance2 < other.distance2; }
+};
+
+// Shoots count photons from the scene's lights, shared between them by
+// power, and gathers those landing after a mirror bounce, in the same
+// order for any threadCount (every hardware thread for zero or less).
+void EmitCausticPhotons(const Scene &scene, const Accelerator &accelerator, int count,
+                        int threadCount, std::vector<Photon> &photons);
+
+class PhotonMap
+{
+	std::vector<Photon> m_photons;  // kd-tree: each range's median is its root
+	int     m_emitted;
+
+	void BuildRange(int begin, int end, int parallelDepth);
+	void Search(int begin, int end, const glm::vec3 &position, int count, float &radius2,
+	            std::vector<NearPhoton> &nearest) const;
+
+public:
+	PhotonMap() : m_emitted(0) {}
+
+	// takes over the photons, leaving the vector empty; emitted is the
+	// number of photons shot to find them
+	void Build(std::vector<Photon> &photons, int emitted, int threadCount = 0);
+	void Clear();
+
+	bool Empty() const { return m_photons.empty(); }
+	int Size() const { return int(m_photons.size()); }
+	int Emitted() const { return m_emitted; }
+	size_t MemoryBytes() const { return m_photons.capacity() * sizeof(Photon); }
+
+	// caustic power per unit area arriving at a surface point from the
+	// side the normal faces, from its count nearest photons within
+	// maxRadius; nearest is scratch space for the search
+	glm::vec3 Density(const glm::vec3 &position, const glm::vec3 &normal, int count,
+	                  float maxRadius, std::vector<NearPhoton> &nearest) const;
+};
+
+// --------------------------------------------------------------------------
+#endif // PHOTONMAP_H
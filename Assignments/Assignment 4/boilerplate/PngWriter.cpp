@@ -0,0 +1,276 @@
+// ==========================================================================
+// Parallel PNG Writer
+// ==========================================================================
+
+#include "PngWriter.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <zlib.h>
+
+using namespace std;
+
+// --------------------------------------------------------------------------
+
+namespace
+{
+	const unsigned char PNG_SIGNATURE[8] = { 137, 'P', 'N', 'G', '\r', '\n', 26, '\n' };
+
+	// zlib stream header for a 32K window at the default compression level
+	const unsigned char ZLIB_HEADER[2] = { 0x78, 0x9c };
+
+	// PNG row filters
+	enum RowFilter { FILTER_NONE, FILTER_SUB, FILTER_UP, FILTER_AVERAGE, FILTER_PAETH };
+	const int FILTER_COUNT = 5;
+	const int BYTES_PER_PIXEL = 3;
+
+	int Paeth(int a, int b, int c)
+	{
+		int p = a + b - c;
+		int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+		if (pa <= pb && pa <= pc) return a;
+		return pb <= pc ? b : c;
+	}
+
+	// filters a row against the row above it (zeros for the first row)
+	void FilterRow(RowFilter filter, const unsigned char *row, const unsigned char *above,
+	               size_t size, unsigned char *out)
+	{
+		for (size_t i = 0; i < size; ++i)
+		{
+			int left = i >= BYTES_PER_PIXEL ? row[i - BYTES_PER_PIXEL] : 0;
+			int upperLeft = i >= BYTES_PER_PIXEL ? above[i - BYTES_PER_PIXEL] : 0;
+			int predicted = 0;
+			switch (filter)
+			{
+			case FILTER_SUB:        predicted = left; break;
+			case FILTER_UP:         predicted = above[i]; break;
+			case FILTER_AVERAGE:    predicted = (left + above[i]) / 2; break;
+			case FILTER_PAETH:      predicted = Paeth(left, above[i], upperLeft); break;
+			default:                break;
+			}
+			out[i] = (unsigned char)(row[i] - predicted);
+		}
+	}
+
+	// the usual heuristic: the filter whose output, read as signed bytes,
+	// has the smallest sum of magnitudes tends to compress best
+	void FilterRowBest(const unsigned char *row, const unsigned char *above, size_t size,
+	                   unsigned char *out, vector<unsigned char> &scratch)
+	{
+		scratch.resize(size);
+		long best = -1;
+		for (int f = 0; f < FILTER_COUNT; ++f)
+		{
+			FilterRow(RowFilter(f), row, above, size, &scratch[0]);
+			long cost = 0;
+			for (size_t i = 0; i < size; ++i)
+				cost += abs(int((signed char)scratch[i]));
+			if (best < 0 || cost < best)
+			{
+				best = cost;
+				out[0] = (unsigned char)f;
+				memcpy(out + 1, &scratch[0], size);
+			}
+		}
+	}
+
+	void PutBigEndian(unsigned long value, unsigned char *out)
+	{
+		out[0] = (unsigned char)(value >> 24);
+		out[1] = (unsigned char)(value >> 16);
+		out[2] = (unsigned char)(value >> 8);
+		out[3] = (unsigned char)value;
+	}
+
+	bool WriteChunk(FILE *file, const char *type, const unsigned char *data, size_t size)
+	{
+		unsigned char header[8], footer[4];
+		PutBigEndian((unsigned long)size, header);
+		memcpy(header + 4, type, 4);
+		uLong crc = crc32(0L, header + 4, 4);
+		if (size > 0)
+			crc = crc32(crc, data, uInt(size));
+		PutBigEndian(crc, footer);
+
+		return fwrite(header, 1, 8, file) == 8 &&
+		       (size == 0 || fwrite(data, 1, size, file) == size) &&
+		       fwrite(footer, 1, 4, file) == 4;
+	}
+
+	// state shared by the threads encoding one file
+	struct PngStream
+	{
+		FILE               *file;
+		int                 width, height;
+		int                 bandHeight, bandCount;
+		const PngRowSource &rows;
+
+		atomic<int>         nextBand;       // next band to encode
+
+		// bands are written strictly in order, each waiting for its turn
+		mutex               lock;
+		condition_variable  turn;
+		int                 nextToWrite;
+		uLong               adler;          // checksum of everything written
+		bool                failed;
+
+		PngStream(const PngRowSource &source) : rows(source) {}
+	};
+
+	// Fetches, filters and deflates one band of rows. Filters predict from
+	// the row above, so the row just above the band is fetched again, which
+	// keeps bands independent of each other.
+	bool EncodeBand(PngStream &stream, int band, vector<unsigned char> &raw,
+	                vector<unsigned char> &above, vector<unsigned char> &row,
+	                vector<unsigned char> &scratch, vector<unsigned char> &compressed,
+	                uLong &adler)
+	{
+		size_t rowSize = size_t(stream.width) * 3;
+		int first = band * stream.bandHeight;
+		int last = std::min(first + stream.bandHeight, stream.height);
+
+		if (first > 0)
+			stream.rows(first - 1, &above[0]);
+		else
+			std::fill(above.begin(), above.end(), 0);
+		raw.resize((last - first) * (rowSize + 1));
+		for (int y = first; y < last; ++y)
+		{
+			stream.rows(y, &row[0]);
+			FilterRowBest(&row[0], &above[0], rowSize, &raw[(y - first) * (rowSize + 1)], scratch);
+			above.swap(row);
+		}
+		adler = adler32(adler32(0L, Z_NULL, 0), &raw[0], uInt(raw.size()));
+
+		// raw deflate: the zlib header and checksum are written around the
+		// chain of bands; all but the last end byte aligned and unfinished
+		bool lastBand = band == stream.bandCount - 1;
+		z_stream z;
+		memset(&z, 0, sizeof(z));
+		if (deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8,
+		                 Z_DEFAULT_STRATEGY) != Z_OK)
+			return false;
+		compressed.resize(deflateBound(&z, uLong(raw.size())) + 16);
+		z.next_in = &raw[0];
+		z.avail_in = uInt(raw.size());
+		z.next_out = &compressed[0];
+		z.avail_out = uInt(compressed.size());
+		int status = deflate(&z, lastBand ? Z_FINISH : Z_SYNC_FLUSH);
+		bool ok = lastBand ? status == Z_STREAM_END : (status == Z_OK && z.avail_in == 0);
+		compressed.resize(z.total_out);
+		deflateEnd(&z);
+		return ok;
+	}
+
+	void EncodeBands(PngStream &stream)
+	{
+		size_t rowSize = size_t(stream.width) * 3;
+		vector<unsigned char> raw, above(rowSize), row(rowSize), scratch, compressed;
+		int band;
+		while ((band = stream.nextBand++) < stream.bandCount)
+		{
+			uLong adler = 0;
+			bool encoded = EncodeBand(stream, band, raw, above, row, scratch, compressed, adler);
+
+			unique_lock<mutex> guard(stream.lock);
+			stream.turn.wait(guard, [&] { return stream.nextToWrite == band || stream.failed; });
+			if (stream.failed)
+				return;
+			if (!encoded)
+			{
+				cout << "PngWriter ERROR: Failed to compress band " << band << endl;
+				stream.failed = true;
+				stream.turn.notify_all();
+				return;
+			}
+
+			// the first band opens the zlib stream and the last one closes it
+			// with the checksum of all the bands
+			if (band == 0)
+				compressed.insert(compressed.begin(), ZLIB_HEADER, ZLIB_HEADER + 2);
+			stream.adler = adler32_combine(stream.adler, adler, z_off_t(raw.size()));
+			if (band == stream.bandCount - 1)
+			{
+				unsigned char trailer[4];
+				PutBigEndian(stream.adler, trailer);
+				compressed.insert(compressed.end(), trailer, trailer + 4);
+			}
+
+			if (!WriteChunk(stream.file, "IDAT", &compressed[0], compressed.size()))
+			{
+				cout << "PngWriter ERROR: Failed writing image data" << endl;
+				stream.failed = true;
+			}
+			++stream.nextToWrite;
+			stream.turn.notify_all();
+		}
+	}
+}
+
+// --------------------------------------------------------------------------
+
+bool WritePng(const string &fileName, int width, int height,
+              const PngRowSource &rows, int threadCount, int bandHeight)
+{
+	if (width <= 0 || height <= 0)
+	{
+		cout << "PngWriter ERROR: Invalid image size " << width << "x" << height << endl;
+		return false;
+	}
+
+	FILE *file = fopen(fileName.c_str(), "wb");
+	if (!file)
+	{
+		cout << "PngWriter ERROR: Could not open " << fileName << " for writing" << endl;
+		return false;
+	}
+
+	// 8-bit RGB, no interlacing
+	unsigned char header[13];
+	PutBigEndian(width, header);
+	PutBigEndian(height, header + 4);
+	header[8] = 8;
+	header[9] = 2;
+	header[10] = header[11] = header[12] = 0;
+	bool ok = fwrite(PNG_SIGNATURE, 1, 8, file) == 8 && WriteChunk(file, "IHDR", header, 13);
+
+	PngStream stream(rows);
+	stream.file = file;
+	stream.width = width;
+	stream.height = height;
+	stream.bandHeight = std::max(bandHeight, 1);
+	stream.bandCount = (height + stream.bandHeight - 1) / stream.bandHeight;
+	stream.nextBand = 0;
+	stream.nextToWrite = 0;
+	stream.adler = adler32(0L, Z_NULL, 0);
+	stream.failed = !ok;
+
+	if (threadCount <= 0)
+		threadCount = std::max(int(thread::hardware_concurrency()), 1);
+	threadCount = std::min(threadCount, stream.bandCount);
+
+	// the calling thread encodes bands too
+	vector<thread> workers;
+	for (int i = 1; i < threadCount; ++i)
+		workers.push_back(thread(EncodeBands, std::ref(stream)));
+	EncodeBands(stream);
+	for (size_t i = 0; i < workers.size(); ++i)
+		workers[i].join();
+
+	ok = !stream.failed && WriteChunk(file, "IEND", 0, 0);
+	ok = fclose(file) == 0 && ok;
+	if (!ok)
+		cout << "PngWriter ERROR: Failed to write " << fileName << endl;
+	return ok;
+}
+
+// --------------------------------------------------------------------------
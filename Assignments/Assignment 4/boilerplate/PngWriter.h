@@ -0,0 +1,33 @@
+// ==========================================================================
+// Parallel PNG Writer
+//  - writes 8-bit RGB PNG files, compressing bands of rows on several
+//    threads at once with zlib
+//  - rows are pulled from the caller band by band and the file is written
+//    as the bands finish, in order, so memory use stays at a few bands
+//    per thread no matter how large the image is
+//
+// Every band is deflated as an independent stream ended with a sync flush,
+// which leaves it byte aligned with no final block. The streams chained
+// together are a single valid zlib stream, with its checksum combined from
+// the per-band ones. Matches cannot reach back across a band boundary,
+// which costs a little compression on bands of a few dozen rows.
+// ==========================================================================
+#ifndef PNGWRITER_H
+#define PNGWRITER_H
+
+#include <functional>
+#include <string>
+
+// --------------------------------------------------------------------------
+
+// fills row y, counted from the top of the image, with width RGB pixels;
+// called from several threads at once, for different rows
+typedef std::function<void(int y, unsigned char *rgb)> PngRowSource;
+
+// writes a width x height image to fileName; a threadCount of zero or less
+// uses every hardware thread
+bool WritePng(const std::string &fileName, int width, int height,
+              const PngRowSource &rows, int threadCount = 0, int bandHeight = 32);
+
+// --------------------------------------------------------------------------
+#endif // PNGWRITER_H
@@ -0,0 +1,330 @@
+// ==========================================================================
+// Multi-Process Renderer
+//
+// The coordinator and each worker talk in 32-bit tile indices: the
+// coordinator sends the tile to trace, or -1 to stop, and the worker
+// answers with the index once the tile's colours are in the framebuffer.
+// Told to stop, a worker sends its ray counts and exits.
+// ==========================================================================
+
+#include "ProcessRenderer.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include "ImageBuffer.h"
+
+#ifndef _WIN32
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+using namespace glm;
+
+// --------------------------------------------------------------------------
+
+struct ProcessRenderer::Worker
+{
+	int     pid;
+	int     socket;         // the coordinator's end
+	int     tile;           // index of the tile it is on, -1 when idle
+};
+
+#ifndef _WIN32
+
+namespace
+{
+	const int STOP = -1;
+
+	// the counters a worker sends back when it stops
+	const int COUNTERS = 4;
+
+#ifdef MSG_NOSIGNAL
+	const int SEND_FLAGS = MSG_NOSIGNAL;    // a dead worker is an error, not a signal
+#else
+	const int SEND_FLAGS = 0;
+#endif
+
+	bool SendAll(int socket, const void *data, size_t size)
+	{
+		const char *bytes = static_cast<const char *>(data);
+		while (size > 0)
+		{
+			ssize_t sent = send(socket, bytes, size, SEND_FLAGS);
+			if (sent < 0 && errno == EINTR)
+				continue;
+			if (sent <= 0)
+				return false;
+			bytes += sent;
+			size -= size_t(sent);
+		}
+		return true;
+	}
+
+	bool ReceiveAll(int socket, void *data, size_t size)
+	{
+		char *bytes = static_cast<char *>(data);
+		while (size > 0)
+		{
+			ssize_t read = recv(socket, bytes, size, 0);
+			if (read < 0 && errno == EINTR)
+				continue;
+			if (read <= 0)
+				return false;
+			bytes += read;
+			size -= size_t(read);
+		}
+		return true;
+	}
+
+	// a worker's life: trace the tiles it is sent until told to stop
+	void WorkerLoop(const RayTracer &tracer, int width, int height, const vector<Tile> &tiles,
+	                vec3 *framebuffer, int socket)
+	{
+		TraceContext context;
+		vector<vec3> colours;
+		int32_t index;
+		while (ReceiveAll(socket, &index, sizeof(index)) && index != STOP)
+		{
+			const Tile &tile = tiles[index];
+			tracer.RenderTile(tile, width, height, colours, context);
+			for (int j = 0; j < tile.height; ++j)
+				std::copy(&colours[j * tile.width], &colours[j * tile.width] + tile.width,
+				          &framebuffer[(tile.y + j) * width + tile.x]);
+			if (!SendAll(socket, &index, sizeof(index)))
+				return;
+		}
+		unsigned long long counts[COUNTERS] = { context.primarySamples, context.shadowRays,
+		                                        context.reflectionRays, context.bounceRays };
+		SendAll(socket, counts, sizeof(counts));
+	}
+
+	// collects a worker that has exited, and says how it went
+	string Reap(int pid)
+	{
+		int status = 0;
+		while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+			;
+		if (WIFSIGNALED(status))
+			return "was killed by signal " + to_string(WTERMSIG(status));
+		if (WIFEXITED(status))
+			return "exited with status " + to_string(WEXITSTATUS(status));
+		return "stopped";
+	}
+}
+
+// --------------------------------------------------------------------------
+
+bool ProcessRenderer::Spawn(const RayTracer &tracer, int width, int height,
+                            const vector<Tile> &tiles, vec3 *framebuffer,
+                            vector<Worker> &workers, Worker &worker)
+{
+	int ends[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, ends) != 0)
+		return false;
+
+	// anything still buffered would be written by both processes
+	cout.flush();
+	int pid = fork();
+	if (pid < 0)
+	{
+		close(ends[0]);
+		close(ends[1]);
+		return false;
+	}
+	if (pid == 0)
+	{
+		// the worker needs none of the coordinator's sockets, and leaves
+		// without running destructors the coordinator still relies on
+		for (size_t i = 0; i < workers.size(); ++i)
+			if (workers[i].socket >= 0)
+				close(workers[i].socket);
+		close(ends[0]);
+		WorkerLoop(tracer, width, height, tiles, framebuffer, ends[1]);
+		_exit(0);
+	}
+
+	close(ends[1]);
+	worker.pid = pid;
+	worker.socket = ends[0];
+	worker.tile = -1;
+	return true;
+}
+
+bool ProcessRenderer::Render(const RayTracer &tracer, ImageBuffer &image, int tileSize,
+                             int processCount)
+{
+	m_counts = TraceContext();
+	m_workersLost = 0;
+	int width = image.Width(), height = image.Height();
+	tileSize = std::max(tileSize, 1);
+	vector<Tile> tiles;
+	for (int y = 0; y < height; y += tileSize)
+		for (int x = 0; x < width; x += tileSize)
+		{
+			Tile tile = { x, y, std::min(tileSize, width - x), std::min(tileSize, height - y), 0 };
+			tiles.push_back(tile);
+		}
+	if (tiles.empty())
+		return true;
+
+	// the framebuffer is mapped before the fork, so every worker writes
+	// into the same pages the coordinator reads
+	size_t bytes = size_t(width) * height * sizeof(vec3);
+	void *mapping = mmap(0, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (mapping == MAP_FAILED)
+	{
+		cout << "ERROR: Could not map a shared framebuffer: " << strerror(errno) << endl;
+		return false;
+	}
+	vec3 *framebuffer = static_cast<vec3 *>(mapping);
+
+	vector<Worker> workers;
+	processCount = std::max(1, std::min(processCount, int(tiles.size())));
+	for (int i = 0; i < processCount; ++i)
+	{
+		Worker worker;
+		if (Spawn(tracer, width, height, tiles, framebuffer, workers, worker))
+			workers.push_back(worker);
+	}
+	if (workers.empty())
+	{
+		cout << "ERROR: Could not start any worker process: " << strerror(errno) << endl;
+		munmap(mapping, bytes);
+		return false;
+	}
+
+	deque<int> queue;
+	for (int i = 0; i < int(tiles.size()); ++i)
+		queue.push_back(i);
+	vector<int> failures(tiles.size(), 0);
+	int tilesDone = 0;
+	bool failed = false;
+	vector<pollfd> waiting;
+	while (tilesDone < int(tiles.size()) && !failed && !workers.empty())
+	{
+		// every idle worker gets the next tile; a send to a worker that
+		// has just died fails quietly, and the poll below finds it gone
+		for (size_t i = 0; i < workers.size() && !queue.empty(); ++i)
+		{
+			if (workers[i].tile >= 0) continue;
+			int32_t index = queue.front();
+			queue.pop_front();
+			workers[i].tile = index;
+			SendAll(workers[i].socket, &index, sizeof(index));
+		}
+
+		waiting.assign(workers.size(), pollfd());
+		for (size_t i = 0; i < workers.size(); ++i)
+		{
+			waiting[i].fd = workers[i].socket;
+			waiting[i].events = POLLIN;
+		}
+		if (poll(&waiting[0], waiting.size(), -1) < 0 && errno != EINTR)
+		{
+			cout << "ERROR: Lost track of the worker processes: " << strerror(errno) << endl;
+			failed = true;
+			break;
+		}
+
+		for (size_t i = 0; i < workers.size(); ++i)
+		{
+			if (!waiting[i].revents) continue;
+			Worker &worker = workers[i];
+			int32_t index;
+			if (ReceiveAll(worker.socket, &index, sizeof(index)) && index == worker.tile)
+			{
+				worker.tile = -1;
+				++tilesDone;
+				continue;
+			}
+
+			// the worker is gone, or talking nonsense and put down; its tile
+			// goes back to the front of the queue, and another worker takes
+			// its place
+			kill(worker.pid, SIGKILL);
+			close(worker.socket);
+			worker.socket = -1;
+			string how = Reap(worker.pid);
+			++m_workersLost;
+			cout << "Worker process " << worker.pid << " " << how;
+			if (worker.tile >= 0)
+			{
+				const Tile &tile = tiles[worker.tile];
+				cout << " on the tile at (" << tile.x << ", " << tile.y << ")";
+				if (++failures[worker.tile] >= MAX_TILE_FAILURES)
+				{
+					cout << endl << "ERROR: The tile at (" << tile.x << ", " << tile.y
+					     << ") killed " << MAX_TILE_FAILURES << " workers, giving up" << endl;
+					failed = true;
+					break;
+				}
+				queue.push_front(worker.tile);
+			}
+			if (Spawn(tracer, width, height, tiles, framebuffer, workers, worker))
+				cout << ", replaced by " << worker.pid << endl;
+			else
+				cout << ", and could not be replaced" << endl;
+		}
+
+		// workers that could not be replaced leave the pool
+		for (size_t i = workers.size(); i-- > 0; )
+			if (workers[i].socket < 0)
+				workers.erase(workers.begin() + i);
+	}
+
+	// the workers that are left stop and send their counts
+	for (size_t i = 0; i < workers.size(); ++i)
+	{
+		if (workers[i].socket < 0) continue;    // already reaped
+		int32_t stop = STOP;
+		unsigned long long counts[COUNTERS];
+		if (!failed && SendAll(workers[i].socket, &stop, sizeof(stop)) &&
+		    ReceiveAll(workers[i].socket, counts, sizeof(counts)))
+		{
+			m_counts.primarySamples += counts[0];
+			m_counts.shadowRays += counts[1];
+			m_counts.reflectionRays += counts[2];
+			m_counts.bounceRays += counts[3];
+		}
+		else
+			kill(workers[i].pid, SIGKILL);
+		close(workers[i].socket);
+		Reap(workers[i].pid);
+	}
+
+	if (!failed && tilesDone < int(tiles.size()))
+	{
+		cout << "ERROR: Every worker process died and none could be started" << endl;
+		failed = true;
+	}
+	if (!failed)
+		image.SetTile(0, 0, width, height, framebuffer);
+	munmap(mapping, bytes);
+	return !failed;
+}
+
+#else
+
+bool ProcessRenderer::Spawn(const RayTracer &, int, int, const vector<Tile> &, vec3 *,
+                            vector<Worker> &, Worker &)
+{
+	return false;
+}
+
+bool ProcessRenderer::Render(const RayTracer &, ImageBuffer &, int, int)
+{
+	cout << "ERROR: Rendering in several processes is not supported on this platform" << endl;
+	return false;
+}
+
+#endif
+
+// --------------------------------------------------------------------------
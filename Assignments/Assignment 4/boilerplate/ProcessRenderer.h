@@ -0,0 +1,60 @@
+// ==========================================================================
+// Multi-Process Renderer
+//  - renders an image across worker processes forked from this one, which
+//    share the loaded scene, BVH and light tree with it copy-on-write, so
+//    nothing is loaded or built again
+//  - a coordinator hands the workers one tile at a time over a socket pair
+//    each; workers trace the tile on their own and write its colours
+//    straight into a framebuffer mapped shared between all the processes,
+//    then say which tile they finished
+//  - a worker that dies, whether it crashed or was killed, costs only the
+//    tile it was on: the tile goes back to the front of the queue and a new
+//    worker is forked in its place
+//
+// Every pixel is traced as it would be by the threads of a single process,
+// so the image comes out the same; only the irradiance cache differs, as
+// each worker fills its own. A tile that keeps killing its workers is given
+// up on after MAX_TILE_FAILURES tries, since it would kill any other too.
+//
+// Needs fork and shared memory, so not available on Windows.
+// ==========================================================================
+#ifndef PROCESSRENDERER_H
+#define PROCESSRENDERER_H
+
+#include <vector>
+#include "RayTracer.h"
+#include "TileScheduler.h"
+
+class ImageBuffer;
+
+// --------------------------------------------------------------------------
+
+const int MAX_TILE_FAILURES = 3;
+
+class ProcessRenderer
+{
+public:
+	ProcessRenderer() : m_workersLost(0) {}
+
+	// renders the tracer's scene into the whole of image on processCount
+	// workers, blocking until it is done; returns false, with an error
+	// printed, if no worker could be started or a tile failed too often
+	bool Render(const RayTracer &tracer, ImageBuffer &image, int tileSize, int processCount);
+
+	// rays traced by the workers that lived to the end
+	const TraceContext &Counts() const { return m_counts; }
+	// workers that died during the render, each replaced by a new one
+	int WorkersLost() const { return m_workersLost; }
+
+private:
+	struct Worker;
+
+	TraceContext    m_counts;
+	int             m_workersLost;
+
+	bool Spawn(const RayTracer &tracer, int width, int height, const std::vector<Tile> &tiles,
+	           glm::vec3 *framebuffer, std::vector<Worker> &workers, Worker &worker);
+};
+
+// --------------------------------------------------------------------------
+#endif // PROCESSRENDERER_H
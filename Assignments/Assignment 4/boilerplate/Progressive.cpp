@@ -0,0 +1,160 @@
+// ==========================================================================
+// Progressive Rendering
+// ==========================================================================
+
+#include "Progressive.h"
+
+#include <algorithm>
+#include <climits>
+
+using namespace std;
+using namespace glm;
+
+// --------------------------------------------------------------------------
+
+bool AddSamplePasses(const RenderSettings &settings, int maxSamples,
+                     vector<RenderPass> &passes)
+{
+	int samples = settings.samplesPerPixel;
+	if (samples <= 1 || settings.adaptive)
+		return false;
+	for (int first = 0; first < samples; )
+	{
+		int count = std::min(std::min(std::max(first, 1), maxSamples), samples - first);
+		RenderPass pass = { 1, first, count, false };
+		passes.push_back(pass);
+		first += count;
+	}
+	return true;
+}
+
+void AccumulateTile(const RayTracer &tracer, const Tile &tile, int width, int height,
+                    const RenderPass &pass, const vector<vec3> &sums,
+                    vector<vec3> &colours, TraceContext &context)
+{
+	colours.resize(tile.width * tile.height);
+	for (int j = 0; j < tile.height; ++j)
+		std::copy(&sums[(tile.y + j) * width + tile.x],
+		          &sums[(tile.y + j) * width + tile.x] + tile.width,
+		          &colours[j * tile.width]);
+	tracer.AccumulateSamples(tile, width, height, pass.firstSample, pass.sampleCount,
+	                         colours, context);
+}
+
+// --------------------------------------------------------------------------
+
+void ProgressiveRenderer::Start(const RayTracer &tracer, int width, int height,
+                                int tileSize, int threadCount,
+                                const TileOutput &output, bool progressive)
+{
+	m_scheduler.Cancel();
+
+	// previews at 1/16 and 1/4 of the pixel count
+	m_passes.clear();
+	if (progressive)
+		for (int block = 4; block > 1; block /= 2)
+		{
+			RenderPass pass = { block, 0, 0, false };
+			m_passes.push_back(pass);
+		}
+
+	// supersampled images double their samples with every pass
+	int samples = tracer.settings.samplesPerPixel;
+	if (progressive && AddSamplePasses(tracer.settings, INT_MAX, m_passes))
+		m_sums.assign(size_t(width) * height, vec3(0.f));
+	else
+	{
+		m_sums.clear();
+		RenderPass pass = { 1, 0, 0, false };
+		m_passes.push_back(pass);
+	}
+
+	// single sample images keep their first hits for Reshade()
+	m_recording = samples <= 1;
+	m_gbufferReady = false;
+	if (m_recording)
+		m_gbuffer.Resize(width, height);
+
+	Launch(tracer, width, height, tileSize, threadCount, output);
+}
+
+bool ProgressiveRenderer::CanReshade(int width, int height)
+{
+	// a recording render counts once its last pass is through
+	if (m_recording && !Running() && PassesDone() == PassCount())
+	{
+		m_recording = false;
+		m_gbufferReady = true;
+	}
+	return m_gbufferReady && m_gbuffer.width == width && m_gbuffer.height == height;
+}
+
+bool ProgressiveRenderer::Reshade(const RayTracer &tracer, int width, int height,
+                                  int tileSize, int threadCount,
+                                  const TileOutput &output, bool progressive)
+{
+	m_scheduler.Cancel();
+	if (!CanReshade(width, height))
+		return false;
+	m_recording = false;
+
+	m_passes.clear();
+	m_sums.clear();
+	for (int block = progressive ? 4 : 1; block >= 1; block /= 2)
+	{
+		RenderPass pass = { block, 0, 0, true };
+		m_passes.push_back(pass);
+	}
+
+	Launch(tracer, width, height, tileSize, threadCount, output);
+	return true;
+}
+
+void ProgressiveRenderer::Launch(const RayTracer &tracer, int width, int height,
+                                 int tileSize, int threadCount, const TileOutput &output)
+{
+	m_contexts.assign(threadCount > 0 ? threadCount : TileScheduler::HardwareThreads(),
+	                  TraceContext());
+	m_scheduler.Start(width, height, tileSize, int(m_contexts.size()),
+		[this, &tracer, width, height, output](const Tile &tile, int thread) {
+			RenderTile(tracer, width, height, tile, thread, output);
+		}, int(m_passes.size()));
+}
+
+// --------------------------------------------------------------------------
+
+void ProgressiveRenderer::RenderTile(const RayTracer &tracer, int width, int height,
+                                     const Tile &tile, int thread,
+                                     const TileOutput &output)
+{
+	const RenderPass &pass = m_passes[tile.pass];
+	TraceContext &context = m_contexts[thread];
+	vector<vec3> colours;
+
+	if (pass.shadeOnly)
+		tracer.ShadeTile(tile, width, height, m_gbuffer, pass.blockSize, colours, context);
+	else if (pass.blockSize > 1)
+		tracer.RenderTileCoarse(tile, width, height, pass.blockSize, colours, context);
+	else if (m_sums.empty())
+		tracer.RenderTile(tile, width, height, colours, context,
+		                  m_recording ? &m_gbuffer : 0);
+	else
+	{
+		// tiles of one pass never overlap and passes don't overlap in time,
+		// so the tile's part of the accumulation buffer is ours alone
+		AccumulateTile(tracer, tile, width, height, pass, m_sums, colours, context);
+
+		float samples = float(pass.firstSample + pass.sampleCount);
+		for (int j = 0; j < tile.height; ++j)
+			for (int i = 0; i < tile.width; ++i)
+			{
+				vec3 &sum = colours[j * tile.width + i];
+				m_sums[(tile.y + j) * width + tile.x + i] = sum;
+				sum /= samples;
+			}
+	}
+
+	output(tile, &colours[0]);
+}
+
+// --------------------------------------------------------------------------
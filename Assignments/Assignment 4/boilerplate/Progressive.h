@@ -0,0 +1,106 @@
+// ==========================================================================
+// Progressive Rendering
+//  - renders an image in a sequence of passes from coarse to fine, handing
+//    every finished tile to the caller so the window fills in quickly
+//  - preview passes trace one ray per 4x4 and then per 2x2 block of pixels
+//  - supersampled images then build up in a sample accumulation buffer,
+//    doubling the samples per pixel with each pass
+//
+// The last pass leaves every pixel with exactly the value a straight
+// RenderTile() over the same tiles gives, bit for bit: the preview passes
+// are only ever overwritten, and the accumulated sums are formed in the
+// same order a straight render forms them.
+//
+// Single sample renders record their first hits in a G-buffer as they go.
+// Once one has finished, Reshade() redraws the image for moved lights or
+// changed materials from it, with previews of its own, skipping the
+// primary rays altogether.
+// ==========================================================================
+#ifndef PROGRESSIVE_H
+#define PROGRESSIVE_H
+
+#include <functional>
+#include <vector>
+#include <glm/glm.hpp>
+#include "RayTracer.h"
+#include "TileScheduler.h"
+
+// --------------------------------------------------------------------------
+
+struct RenderPass
+{
+	int     blockSize;      // pixels per preview ray along each side, or 1
+	int     firstSample;    // samples accumulated by the pass, when the
+	int     sampleCount;    // image is supersampled in uniform mode
+	bool    shadeOnly;      // shaded from the G-buffer, no primary rays
+};
+
+// Appends the passes of a uniformly supersampled render, which take 1, 1,
+// 2, 4, ... samples per pixel, each as many as all before it, up to
+// maxSamples at a time. Adaptive sampling decides per pixel from its
+// neighbours, so it can't be split into passes and runs whole, as do
+// single sample images; for those nothing is appended and false returned.
+bool AddSamplePasses(const RenderSettings &settings, int maxSamples,
+                     std::vector<RenderPass> &passes);
+
+// traces a sample pass over a tile whose running sums are kept in sums, an
+// image sized buffer, leaving the tile's new sums in colours
+void AccumulateTile(const RayTracer &tracer, const Tile &tile, int width, int height,
+                    const RenderPass &pass, const std::vector<glm::vec3> &sums,
+                    std::vector<glm::vec3> &colours, TraceContext &context);
+
+class ProgressiveRenderer
+{
+public:
+	// receives the colours of a tile, row by row from the bottom; called
+	// from the render threads, several at once
+	typedef std::function<void(const Tile &tile, const glm::vec3 *colours)> TileOutput;
+
+	// starts rendering the tracer's scene in the background, with previews
+	// when progressive is set and a single straight pass otherwise; the
+	// tracer and its settings must stay unchanged until the render ends
+	void Start(const RayTracer &tracer, int width, int height, int tileSize,
+	           int threadCount, const TileOutput &output, bool progressive = true);
+
+	// Like Start(), but shades the image from the first hits recorded by
+	// the last single sample render, which must have run to the end with
+	// the same tracer, camera, geometry and image size; only lights and
+	// materials may have changed since. Returns false, starting nothing,
+	// when there is no such render to reuse.
+	bool Reshade(const RayTracer &tracer, int width, int height, int tileSize,
+	             int threadCount, const TileOutput &output, bool progressive = true);
+	bool CanReshade(int width, int height);
+
+	void Wait()     { m_scheduler.Wait(); }
+	void Cancel()   { m_scheduler.Cancel(); }
+	bool Running() const  { return m_scheduler.Running(); }
+	bool Finished() const { return m_scheduler.Finished(); }
+
+	int PassCount() const  { return int(m_passes.size()); }
+	int PassesDone() const { return m_scheduler.PassesDone(); }
+	const TileScheduler &Scheduler() const { return m_scheduler; }
+
+	// per-thread state of the render, e.g. for its ray counts
+	const std::vector<TraceContext> &Contexts() const { return m_contexts; }
+
+	ProgressiveRenderer() : m_recording(false), m_gbufferReady(false)
+	{}
+
+private:
+	TileScheduler               m_scheduler;
+	std::vector<RenderPass>     m_passes;
+	std::vector<TraceContext>   m_contexts;
+	std::vector<glm::vec3>      m_sums;     // accumulation buffer
+
+	GBuffer                     m_gbuffer;
+	bool                        m_recording;    // the current render fills it
+	bool                        m_gbufferReady; // a render has filled it
+
+	void Launch(const RayTracer &tracer, int width, int height, int tileSize,
+	            int threadCount, const TileOutput &output);
+	void RenderTile(const RayTracer &tracer, int width, int height,
+	                const Tile &tile, int thread, const TileOutput &output);
+};
+
+// --------------------------------------------------------------------------
+#endif // PROGRESSIVE_H
@@ -0,0 +1,999 @@
+// ==========================================================================
+// Whitted-Style Ray Tracer
+// ==========================================================================
+
+#include "RayTracer.h"
+
+#include <cmath>
+#include <algorithm>
+
+using namespace std;
+using namespace glm;
+
+// --------------------------------------------------------------------------
+
+namespace
+{
+	// extra samples are added to a pixel this many at a time
+	const int ADAPTIVE_BATCH = 4;
+
+	// Russian roulette survival is capped below one, so even a path
+	// trapped between perfect mirrors ends; this only guards against a
+	// path that keeps surviving by chance for far longer
+	const float MAX_SURVIVAL = 0.95f;
+	const int MAX_PATH_LENGTH = 256;
+
+	// bounds on irradiance record radii, as fractions of the cache's root
+	// cube: the lower keeps corners from filling with records, the upper
+	// makes wide open surfaces still get a few
+	const float MIN_RECORD_RADIUS = 0.005f;
+	const float MAX_RECORD_RADIUS = 0.125f;
+
+	// samples set out together in a wavefront render; tiles with more
+	// are rendered a few rows at a time to keep the queues this small
+	const int WAVEFRONT_PATHS = 1 << 16;
+
+	// integer hash (from the PCG family) used for repeatable sample jitter
+	unsigned Hash(unsigned x)
+	{
+		unsigned state = x * 747796405u + 2891336453u;
+		unsigned word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+		return (word >> 22u) ^ word;
+	}
+
+	float HashFloat(unsigned x)
+	{
+		return (Hash(x) >> 8) * (1.f / 16777216.f);
+	}
+
+	// next number in [0,1) of the context's random stream
+	float NextRandom(TraceContext &context)
+	{
+		context.random = Hash(context.random);
+		return (context.random >> 8) * (1.f / 16777216.f);
+	}
+
+	// direction about the normal with density cos(theta) / pi, from two
+	// uniform numbers mapped onto the unit disc and lifted to the hemisphere
+	vec3 CosineDirection(const vec3 &normal, float u1, float u2)
+	{
+		vec3 tangent, bitangent;
+		OrthonormalBasis(normal, tangent, bitangent);
+
+		float r = std::sqrt(u1), phi = 6.2831853f * u2;
+		float z = std::sqrt(std::max(1.f - u1, 0.f));
+		return r * std::cos(phi) * tangent + r * std::sin(phi) * bitangent + z * normal;
+	}
+
+	float Luminance(const vec3 &c)
+	{
+		return dot(c, vec3(0.2126f, 0.7152f, 0.0722f));
+	}
+
+	// cells per side of the square grid holding samplesPerPixel samples
+	int StrataPerSide(int samples)
+	{
+		return int(std::ceil(std::sqrt(float(std::max(samples, 1)))));
+	}
+
+	// Visiting order for the cells of a side x side grid. Sorting by the
+	// bit-reversed Morton code visits every quadrant before returning to
+	// one, at every scale, so any prefix of the order covers the pixel
+	// evenly. The scramble varies the order from pixel to pixel.
+	//
+	// Scrambling flips bits of the Morton codes, which flips the mirrored
+	// bits of the sort keys, and the keys are all different; so rather than
+	// sorting for every pixel, the keys are walked upward through a table of
+	// the cell holding each unscrambled key. Passes of a few samples then
+	// don't pay for the whole grid's order each.
+	class StrataOrder
+	{
+		int                 m_bits;
+		std::vector<int>    m_cells;    // by unscrambled key, -1 where none
+
+		unsigned Reversed(unsigned code) const
+		{
+			unsigned reversed = 0;
+			for (int b = 0; b < 2 * m_bits; ++b)
+				reversed |= ((code >> b) & 1u) << (2 * m_bits - 1 - b);
+			return reversed;
+		}
+
+	public:
+		explicit StrataOrder(int side) : m_bits(0)
+		{
+			while ((1 << m_bits) < side) ++m_bits;
+			m_cells.assign(size_t(1) << (2 * m_bits), -1);
+			for (int cy = 0; cy < side; ++cy)
+				for (int cx = 0; cx < side; ++cx)
+				{
+					unsigned morton = 0;
+					for (int b = 0; b < m_bits; ++b)
+						morton |= (((cx >> b) & 1u) << (2 * b)) | (((cy >> b) & 1u) << (2 * b + 1));
+					m_cells[Reversed(morton)] = cy * side + cx;
+				}
+		}
+
+		// the first count cells visited with a scramble
+		void Order(unsigned scramble, int count, vector<int> &order) const
+		{
+			unsigned flip = Reversed(scramble & unsigned(m_cells.size() - 1));
+			order.clear();
+			for (unsigned key = 0; key < m_cells.size() && int(order.size()) < count; ++key)
+				if (m_cells[key ^ flip] >= 0)
+					order.push_back(m_cells[key ^ flip]);
+		}
+	};
+
+	unsigned PixelSeed(int x, int y)
+	{
+		return Hash(unsigned(x) * 73856093u ^ unsigned(y) * 19349663u);
+	}
+}
+
+// --------------------------------------------------------------------------
+
+Ray Camera::GenerateRay(float px, float py, int width, int height) const
+{
+	float focal = 0.5f * width / tan(0.5f * fieldOfView);
+	vec3 direction(px - 0.5f * width, py - 0.5f * height, -focal);
+	return Ray(position, normalize(orientation * direction));
+}
+
+// --------------------------------------------------------------------------
+
+void RayTracer::SetScene(const Scene &scene, BVHLayout layout)
+{
+	m_scene = &scene;
+	m_accelerator.Build(scene, layout);
+	UpdateLights();
+}
+
+void RayTracer::SetScene(const Scene &scene, Accelerator &built)
+{
+	m_scene = &scene;
+	m_accelerator = std::move(built);
+	built = Accelerator();
+	UpdateLights();
+}
+
+void RayTracer::UpdateLights()
+{
+	if (m_scene)
+		m_lightTree.Build(m_scene->lights);
+	else
+		m_lightTree.Clear();
+	UpdateCaustics();
+	ResetIrradianceCache();
+}
+
+void RayTracer::ResetIrradianceCache()
+{
+	// records land on the geometry, or off it on planes, which the cache
+	// keeps apart from its octree
+	AABB bounds = m_accelerator.Hierarchy().Empty() ? AABB() : m_accelerator.Hierarchy().Bounds();
+	bounds.Extend(camera.position);
+	if (m_scene)
+		for (size_t i = 0; i < m_scene->lights.size(); ++i)
+			bounds.Extend(m_scene->lights[i].position);
+	m_irradiance.Reset(bounds, settings.irradianceAccuracy);
+}
+
+void RayTracer::UpdateCaustics()
+{
+	if (!m_scene || settings.causticPhotons <= 0)
+	{
+		m_caustics.Clear();
+		return;
+	}
+	vector<Photon> photons;
+	EmitCausticPhotons(*m_scene, m_accelerator, settings.causticPhotons, 0, photons);
+	m_caustics.Build(photons, settings.causticPhotons);
+}
+
+bool RayTracer::RefitScene(bool meshesMoved, float maxCostGrowth)
+{
+	bool refitted = m_accelerator.Refit(meshesMoved, maxCostGrowth);
+	UpdateCaustics();
+	ResetIrradianceCache();
+	return refitted;
+}
+
+vec3 RayTracer::Trace(const Ray &ray, TraceContext &context, int depth) const
+{
+	Hit hit;
+	if (!m_scene || !m_accelerator.Intersect(ray, hit))
+		return settings.background;
+	return Shade(ray, hit, context, depth);
+}
+
+vec3 RayTracer::RenderPixel(int x, int y, int width, int height,
+                            TraceContext &context) const
+{
+	context.random = PixelSeed(x, y);
+	return Trace(camera.GenerateRay(x + 0.5f, y + 0.5f, width, height), context);
+}
+
+void RayTracer::RenderTile(const Tile &tile, int width, int height,
+                           vector<vec3> &colours, TraceContext &context,
+                           GBuffer *gbuffer) const
+{
+	colours.resize(tile.width * tile.height);
+	bool wavefront = settings.wavefront && !settings.pathTracing;
+	if (settings.samplesPerPixel <= 1)
+	{
+		if (!wavefront)
+			RenderTileCentres(tile, width, height, colours, context, gbuffer);
+		else
+		{
+			colours.assign(tile.width * tile.height, vec3(0.f));
+			RenderTileWavefront(tile, width, height, 0, 1, colours, context, gbuffer);
+		}
+		return;
+	}
+	if (settings.adaptive)
+	{
+		RenderTileAdaptive(tile, width, height, colours, context);
+		return;
+	}
+
+	// the same sums a progressive render builds up over several passes
+	int samples = settings.samplesPerPixel;
+	colours.assign(tile.width * tile.height, vec3(0.f));
+	AccumulateSamples(tile, width, height, 0, samples, colours, context);
+	for (size_t i = 0; i < colours.size(); ++i)
+		colours[i] /= float(samples);
+}
+
+void RayTracer::AccumulateSamples(const Tile &tile, int width, int height,
+                                  int first, int count, vector<vec3> &sums,
+                                  TraceContext &context) const
+{
+	if (settings.wavefront && !settings.pathTracing)
+	{
+		RenderTileWavefront(tile, width, height, first, count, sums, context, 0);
+		return;
+	}
+
+	int side = StrataPerSide(settings.samplesPerPixel);
+	int last = std::min(first + count, side * side);
+	StrataOrder strata(side);
+	vector<int> order;
+	for (int j = 0; j < tile.height; ++j)
+		for (int i = 0; i < tile.width; ++i)
+		{
+			int x = tile.x + i, y = tile.y + j;
+			strata.Order(PixelSeed(x, y), last, order);
+			vec3 &sum = sums[j * tile.width + i];
+			for (int k = first; k < last; ++k)
+				sum += Sample(x, y, order[k], width, height, context);
+		}
+}
+
+void RayTracer::RenderTileCoarse(const Tile &tile, int width, int height,
+                                 int blockSize, vector<vec3> &colours,
+                                 TraceContext &context) const
+{
+	// blocks are aligned to the image rather than the tile, so previews of
+	// neighbouring tiles line up
+	colours.resize(tile.width * tile.height);
+	for (int by = tile.y / blockSize * blockSize; by < tile.y + tile.height; by += blockSize)
+		for (int bx = tile.x / blockSize * blockSize; bx < tile.x + tile.width; bx += blockSize)
+		{
+			float px = std::min(bx + 0.5f * blockSize, float(width));
+			float py = std::min(by + 0.5f * blockSize, float(height));
+			++context.primarySamples;
+			context.random = PixelSeed(bx, by);
+			vec3 colour = Trace(camera.GenerateRay(px, py, width, height), context);
+
+			int x0 = std::max(bx, tile.x), x1 = std::min(bx + blockSize, tile.x + tile.width);
+			int y0 = std::max(by, tile.y), y1 = std::min(by + blockSize, tile.y + tile.height);
+			for (int y = y0; y < y1; ++y)
+				for (int x = x0; x < x1; ++x)
+					colours[(y - tile.y) * tile.width + x - tile.x] = colour;
+		}
+}
+
+void RayTracer::ShadeTile(const Tile &tile, int width, int height,
+                          const GBuffer &gbuffer, int blockSize,
+                          vector<vec3> &colours, TraceContext &context) const
+{
+	colours.resize(tile.width * tile.height);
+	blockSize = std::max(blockSize, 1);
+	for (int by = tile.y / blockSize * blockSize; by < tile.y + tile.height; by += blockSize)
+		for (int bx = tile.x / blockSize * blockSize; bx < tile.x + tile.width; bx += blockSize)
+		{
+			// the G-buffer only has pixel centres, so previews shade the
+			// pixel nearest the middle of the block
+			int x = std::min(bx + blockSize / 2, width - 1);
+			int y = std::min(by + blockSize / 2, height - 1);
+			const GBufferSample &sample = gbuffer.At(x, y);
+			vec3 colour = settings.background;
+			if (m_scene && sample.primitive >= 0)
+			{
+				vec3 direction = camera.GenerateRay(x + 0.5f, y + 0.5f, width, height).direction;
+				context.random = PixelSeed(x, y);
+				colour = ShadeSurface(direction, sample.primitive, sample.position,
+				                      sample.normal, context, 0);
+			}
+
+			int x0 = std::max(bx, tile.x), x1 = std::min(bx + blockSize, tile.x + tile.width);
+			int y0 = std::max(by, tile.y), y1 = std::min(by + blockSize, tile.y + tile.height);
+			for (int py = y0; py < y1; ++py)
+				for (int px = x0; px < x1; ++px)
+					colours[(py - tile.y) * tile.width + px - tile.x] = colour;
+		}
+}
+
+void RayTracer::RenderTileCentres(const Tile &tile, int width, int height,
+                                  vector<vec3> &colours, TraceContext &context,
+                                  GBuffer *gbuffer) const
+{
+	colours.resize(tile.width * tile.height);
+	context.primarySamples += tile.width * tile.height;
+	switch (settings.packetSize)
+	{
+	case 4:  RenderTilePackets<4>(tile, width, height, colours, context, gbuffer); return;
+	case 8:  RenderTilePackets<8>(tile, width, height, colours, context, gbuffer); return;
+	case 16: RenderTilePackets<16>(tile, width, height, colours, context, gbuffer); return;
+	}
+
+	for (int j = 0; j < tile.height; ++j)
+		for (int i = 0; i < tile.width; ++i)
+		{
+			int x = tile.x + i, y = tile.y + j;
+			Ray ray = camera.GenerateRay(x + 0.5f, y + 0.5f, width, height);
+			Hit hit;
+			if (m_scene)
+				m_accelerator.Intersect(ray, hit);
+			colours[j * tile.width + i] = ShadePrimary(x, y, ray, hit, context, gbuffer);
+		}
+}
+
+vec3 RayTracer::ShadePrimary(int x, int y, const Ray &ray, const Hit &hit,
+                             TraceContext &context, GBuffer *gbuffer) const
+{
+	context.random = PixelSeed(x, y);
+	if (!gbuffer)
+		return hit.Valid() ? Shade(ray, hit, context, 0) : settings.background;
+
+	GBufferSample &sample = gbuffer->At(x, y);
+	sample.primitive = hit.primitive;
+	sample.u = hit.u;
+	sample.v = hit.v;
+	if (!hit.Valid())
+		return settings.background;
+	SurfaceAt(ray, hit, sample.position, sample.normal);
+	return ShadeSurface(ray.direction, hit.primitive, sample.position, sample.normal,
+	                    context, 0);
+}
+
+template <int N>
+void RayTracer::RenderTilePackets(const Tile &tile, int width, int height,
+                                  vector<vec3> &colours, TraceContext &context,
+                                  GBuffer *gbuffer) const
+{
+	int blockWidth, blockHeight;
+	PacketFootprint(N, blockWidth, blockHeight);
+
+	RayPacket<N> packet;
+	Hit hits[N];
+	for (int by = 0; by < tile.height; by += blockHeight)
+		for (int bx = 0; bx < tile.width; bx += blockWidth)
+		{
+			// lanes falling outside the tile are disabled
+			for (int k = 0; k < N; ++k)
+			{
+				int i = bx + k % blockWidth, j = by + k / blockWidth;
+				if (i < tile.width && j < tile.height)
+					packet.Set(k, camera.GenerateRay(tile.x + i + 0.5f, tile.y + j + 0.5f,
+					                                 width, height));
+				else
+					packet.Disable(k);
+			}
+
+			m_accelerator.IntersectPacket(packet, hits);
+
+			for (int k = 0; k < N; ++k)
+			{
+				int i = bx + k % blockWidth, j = by + k / blockWidth;
+				if (i >= tile.width || j >= tile.height) continue;
+				colours[j * tile.width + i] = ShadePrimary(tile.x + i, tile.y + j, packet.Get(k),
+				                                           hits[k], context, gbuffer);
+			}
+		}
+}
+
+vec3 RayTracer::Sample(int x, int y, int cell, int width, int height,
+                       TraceContext &context) const
+{
+	++context.primarySamples;
+	Ray ray = SampleRay(x, y, cell, width, height, context.random);
+	return Trace(ray, context);
+}
+
+Ray RayTracer::SampleRay(int x, int y, int cell, int width, int height, unsigned &seed) const
+{
+	int side = StrataPerSide(settings.samplesPerPixel);
+	seed = PixelSeed(x, y) ^ Hash(unsigned(cell));
+	float px = x + (cell % side + HashFloat(seed)) / side;
+	float py = y + (cell / side + HashFloat(seed + 1u)) / side;
+	return camera.GenerateRay(px, py, width, height);
+}
+
+void RayTracer::RenderTileAdaptive(const Tile &tile, int width, int height,
+                                   vector<vec3> &colours, TraceContext &context) const
+{
+	// first pass: one centre sample for the tile plus a one pixel border,
+	// so that contrast can be judged across tile edges too
+	int x0 = std::max(tile.x - 1, 0), y0 = std::max(tile.y - 1, 0);
+	int x1 = std::min(tile.x + tile.width + 1, width);
+	int y1 = std::min(tile.y + tile.height + 1, height);
+	Tile outer = { x0, y0, x1 - x0, y1 - y0, 0 };
+	vector<vec3> base;
+	RenderTileCentres(outer, width, height, base, context);
+
+	int cap = settings.samplesPerPixel;
+	StrataOrder strata(StrataPerSide(cap));
+	vector<int> order;
+	for (int j = 0; j < tile.height; ++j)
+		for (int i = 0; i < tile.width; ++i)
+		{
+			int ox = tile.x + i - x0, oy = tile.y + j - y0;
+			vec3 centre = base[oy * outer.width + ox];
+
+			// Mitchell's relative contrast over the 3x3 neighbourhood
+			vec3 lo = centre, hi = centre;
+			for (int dy = -1; dy <= 1; ++dy)
+				for (int dx = -1; dx <= 1; ++dx)
+				{
+					int nx = ox + dx, ny = oy + dy;
+					if (nx < 0 || ny < 0 || nx >= outer.width || ny >= outer.height)
+						continue;
+					lo = glm::min(lo, base[ny * outer.width + nx]);
+					hi = glm::max(hi, base[ny * outer.width + nx]);
+				}
+			vec3 contrast = (hi - lo) / glm::max(hi + lo, vec3(1e-4f));
+			if (glm::max(contrast.x, glm::max(contrast.y, contrast.z)) <= settings.contrastThreshold)
+			{
+				colours[j * tile.width + i] = centre;
+				continue;
+			}
+
+			// refine in batches until the mean is trustworthy or the cap is
+			// hit; a few samples can all land on one side of an edge and look
+			// noise free, so the error is only trusted after half the budget
+			int x = tile.x + i, y = tile.y + j;
+			strata.Order(PixelSeed(x, y), cap, order);
+			vec3 sum = centre;
+			float lumSum = Luminance(centre), lumSquares = lumSum * lumSum;
+			int n = 1;
+			while (n < cap)
+			{
+				for (int b = 0; b < ADAPTIVE_BATCH && n < cap; ++b, ++n)
+				{
+					vec3 c = Sample(x, y, order[n - 1], width, height, context);
+					float lum = Luminance(c);
+					sum += c;
+					lumSum += lum;
+					lumSquares += lum * lum;
+				}
+				if (2 * n < cap) continue;
+				float mean = lumSum / n;
+				float variance = std::max(lumSquares / n - mean * mean, 0.f) * n / (n - 1);
+				if (std::sqrt(variance / n) < settings.errorThreshold)
+					break;
+			}
+			colours[j * tile.width + i] = sum / float(n);
+		}
+}
+
+// --------------------------------------------------------------------------
+
+bool RayTracer::InShadow(const Ray &ray, int light, TraceContext &context) const
+{
+	++context.shadowRays;
+	if (int(context.lastOccluder.size()) != int(m_scene->lights.size()))
+		context.lastOccluder.assign(m_scene->lights.size(), -1);
+
+	// try the primitive that blocked this light last time before searching
+	PrimitiveId &cached = context.lastOccluder[light];
+	if (cached >= 0 && cached < m_scene->PrimitiveCount())
+	{
+		Ray r = ray;
+		Hit hit;
+		if (m_scene->IntersectPrimitive(cached, r, hit))
+		{
+			++context.occluderCacheHits;
+			return true;
+		}
+	}
+
+	PrimitiveId occluder;
+	if (!m_accelerator.Occluded(ray, occluder))
+		return false;
+	cached = occluder;
+	return true;
+}
+
+bool RayTracer::UnshadowedLight(int light, const Material &material, const vec3 &position,
+                                const vec3 &normal, const vec3 &view, vec3 &colour,
+                                Ray &shadow) const
+{
+	const Light &source = m_scene->lights[light];
+	vec3 toLight = source.position - position;
+	float distance = length(toLight);
+	vec3 l = toLight / distance;
+	float diffuse = dot(normal, l);
+	if (diffuse <= 0.f)
+		return false;
+
+	shadow = Ray(position + SURFACE_EPSILON * normal, l, 0.f, distance);
+	float specular = pow(glm::max(dot(normal, normalize(l + view)), 0.f), material.shininess);
+	colour = source.colour * source.Attenuation(distance) *
+	         (material.diffuse * diffuse + material.specular * specular);
+	return true;
+}
+
+vec3 RayTracer::DirectLight(int light, const Material &material, const vec3 &position,
+                            const vec3 &normal, const vec3 &view, TraceContext &context) const
+{
+	vec3 colour;
+	Ray shadow;
+	if (!UnshadowedLight(light, material, position, normal, view, colour, shadow) ||
+	    InShadow(shadow, light, context))
+		return vec3(0.f);
+	return colour;
+}
+
+void RayTracer::SurfaceAt(const Ray &ray, const Hit &hit, vec3 &position,
+                          vec3 &normal) const
+{
+	position = ray.At(hit.t);
+	normal = m_scene->Normal(hit.primitive, position);
+	if (dot(normal, ray.direction) > 0.f)
+		normal = -normal;
+}
+
+vec3 RayTracer::Shade(const Ray &ray, const Hit &hit, TraceContext &context,
+                      int depth) const
+{
+	vec3 position, normal;
+	SurfaceAt(ray, hit, position, normal);
+	return ShadeSurface(ray.direction, hit.primitive, position, normal, context, depth);
+}
+
+template <class Visit>
+void RayTracer::ForEachLight(const vec3 &position, const vec3 &normal, TraceContext &context,
+                             Visit visit) const
+{
+	int lightCount = int(m_scene->lights.size());
+	if (settings.lightSamples > 0 && lightCount >= std::max(settings.manyLights, 1) &&
+	    !m_lightTree.Empty())
+	{
+		// each pick stands in for every light, weighted by its probability
+		for (int s = 0; s < settings.lightSamples; ++s)
+		{
+			float probability;
+			int light = m_lightTree.Sample(position, normal, NextRandom(context), probability);
+			if (light >= 0)
+				visit(light, probability * settings.lightSamples);
+		}
+	}
+	else
+		for (int i = 0; i < lightCount; ++i)
+			visit(i, 1.f);
+}
+
+void RayTracer::AddDirectLight(const Material &material, const vec3 &position,
+                               const vec3 &normal, const vec3 &view, vec3 &colour,
+                               TraceContext &context) const
+{
+	ForEachLight(position, normal, context, [&](int light, float divisor) {
+		colour += DirectLight(light, material, position, normal, view, context) / divisor;
+	});
+}
+
+void RayTracer::AddCausticLight(const Material &material, const vec3 &position,
+                                const vec3 &normal, vec3 &colour, TraceContext &context) const
+{
+	if (!m_caustics.Empty())
+		colour += material.diffuse * m_caustics.Density(position, normal,
+		                                                settings.causticNeighbours,
+		                                                settings.causticRadius,
+		                                                context.nearPhotons);
+}
+
+vec3 RayTracer::ShadeSurface(const vec3 &direction, PrimitiveId primitive, const vec3 &position,
+                             const vec3 &normal, TraceContext &context, int depth) const
+{
+	if (settings.pathTracing)
+		return TracePath(direction, primitive, position, normal, context);
+
+	const Material &material = m_scene->materials[m_scene->MaterialOf(primitive)];
+	vec3 view = -normalize(direction);
+	vec3 colour = settings.ambient * material.diffuse;
+	AddDirectLight(material, position, normal, view, colour, context);
+	AddCausticLight(material, position, normal, colour, context);
+
+	if (material.reflectance > 0.f && depth < settings.maxDepth)
+	{
+		vec3 origin = position + SURFACE_EPSILON * normal;
+		Ray reflected(origin, reflect(direction, normal));
+		++context.reflectionRays;
+		colour = mix(colour, Trace(reflected, context, depth + 1), material.reflectance);
+	}
+	return colour;
+}
+
+vec3 RayTracer::TracePath(const vec3 &direction, PrimitiveId primitive, const vec3 &position,
+                          const vec3 &normal, TraceContext &context,
+                          bool cacheIrradiance) const
+{
+	vec3 colour(0.f), throughput(1.f);
+	vec3 incoming = normalize(direction), p = position, n = normal;
+	for (int bounce = 0; bounce < MAX_PATH_LENGTH; ++bounce)
+	{
+		// the Whitted shading mixes the mirror image in by the reflectance;
+		// following the mirror that often gives the same mix on average
+		const Material &material = m_scene->materials[m_scene->MaterialOf(primitive)];
+		vec3 next;
+		if (material.reflectance > 0.f && NextRandom(context) < material.reflectance)
+			next = reflect(incoming, n);
+		else
+		{
+			vec3 direct(0.f);
+			AddDirectLight(material, p, n, -incoming, direct, context);
+			AddCausticLight(material, p, n, direct, context);
+			if (cacheIrradiance && settings.irradianceCaching)
+			{
+				colour += throughput * (direct + material.diffuse * CachedIrradiance(p, n, context));
+				break;
+			}
+			colour += throughput * direct;
+
+			// with cosine-weighted directions the cosine and the density
+			// cancel, leaving the albedo as the path's weight
+			float u1 = NextRandom(context), u2 = NextRandom(context);
+			next = CosineDirection(n, u1, u2);
+			throughput *= material.diffuse;
+		}
+
+		float strongest = glm::max(throughput.r, glm::max(throughput.g, throughput.b));
+		if (strongest <= 0.f)
+			break;
+		if (bounce >= settings.rouletteDepth)
+		{
+			float survival = std::min(strongest, MAX_SURVIVAL);
+			if (NextRandom(context) >= survival)
+				break;
+			throughput /= survival;
+		}
+
+		Ray ray(p + SURFACE_EPSILON * n, next);
+		++context.bounceRays;
+		Hit hit;
+		if (!m_accelerator.Intersect(ray, hit))
+		{
+			colour += throughput * settings.background;
+			break;
+		}
+		primitive = hit.primitive;
+		incoming = next;
+		SurfaceAt(ray, hit, p, n);
+	}
+	return colour;
+}
+
+// --------------------------------------------------------------------------
+
+vec3 RayTracer::CachedIrradiance(const vec3 &position, const vec3 &normal,
+                                 TraceContext &context) const
+{
+	vec3 irradiance;
+	if (m_irradiance.Interpolate(position, normal, irradiance))
+		return irradiance;
+
+	// two threads reaching the same gap at once both fill it, which only
+	// costs the time of one record
+	IrradianceRecord record = MakeIrradianceRecord(position, normal, context);
+	m_irradiance.Add(record);
+	return record.irradiance;
+}
+
+IrradianceRecord RayTracer::MakeIrradianceRecord(const vec3 &position, const vec3 &normal,
+                                                 TraceContext &context) const
+{
+	// Ward and Heckbert's stratification: M rings of equal projected solid
+	// angle, each cut into N cells, with about pi times as many cells
+	// around as rings
+	int samples = std::max(settings.irradianceSamples, 4);
+	int rings = std::max(int(std::sqrt(samples / 3.14159265f) + 0.5f), 1);
+	int sectors = std::max(samples / rings, 1);
+	vec3 tangent, bitangent;
+	OrthonormalBasis(normal, tangent, bitangent);
+
+	vector<vec3> radiance(rings * sectors);
+	vector<float> distance(rings * sectors);
+	IrradianceRecord record;
+	record.position = position;
+	record.normal = normal;
+	record.irradiance = vec3(0.f);
+	record.rotational = mat3(0.f);
+	record.translational = mat3(0.f);
+
+	float inverseDistances = 0.f;
+	for (int k = 0; k < sectors; ++k)
+		for (int j = 0; j < rings; ++j)
+		{
+			float sin2 = (j + NextRandom(context)) / rings;
+			float phi = 6.2831853f * (k + NextRandom(context)) / sectors;
+			float sinTheta = std::sqrt(sin2), cosTheta = std::sqrt(std::max(1.f - sin2, 0.f));
+			vec3 direction = sinTheta * std::cos(phi) * tangent +
+			                 sinTheta * std::sin(phi) * bitangent + cosTheta * normal;
+
+			Ray ray(position + SURFACE_EPSILON * normal, direction);
+			++context.bounceRays;
+			Hit hit;
+			vec3 &L = radiance[k * rings + j];
+			float &d = distance[k * rings + j];
+			if (m_accelerator.Intersect(ray, hit))
+			{
+				vec3 p, n;
+				SurfaceAt(ray, hit, p, n);
+				L = TracePath(direction, hit.primitive, p, n, context, false);
+				d = hit.t;
+				inverseDistances += 1.f / std::max(hit.t, 1e-6f);
+			}
+			else
+			{
+				L = settings.background;
+				d = INFINITY;
+			}
+			record.irradiance += L;
+
+			// turning the normal about v tips it toward this cell, which
+			// then weighs more by the change in its cosine
+			vec3 v(-std::sin(phi) * tangent + std::cos(phi) * bitangent);
+			record.rotational += outerProduct(v, L * (sinTheta / std::max(cosTheta, 1e-3f)));
+		}
+
+	float cells = float(rings * sectors);
+	record.irradiance /= cells;
+	record.rotational /= cells;
+
+	// Moving the point shifts the walls between neighbouring cells by
+	// their distance; radiance crossing each wall changes the estimate.
+	// The estimate here is irradiance over pi, hence the scale.
+	for (int k = 0; k < sectors; ++k)
+	{
+		float phiMiddle = 6.2831853f * (k + 0.5f) / sectors;
+		float phiEdge = 6.2831853f * k / sectors;
+		vec3 u(std::cos(phiMiddle) * tangent + std::sin(phiMiddle) * bitangent);
+		vec3 v(-std::sin(phiEdge) * tangent + std::cos(phiEdge) * bitangent);
+		int previous = (k + sectors - 1) % sectors;
+
+		vec3 polar(0.f), azimuthal(0.f);
+		for (int j = 0; j < rings; ++j)
+		{
+			float sinLower = std::sqrt(float(j) / rings);
+			float sinUpper = std::sqrt(float(j + 1) / rings);
+			const vec3 &L = radiance[k * rings + j];
+			if (j > 0)
+			{
+				float nearest = std::min(distance[k * rings + j], distance[k * rings + j - 1]);
+				float cos2 = 1.f - float(j) / rings;
+				if (nearest < INFINITY)
+					polar += (sinLower * cos2 / nearest) * (L - radiance[k * rings + j - 1]);
+			}
+			float nearest = std::min(distance[k * rings + j], distance[previous * rings + j]);
+			if (nearest < INFINITY)
+				azimuthal += ((sinUpper - sinLower) / nearest) * (L - radiance[previous * rings + j]);
+		}
+		record.translational += outerProduct(u, polar * (6.2831853f / sectors)) +
+		                        outerProduct(v, azimuthal);
+	}
+	record.translational /= 3.14159265f;
+
+	// the harmonic mean distance, kept within the spacing limits and
+	// below what the translational gradient says the light changes over
+	float size = m_irradiance.CubeSize();
+	float radius = inverseDistances > 0.f ? cells / inverseDistances : INFINITY;
+	for (int c = 0; c < 3; ++c)
+	{
+		float slope = length(record.translational[c]);
+		if (slope > 0.f)
+			radius = std::min(radius, record.irradiance[c] / slope);
+	}
+	record.radius = glm::clamp(radius, MIN_RECORD_RADIUS * size, MAX_RECORD_RADIUS * size);
+	return record;
+}
+
+// --------------------------------------------------------------------------
+
+// Wavefront rendering
+
+void RayTracer::RenderTileWavefront(const Tile &tile, int width, int height, int first,
+                                    int count, vector<vec3> &sums, TraceContext &context,
+                                    GBuffer *gbuffer) const
+{
+	bool centres = settings.samplesPerPixel <= 1;
+	int side = StrataPerSide(settings.samplesPerPixel);
+	int last = centres ? 1 : std::min(first + count, side * side);
+	if (centres)
+		first = 0;
+	if (first >= last)
+		return;
+
+	AABB bounds = m_scene && !m_accelerator.Hierarchy().Empty() ?
+	              m_accelerator.Hierarchy().Bounds() : AABB();
+	CoherenceGrid grid(bounds);
+	Wavefront &wave = context.wavefront;
+	StrataOrder strata(side);
+	vector<int> order;
+
+	int rows = std::max(WAVEFRONT_PATHS / (tile.width * (last - first)), 1);
+	for (int rowsDone = 0; rowsDone < tile.height; rowsDone += rows)
+	{
+		// paths are made in the order the recursive render traces them,
+		// which is also the order their colours are summed in at the end
+		int rowsEnd = std::min(rowsDone + rows, tile.height);
+		wave.Clear(settings.maxDepth, (rowsEnd - rowsDone) * tile.width * (last - first));
+		for (int j = rowsDone; j < rowsEnd; ++j)
+			for (int i = 0; i < tile.width; ++i)
+			{
+				int x = tile.x + i, y = tile.y + j;
+				if (!centres)
+					strata.Order(PixelSeed(x, y), last, order);
+				for (int k = first; k < last; ++k)
+				{
+					unsigned seed = PixelSeed(x, y);
+					Ray ray = centres ?
+					          camera.GenerateRay(x + 0.5f, y + 0.5f, width, height) :
+					          SampleRay(x, y, order[k], width, height, seed);
+					++context.primarySamples;
+					wave.rays.Push(ray, wave.AddPath(seed, j * tile.width + i));
+				}
+			}
+
+		for (int bounce = 0; wave.rays.Size() > 0 && m_scene; ++bounce)
+		{
+			ExtendWavefront(wave, grid, bounce == 0 && centres);
+			if (bounce == 0 && gbuffer && centres)
+				for (int i = 0; i < wave.rays.Size(); ++i)
+				{
+					int pixel = wave.pixel[wave.rays.path[i]];
+					GBufferSample &sample = gbuffer->At(tile.x + pixel % tile.width,
+					                                    tile.y + pixel / tile.width);
+					Hit hit = wave.hits.Get(i);
+					sample.primitive = hit.primitive;
+					sample.u = hit.u;
+					sample.v = hit.v;
+					if (hit.Valid())
+						SurfaceAt(wave.rays.Get(i), hit, sample.position, sample.normal);
+				}
+			ShadeWavefront(wave, context);
+			ShadowWavefront(wave, grid, context);
+			wave.rays.Clear();
+			swap(wave.rays, wave.next);
+		}
+
+		// each chain folds up from its far end as the recursion unwinds:
+		// an escaped ray's background, mixed into every mirror before it
+		for (size_t p = 0; p < wave.depth.size(); ++p)
+		{
+			vec3 colour = settings.background;
+			for (int d = wave.depth[p] - 1; d >= 0; --d)
+			{
+				int v = int(p) * wave.vertices + d;
+				colour = wave.reflectance[v] > 0.f ?
+				         mix(wave.local[v], colour, wave.reflectance[v]) : wave.local[v];
+			}
+			sums[wave.pixel[p]] += colour;
+		}
+	}
+}
+
+void RayTracer::ExtendWavefront(Wavefront &wave, const CoherenceGrid &grid, bool centres) const
+{
+	// rays through pixel centres come in pixel order, already as coherent
+	// as rays get, and go in packets as in the recursive render; the rest
+	// are sorted and traced one at a time, again as there, so that both
+	// find exactly the same hits
+	if (centres)
+	{
+		wave.order.resize(wave.rays.Size());
+		for (int i = 0; i < wave.rays.Size(); ++i)
+			wave.order[i] = i;
+		IntersectQueue(m_accelerator, wave.rays, wave.order, settings.packetSize, wave.hits);
+		return;
+	}
+	SortByKey(wave.rays, grid, wave.keys, wave.order, wave.scratch);
+	IntersectQueue(m_accelerator, wave.rays, wave.order, 1, wave.hits);
+}
+
+void RayTracer::ShadeWavefront(Wavefront &wave, TraceContext &context) const
+{
+	// hits on one material are shaded together, and misses, which leave
+	// their paths as they are, go in a bin of their own at the end
+	int materials = int(m_scene->materials.size());
+	wave.bins.resize(wave.rays.Size());
+	for (int i = 0; i < wave.rays.Size(); ++i)
+	{
+		PrimitiveId primitive = wave.hits.primitive[i];
+		wave.bins[i] = primitive >= 0 ? m_scene->MaterialOf(primitive) : materials;
+	}
+	SortByBin(wave.bins, materials + 1, wave.order);
+
+	wave.shadows.Clear();
+	wave.next.Clear();
+	for (size_t k = 0; k < wave.order.size(); ++k)
+	{
+		int i = wave.order[k];
+		if (wave.bins[i] == materials)
+			break;
+		int path = wave.rays.path[i];
+		int vertex = wave.Vertex(path);
+		Ray ray = wave.rays.Get(i);
+		vec3 position, normal;
+		SurfaceAt(ray, wave.hits.Get(i), position, normal);
+
+		const Material &material = m_scene->materials[wave.bins[i]];
+		vec3 view = -normalize(ray.direction);
+		wave.local[vertex] = settings.ambient * material.diffuse;
+		context.random = wave.random[path];
+		ForEachLight(position, normal, context, [&](int light, float divisor) {
+			vec3 colour;
+			Ray shadow;
+			if (UnshadowedLight(light, material, position, normal, view, colour, shadow))
+				wave.shadows.Push(shadow, path, light, colour / divisor);
+		});
+		wave.random[path] = context.random;
+		if (!m_caustics.Empty())
+		{
+			wave.caustic[path] = vec3(0.f);
+			AddCausticLight(material, position, normal, wave.caustic[path], context);
+		}
+
+		wave.reflectance[vertex] = 0.f;
+		if (material.reflectance > 0.f && wave.depth[path] < settings.maxDepth)
+		{
+			vec3 origin = position + SURFACE_EPSILON * normal;
+			wave.next.Push(Ray(origin, reflect(ray.direction, normal)), path);
+			++context.reflectionRays;
+			wave.reflectance[vertex] = material.reflectance;
+		}
+	}
+}
+
+void RayTracer::ShadowWavefront(Wavefront &wave, const CoherenceGrid &grid,
+                                TraceContext &context) const
+{
+	// sorted shadow rays toward one light tend to be blocked by the same
+	// object one after another, which the occluder cache makes the most of
+	ShadowQueue &shadows = wave.shadows;
+	SortByKey(shadows.rays, grid, wave.keys, wave.order, wave.scratch);
+	wave.blocked.resize(shadows.Size());
+	for (size_t k = 0; k < wave.order.size(); ++k)
+	{
+		int i = wave.order[k];
+		wave.blocked[i] = InShadow(shadows.rays.Get(i), shadows.light[i], context);
+	}
+
+	// queue order keeps each surface's lights in the order it met them
+	for (int i = 0; i < shadows.Size(); ++i)
+		if (!wave.blocked[i])
+			wave.local[wave.Vertex(shadows.rays.path[i])] += shadows.colour[i];
+
+	for (int i = 0; i < wave.rays.Size(); ++i)
+	{
+		if (wave.hits.primitive[i] < 0)
+			continue;
+		int path = wave.rays.path[i];
+		if (!m_caustics.Empty())
+			wave.local[wave.Vertex(path)] += wave.caustic[path];
+		++wave.depth[path];
+	}
+}
+
+// --------------------------------------------------------------------------
@@ -0,0 +1,366 @@
+// ==========================================================================
+// Whitted-Style Ray Tracer
+//  - pinhole camera generating primary rays through pixel positions
+//  - Phong shading with hard shadows from point lights
+//  - many-light mode: scenes with lots of lights are shaded from a few
+//    lights per point, picked through a light tree by their likely
+//    contribution (see LightTree.h)
+//  - recursive mirror reflection up to a fixed depth
+//  - path tracing mode: global illumination from cosine-weighted diffuse
+//    bounces, with next-event estimation toward the lights at every
+//    vertex and Russian roulette ending paths without bias
+//  - caustics from a photon map, in either mode (see PhotonMap.h)
+//  - irradiance caching for path tracing: indirect light at the first
+//    diffuse surface of a path is interpolated between sparse records
+//    shared by every thread (see IrradianceCache.h)
+//  - wavefront mode: Whitted renders traced a tile at a time in stages,
+//    each over a queue of rays sorted for coherence (see Wavefront.h)
+//
+// Primary rays are traced in SIMD packets over small pixel blocks; shadow
+// and reflection rays go through the scalar path one at a time. Shadow rays
+// use an any-hit query, tried first against the primitive that last
+// blocked the same light on the same thread, since neighbouring pixels are
+// usually shadowed by the same object.
+//
+// In many-light and path tracing modes the random numbers come from a
+// stream held by each thread's context and seeded by the pixel and sample,
+// so a pixel shades the same however tiles fall on threads, and noise
+// doesn't crawl between progressive passes.
+//
+// Point lights can't be hit by a bounce, so paths gather light only
+// through next-event estimation and nothing is counted twice. The diffuse
+// reflectance is read as an albedo, with light colours standing for
+// intensity over pi, which keeps direct light exactly as bright as in the
+// Whitted shading; the mirror part of a material is followed with
+// probability equal to its reflectance, and the ambient term is dropped,
+// since the bounces now gather that light.
+//
+// In wavefront mode a tile's samples set out together: each stage traces
+// a whole queue of rays, sorted for coherence, before the next one shades
+// the hits and queues the shadow and reflected rays. Samples fold their
+// reflections back up in the order the recursive shading does, so the
+// image matches the recursive tracer's. Path tracing and adaptive sampling
+// always trace recursively.
+//
+// Single sample renders can record the first hit of every primary ray in a
+// G-buffer. Lights and materials play no part in finding those hits, so
+// after changing them the image can be shaded again from the G-buffer,
+// tracing only shadow and reflection rays.
+// ==========================================================================
+#ifndef RAYTRACER_H
+#define RAYTRACER_H
+
+#include <vector>
+#include <glm/glm.hpp>
+#include "Scene.h"
+#include "Accelerator.h"
+#include "LightTree.h"
+#include "PhotonMap.h"
+#include "IrradianceCache.h"
+#include "Wavefront.h"
+#include "TileScheduler.h"
+
+// --------------------------------------------------------------------------
+
+struct Camera
+{
+	glm::vec3 position;
+	glm::mat3 orientation;  // columns are the right, up and backward axes
+	float   fieldOfView;    // horizontal, in radians
+
+	Camera() : position(0.f), orientation(1.f), fieldOfView(glm::radians(60.f))
+	{}
+
+	// ray through image-plane position (px, py), measured in pixels with
+	// (0,0) at the bottom-left corner of the image
+	Ray GenerateRay(float px, float py, int width, int height) const;
+};
+
+struct RenderSettings
+{
+	int     maxDepth;       // number of reflection bounces
+	float   ambient;        // fraction of diffuse colour lit everywhere
+	glm::vec3 background;   // colour of rays that escape the scene
+	int     packetSize;     // primary rays traced together: 4, 8 or 16,
+	                        // or 1 to trace every ray on its own
+
+	// Anti-aliasing. Uniform mode traces samplesPerPixel jittered samples,
+	// one per cell of a square grid, in every pixel. Adaptive mode traces
+	// one sample per pixel, and only pixels whose 3x3 neighbourhood has a
+	// relative contrast above contrastThreshold get further stratified
+	// samples, until the standard error of their mean luminance drops
+	// below errorThreshold or samplesPerPixel is reached.
+	int     samplesPerPixel;
+	bool    adaptive;
+	float   contrastThreshold;
+	float   errorThreshold;
+
+	// Many-light mode. Scenes with at least manyLights lights send
+	// lightSamples shadow rays per shading point, to lights picked through
+	// the light tree, instead of one to every light; a lightSamples of
+	// zero always shades every light.
+	int     lightSamples;
+	int     manyLights;
+
+	// Path tracing. Every sample follows one path of diffuse and mirror
+	// bounces instead of the Whitted reflection tree, and maxDepth and
+	// ambient are ignored. Past rouletteDepth bounces each further bounce
+	// is survived with the probability of the path's remaining throughput;
+	// three spares the early bounces that carry most of the light.
+	bool    pathTracing;
+	int     rouletteDepth;
+
+	// Caustics. Scenes are lit by way of their mirrors too when
+	// causticPhotons is above zero: that many photons are shot from the
+	// lights whenever they or the geometry change, and diffuse surfaces add
+	// an estimate from the causticNeighbours photons nearest each shading
+	// point, searched for no farther away than causticRadius. More
+	// neighbours give smoother caustics with softer edges.
+	int     causticPhotons;
+	int     causticNeighbours;
+	float   causticRadius;
+
+	// Irradiance caching. In path tracing mode, the indirect light at the
+	// first diffuse surface of each path comes from the irradiance cache
+	// instead of a further bounce: records are made as the render finds
+	// gaps between them, from irradianceSamples stratified hemisphere
+	// paths each, and interpolated wherever they are within Ward's
+	// irradianceAccuracy; smaller values place them closer together.
+	bool    irradianceCaching;
+	int     irradianceSamples;
+	float   irradianceAccuracy;
+
+	// Whitted renders run as a wavefront of sorted ray queues rather than
+	// recursing pixel by pixel, with the same result
+	bool    wavefront;
+
+	RenderSettings()
+		: maxDepth(5), ambient(0.1f), background(0.f), packetSize(16),
+		  samplesPerPixel(1), adaptive(false), contrastThreshold(0.03f),
+		  errorThreshold(0.005f), lightSamples(4), manyLights(32),
+		  pathTracing(false), rouletteDepth(3), causticPhotons(0), causticNeighbours(64),
+		  causticRadius(0.25f), irradianceCaching(false), irradianceSamples(256),
+		  irradianceAccuracy(0.2f), wavefront(false)
+	{}
+};
+
+// Per-thread tracing state: each render thread owns one of these and passes
+// it through every call, so threads never share anything mutable
+
+struct TraceContext
+{
+	std::vector<PrimitiveId> lastOccluder;  // per light, -1 when unknown
+	unsigned            random;         // random stream, seeded per sample
+	std::vector<NearPhoton> nearPhotons;    // photon search scratch space
+	Wavefront           wavefront;      // wavefront render queues
+
+	// counters for reporting
+	unsigned long long  primarySamples;
+	unsigned long long  shadowRays;
+	unsigned long long  reflectionRays;
+	unsigned long long  bounceRays;     // path tracing diffuse and mirror bounces
+	unsigned long long  occluderCacheHits;
+
+	TraceContext()
+		: random(0), primarySamples(0), shadowRays(0), reflectionRays(0), bounceRays(0),
+		  occluderCacheHits(0)
+	{}
+};
+
+// First hit of the primary ray through a pixel centre: everything shading
+// needs besides the ray direction, which the camera gives again
+
+struct GBufferSample
+{
+	PrimitiveId primitive;  // -1 where the ray left the scene
+	float   u, v;           // barycentric coordinates of a triangle hit
+	glm::vec3 position;
+	glm::vec3 normal;       // facing back along the ray
+};
+
+// first hits of a whole image, valid for as long as the camera and the
+// geometry stay as they were when it was recorded
+
+struct GBuffer
+{
+	int     width, height;
+	std::vector<GBufferSample> samples;     // row by row from the bottom
+
+	GBuffer() : width(0), height(0)
+	{}
+
+	void Resize(int w, int h)
+	{
+		width = w;
+		height = h;
+		samples.resize(size_t(w) * h);
+	}
+
+	GBufferSample &At(int x, int y) { return samples[size_t(y) * width + x]; }
+	const GBufferSample &At(int x, int y) const { return samples[size_t(y) * width + x]; }
+};
+
+// --------------------------------------------------------------------------
+
+class RayTracer
+{
+	const Scene *m_scene;
+	Accelerator m_accelerator;
+	LightTree   m_lightTree;
+	PhotonMap   m_caustics;
+	// filled in by const render calls, safely from many threads at once
+	mutable IrradianceCache m_irradiance;
+
+	glm::vec3 Shade(const Ray &ray, const Hit &hit, TraceContext &context,
+	                int depth) const;
+	glm::vec3 ShadeSurface(const glm::vec3 &direction, PrimitiveId primitive,
+	                       const glm::vec3 &position, const glm::vec3 &normal,
+	                       TraceContext &context, int depth) const;
+	// hit point of a ray and the surface normal there, facing the ray
+	void SurfaceAt(const Ray &ray, const Hit &hit, glm::vec3 &position,
+	               glm::vec3 &normal) const;
+	bool InShadow(const Ray &ray, int light, TraceContext &context) const;
+	// Phong light reaching a surface point from one light unless the
+	// shadow ray toward it is blocked; false when the light is behind
+	bool UnshadowedLight(int light, const Material &material, const glm::vec3 &position,
+	                     const glm::vec3 &normal, const glm::vec3 &view, glm::vec3 &colour,
+	                     Ray &shadow) const;
+	// Phong light reaching a surface point from one light, zero in shadow
+	glm::vec3 DirectLight(int light, const Material &material, const glm::vec3 &position,
+	                      const glm::vec3 &normal, const glm::vec3 &view,
+	                      TraceContext &context) const;
+	// calls visit(light, divisor) for every light shading a point, or for
+	// each of the few picked through the light tree in many-light mode,
+	// whose light is to be divided by divisor
+	template <class Visit>
+	void ForEachLight(const glm::vec3 &position, const glm::vec3 &normal,
+	                  TraceContext &context, Visit visit) const;
+	// adds the light reaching a surface point from every light to colour,
+	// or an estimate of it from a few picked through the light tree in
+	// many-light mode
+	void AddDirectLight(const Material &material, const glm::vec3 &position,
+	                    const glm::vec3 &normal, const glm::vec3 &view,
+	                    glm::vec3 &colour, TraceContext &context) const;
+	// adds the caustic light a surface point reflects to colour
+	void AddCausticLight(const Material &material, const glm::vec3 &position,
+	                     const glm::vec3 &normal, glm::vec3 &colour,
+	                     TraceContext &context) const;
+	// shoots the caustic photons again, or drops them when turned off
+	void UpdateCaustics();
+	// colour a path tracing sample sees, given its first hit; with
+	// cacheIrradiance the indirect light comes from the irradiance cache
+	// when irradiance caching is on
+	glm::vec3 TracePath(const glm::vec3 &direction, PrimitiveId primitive, const glm::vec3 &position,
+	                    const glm::vec3 &normal, TraceContext &context,
+	                    bool cacheIrradiance = true) const;
+	// indirect light arriving at a diffuse point, from the cache or from a
+	// new record made there
+	glm::vec3 CachedIrradiance(const glm::vec3 &position, const glm::vec3 &normal,
+	                           TraceContext &context) const;
+	IrradianceRecord MakeIrradianceRecord(const glm::vec3 &position, const glm::vec3 &normal,
+	                                      TraceContext &context) const;
+	// drops the records after the lights, geometry or settings changed
+	void ResetIrradianceCache();
+
+	// one sample through the centre of every pixel, with the first hits
+	// written to gbuffer when one is given
+	void RenderTileCentres(const Tile &tile, int width, int height,
+	                       std::vector<glm::vec3> &colours,
+	                       TraceContext &context, GBuffer *gbuffer = 0) const;
+	template <int N>
+	void RenderTilePackets(const Tile &tile, int width, int height,
+	                       std::vector<glm::vec3> &colours,
+	                       TraceContext &context, GBuffer *gbuffer) const;
+	glm::vec3 ShadePrimary(int x, int y, const Ray &ray, const Hit &hit,
+	                       TraceContext &context, GBuffer *gbuffer) const;
+
+	void RenderTileAdaptive(const Tile &tile, int width, int height,
+	                        std::vector<glm::vec3> &colours,
+	                        TraceContext &context) const;
+
+	// sample of pixel (x, y) jittered inside one cell of the square
+	// stratification grid used for the samplesPerPixel budget
+	glm::vec3 Sample(int x, int y, int cell, int width, int height,
+	                 TraceContext &context) const;
+	// the ray of such a sample, and the seed of its random stream
+	Ray SampleRay(int x, int y, int cell, int width, int height, unsigned &seed) const;
+
+	// Wavefront mode: adds samples first to first+count-1 of every tile
+	// pixel into sums, or the one through each pixel centre for single
+	// sample renders, recording their first hits in gbuffer when given
+	void RenderTileWavefront(const Tile &tile, int width, int height, int first, int count,
+	                         std::vector<glm::vec3> &sums, TraceContext &context,
+	                         GBuffer *gbuffer) const;
+	// the stages, each run over the whole wave; the shadow stage also
+	// finishes the surfaces shaded, moving their paths a bounce on
+	void ExtendWavefront(Wavefront &wave, const CoherenceGrid &grid, bool centres) const;
+	void ShadeWavefront(Wavefront &wave, TraceContext &context) const;
+	void ShadowWavefront(Wavefront &wave, const CoherenceGrid &grid,
+	                     TraceContext &context) const;
+
+public:
+	Camera          camera;
+	RenderSettings  settings;
+
+	RayTracer() : m_scene(0) {}
+
+	// builds the acceleration structure for a scene that must outlive us
+	void SetScene(const Scene &scene, BVHLayout layout = DEFAULT_BVH_LAYOUT);
+	// takes over a structure already built or loaded for the scene, such
+	// as one from a compiled scene cache, leaving built empty
+	void SetScene(const Scene &scene, Accelerator &built);
+	// rebuilds the light tree, and the caustic photon map if caustics are
+	// on, and empties the irradiance cache, after lights were added, moved
+	// or changed, or the settings were
+	void UpdateLights();
+
+	// updates the acceleration structure after the scene's geometry moved,
+	// refitting it where it stays good enough (see Accelerator::Refit);
+	// returns false if anything was rebuilt
+	bool RefitScene(bool meshesMoved = false,
+	                float maxCostGrowth = DEFAULT_MAX_COST_GROWTH);
+
+	// colour seen along a ray, following reflections up to the max depth
+	glm::vec3 Trace(const Ray &ray, TraceContext &context, int depth = 0) const;
+
+	// colour of the pixel at (x, y) in a width x height image
+	glm::vec3 RenderPixel(int x, int y, int width, int height,
+	                      TraceContext &context) const;
+
+	// renders a tile of a width x height image into colours, row by row
+	// from the bottom; safe to call from several threads at once as long
+	// as each uses its own context. With one sample per pixel the first
+	// hits are also recorded in gbuffer, if given, which must be sized to
+	// the image.
+	void RenderTile(const Tile &tile, int width, int height,
+	                std::vector<glm::vec3> &colours, TraceContext &context,
+	                GBuffer *gbuffer = 0) const;
+
+	// shades a tile from the first hits of an earlier single sample render,
+	// giving exactly what RenderTile would with the current lights and
+	// materials; a blockSize above one shades one pixel per block for a
+	// preview, like RenderTileCoarse
+	void ShadeTile(const Tile &tile, int width, int height, const GBuffer &gbuffer,
+	               int blockSize, std::vector<glm::vec3> &colours,
+	               TraceContext &context) const;
+
+	// adds samples first to first+count-1 of each pixel's stratified
+	// sequence into sums, which holds one running total per tile pixel;
+	// dividing the totals by samplesPerPixel once every sample is in gives
+	// exactly what RenderTile does in uniform mode
+	void AccumulateSamples(const Tile &tile, int width, int height,
+	                       int first, int count, std::vector<glm::vec3> &sums,
+	                       TraceContext &context) const;
+
+	// quick preview of a tile: one ray per blockSize x blockSize block of
+	// pixels, copied to the whole block
+	void RenderTileCoarse(const Tile &tile, int width, int height, int blockSize,
+	                      std::vector<glm::vec3> &colours, TraceContext &context) const;
+
+	const Accelerator &Acceleration() const { return m_accelerator; }
+	const PhotonMap &Caustics() const { return m_caustics; }
+	const IrradianceCache &Irradiance() const { return m_irradiance; }
+};
+
+// --------------------------------------------------------------------------
+#endif // RAYTRACER_H
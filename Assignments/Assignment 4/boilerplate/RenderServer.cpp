@@ -0,0 +1,545 @@
+// ==========================================================================
+// Render Server
+// ==========================================================================
+
+#include "RenderServer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <sys/stat.h>
+#include <glm/glm.hpp>
+#include "ImageBuffer.h"
+#include "Scene.h"
+#include "RayTracer.h"
+#include "Progressive.h"
+#include "SceneCache.h"
+
+using namespace std;
+using namespace glm;
+
+// --------------------------------------------------------------------------
+
+namespace
+{
+	const int TILE_SIZE = 32;
+
+	// how often a new connection and a running render are checked on, and
+	// how often a client hears of its render's progress at most
+	const int ACCEPT_POLL_MS = 200;
+	const int RENDER_POLL_MS = 10;
+	const double PROGRESS_INTERVAL = 0.25;
+
+	double SecondsSince(chrono::steady_clock::time_point start)
+	{
+		return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	}
+
+	// size and time of last change of a file, which tell us when a loaded
+	// scene has gone stale; false if there is no such file
+	bool FileStamp(const string &fileName, long long &size, long long &modified)
+	{
+		struct stat info;
+		if (stat(fileName.c_str(), &info) != 0)
+			return false;
+		size = (long long)info.st_size;
+		modified = (long long)info.st_mtime;
+		return true;
+	}
+
+	// the sizes and times of last change of a scene's files in turn; false
+	// if one of them is gone
+	bool SourceStamps(const vector<string> &files, vector<long long> &stamps)
+	{
+		stamps.clear();
+		for (size_t i = 0; i < files.size(); ++i)
+		{
+			long long size, modified;
+			if (!FileStamp(files[i], size, modified))
+				return false;
+			stamps.push_back(size);
+			stamps.push_back(modified);
+		}
+		return true;
+	}
+
+	// orientation of a camera at eye looking at target, upright
+	bool LookAt(const vec3 &eye, const vec3 &target, mat3 &orientation)
+	{
+		vec3 backward = eye - target;
+		if (length(backward) <= 0.f)
+			return false;
+		backward = normalize(backward);
+		vec3 right = cross(vec3(0.f, 1.f, 0.f), backward);
+		if (length(right) < 1e-6f)
+			return false;
+		right = normalize(right);
+		orientation = mat3(right, cross(backward, right), backward);
+		return true;
+	}
+}
+
+// --------------------------------------------------------------------------
+
+struct RenderServer::Client
+{
+	LocalSocket socket;
+};
+
+struct RenderServer::Job
+{
+	int         id;
+	int         priority;           // higher goes first
+	unsigned long long arrival;
+	bool        render;             // false to only load the scene
+	string      sceneFile;
+	string      imageFile;
+	int         width, height;
+	int         samplesPerPixel;
+	bool        pathTracing;
+	Camera      camera;
+	ClientPtr   client;             // who hears how the job goes
+
+	atomic<bool> cancelled;
+	atomic<int> percent;
+
+	Job()
+		: id(0), priority(0), arrival(0), render(true), width(1024), height(768),
+		  samplesPerPixel(1), pathTracing(false), cancelled(false), percent(0)
+	{}
+
+	void Tell(const string &message) { client->socket.WriteLine(message); }
+};
+
+// A scene as loaded, with a tracer holding its BVH and light tree; the
+// tracer's camera and settings are set afresh for every job
+struct RenderServer::CachedScene
+{
+	Scene       scene;
+	RayTracer   tracer;
+	vector<long long> stamps;       // of its source files when it was loaded
+	unsigned long long lastUse;
+	int         renders;            // guarded by m_lock
+};
+
+// --------------------------------------------------------------------------
+
+RenderServer::RenderServer(int threadCount, int maxScenes)
+	: m_threadCount(threadCount), m_maxScenes(std::max(maxScenes, 1)), m_nextJob(1),
+	  m_arrivals(0), m_uses(0), m_stopping(false)
+{}
+
+RenderServer::~RenderServer()
+{}
+
+bool RenderServer::Run(const string &path)
+{
+	LocalSocket listener;
+	if (!listener.Listen(path))
+		return false;
+	cout << "Render server listening on " << path << ", rendering on "
+	     << (m_threadCount > 0 ? m_threadCount : TileScheduler::HardwareThreads())
+	     << " threads, keeping up to " << m_maxScenes << " scenes" << endl;
+
+	thread dispatcher(&RenderServer::Dispatch, this);
+	for (;;)
+	{
+		ClientPtr client(new Client);
+		bool connected = listener.Accept(client->socket, ACCEPT_POLL_MS);
+		lock_guard<mutex> guard(m_lock);
+		if (m_stopping)
+			break;
+		if (connected)
+		{
+			m_clients.push_back(client);
+			thread(&RenderServer::Serve, this, client).detach();
+		}
+	}
+	listener.Close();
+	dispatcher.join();
+
+	// clients still connected are cut off, and their threads leave
+	unique_lock<mutex> lock(m_lock);
+	for (size_t i = 0; i < m_clients.size(); ++i)
+		m_clients[i]->socket.Shutdown();
+	m_wake.wait(lock, [this] { return m_clients.empty(); });
+	cout << "Render server stopped" << endl;
+	return true;
+}
+
+// --------------------------------------------------------------------------
+// Clients
+
+void RenderServer::Serve(ClientPtr client)
+{
+	string line;
+	while (client->socket.ReadLine(line))
+		Command(line, client);
+
+	// jobs the client left behind still run, with nobody to tell
+	client->socket.Close();
+	lock_guard<mutex> guard(m_lock);
+	for (size_t i = 0; i < m_clients.size(); ++i)
+	{
+		if (m_clients[i] == client)
+		{
+			m_clients.erase(m_clients.begin() + i);
+			break;
+		}
+	}
+	m_wake.notify_all();
+}
+
+void RenderServer::Command(const string &line, const ClientPtr &client)
+{
+	vector<string> words = SplitWords(line);
+	if (words.empty())
+		return;
+	const string &command = words[0];
+	if (command == "status")
+		Status(client);
+	else if (command == "shutdown")
+	{
+		client->socket.WriteLine("ok");
+		Stop();
+	}
+	else if (command == "cancel" && words.size() == 2)
+		Cancel(words[1], client);
+	else if ((command == "render" || command == "load") && words.size() >= 2)
+	{
+		JobPtr job(new Job);
+		job->render = command == "render";
+		job->sceneFile = words[1];
+		vec3 eye(0.f), target(0.f);
+		bool aimed = false;
+		for (size_t i = 2; i < words.size(); ++i)
+		{
+			// a load takes nothing but a priority
+			const string &arg = words[i];
+			size_t values = words.size() - i - 1;
+			bool render = job->render;
+			if (arg == "-priority" && values >= 1)
+				job->priority = atoi(words[++i].c_str());
+			else if (render && arg == "-path")
+				job->pathTracing = true;
+			else if (render && arg == "-o" && values >= 1)
+				job->imageFile = words[++i];
+			else if (render && arg == "-w" && values >= 1)
+				job->width = atoi(words[++i].c_str());
+			else if (render && arg == "-h" && values >= 1)
+				job->height = atoi(words[++i].c_str());
+			else if (render && arg == "-spp" && values >= 1)
+				job->samplesPerPixel = atoi(words[++i].c_str());
+			else if (render && arg == "-fov" && values >= 1)
+				job->camera.fieldOfView = radians(float(atof(words[++i].c_str())));
+			else if (render && (arg == "-eye" || arg == "-target") && values >= 3)
+			{
+				vec3 &point = arg == "-eye" ? eye : target;
+				for (int axis = 0; axis < 3; ++axis)
+					point[axis] = float(atof(words[++i].c_str()));
+				aimed = aimed || arg == "-target";
+			}
+			else
+			{
+				client->socket.WriteLine("error unexpected argument " + QuoteWord(arg));
+				return;
+			}
+		}
+
+		if (job->width <= 0 || job->height <= 0 || job->samplesPerPixel <= 0 ||
+		    !(job->camera.fieldOfView > 0.f && job->camera.fieldOfView < radians(180.f)))
+		{
+			client->socket.WriteLine("error size and samples must be positive, and the field"
+			                         " of view between 0 and 180 degrees");
+			return;
+		}
+
+		// without a target the camera looks down -z, as in the viewer
+		job->camera.position = eye;
+		if (aimed && !LookAt(eye, target, job->camera.orientation))
+		{
+			client->socket.WriteLine("error the camera must look at a point away from it,"
+			                         " and not straight up or down");
+			return;
+		}
+		if (job->imageFile.empty())
+		{
+			size_t dot = job->sceneFile.rfind('.');
+			size_t slash = job->sceneFile.rfind('/');
+			job->imageFile = dot != string::npos && (slash == string::npos || dot > slash) ?
+			                 job->sceneFile.substr(0, dot) + ".png" : job->sceneFile + ".png";
+		}
+		Queue(job, client);
+	}
+	else
+		client->socket.WriteLine("error unknown command " + QuoteWord(command));
+}
+
+void RenderServer::Queue(const JobPtr &job, const ClientPtr &client)
+{
+	lock_guard<mutex> guard(m_lock);
+	if (m_stopping)
+	{
+		client->socket.WriteLine("error the server is shutting down");
+		return;
+	}
+	job->id = m_nextJob++;
+	job->arrival = m_arrivals++;
+	job->client = client;
+
+	int ahead = m_running ? 1 : 0;
+	for (size_t i = 0; i < m_waiting.size(); ++i)
+		ahead += m_waiting[i]->priority >= job->priority ? 1 : 0;
+	m_waiting.push_back(job);
+	ostringstream message;
+	message << "queued " << job->id << " " << ahead;
+	job->Tell(message.str());
+	m_wake.notify_all();
+}
+
+void RenderServer::Cancel(const string &id, const ClientPtr &client)
+{
+	int job = atoi(id.c_str());
+	lock_guard<mutex> guard(m_lock);
+	if (m_running && m_running->id == job)
+	{
+		// the dispatcher sees the flag and tells the job's client
+		m_running->cancelled = true;
+		client->socket.WriteLine("ok");
+		return;
+	}
+	for (size_t i = 0; i < m_waiting.size(); ++i)
+	{
+		if (m_waiting[i]->id == job)
+		{
+			JobPtr cancelled = m_waiting[i];
+			m_waiting.erase(m_waiting.begin() + i);
+			client->socket.WriteLine("ok");
+			cancelled->Tell("cancelled " + to_string(cancelled->id));
+			return;
+		}
+	}
+	client->socket.WriteLine("error no job " + to_string(job) + " is running or waiting");
+}
+
+void RenderServer::Status(const ClientPtr &client)
+{
+	lock_guard<mutex> guard(m_lock);
+	for (auto i = m_scenes.begin(); i != m_scenes.end(); ++i)
+	{
+		const CachedScene &cached = *i->second;
+		double bytes = double(cached.scene.GeometryBytes() + cached.tracer.Acceleration().MemoryBytes());
+		ostringstream message;
+		message << "scene " << QuoteWord(i->first) << " " << cached.scene.StoredTriangleCount() << " "
+		        << bytes / (1024.0 * 1024.0) << " " << cached.renders;
+		client->socket.WriteLine(message.str());
+	}
+	if (m_running)
+	{
+		ostringstream message;
+		message << "running " << m_running->id << " " << m_running->priority << " "
+		        << m_running->percent.load() << " " << QuoteWord(m_running->sceneFile);
+		client->socket.WriteLine(message.str());
+	}
+	for (size_t i = 0; i < m_waiting.size(); ++i)
+	{
+		ostringstream message;
+		message << "waiting " << m_waiting[i]->id << " " << m_waiting[i]->priority << " "
+		        << QuoteWord(m_waiting[i]->sceneFile);
+		client->socket.WriteLine(message.str());
+	}
+	client->socket.WriteLine("end");
+}
+
+void RenderServer::Stop()
+{
+	lock_guard<mutex> guard(m_lock);
+	m_stopping = true;
+	if (m_running)
+		m_running->cancelled = true;
+	for (size_t i = 0; i < m_waiting.size(); ++i)
+	{
+		ostringstream message;
+		message << "cancelled " << m_waiting[i]->id;
+		m_waiting[i]->Tell(message.str());
+	}
+	m_waiting.clear();
+	m_wake.notify_all();
+}
+
+// --------------------------------------------------------------------------
+// Rendering
+
+void RenderServer::Dispatch()
+{
+	while (JobPtr job = NextJob())
+	{
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		bool warm = false;
+		string error;
+		CachedScene *scene = FindScene(*job, warm, error);
+		string id = to_string(job->id);
+		if (!scene)
+			job->Tell("failed " + id + " " + error);
+		else
+		{
+			ostringstream message;
+			message << "started " << id << " " << QuoteWord(job->sceneFile) << " "
+			        << (warm ? "warm " : "loaded ") << SecondsSince(start);
+			job->Tell(message.str());
+			if (job->cancelled)
+				job->Tell("cancelled " + id);
+			else if (job->render)
+				Render(*job, *scene);
+			else
+				job->Tell("done " + id + " 0 -");
+		}
+
+		lock_guard<mutex> guard(m_lock);
+		m_running.reset();
+	}
+}
+
+RenderServer::JobPtr RenderServer::NextJob()
+{
+	unique_lock<mutex> lock(m_lock);
+	m_wake.wait(lock, [this] { return m_stopping || !m_waiting.empty(); });
+	if (m_stopping)
+		return JobPtr();
+
+	// highest priority first, and the earliest of those
+	size_t next = 0;
+	for (size_t i = 1; i < m_waiting.size(); ++i)
+	{
+		const Job &job = *m_waiting[i], &best = *m_waiting[next];
+		if (job.priority > best.priority ||
+		    (job.priority == best.priority && job.arrival < best.arrival))
+			next = i;
+	}
+	m_running = m_waiting[next];
+	m_waiting.erase(m_waiting.begin() + next);
+	return m_running;
+}
+
+RenderServer::CachedScene *RenderServer::FindScene(const Job &job, bool &warm, string &error)
+{
+	long long size, modified;
+	if (!FileStamp(job.sceneFile, size, modified))
+	{
+		error = "no scene file " + QuoteWord(job.sceneFile);
+		return 0;
+	}
+	{
+		lock_guard<mutex> guard(m_lock);
+		auto found = m_scenes.find(job.sceneFile);
+		vector<long long> stamps;
+		if (found != m_scenes.end() &&
+		    SourceStamps(found->second->scene.sourceFiles, stamps) &&
+		    stamps == found->second->stamps)
+		{
+			warm = true;
+			found->second->lastUse = ++m_uses;
+			return found->second.get();
+		}
+	}
+
+	// loading takes a while, and status requests are answered meanwhile
+	unique_ptr<CachedScene> loaded(new CachedScene);
+	Accelerator built;
+	if (!LoadCompiledScene(job.sceneFile, loaded->scene, built))
+	{
+		error = "could not load scene " + QuoteWord(job.sceneFile);
+		return 0;
+	}
+	loaded->tracer.SetScene(loaded->scene, built);
+	SourceStamps(loaded->scene.sourceFiles, loaded->stamps);
+	loaded->renders = 0;
+
+	// the scene used longest ago makes room, but never the one just loaded
+	lock_guard<mutex> guard(m_lock);
+	CachedScene *scene = loaded.get();
+	scene->lastUse = ++m_uses;
+	m_scenes[job.sceneFile] = std::move(loaded);
+	while (int(m_scenes.size()) > m_maxScenes)
+	{
+		auto oldest = m_scenes.end();
+		for (auto i = m_scenes.begin(); i != m_scenes.end(); ++i)
+			if (i->second.get() != scene &&
+			    (oldest == m_scenes.end() || i->second->lastUse < oldest->second->lastUse))
+				oldest = i;
+		cout << "Dropping scene " << oldest->first << " to make room" << endl;
+		m_scenes.erase(oldest);
+	}
+	return scene;
+}
+
+void RenderServer::Render(Job &job, CachedScene &scene)
+{
+	RayTracer &tracer = scene.tracer;
+	tracer.camera = job.camera;
+	tracer.settings = RenderSettings();
+	tracer.settings.samplesPerPixel = job.samplesPerPixel;
+	tracer.settings.pathTracing = job.pathTracing;
+
+	ImageBuffer image;
+	if (!image.Initialize(job.width, job.height))
+	{
+		job.Tell("failed " + to_string(job.id) + " could not make the image");
+		return;
+	}
+
+	// a single straight pass, reported on as its tiles come in
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	ProgressiveRenderer renderer;
+	renderer.Start(tracer, job.width, job.height, TILE_SIZE, m_threadCount,
+		[&](const Tile &tile, const vec3 *colours) {
+			image.SetTile(tile.x, tile.y, tile.width, tile.height, colours);
+		}, false);
+	const TileScheduler &scheduler = renderer.Scheduler();
+	chrono::steady_clock::time_point reported = start;
+	while (!renderer.Finished() && !job.cancelled)
+	{
+		this_thread::sleep_for(chrono::milliseconds(RENDER_POLL_MS));
+		job.percent = 100 * scheduler.TilesDone() / std::max(scheduler.TileCount(), 1);
+		if (SecondsSince(reported) >= PROGRESS_INTERVAL)
+		{
+			reported = chrono::steady_clock::now();
+			job.Tell("progress " + to_string(job.id) + " " + to_string(job.percent.load()));
+		}
+	}
+	if (job.cancelled)
+	{
+		renderer.Cancel();
+		job.Tell("cancelled " + to_string(job.id));
+		cout << "Job " << job.id << " cancelled" << endl;
+		return;
+	}
+	renderer.Wait();
+	double renderTime = SecondsSince(start);
+	job.percent = 100;
+	{
+		lock_guard<mutex> guard(m_lock);
+		++scene.renders;
+	}
+
+	unsigned long long rays = 0;
+	const vector<TraceContext> &contexts = renderer.Contexts();
+	for (size_t i = 0; i < contexts.size(); ++i)
+		rays += contexts[i].primarySamples + contexts[i].shadowRays +
+		        contexts[i].reflectionRays + contexts[i].bounceRays;
+	cout << "Job " << job.id << ": " << job.sceneFile << " " << job.width << "x" << job.height
+	     << " at " << job.samplesPerPixel << " spp" << (job.pathTracing ? " path traced" : "")
+	     << " in " << renderTime << " s, " << rays / std::max(renderTime, 1e-9)
+	     << " rays per second" << endl;
+
+	ostringstream message;
+	if (image.SaveToFile(job.imageFile))
+		message << "done " << job.id << " " << renderTime << " " << QuoteWord(job.imageFile);
+	else
+		message << "failed " << job.id << " could not save " << QuoteWord(job.imageFile);
+	job.Tell(message.str());
+}
+
+// --------------------------------------------------------------------------
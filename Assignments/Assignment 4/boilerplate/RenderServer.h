@@ -0,0 +1,111 @@
+// ==========================================================================
+// Render Server
+//  - a long running process that keeps the scenes it has loaded, with their
+//    BVHs, light trees and tracers, so later renders of the same scene start
+//    at once rather than loading and building all over again
+//  - takes render jobs from clients on a local socket, queues them by
+//    priority, and renders them one after another on the tile scheduler's
+//    threads, streaming progress back to the client that sent each one
+//  - notices a scene file, or an OBJ file it reads, changing on disk and
+//    loads the scene afresh
+//
+// Every job gets every thread: tiles are stolen between threads anyway, so
+// a job finishes soonest with the whole machine to itself, and the queue
+// order alone decides who goes first. A running job is not interrupted by
+// a more urgent one arriving; it keeps the threads until it ends or is
+// cancelled.
+//
+// Protocol: one command per line, of words as LocalSocket splits them,
+// answered by lines of the same kind. The last line of every answer is one
+// of done, failed, cancelled, ok, error or end.
+//
+//   render scene.txt [-o image.png] [-w width] [-h height] [-spp samples]
+//                    [-priority n] [-eye x y z] [-target x y z] [-fov degrees]
+//                    [-path]
+//       queued <job> <jobs ahead>
+//       started <job> <scene> warm|loaded <load seconds>
+//       progress <job> <percent>
+//       done <job> <render seconds> <image>  |  failed <job> <reason>
+//                                            |  cancelled <job>
+//   load scene.txt [-priority n]    as render, without rendering: warms the
+//                                   cache, answered queued, started, done
+//   cancel <job>                    ok | error <reason>
+//   status                          scene <file> <triangles> <MB> <renders>,
+//                                   running <job> <priority> <percent> <scene>,
+//                                   waiting <job> <priority> <scene>, end
+//   shutdown                        ok, then every job is cancelled and the
+//                                   server exits
+//
+// Paths are taken as the server sees them; the client makes them absolute.
+// ==========================================================================
+#ifndef RENDERSERVER_H
+#define RENDERSERVER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "LocalSocket.h"
+
+// --------------------------------------------------------------------------
+
+// where the server listens unless told otherwise
+const char *const DEFAULT_RENDER_SOCKET = "/tmp/raytracer.sock";
+
+class RenderServer
+{
+public:
+	// renders on threadCount threads, every hardware thread if zero or
+	// less, keeping up to maxScenes scenes loaded
+	RenderServer(int threadCount, int maxScenes);
+	~RenderServer();
+
+	// serves clients on the socket at path until told to shut down; false
+	// if the socket could not be opened
+	bool Run(const std::string &path);
+
+private:
+	struct Client;
+	struct Job;
+	struct CachedScene;
+	typedef std::shared_ptr<Client> ClientPtr;
+	typedef std::shared_ptr<Job> JobPtr;
+
+	int         m_threadCount;
+	int         m_maxScenes;
+
+	// guards everything below, which client threads and the dispatcher
+	// share; the scenes themselves are only touched by the dispatcher
+	std::mutex  m_lock;
+	std::condition_variable m_wake;     // a job was queued, a client left, or we stop
+	std::vector<JobPtr> m_waiting;
+	JobPtr      m_running;
+	int         m_nextJob;
+	unsigned long long m_arrivals;      // orders jobs of equal priority
+	std::map<std::string, std::unique_ptr<CachedScene>> m_scenes;
+	unsigned long long m_uses;          // orders scenes by when they were last used
+	std::vector<ClientPtr> m_clients;
+	bool        m_stopping;
+
+	void Serve(ClientPtr client);
+	void Command(const std::string &line, const ClientPtr &client);
+	void Queue(const JobPtr &job, const ClientPtr &client);
+	void Cancel(const std::string &id, const ClientPtr &client);
+	void Status(const ClientPtr &client);
+	void Stop();
+
+	void Dispatch();
+	JobPtr NextJob();
+	CachedScene *FindScene(const Job &job, bool &warm, std::string &error);
+	void Render(Job &job, CachedScene &scene);
+
+	RenderServer(const RenderServer &);
+	RenderServer &operator=(const RenderServer &);
+};
+
+// --------------------------------------------------------------------------
+#endif // RENDERSERVER_H
@@ -0,0 +1,503 @@
+// ==========================================================================
+// Scene Description for Ray Tracing
+//
+// Scene files are a sequence of blocks of the form
+//
+//      keyword { numbers... }
+//
+// with '#' starting a comment that runs to the end of the line. Besides the
+// light, sphere, plane and triangle blocks described in the scene files,
+// the loader accepts
+//
+//      light    { x y z  r g b }
+//      light    { x y z  r g b  falloff }
+//      material { dr dg db  sr sg sb  shininess  reflectance }
+//      mesh name { triangle {...} material {...} ... }
+//      mesh name file.obj
+//      instance name { tx ty tz }
+//      instance name { m00 m01 m02 m03  m10 m11 m12 m13  m20 m21 m22 m23 }
+//
+// where a material block applies to every object that follows it, and a
+// light's falloff distance makes it fade with distance (see Light). A mesh
+// block holds triangles in a frame of their own and places nothing; each
+// instance of it that follows places a copy of them, moved by a
+// translation or by an affine transform given row by row (a fourth row of
+// 0 0 0 1 may be added). Only the transform is stored per instance, so a
+// thousand copies of a mesh cost little more than one. A mesh can also take
+// the triangles of an OBJ file, found next to the scene file unless its
+// path is absolute, in the material in effect.
+// ==========================================================================
+
+#include "Scene.h"
+#include "ObjLoader.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <cctype>
+#include <algorithm>
+
+using namespace std;
+using namespace glm;
+
+// --------------------------------------------------------------------------
+// Tokenizer for scene files, remembering line numbers for error messages
+
+namespace
+{
+	struct SceneTokens
+	{
+		vector<string>  tokens;
+		vector<int>     lines;
+		size_t          next;
+
+		SceneTokens() : next(0) {}
+
+		bool Read(istream &input)
+		{
+			string line;
+			for (int lineNumber = 1; getline(input, line); ++lineNumber)
+			{
+				size_t comment = line.find('#');
+				if (comment != string::npos)
+					line.erase(comment);
+
+				string token;
+				for (size_t i = 0; i <= line.size(); ++i)
+				{
+					char c = i < line.size() ? line[i] : ' ';
+					bool brace = c == '{' || c == '}';
+					if (brace || isspace((unsigned char)c))
+					{
+						if (!token.empty()) Push(token, lineNumber);
+						token.clear();
+						if (brace) Push(string(1, c), lineNumber);
+					}
+					else
+						token += c;
+				}
+			}
+			return !input.bad();
+		}
+
+		void Push(const string &token, int line)
+		{
+			tokens.push_back(token);
+			lines.push_back(line);
+		}
+
+		bool Done() const { return next >= tokens.size(); }
+		const string &Peek() const { return tokens[next]; }
+		int Line() const { return lines[std::min(next, lines.size() - 1)]; }
+	};
+
+	bool SceneError(int line, const string &message)
+	{
+		cout << "Scene ERROR (line " << line << "): " << message << endl;
+		return false;
+	}
+
+	// reads "{ n0 n1 ... }" following a block keyword
+	bool ReadBlock(SceneTokens &tokens, vector<float> &values)
+	{
+		values.clear();
+		if (tokens.Done() || tokens.Peek() != "{")
+			return SceneError(tokens.Line(), "expected '{'");
+		++tokens.next;
+
+		while (!tokens.Done() && tokens.Peek() != "}")
+		{
+			const string &token = tokens.Peek();
+			char *end = 0;
+			float value = strtof(token.c_str(), &end);
+			if (end == token.c_str() || *end != '\0')
+				return SceneError(tokens.Line(), "expected a number but found '" + token + "'");
+			values.push_back(value);
+			++tokens.next;
+		}
+
+		if (tokens.Done())
+			return SceneError(tokens.Line(), "missing '}' at end of file");
+		++tokens.next;
+		return true;
+	}
+
+	vec3 ReadVec3(const vector<float> &values, int offset)
+	{
+		return vec3(values[offset], values[offset + 1], values[offset + 2]);
+	}
+}
+
+// --------------------------------------------------------------------------
+
+Scene::Scene()
+{
+	Clear();
+}
+
+void Scene::Clear()
+{
+	vertices.clear();
+	triangles.clear();
+	spheres.clear();
+	planes.clear();
+	lights.clear();
+	materials.assign(1, Material());
+	meshes.clear();
+	instances.clear();
+	sourceFiles.clear();
+}
+
+bool Scene::LoadFromFile(const string &fileName)
+{
+	Clear();
+
+	ifstream input(fileName.c_str());
+	SceneTokens tokens;
+	if (!input || !tokens.Read(input))
+	{
+		cout << "Scene ERROR: Could not read scene file " << fileName << endl;
+		return false;
+	}
+
+	// any error leaves the scene empty
+	auto fail = [this](int line, const string &message) {
+		SceneError(line, message);
+		Clear();
+		return false;
+	};
+
+	sourceFiles.push_back(fileName);
+	int material = 0;
+	int mesh = -1;      // mesh whose block is being read, if any
+	vector<float> values;
+	while (!tokens.Done())
+	{
+		string keyword = tokens.Peek();
+		int line = tokens.Line();
+		++tokens.next;
+
+		if (keyword == "}" && mesh >= 0)
+		{
+			if (meshes[mesh].triangles.empty())
+				return fail(line, "mesh '" + meshes[mesh].name + "' has no triangles");
+			mesh = -1;
+			continue;
+		}
+
+		// mesh and instance blocks name their mesh before the '{'
+		string name;
+		if (keyword == "mesh" || keyword == "instance")
+		{
+			if (tokens.Done() || tokens.Peek() == "{" || tokens.Peek() == "}")
+				return fail(line, "expected a mesh name after '" + keyword + "'");
+			name = tokens.Peek();
+			++tokens.next;
+		}
+
+		if (keyword == "mesh")
+		{
+			if (mesh >= 0)
+				return fail(line, "meshes can't be nested");
+			if (FindMesh(name) >= 0)
+				return fail(line, "mesh '" + name + "' is already defined");
+			if (tokens.Done() || tokens.Peek() == "}")
+				return fail(tokens.Line(), "expected '{' or an OBJ file name");
+
+			Mesh m;
+			m.name = name;
+			meshes.push_back(m);
+			if (tokens.Peek() != "{")
+			{
+				string path = tokens.Peek();
+				size_t slash = fileName.find_last_of("/\\");
+				if (path[0] != '/' && path[0] != '\\' && slash != string::npos)
+					path = fileName.substr(0, slash + 1) + path;
+				++tokens.next;
+				sourceFiles.push_back(path);
+				if (!LoadObj(path, meshes.back(), material))
+					return fail(line, "could not load mesh '" + name + "'");
+				if (meshes.back().triangles.empty())
+					return fail(line, "mesh '" + name + "' has no triangles");
+				continue;
+			}
+			++tokens.next;
+			mesh = int(meshes.size()) - 1;
+			continue;
+		}
+
+		if (!ReadBlock(tokens, values))
+		{
+			Clear();
+			return false;
+		}
+
+		if (mesh >= 0 && keyword != "triangle" && keyword != "material")
+			return fail(line, "only triangles and materials can go in a mesh");
+
+		size_t count = values.size();
+		bool valid = true;
+		if (keyword == "light" && (count == 3 || count == 6 || count == 7))
+		{
+			Light light;
+			light.position = ReadVec3(values, 0);
+			if (count >= 6) light.colour = ReadVec3(values, 3);
+			if (count == 7) light.falloff = values[6];
+			if (light.falloff < 0.f)
+				return fail(line, "light falloff distances can't be negative");
+			lights.push_back(light);
+		}
+		else if (keyword == "sphere" && count == 4)
+		{
+			if (!(values[3] > 0.f))
+				return fail(line, "sphere radius must be positive");
+			Sphere sphere = { ReadVec3(values, 0), values[3], material };
+			spheres.push_back(sphere);
+		}
+		else if (keyword == "plane" && count == 6)
+		{
+			vec3 normal = ReadVec3(values, 0);
+			if (!(dot(normal, normal) > 0.f))
+				return fail(line, "plane normal can't be zero");
+			Plane plane = { normalize(normal), ReadVec3(values, 3), material };
+			planes.push_back(plane);
+		}
+		else if (keyword == "triangle" && count == 9)
+		{
+			vector<vec3> &corners = mesh >= 0 ? meshes[mesh].vertices : vertices;
+			Triangle triangle;
+			for (int i = 0; i < 3; ++i)
+			{
+				triangle.v[i] = unsigned(corners.size());
+				corners.push_back(ReadVec3(values, 3 * i));
+			}
+			triangle.material = material;
+			(mesh >= 0 ? meshes[mesh].triangles : triangles).push_back(triangle);
+		}
+		else if (keyword == "instance" && (count == 3 || count == 12 || count == 16))
+		{
+			int placed = FindMesh(name);
+			if (placed < 0)
+				return fail(line, "unknown mesh '" + name + "'");
+
+			// glm matrices are indexed column first
+			mat4 toWorld(1.f);
+			if (count == 3)
+				toWorld[3] = vec4(ReadVec3(values, 0), 1.f);
+			else
+				for (int row = 0; row < 3; ++row)
+					for (int column = 0; column < 4; ++column)
+						toWorld[column][row] = values[4 * row + column];
+			if (count == 16 && (values[12] != 0.f || values[13] != 0.f ||
+			                    values[14] != 0.f || values[15] != 1.f))
+				return fail(line, "instance transforms must be affine");
+			if (determinant(mat3(toWorld)) == 0.f)
+				return fail(line, "instance transform can't be inverted");
+			AddInstance(placed, toWorld);
+		}
+		else if (keyword == "material" && count == 8)
+		{
+			Material m;
+			m.diffuse = ReadVec3(values, 0);
+			m.specular = ReadVec3(values, 3);
+			m.shininess = values[6];
+			m.reflectance = values[7];
+			material = int(materials.size());
+			materials.push_back(m);
+		}
+		else
+			valid = false;
+
+		if (!valid)
+			return fail(line, "unknown object '" + keyword + "' or wrong number of values");
+	}
+	if (mesh >= 0)
+		return fail(tokens.Line(), "missing '}' at end of mesh '" + meshes[mesh].name + "'");
+
+	cout << "Scene loaded " << fileName << ": " << Summary() << endl;
+	return true;
+}
+
+string Scene::Summary() const
+{
+	ostringstream summary;
+	summary << triangles.size() << " triangles, " << spheres.size() << " spheres, "
+	        << planes.size() << " planes, " << lights.size() << " lights";
+	if (!instances.empty())
+		summary << ", " << instances.size() << " instances of " << meshes.size() << " meshes ("
+		        << PrimitiveCount() - FirstInstanced() << " instanced triangles)";
+	return summary.str();
+}
+
+// --------------------------------------------------------------------------
+
+int Scene::AddInstance(int mesh, const mat4 &toWorld)
+{
+	Instance instance;
+	instance.mesh = mesh;
+	instance.offset = PrimitiveCount() - FirstInstanced();
+	instances.push_back(instance);
+	SetInstanceTransform(int(instances.size()) - 1, toWorld);
+	return int(instances.size()) - 1;
+}
+
+void Scene::SetInstanceTransform(int index, const mat4 &toWorld)
+{
+	Instance &instance = instances[index];
+	instance.toWorld = toWorld;
+	instance.toObject = inverse(toWorld);
+	instance.normalToWorld = transpose(mat3(instance.toObject));
+}
+
+size_t Scene::StoredTriangleCount() const
+{
+	size_t count = triangles.size();
+	for (size_t i = 0; i < meshes.size(); ++i)
+		count += meshes[i].triangles.size();
+	return count;
+}
+
+size_t Scene::GeometryBytes() const
+{
+	size_t bytes = vertices.capacity() * sizeof(vec3) + triangles.capacity() * sizeof(Triangle) +
+	               spheres.capacity() * sizeof(Sphere) + planes.capacity() * sizeof(Plane) +
+	               instances.capacity() * sizeof(Instance);
+	for (size_t i = 0; i < meshes.size(); ++i)
+		bytes += meshes[i].vertices.capacity() * sizeof(vec3) +
+		         meshes[i].triangles.capacity() * sizeof(Triangle);
+	return bytes;
+}
+
+int Scene::FindMesh(const string &name) const
+{
+	for (size_t i = 0; i < meshes.size(); ++i)
+		if (meshes[i].name == name)
+			return int(i);
+	return -1;
+}
+
+PrimitiveId Scene::PrimitiveCount() const
+{
+	if (instances.empty())
+		return FirstInstanced();
+	const Instance &last = instances.back();
+	return FirstInstanced() + last.offset + PrimitiveId(meshes[last.mesh].triangles.size());
+}
+
+int Scene::InstanceOf(PrimitiveId id) const
+{
+	// the last instance starting at or before the id
+	PrimitiveId offset = id - FirstInstanced();
+	vector<Instance>::const_iterator next = std::upper_bound(instances.begin(), instances.end(),
+		offset, [](PrimitiveId o, const Instance &instance) { return o < instance.offset; });
+	return int(next - instances.begin()) - 1;
+}
+
+const Instance &Scene::InstanceAt(PrimitiveId id, int &triangle) const
+{
+	const Instance &instance = instances[InstanceOf(id)];
+	triangle = int(id - FirstInstanced() - instance.offset);
+	return instance;
+}
+
+// --------------------------------------------------------------------------
+
+AABB Scene::Bounds(int id) const
+{
+	AABB box;
+	if (IsTriangle(id))
+	{
+		const Triangle &tri = triangles[id];
+		for (int i = 0; i < 3; ++i)
+			box.Extend(vertices[tri.v[i]]);
+	}
+	else
+	{
+		const Sphere &s = spheres[id - triangles.size()];
+		box = AABB(s.centre - vec3(s.radius), s.centre + vec3(s.radius));
+	}
+	return box;
+}
+
+bool Scene::IntersectPrimitive(PrimitiveId id, Ray &ray, Hit &hit) const
+{
+	float t, u = 0.f, v = 0.f;
+	bool found;
+	if (IsTriangle(id))
+	{
+		const Triangle &tri = triangles[id];
+		found = IntersectTriangle(vertices[tri.v[0]], vertices[tri.v[1]],
+		                          vertices[tri.v[2]], ray, t, u, v);
+	}
+	else if (IsSphere(id))
+	{
+		const Sphere &s = spheres[id - triangles.size()];
+		found = IntersectSphere(s.centre, s.radius, ray, t);
+	}
+	else if (IsInstanced(id))
+	{
+		int index;
+		const Instance &instance = InstanceAt(id, index);
+		const Mesh &mesh = meshes[instance.mesh];
+		const Triangle &tri = mesh.triangles[index];
+		found = IntersectTriangle(mesh.vertices[tri.v[0]], mesh.vertices[tri.v[1]],
+		                          mesh.vertices[tri.v[2]], instance.ToObject(ray), t, u, v);
+	}
+	else
+	{
+		const Plane &p = planes[id - BoundedCount()];
+		found = IntersectPlane(p.normal, p.point, ray, t);
+	}
+
+	if (found)
+	{
+		ray.tMax = t;
+		hit.t = t;
+		hit.primitive = id;
+		hit.u = u;
+		hit.v = v;
+	}
+	return found;
+}
+
+vec3 Scene::Normal(PrimitiveId id, const vec3 &position) const
+{
+	if (IsTriangle(id))
+	{
+		const Triangle &tri = triangles[id];
+		const vec3 &p0 = vertices[tri.v[0]];
+		return normalize(cross(vertices[tri.v[1]] - p0, vertices[tri.v[2]] - p0));
+	}
+	if (IsSphere(id))
+	{
+		const Sphere &s = spheres[id - triangles.size()];
+		return (position - s.centre) / s.radius;
+	}
+	if (IsInstanced(id))
+	{
+		int index;
+		const Instance &instance = InstanceAt(id, index);
+		const Mesh &mesh = meshes[instance.mesh];
+		const Triangle &tri = mesh.triangles[index];
+		const vec3 &p0 = mesh.vertices[tri.v[0]];
+		return normalize(instance.normalToWorld *
+		                 cross(mesh.vertices[tri.v[1]] - p0, mesh.vertices[tri.v[2]] - p0));
+	}
+	return planes[id - BoundedCount()].normal;
+}
+
+int Scene::MaterialOf(PrimitiveId id) const
+{
+	if (IsTriangle(id)) return triangles[id].material;
+	if (IsSphere(id)) return spheres[id - triangles.size()].material;
+	if (IsInstanced(id))
+	{
+		int index;
+		const Instance &instance = InstanceAt(id, index);
+		return meshes[instance.mesh].triangles[index].material;
+	}
+	return planes[id - BoundedCount()].material;
+}
+
+// --------------------------------------------------------------------------
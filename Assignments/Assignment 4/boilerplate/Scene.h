@@ -0,0 +1,176 @@
+// ==========================================================================
+// Scene Description for Ray Tracing
+//  - loads the light/sphere/plane/triangle scene files (scene1.txt, ...)
+//  - stores geometry in flat arrays that the acceleration structures index
+//  - meshes hold triangles once, in their own frame, for any number of
+//    instances to place in the scene with an affine transform
+//
+// Primitives share a single id space: triangles come first, then spheres,
+// then planes, then the triangles of every instance, one instance after
+// another. Triangles and spheres are bounded and go into the BVH;
+// planes are infinite and are always tested separately. Instanced
+// triangles are only ever intersected through their mesh's own BVH.
+// ==========================================================================
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <vector>
+#include <string>
+#include <glm/glm.hpp>
+#include "Geometry.h"
+
+// --------------------------------------------------------------------------
+// Scene elements
+
+// Phong-style surface description; reflectance blends in a mirror bounce
+struct Material
+{
+	glm::vec3 diffuse;
+	glm::vec3 specular;
+	float   shininess;
+	float   reflectance;
+
+	Material() : diffuse(0.7f), specular(0.f), shininess(1.f), reflectance(0.f)
+	{}
+};
+
+// lights with a falloff distance keep most of their strength within it and
+// fade with the inverse square of distance beyond; others never fade
+struct Light
+{
+	glm::vec3 position;
+	glm::vec3 colour;
+	float   falloff;    // 0 for none
+
+	Light() : position(0.f), colour(1.f), falloff(0.f)
+	{}
+
+	float Attenuation(float distance) const
+	{
+		if (falloff <= 0.f) return 1.f;
+		float d = distance / falloff;
+		return 1.f / (1.f + d * d);
+	}
+};
+
+// triangle corners index into Scene::vertices, in counter-clockwise order
+struct Triangle
+{
+	unsigned v[3];
+	int     material;
+};
+
+struct Sphere
+{
+	glm::vec3 centre;
+	float   radius;
+	int     material;
+};
+
+struct Plane
+{
+	glm::vec3 normal;
+	glm::vec3 point;
+	int     material;
+};
+
+// triangles shared by every instance of a mesh, in the mesh's own frame
+struct Mesh
+{
+	std::string             name;
+	std::vector<glm::vec3>  vertices;
+	std::vector<Triangle>   triangles;
+};
+
+// a mesh placed in the scene; instances are added with Scene::AddInstance,
+// after their mesh is complete
+struct Instance
+{
+	int     mesh;
+	glm::mat4 toWorld;      // affine object to world transform
+	glm::mat4 toObject;     // and its inverse
+	glm::mat3 normalToWorld;    // inverse transpose of the linear part
+	PrimitiveId offset;     // id of the mesh's first triangle here, counted
+	                        // from the first instanced primitive
+
+	// the ray in the mesh's frame: the direction isn't renormalized, so
+	// distances along it are the same in both frames
+	Ray ToObject(const Ray &ray) const
+	{
+		return Ray(glm::vec3(toObject * glm::vec4(ray.origin, 1.f)),
+		           glm::mat3(toObject) * ray.direction, ray.tMin, ray.tMax);
+	}
+};
+
+// --------------------------------------------------------------------------
+
+class Scene
+{
+public:
+	std::vector<glm::vec3>  vertices;
+	std::vector<Triangle>   triangles;
+	std::vector<Sphere>     spheres;
+	std::vector<Plane>      planes;
+	std::vector<Light>      lights;
+	std::vector<Material>   materials;  // materials[0] is the default
+	std::vector<Mesh>       meshes;
+	std::vector<Instance>   instances;
+	// the scene file and the OBJ files it read, for compiled scene caches
+	std::vector<std::string> sourceFiles;
+
+	Scene();
+
+	// removes everything except the default material
+	void Clear();
+
+	// reads a scene file, replacing the current contents; on failure an
+	// error is printed and the scene is left empty
+	bool LoadFromFile(const std::string &fileName);
+
+	// object counts for load messages, e.g. "3 triangles, 2 spheres, ..."
+	std::string Summary() const;
+
+	// places a mesh with an affine transform, returning the instance index
+	int AddInstance(int mesh, const glm::mat4 &toWorld);
+	// moves an instance, e.g. between the frames of an animation
+	void SetInstanceTransform(int instance, const glm::mat4 &toWorld);
+
+	// index of the mesh with the given name, or -1
+	int FindMesh(const std::string &name) const;
+
+	// triangles stored, counting each mesh's once however often it is
+	// placed, and the heap memory held by the geometry
+	size_t StoredTriangleCount() const;
+	size_t GeometryBytes() const;
+
+	// number of primitives that live in the BVH (triangles and spheres)
+	int BoundedCount() const { return int(triangles.size() + spheres.size()); }
+	int FirstInstanced() const { return BoundedCount() + int(planes.size()); }
+	PrimitiveId PrimitiveCount() const;
+
+	bool IsTriangle(PrimitiveId id) const { return id < PrimitiveId(triangles.size()); }
+	bool IsSphere(PrimitiveId id) const { return !IsTriangle(id) && id < BoundedCount(); }
+	bool IsPlane(PrimitiveId id) const { return id >= BoundedCount() && id < FirstInstanced(); }
+	bool IsInstanced(PrimitiveId id) const { return id >= FirstInstanced(); }
+
+	// instance owning an instanced primitive id
+	int InstanceOf(PrimitiveId id) const;
+
+	// bounds of a triangle or sphere primitive
+	AABB Bounds(int id) const;
+
+	// tests a single primitive, updating hit and shrinking ray.tMax on a hit
+	bool IntersectPrimitive(PrimitiveId id, Ray &ray, Hit &hit) const;
+
+	// geometric unit normal of a primitive at the given surface position
+	glm::vec3 Normal(PrimitiveId id, const glm::vec3 &position) const;
+
+	int MaterialOf(PrimitiveId id) const;
+
+private:
+	// instance of an instanced primitive id, and the id's triangle in its mesh
+	const Instance &InstanceAt(PrimitiveId id, int &triangle) const;
+};
+
+// --------------------------------------------------------------------------
+#endif // SCENE_H
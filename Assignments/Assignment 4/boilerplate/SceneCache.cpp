@@ -0,0 +1,304 @@
+// ==========================================================================
+// Compiled Scene Cache
+//
+// File layout, a binary stream (see BinaryStream.h) after its header:
+//
+//      layout   BVH layout
+//      sources  count, then path, size and CRC-32 of each source file
+//      scene    vertices, triangles, spheres, planes, lights, materials,
+//               meshes (name, vertices, triangles), instances
+//      BVH      Accelerator::Save
+//
+// Everything read is checked against what the tracer indexes without
+// checks, so a damaged cache is reported as stale instead of crashing.
+// ==========================================================================
+
+#include "SceneCache.h"
+#include "BinaryStream.h"
+#include "MappedFile.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <zlib.h>
+
+using namespace std;
+using namespace glm;
+
+// --------------------------------------------------------------------------
+
+namespace
+{
+	const char MAGIC[8] = { 'A', '4', 'S', 'C', 'E', 'N', 'E', '\0' };
+
+	// every struct written as raw bytes
+	uint32_t StructLayout()
+	{
+		const uint32_t sizes[] = { sizeof(vec3), sizeof(mat4), sizeof(Triangle), sizeof(Sphere),
+		                           sizeof(Plane), sizeof(Light), sizeof(Material),
+		                           sizeof(Instance), sizeof(BVHNode), sizeof(WideNode<4>),
+		                           sizeof(WideNode<8>) };
+		return LayoutSignature(sizes, sizeof(sizes) / sizeof(sizes[0]));
+	}
+
+	struct SourceFile
+	{
+		string      path;
+		uint64_t    size;
+		uint32_t    crc;
+	};
+
+	bool ReadSource(const string &path, SourceFile &source)
+	{
+		source.path = path;
+		return FileChecksum(path, source.size, source.crc);
+	}
+
+	double SecondsSince(chrono::steady_clock::time_point start)
+	{
+		return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	}
+
+	// ----------------------------------------------------------------------
+
+	void SaveScene(BinaryWriter &writer, const Scene &scene)
+	{
+		writer.WriteVector(scene.vertices);
+		writer.WriteVector(scene.triangles);
+		writer.WriteVector(scene.spheres);
+		writer.WriteVector(scene.planes);
+		writer.WriteVector(scene.lights);
+		writer.WriteVector(scene.materials);
+		writer.Write(uint64_t(scene.meshes.size()));
+		for (size_t i = 0; i < scene.meshes.size(); ++i)
+		{
+			writer.WriteString(scene.meshes[i].name);
+			writer.WriteVector(scene.meshes[i].vertices);
+			writer.WriteVector(scene.meshes[i].triangles);
+		}
+		writer.WriteVector(scene.instances);
+	}
+
+	bool ValidTriangles(const vector<Triangle> &triangles, size_t vertexCount, size_t materialCount)
+	{
+		for (size_t i = 0; i < triangles.size(); ++i)
+		{
+			const Triangle &triangle = triangles[i];
+			if (triangle.v[0] >= vertexCount || triangle.v[1] >= vertexCount ||
+			    triangle.v[2] >= vertexCount || triangle.material < 0 ||
+			    size_t(triangle.material) >= materialCount)
+				return false;
+		}
+		return true;
+	}
+
+	template <class T>
+	bool ValidMaterials(const vector<T> &objects, size_t materialCount)
+	{
+		for (size_t i = 0; i < objects.size(); ++i)
+			if (objects[i].material < 0 || size_t(objects[i].material) >= materialCount)
+				return false;
+		return true;
+	}
+
+	bool LoadScene(BinaryReader &reader, Scene &scene)
+	{
+		uint64_t meshCount = 0;
+		bool valid = reader.ReadVector(scene.vertices) && reader.ReadVector(scene.triangles) &&
+		             reader.ReadVector(scene.spheres) && reader.ReadVector(scene.planes) &&
+		             reader.ReadVector(scene.lights) && reader.ReadVector(scene.materials) &&
+		             !scene.materials.empty() && reader.Read(meshCount);
+
+		size_t materialCount = scene.materials.size();
+		valid = valid && ValidTriangles(scene.triangles, scene.vertices.size(), materialCount) &&
+		        ValidMaterials(scene.spheres, materialCount) &&
+		        ValidMaterials(scene.planes, materialCount);
+
+		for (uint64_t i = 0; valid && i < meshCount; ++i)
+		{
+			Mesh mesh;
+			valid = reader.ReadString(mesh.name) && reader.ReadVector(mesh.vertices) &&
+			        reader.ReadVector(mesh.triangles) &&
+			        ValidTriangles(mesh.triangles, mesh.vertices.size(), materialCount);
+			if (valid)
+				scene.meshes.push_back(mesh);
+		}
+
+		// instanced ids run on from one instance to the next
+		valid = valid && reader.ReadVector(scene.instances);
+		PrimitiveId offset = 0;
+		for (size_t i = 0; valid && i < scene.instances.size(); ++i)
+		{
+			const Instance &instance = scene.instances[i];
+			valid = instance.mesh >= 0 && size_t(instance.mesh) < scene.meshes.size() &&
+			        instance.offset == offset;
+			if (valid)
+				offset += PrimitiveId(scene.meshes[instance.mesh].triangles.size());
+		}
+		return valid;
+	}
+
+	// ----------------------------------------------------------------------
+
+	// loads the scene and its structure from the cache; when the cache
+	// can't be used, says why, or nothing when there is no cache at all
+	bool ReadCache(const string &cacheFile, const string &sceneFile, BVHLayout layout,
+	               Scene &scene, Accelerator &accelerator, string &reason)
+	{
+		MappedFile file;
+		if (!file.Open(cacheFile))
+			return false;
+		BinaryReader reader(file.Data(), file.Size());
+
+		uint32_t sourceCount = 0;
+		int32_t cachedLayout = 0;
+		if (!ReadHeader(reader, MAGIC, SCENE_CACHE_VERSION, StructLayout()))
+		{
+			reason = "it was written by another version of the tracer";
+			return false;
+		}
+		if (!reader.Read(cachedLayout) || cachedLayout != int32_t(layout))
+		{
+			reason = "it holds another BVH layout";
+			return false;
+		}
+
+		// the scene file comes first; it is checked under the name it has
+		// now, which may be spelled differently from when it was cached
+		reader.Read(sourceCount);
+		vector<string> sources;
+		for (uint32_t i = 0; i < sourceCount && !reader.Failed(); ++i)
+		{
+			SourceFile cached, current;
+			reader.ReadString(cached.path);
+			reader.Read(cached.size);
+			reader.Read(cached.crc);
+			if (reader.Failed())
+				break;
+			string path = i == 0 ? sceneFile : cached.path;
+			if (!ReadSource(path, current) || current.size != cached.size ||
+			    current.crc != cached.crc)
+			{
+				reason = path + " has changed";
+				return false;
+			}
+			sources.push_back(path);
+		}
+
+		scene.Clear();
+		if (reader.Failed() || sources.empty() || !LoadScene(reader, scene) ||
+		    !accelerator.Load(reader, scene) || accelerator.Layout() != layout ||
+		    !reader.AtEnd())
+		{
+			scene.Clear();
+			accelerator = Accelerator();
+			reason = "it is damaged";
+			return false;
+		}
+		scene.sourceFiles = sources;
+		return true;
+	}
+
+	// writes to a temporary file renamed over the cache once complete, so
+	// a run reading the cache never sees half of one
+	bool WriteCache(const string &cacheFile, const Scene &scene, const Accelerator &accelerator)
+	{
+		vector<SourceFile> sources(scene.sourceFiles.size());
+		for (size_t i = 0; i < sources.size(); ++i)
+			if (!ReadSource(scene.sourceFiles[i], sources[i]))
+				return false;
+
+		string partFile = cacheFile + ".part";
+		FILE *file = fopen(partFile.c_str(), "wb");
+		if (!file)
+			return false;
+
+		BinaryWriter writer(file);
+		WriteHeader(writer, MAGIC, SCENE_CACHE_VERSION, StructLayout());
+		writer.Write(int32_t(accelerator.Layout()));
+		writer.Write(uint32_t(sources.size()));
+		for (size_t i = 0; i < sources.size(); ++i)
+		{
+			writer.WriteString(sources[i].path);
+			writer.Write(sources[i].size);
+			writer.Write(sources[i].crc);
+		}
+		SaveScene(writer, scene);
+		accelerator.Save(writer);
+
+		bool ok = !writer.Failed();
+		ok = fclose(file) == 0 && ok;
+		if (!ok)
+		{
+			remove(partFile.c_str());
+			return false;
+		}
+		return ReplaceFile(partFile, cacheFile);
+	}
+}
+
+// --------------------------------------------------------------------------
+
+bool FileChecksum(const string &fileName, uint64_t &size, uint32_t &crc)
+{
+	MappedFile file;
+	if (!file.Open(fileName))
+		return false;
+	size = file.Size();
+
+	// crc32 takes at most a uInt of bytes at a time
+	uLong sum = crc32(0L, Z_NULL, 0);
+	const char *data = file.Data();
+	for (size_t left = file.Size(); left > 0; )
+	{
+		uInt length = uInt(std::min<size_t>(left, 1u << 30));
+		sum = crc32(sum, reinterpret_cast<const Bytef *>(data), length);
+		data += length;
+		left -= length;
+	}
+	crc = uint32_t(sum);
+	return true;
+}
+
+string SceneCacheFile(const string &sceneFile)
+{
+	return sceneFile + ".cache";
+}
+
+bool LoadCompiledScene(const string &sceneFile, Scene &scene, Accelerator &accelerator,
+                       BVHLayout layout, bool useCache)
+{
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	string cacheFile = SceneCacheFile(sceneFile);
+	if (useCache)
+	{
+		string reason;
+		if (ReadCache(cacheFile, sceneFile, layout, scene, accelerator, reason))
+		{
+			cout << "Scene loaded " << sceneFile << " from " << cacheFile << " in "
+			     << SecondsSince(start) << " s: " << scene.Summary() << endl;
+			return true;
+		}
+		if (!reason.empty())
+			cout << "Scene cache " << cacheFile << " not used: " << reason << endl;
+	}
+
+	accelerator = Accelerator();
+	if (!scene.LoadFromFile(sceneFile))
+		return false;
+	accelerator.Build(scene, layout);
+
+	if (useCache)
+	{
+		chrono::steady_clock::time_point writeStart = chrono::steady_clock::now();
+		if (WriteCache(cacheFile, scene, accelerator))
+			cout << "Scene cache written to " << cacheFile << " in " << SecondsSince(writeStart)
+			     << " s" << endl;
+		else
+			cout << "Scene cache WARNING: Could not write " << cacheFile << endl;
+	}
+	return true;
+}
+
+// --------------------------------------------------------------------------
@@ -0,0 +1,45 @@
+// ==========================================================================
+// Compiled Scene Cache
+//  - once a scene file is parsed and its BVH built, the primitives,
+//    materials and built structure are written beside it as one flat,
+//    pointer-free binary file, scene.txt.cache
+//  - later loads map the cache and copy its arrays straight into place,
+//    with no parsing and no build
+//  - the cache records the size and CRC-32 of the scene file and of every
+//    OBJ file it read; a change to any of them, another BVH layout, or a
+//    build with different struct layouts makes the cache stale, and it is
+//    written again from the text
+//
+// Arrays are copied out of the mapping rather than traced in place, so the
+// scene and BVH classes keep owning their memory; the copy runs at memory
+// speed, far faster than parsing or building. Bump SCENE_CACHE_VERSION
+// whenever what is written changes.
+// ==========================================================================
+#ifndef SCENECACHE_H
+#define SCENECACHE_H
+
+#include <cstdint>
+#include <string>
+#include "Scene.h"
+#include "Accelerator.h"
+
+// --------------------------------------------------------------------------
+
+const uint32_t SCENE_CACHE_VERSION = 3;
+
+// size and CRC-32 of a file, as the cache records them for the files a
+// scene was read from; false if the file can't be read
+bool FileChecksum(const std::string &fileName, uint64_t &size, uint32_t &crc);
+
+// cache file kept for a scene file
+std::string SceneCacheFile(const std::string &sceneFile);
+
+// Loads a scene and its acceleration structure, from the scene's cache
+// when it is current, otherwise from the text, writing a new cache after
+// the build. With useCache false the cache is neither read nor written. On
+// failure an error is printed and both are left empty.
+bool LoadCompiledScene(const std::string &sceneFile, Scene &scene, Accelerator &accelerator,
+                       BVHLayout layout = DEFAULT_BVH_LAYOUT, bool useCache = true);
+
+// --------------------------------------------------------------------------
+#endif // SCENECACHE_H
@@ -0,0 +1,247 @@
+// ==========================================================================
+// Minimal SIMD Float Vectors
+//  - vfloat4 wraps SSE and vfloat8 wraps AVX when the compiler targets them
+//  - both fall back to plain arrays with the same interface otherwise, so
+//    the packet and wide BVH kernels compile on any machine
+//
+// Comparisons return masks with all bits of a lane set, stored in the same
+// vector type. Masks combine with &, | and AndNot(), and Select() blends by
+// mask. FromBits()/StoreBits() move 32-bit integers through the lanes,
+// which the kernels use to carry primitive ids alongside hit distances.
+// ==========================================================================
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define SIMD_SSE
+#include <emmintrin.h>
+#endif
+#if defined(__AVX__)
+#define SIMD_AVX
+#include <immintrin.h>
+#endif
+
+// --------------------------------------------------------------------------
+// Portable fallback: W floats in an array, with element-wise loops that the
+// compiler is free to vectorize for whatever the target supports
+
+template <int W>
+struct vfloatArray
+{
+	static const int Width = W;
+	float   f[W];
+
+	vfloatArray() {}
+	explicit vfloatArray(float s) { for (int i = 0; i < W; ++i) f[i] = s; }
+
+	static vfloatArray Load(const float *p) { vfloatArray r; std::memcpy(r.f, p, sizeof(r.f)); return r; }
+	void Store(float *p) const { std::memcpy(p, f, sizeof(f)); }
+
+	static vfloatArray FromBits(int bits)
+	{
+		vfloatArray r;
+		for (int i = 0; i < W; ++i) std::memcpy(&r.f[i], &bits, 4);
+		return r;
+	}
+	void StoreBits(int *p) const { std::memcpy(p, f, sizeof(f)); }
+
+	float operator[](int i) const { return f[i]; }
+
+	// lane mask with bit i set when the sign bit of lane i is set
+	int Movemask() const
+	{
+		int m = 0;
+		for (int i = 0; i < W; ++i) m |= int(std::signbit(f[i])) << i;
+		return m;
+	}
+};
+
+namespace simd_detail
+{
+	template <int W, class Op>
+	vfloatArray<W> Apply(const vfloatArray<W> &a, const vfloatArray<W> &b, Op op)
+	{
+		vfloatArray<W> r;
+		for (int i = 0; i < W; ++i) r.f[i] = op(a.f[i], b.f[i]);
+		return r;
+	}
+
+	inline float Mask(bool b)
+	{
+		unsigned bits = b ? 0xffffffffu : 0u;
+		float f;
+		std::memcpy(&f, &bits, 4);
+		return f;
+	}
+
+	template <class Op>
+	float Bitwise(float a, float b, Op op)
+	{
+		unsigned x, y;
+		std::memcpy(&x, &a, 4);
+		std::memcpy(&y, &b, 4);
+		x = op(x, y);
+		std::memcpy(&a, &x, 4);
+		return a;
+	}
+
+	struct Add { float operator()(float a, float b) const { return a + b; } };
+	struct Sub { float operator()(float a, float b) const { return a - b; } };
+	struct Mul { float operator()(float a, float b) const { return a * b; } };
+	struct Div { float operator()(float a, float b) const { return a / b; } };
+	struct Min { float operator()(float a, float b) const { return b < a ? b : a; } };
+	struct Max { float operator()(float a, float b) const { return a < b ? b : a; } };
+	struct Lt  { float operator()(float a, float b) const { return Mask(a < b); } };
+	struct Le  { float operator()(float a, float b) const { return Mask(a <= b); } };
+	struct And { unsigned operator()(unsigned a, unsigned b) const { return a & b; } };
+	struct Or  { unsigned operator()(unsigned a, unsigned b) const { return a | b; } };
+	struct AndN { unsigned operator()(unsigned a, unsigned b) const { return ~a & b; } };
+	struct BitAnd { float operator()(float a, float b) const { return Bitwise(a, b, And()); } };
+	struct BitOr  { float operator()(float a, float b) const { return Bitwise(a, b, Or()); } };
+	struct BitAndN { float operator()(float a, float b) const { return Bitwise(a, b, AndN()); } };
+}
+
+template <int W> inline vfloatArray<W> operator+(const vfloatArray<W> &a, const vfloatArray<W> &b) { return simd_detail::Apply(a, b, simd_detail::Add()); }
+template <int W> inline vfloatArray<W> operator-(const vfloatArray<W> &a, const vfloatArray<W> &b) { return simd_detail::Apply(a, b, simd_detail::Sub()); }
+template <int W> inline vfloatArray<W> operator-(const vfloatArray<W> &a) { return vfloatArray<W>(0.f) - a; }
+template <int W> inline vfloatArray<W> operator*(const vfloatArray<W> &a, const vfloatArray<W> &b) { return simd_detail::Apply(a, b, simd_detail::Mul()); }
+template <int W> inline vfloatArray<W> operator/(const vfloatArray<W> &a, const vfloatArray<W> &b) { return simd_detail::Apply(a, b, simd_detail::Div()); }
+template <int W> inline vfloatArray<W> operator<(const vfloatArray<W> &a, const vfloatArray<W> &b) { return simd_detail::Apply(a, b, simd_detail::Lt()); }
+template <int W> inline vfloatArray<W> operator<=(const vfloatArray<W> &a, const vfloatArray<W> &b) { return simd_detail::Apply(a, b, simd_detail::Le()); }
+template <int W> inline vfloatArray<W> operator>(const vfloatArray<W> &a, const vfloatArray<W> &b) { return b < a; }
+template <int W> inline vfloatArray<W> operator>=(const vfloatArray<W> &a, const vfloatArray<W> &b) { return b <= a; }
+template <int W> inline vfloatArray<W> operator&(const vfloatArray<W> &a, const vfloatArray<W> &b) { return simd_detail::Apply(a, b, simd_detail::BitAnd()); }
+template <int W> inline vfloatArray<W> operator|(const vfloatArray<W> &a, const vfloatArray<W> &b) { return simd_detail::Apply(a, b, simd_detail::BitOr()); }
+template <int W> inline vfloatArray<W> AndNot(const vfloatArray<W> &a, const vfloatArray<W> &b) { return simd_detail::Apply(a, b, simd_detail::BitAndN()); }
+template <int W> inline vfloatArray<W> Min(const vfloatArray<W> &a, const vfloatArray<W> &b) { return simd_detail::Apply(a, b, simd_detail::Min()); }
+template <int W> inline vfloatArray<W> Max(const vfloatArray<W> &a, const vfloatArray<W> &b) { return simd_detail::Apply(a, b, simd_detail::Max()); }
+template <int W> inline vfloatArray<W> Select(const vfloatArray<W> &mask, const vfloatArray<W> &a, const vfloatArray<W> &b) { return (mask & a) | AndNot(mask, b); }
+template <int W> inline vfloatArray<W> Sqrt(const vfloatArray<W> &a)
+{
+	vfloatArray<W> r;
+	for (int i = 0; i < W; ++i) r.f[i] = std::sqrt(a.f[i]);
+	return r;
+}
+template <int W> inline vfloatArray<W> Abs(const vfloatArray<W> &a)
+{
+	vfloatArray<W> r;
+	for (int i = 0; i < W; ++i) r.f[i] = std::fabs(a.f[i]);
+	return r;
+}
+
+// --------------------------------------------------------------------------
+// Four lanes
+
+#ifdef SIMD_SSE
+
+struct vfloat4
+{
+	static const int Width = 4;
+	__m128  v;
+
+	vfloat4() {}
+	vfloat4(__m128 x) : v(x) {}
+	explicit vfloat4(float s) : v(_mm_set1_ps(s)) {}
+
+	static vfloat4 Load(const float *p) { return _mm_loadu_ps(p); }
+	void Store(float *p) const { _mm_storeu_ps(p, v); }
+	static vfloat4 FromBits(int bits) { return _mm_castsi128_ps(_mm_set1_epi32(bits)); }
+	void StoreBits(int *p) const { _mm_storeu_si128((__m128i *)p, _mm_castps_si128(v)); }
+
+	float operator[](int i) const { float f[4]; Store(f); return f[i]; }
+	int Movemask() const { return _mm_movemask_ps(v); }
+};
+
+inline vfloat4 operator+(const vfloat4 &a, const vfloat4 &b) { return _mm_add_ps(a.v, b.v); }
+inline vfloat4 operator-(const vfloat4 &a, const vfloat4 &b) { return _mm_sub_ps(a.v, b.v); }
+inline vfloat4 operator-(const vfloat4 &a) { return _mm_xor_ps(_mm_set1_ps(-0.f), a.v); }
+inline vfloat4 operator*(const vfloat4 &a, const vfloat4 &b) { return _mm_mul_ps(a.v, b.v); }
+inline vfloat4 operator/(const vfloat4 &a, const vfloat4 &b) { return _mm_div_ps(a.v, b.v); }
+inline vfloat4 operator<(const vfloat4 &a, const vfloat4 &b) { return _mm_cmplt_ps(a.v, b.v); }
+inline vfloat4 operator<=(const vfloat4 &a, const vfloat4 &b) { return _mm_cmple_ps(a.v, b.v); }
+inline vfloat4 operator>(const vfloat4 &a, const vfloat4 &b) { return _mm_cmpgt_ps(a.v, b.v); }
+inline vfloat4 operator>=(const vfloat4 &a, const vfloat4 &b) { return _mm_cmpge_ps(a.v, b.v); }
+inline vfloat4 operator&(const vfloat4 &a, const vfloat4 &b) { return _mm_and_ps(a.v, b.v); }
+inline vfloat4 operator|(const vfloat4 &a, const vfloat4 &b) { return _mm_or_ps(a.v, b.v); }
+inline vfloat4 AndNot(const vfloat4 &a, const vfloat4 &b) { return _mm_andnot_ps(a.v, b.v); }
+inline vfloat4 Min(const vfloat4 &a, const vfloat4 &b) { return _mm_min_ps(a.v, b.v); }
+inline vfloat4 Max(const vfloat4 &a, const vfloat4 &b) { return _mm_max_ps(a.v, b.v); }
+inline vfloat4 Sqrt(const vfloat4 &a) { return _mm_sqrt_ps(a.v); }
+inline vfloat4 Abs(const vfloat4 &a) { return _mm_andnot_ps(_mm_set1_ps(-0.f), a.v); }
+inline vfloat4 Select(const vfloat4 &mask, const vfloat4 &a, const vfloat4 &b)
+{
+	return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v));
+}
+
+#else
+typedef vfloatArray<4> vfloat4;
+#endif
+
+// --------------------------------------------------------------------------
+// Eight lanes
+
+#ifdef SIMD_AVX
+
+struct vfloat8
+{
+	static const int Width = 8;
+	__m256  v;
+
+	vfloat8() {}
+	vfloat8(__m256 x) : v(x) {}
+	explicit vfloat8(float s) : v(_mm256_set1_ps(s)) {}
+
+	static vfloat8 Load(const float *p) { return _mm256_loadu_ps(p); }
+	void Store(float *p) const { _mm256_storeu_ps(p, v); }
+	static vfloat8 FromBits(int bits) { return _mm256_castsi256_ps(_mm256_set1_epi32(bits)); }
+	void StoreBits(int *p) const { _mm256_storeu_si256((__m256i *)p, _mm256_castps_si256(v)); }
+
+	float operator[](int i) const { float f[8]; Store(f); return f[i]; }
+	int Movemask() const { return _mm256_movemask_ps(v); }
+};
+
+inline vfloat8 operator+(const vfloat8 &a, const vfloat8 &b) { return _mm256_add_ps(a.v, b.v); }
+inline vfloat8 operator-(const vfloat8 &a, const vfloat8 &b) { return _mm256_sub_ps(a.v, b.v); }
+inline vfloat8 operator-(const vfloat8 &a) { return _mm256_xor_ps(_mm256_set1_ps(-0.f), a.v); }
+inline vfloat8 operator*(const vfloat8 &a, const vfloat8 &b) { return _mm256_mul_ps(a.v, b.v); }
+inline vfloat8 operator/(const vfloat8 &a, const vfloat8 &b) { return _mm256_div_ps(a.v, b.v); }
+inline vfloat8 operator<(const vfloat8 &a, const vfloat8 &b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); }
+inline vfloat8 operator<=(const vfloat8 &a, const vfloat8 &b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ); }
+inline vfloat8 operator>(const vfloat8 &a, const vfloat8 &b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ); }
+inline vfloat8 operator>=(const vfloat8 &a, const vfloat8 &b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ); }
+inline vfloat8 operator&(const vfloat8 &a, const vfloat8 &b) { return _mm256_and_ps(a.v, b.v); }
+inline vfloat8 operator|(const vfloat8 &a, const vfloat8 &b) { return _mm256_or_ps(a.v, b.v); }
+inline vfloat8 AndNot(const vfloat8 &a, const vfloat8 &b) { return _mm256_andnot_ps(a.v, b.v); }
+inline vfloat8 Min(const vfloat8 &a, const vfloat8 &b) { return _mm256_min_ps(a.v, b.v); }
+inline vfloat8 Max(const vfloat8 &a, const vfloat8 &b) { return _mm256_max_ps(a.v, b.v); }
+inline vfloat8 Sqrt(const vfloat8 &a) { return _mm256_sqrt_ps(a.v); }
+inline vfloat8 Abs(const vfloat8 &a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.f), a.v); }
+inline vfloat8 Select(const vfloat8 &mask, const vfloat8 &a, const vfloat8 &b)
+{
+	return _mm256_blendv_ps(b.v, a.v, mask.v);
+}
+
+#else
+typedef vfloatArray<8> vfloat8;
+#endif
+
+// --------------------------------------------------------------------------
+// Operations shared by every width
+
+template <class F> inline bool Any(const F &mask) { return mask.Movemask() != 0; }
+template <class F> inline bool None(const F &mask) { return mask.Movemask() == 0; }
+
+// smallest lane of x among those selected by mask (+inf if none)
+template <class F> inline float ReduceMin(const F &mask, const F &x)
+{
+	float f[F::Width];
+	Select(mask, x, F(INFINITY)).Store(f);
+	return *std::min_element(f, f + F::Width);
+}
+
+// --------------------------------------------------------------------------
+#endif // SIMD_H
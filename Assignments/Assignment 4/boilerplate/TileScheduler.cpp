@@ -0,0 +1,172 @@
+// ==========================================================================
+// Parallel Tile Scheduler
+// ==========================================================================
+
+#include "TileScheduler.h"
+
+#include <algorithm>
+
+using namespace std;
+
+// --------------------------------------------------------------------------
+
+TileScheduler::TileScheduler()
+	: m_cancelled(false), m_tilesDone(0), m_finished(0), m_passesDone(0),
+	  m_tileCount(0), m_passes(1), m_threadCount(0), m_waiting(0)
+{
+}
+
+TileScheduler::~TileScheduler()
+{
+	Cancel();
+	for (size_t i = 0; i < m_queues.size(); ++i)
+		delete m_queues[i];
+}
+
+int TileScheduler::HardwareThreads()
+{
+	int threads = int(thread::hardware_concurrency());
+	return threads > 0 ? threads : 1;
+}
+
+// --------------------------------------------------------------------------
+
+void TileScheduler::Start(int width, int height, int tileSize, int threadCount,
+                          const TileFunction &renderTile, int passes)
+{
+	Cancel();
+	for (size_t i = 0; i < m_queues.size(); ++i)
+		delete m_queues[i];
+	m_queues.clear();
+	m_workers.clear();
+
+	if (threadCount <= 0)
+		threadCount = HardwareThreads();
+	tileSize = std::max(tileSize, 1);
+
+	m_tiles.clear();
+	for (int y = 0; y < height; y += tileSize)
+		for (int x = 0; x < width; x += tileSize)
+		{
+			Tile tile = { x, y, std::min(tileSize, width - x), std::min(tileSize, height - y), 0 };
+			m_tiles.push_back(tile);
+		}
+
+	threadCount = std::max(1, std::min(threadCount, int(m_tiles.size())));
+	for (int i = 0; i < threadCount; ++i)
+		m_queues.push_back(new WorkQueue);
+	DealTiles(0);
+
+	m_renderTile = renderTile;
+	m_cancelled = false;
+	m_tilesDone = 0;
+	m_finished = 0;
+	m_passesDone = 0;
+	m_passes = std::max(passes, 1);
+	m_tileCount = int(m_tiles.size()) * m_passes;
+	m_threadCount = threadCount;
+	m_waiting = 0;
+	for (int i = 0; i < threadCount; ++i)
+		m_workers.push_back(thread(&TileScheduler::WorkerLoop, this, i));
+}
+
+void TileScheduler::Wait()
+{
+	for (size_t i = 0; i < m_workers.size(); ++i)
+		if (m_workers[i].joinable())
+			m_workers[i].join();
+}
+
+void TileScheduler::Cancel()
+{
+	// taking the lock makes sure no worker is between checking the flag
+	// and starting to wait, where it would miss the wake-up
+	m_cancelled = true;
+	{
+		lock_guard<mutex> guard(m_barrierLock);
+	}
+	m_barrier.notify_all();
+	Wait();
+}
+
+// --------------------------------------------------------------------------
+
+// deals each worker a contiguous run of tiles so that neighbouring tiles,
+// which touch the same part of the scene, tend to share a core
+void TileScheduler::DealTiles(int pass)
+{
+	size_t count = m_queues.size();
+	for (size_t i = 0; i < count; ++i)
+	{
+		WorkQueue &queue = *m_queues[i];
+		lock_guard<mutex> guard(queue.lock);
+		size_t first = m_tiles.size() * i / count;
+		size_t last = m_tiles.size() * (i + 1) / count;
+		queue.tiles.assign(m_tiles.begin() + first, m_tiles.begin() + last);
+		for (size_t k = 0; k < queue.tiles.size(); ++k)
+			queue.tiles[k].pass = pass;
+	}
+}
+
+bool TileScheduler::NextTile(int thread, Tile &tile)
+{
+	// take work from the front of our own queue first
+	{
+		WorkQueue &own = *m_queues[thread];
+		lock_guard<mutex> guard(own.lock);
+		if (!own.tiles.empty())
+		{
+			tile = own.tiles.front();
+			own.tiles.pop_front();
+			return true;
+		}
+	}
+
+	// then steal from the back of the others, furthest from their owners
+	int count = int(m_queues.size());
+	for (int i = 1; i < count; ++i)
+	{
+		WorkQueue &victim = *m_queues[(thread + i) % count];
+		lock_guard<mutex> guard(victim.lock);
+		if (!victim.tiles.empty())
+		{
+			tile = victim.tiles.back();
+			victim.tiles.pop_back();
+			return true;
+		}
+	}
+	return false;
+}
+
+void TileScheduler::WorkerLoop(int thread)
+{
+	Tile tile;
+	for (int pass = 0; pass < m_passes && !m_cancelled; ++pass)
+	{
+		while (!m_cancelled && NextTile(thread, tile))
+		{
+			m_renderTile(tile, thread);
+			++m_tilesDone;
+		}
+		if (m_cancelled) break;
+
+		// the last worker to finish the pass deals out the next one
+		unique_lock<mutex> guard(m_barrierLock);
+		if (++m_waiting == m_threadCount)
+		{
+			m_waiting = 0;
+			++m_passesDone;
+			if (pass + 1 < m_passes)
+				DealTiles(pass + 1);
+			m_barrier.notify_all();
+		}
+		else
+		{
+			int done = m_passesDone;
+			m_barrier.wait(guard, [&] { return m_passesDone != done || m_cancelled; });
+		}
+	}
+	++m_finished;
+}
+
+// --------------------------------------------------------------------------
@@ -0,0 +1,97 @@
+// ==========================================================================
+// Parallel Tile Scheduler
+//  - splits an image into square tiles and renders them on worker threads
+//  - each worker owns a queue of tiles; when its queue runs dry it steals
+//    from the back of another worker's queue, so threads stay busy even
+//    when some parts of the image are much more expensive than others
+//  - an image can be rendered in several passes, with every tile of one
+//    pass finished before any tile of the next is started
+//
+// Rendering runs in the background, which lets the caller keep the window
+// responsive and show tiles as they complete.
+// ==========================================================================
+#ifndef TILESCHEDULER_H
+#define TILESCHEDULER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// --------------------------------------------------------------------------
+
+// rectangle of pixels, with (x, y) its bottom-left corner
+struct Tile
+{
+	int     x, y;
+	int     width, height;
+	int     pass;           // index of the pass the tile is rendered in
+};
+
+class TileScheduler
+{
+public:
+	// called once per tile; thread is the worker index in [0, threadCount)
+	typedef std::function<void(const Tile &tile, int thread)> TileFunction;
+
+	TileScheduler();
+	~TileScheduler();
+
+	// starts rendering a width x height image in the background, passes
+	// times over; a threadCount of zero or less uses every hardware thread
+	void Start(int width, int height, int tileSize, int threadCount,
+	           const TileFunction &renderTile, int passes = 1);
+
+	// blocks until every tile is done (or abandoned after Cancel)
+	void Wait();
+
+	// asks workers to stop after their current tile, then waits for them
+	void Cancel();
+
+	bool Running() const { return !m_workers.empty() && !Finished(); }
+	bool Finished() const { return m_finished == int(m_workers.size()); }
+	int TilesDone() const { return m_tilesDone; }
+	int TileCount() const { return m_tileCount; }
+	int ThreadCount() const { return int(m_workers.size()); }
+	int PassesDone() const { return m_passesDone; }
+
+	static int HardwareThreads();
+
+private:
+	struct WorkQueue
+	{
+		std::mutex          lock;
+		std::deque<Tile>    tiles;
+	};
+
+	std::vector<std::thread>    m_workers;
+	std::vector<WorkQueue *>    m_queues;
+	std::vector<Tile>           m_tiles;        // tiles of one pass
+	TileFunction                m_renderTile;
+	std::atomic<bool>           m_cancelled;
+	std::atomic<int>            m_tilesDone;
+	std::atomic<int>            m_finished;
+	std::atomic<int>            m_passesDone;
+	int                         m_tileCount;
+	int                         m_passes;
+	int                         m_threadCount;
+
+	// workers that ran out of tiles wait here for the rest of the pass
+	std::mutex                  m_barrierLock;
+	std::condition_variable     m_barrier;
+	int                         m_waiting;
+
+	void DealTiles(int pass);
+	bool NextTile(int thread, Tile &tile);
+	void WorkerLoop(int thread);
+
+	// not copyable: workers hold a pointer to us
+	TileScheduler(const TileScheduler &);
+	TileScheduler &operator=(const TileScheduler &);
+};
+
+// --------------------------------------------------------------------------
+#endif // TILESCHEDULER_H
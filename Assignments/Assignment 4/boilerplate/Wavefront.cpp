@@ -0,0 +1,198 @@
+// ==========================================================================
+// Wavefront Queues
+// ==========================================================================
+
+#include "Wavefront.h"
+
+#include <algorithm>
+
+using namespace std;
+using namespace glm;
+
+// --------------------------------------------------------------------------
+
+namespace
+{
+	const int GRID_BITS = 9;
+	const int GRID_CELLS = 1 << GRID_BITS;
+
+	// spreads the low ten bits of x three apart, for Morton codes
+	unsigned SpreadBits(unsigned x)
+	{
+		x = (x | (x << 16)) & 0x030000FFu;
+		x = (x | (x << 8)) & 0x0300F00Fu;
+		x = (x | (x << 4)) & 0x030C30C3u;
+		x = (x | (x << 2)) & 0x09249249u;
+		return x;
+	}
+
+	int Cell(float coordinate, float origin, float scale)
+	{
+		int cell = int((coordinate - origin) * scale);
+		return std::min(std::max(cell, 0), GRID_CELLS - 1);
+	}
+
+	template <int N>
+	void IntersectPackets(const Accelerator &accelerator, const RayQueue &rays,
+	                      const vector<int> &order, HitQueue &hits)
+	{
+		RayPacket<N> packet;
+		Hit found[N];
+		int count = int(order.size());
+		for (int first = 0; first < count; first += N)
+		{
+			for (int k = 0; k < N; ++k)
+			{
+				if (first + k < count)
+					packet.Set(k, rays.Get(order[first + k]));
+				else
+					packet.Disable(k);
+			}
+			accelerator.IntersectPacket(packet, found);
+			for (int k = 0; k < N && first + k < count; ++k)
+				hits.Set(order[first + k], found[k]);
+		}
+	}
+}
+
+// --------------------------------------------------------------------------
+
+void RayQueue::Clear()
+{
+	ox.clear(); oy.clear(); oz.clear();
+	dx.clear(); dy.clear(); dz.clear();
+	tMax.clear();
+	path.clear();
+}
+
+void HitQueue::Resize(int size)
+{
+	t.resize(size);
+	u.resize(size);
+	v.resize(size);
+	primitive.resize(size);
+}
+
+void ShadowQueue::Clear()
+{
+	rays.Clear();
+	light.clear();
+	colour.clear();
+}
+
+void Wavefront::Clear(int maxDepth, int paths)
+{
+	rays.Clear();
+	next.Clear();
+	shadows.Clear();
+	random.clear();
+	pixel.clear();
+	depth.clear();
+	caustic.clear();
+	vertices = std::max(maxDepth, 0) + 1;
+	local.resize(size_t(paths) * vertices);
+	reflectance.resize(size_t(paths) * vertices);
+}
+
+int Wavefront::AddPath(unsigned seed, int tilePixel)
+{
+	random.push_back(seed);
+	pixel.push_back(tilePixel);
+	depth.push_back(0);
+	caustic.push_back(vec3(0.f));
+	return int(random.size()) - 1;
+}
+
+// --------------------------------------------------------------------------
+
+CoherenceGrid::CoherenceGrid(const AABB &bounds)
+	: m_origin(0.f), m_scale(0.f)
+{
+	if (bounds.Empty())
+		return;
+	vec3 extent = bounds.Extent();
+	m_origin = bounds.lower;
+	for (int axis = 0; axis < 3; ++axis)
+		m_scale[axis] = extent[axis] > 0.f ? GRID_CELLS / extent[axis] : 0.f;
+}
+
+unsigned CoherenceGrid::Key(const RayQueue &queue, int i) const
+{
+	unsigned octant = (queue.dx[i] < 0.f ? 1u : 0u) | (queue.dy[i] < 0.f ? 2u : 0u) |
+	                  (queue.dz[i] < 0.f ? 4u : 0u);
+	unsigned x = unsigned(Cell(queue.ox[i], m_origin.x, m_scale.x));
+	unsigned y = unsigned(Cell(queue.oy[i], m_origin.y, m_scale.y));
+	unsigned z = unsigned(Cell(queue.oz[i], m_origin.z, m_scale.z));
+	return octant << (3 * GRID_BITS) | SpreadBits(x) | SpreadBits(y) << 1 | SpreadBits(z) << 2;
+}
+
+void SortByKey(const RayQueue &queue, const CoherenceGrid &grid, vector<unsigned> &keys,
+               vector<int> &order, vector<int> &scratch)
+{
+	// the counts of all four bytes are taken in one sweep over the keys
+	int count = queue.Size();
+	keys.resize(count);
+	order.resize(count);
+	scratch.resize(count);
+	int offsets[4][256] = { { 0 } };
+	for (int i = 0; i < count; ++i)
+	{
+		unsigned key = grid.Key(queue, i);
+		keys[i] = key;
+		order[i] = i;
+		for (int b = 0; b < 4; ++b)
+			++offsets[b][(key >> (8 * b)) & 0xFFu];
+	}
+
+	// least significant byte first; each pass is stable, so the order
+	// ends up sorted on the whole key, and passes over a byte every key
+	// shares are skipped
+	for (int b = 0; b < 4 && count > 0; ++b)
+	{
+		int *offset = offsets[b];
+		if (offset[(keys[0] >> (8 * b)) & 0xFFu] == count)
+			continue;
+		for (int d = 0, sum = 0; d < 256; ++d)
+		{
+			int size = offset[d];
+			offset[d] = sum;
+			sum += size;
+		}
+		for (int i = 0; i < count; ++i)
+			scratch[offset[(keys[order[i]] >> (8 * b)) & 0xFFu]++] = order[i];
+		order.swap(scratch);
+	}
+}
+
+void SortByBin(const vector<int> &bins, int binCount, vector<int> &order)
+{
+	vector<int> offsets(binCount + 1, 0);
+	for (size_t i = 0; i < bins.size(); ++i)
+		++offsets[bins[i] + 1];
+	for (int b = 0; b < binCount; ++b)
+		offsets[b + 1] += offsets[b];
+	order.resize(bins.size());
+	for (size_t i = 0; i < bins.size(); ++i)
+		order[offsets[bins[i]]++] = int(i);
+}
+
+void IntersectQueue(const Accelerator &accelerator, const RayQueue &rays,
+                    const vector<int> &order, int packetSize, HitQueue &hits)
+{
+	hits.Resize(rays.Size());
+	switch (packetSize)
+	{
+	case 4:  IntersectPackets<4>(accelerator, rays, order, hits); return;
+	case 8:  IntersectPackets<8>(accelerator, rays, order, hits); return;
+	case 16: IntersectPackets<16>(accelerator, rays, order, hits); return;
+	}
+
+	for (size_t k = 0; k < order.size(); ++k)
+	{
+		Hit hit;
+		accelerator.Intersect(rays.Get(order[k]), hit);
+		hits.Set(order[k], hit);
+	}
+}
+
+// --------------------------------------------------------------------------
@@ -0,0 +1,155 @@
+// ==========================================================================
+// Wavefront Queues
+//  - the queues a wavefront render passes between its stages, held as
+//    structure of arrays: rays to extend, the hits they find, and shadow
+//    rays with the light they carry
+//  - coherence keys sorting rays by the cell of a grid over the scene that
+//    their origin lies in, under the octant of their direction
+//  - a stable radix sort of queue entries by key, and a counting sort of
+//    hits into bins by material
+//
+// The recursive tracer follows each pixel's reflection and shadow rays to
+// the end before starting the next pixel, and those rays head off in all
+// directions, so each one walks a different part of the BVH from the last.
+// Sorted, rays setting out from the same region the same way are traced
+// one after another and find the nodes they need still in cache, which is
+// worth most to rays that scatter.
+// ==========================================================================
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include <vector>
+#include <glm/glm.hpp>
+#include "Geometry.h"
+#include "Accelerator.h"
+
+// --------------------------------------------------------------------------
+
+struct RayQueue
+{
+	std::vector<float> ox, oy, oz;
+	std::vector<float> dx, dy, dz;
+	std::vector<float> tMax;
+	std::vector<int>   path;        // owner of each ray among the wave's paths
+
+	int Size() const { return int(path.size()); }
+	void Clear();
+
+	void Push(const Ray &ray, int owner)
+	{
+		ox.push_back(ray.origin.x);    oy.push_back(ray.origin.y);    oz.push_back(ray.origin.z);
+		dx.push_back(ray.direction.x); dy.push_back(ray.direction.y); dz.push_back(ray.direction.z);
+		tMax.push_back(ray.tMax);
+		path.push_back(owner);
+	}
+
+	Ray Get(int i) const
+	{
+		return Ray(glm::vec3(ox[i], oy[i], oz[i]), glm::vec3(dx[i], dy[i], dz[i]), 0.f, tMax[i]);
+	}
+};
+
+struct HitQueue
+{
+	std::vector<float> t, u, v;
+	std::vector<PrimitiveId> primitive;
+
+	void Resize(int size);
+
+	void Set(int i, const Hit &hit)
+	{
+		t[i] = hit.t;
+		u[i] = hit.u;
+		v[i] = hit.v;
+		primitive[i] = hit.primitive;
+	}
+
+	Hit Get(int i) const
+	{
+		Hit hit;
+		hit.t = t[i];
+		hit.u = u[i];
+		hit.v = v[i];
+		hit.primitive = primitive[i];
+		return hit;
+	}
+};
+
+struct ShadowQueue
+{
+	RayQueue    rays;
+	std::vector<int> light;             // scene light each ray goes to
+	std::vector<glm::vec3> colour;      // light it brings when unblocked
+
+	int Size() const { return rays.Size(); }
+	void Clear();
+
+	void Push(const Ray &ray, int owner, int source, const glm::vec3 &carried)
+	{
+		rays.Push(ray, owner);
+		light.push_back(source);
+		colour.push_back(carried);
+	}
+};
+
+// Everything a wavefront render keeps from one stage to the next, held by
+// each thread's context so the queues keep their memory between tiles.
+// Every path is one sample, followed through its chain of mirror bounces;
+// the local colour and reflectance of each surface it meets are kept, so
+// the chain can be folded back into a colour once it ends.
+struct Wavefront
+{
+	RayQueue    rays, next;
+	HitQueue    hits;
+	ShadowQueue shadows;
+	std::vector<unsigned> keys;
+	std::vector<int> order, bins, scratch;
+	std::vector<char> blocked;          // per shadow ray
+
+	int         vertices;               // per path: the maximum depth plus one
+	std::vector<unsigned> random;       // each path's random stream
+	std::vector<int> pixel;             // tile pixel each path adds to
+	std::vector<int> depth;             // surfaces met so far
+	std::vector<glm::vec3> local;       // lit colour at each surface met
+	std::vector<float> reflectance;     // mirror part carried on, or zero
+	std::vector<glm::vec3> caustic;     // added to the current surface last
+
+	Wavefront() : vertices(1) {}
+
+	// empties the wave, making room for paths of up to maxDepth bounces
+	void Clear(int maxDepth, int paths);
+	int AddPath(unsigned seed, int tilePixel);
+	int Vertex(int path) const { return path * vertices + depth[path]; }
+};
+
+// Grid of 2^9 cells a side over a box; rays starting outside it fall in
+// the nearest cell
+class CoherenceGrid
+{
+	glm::vec3   m_origin;
+	glm::vec3   m_scale;
+
+public:
+	CoherenceGrid() : m_origin(0.f), m_scale(0.f) {}
+	explicit CoherenceGrid(const AABB &bounds);
+
+	// direction octant in the top bits, then the Morton code of the cell
+	unsigned Key(const RayQueue &queue, int i) const;
+};
+
+// order of the queue entries by key, ties kept in queue order; keys and
+// scratch are working space
+void SortByKey(const RayQueue &queue, const CoherenceGrid &grid,
+               std::vector<unsigned> &keys, std::vector<int> &order,
+               std::vector<int> &scratch);
+
+// order of entries by bin, from 0 to binCount - 1, ties kept in order
+void SortByBin(const std::vector<int> &bins, int binCount, std::vector<int> &order);
+
+// closest hit of every queued ray, traced in the given order, in packets
+// of packetSize (4, 8 or 16) consecutive rays or else one at a time
+void IntersectQueue(const Accelerator &accelerator, const RayQueue &rays,
+                    const std::vector<int> &order, int packetSize, HitQueue &hits);
+
+// --------------------------------------------------------------------------
+#endif // WAVEFRONT_H
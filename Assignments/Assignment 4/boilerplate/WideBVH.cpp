@@ -0,0 +1,185 @@
+// ==========================================================================
+// Wide Bounding Volume Hierarchy
+//
+// Collapsing starts from the two children of a binary node and repeatedly
+// opens the interior child with the largest surface area, which is the one
+// most likely to be entered, until W children are gathered.
+// ==========================================================================
+
+#include "WideBVH.h"
+#include "BinaryStream.h"
+
+#include <algorithm>
+
+using namespace std;
+using namespace glm;
+
+// --------------------------------------------------------------------------
+
+template <int W>
+void WideBVH<W>::Clear()
+{
+	m_nodes.clear();
+	m_indices.clear();
+}
+
+template <int W>
+size_t WideBVH<W>::MemoryBytes() const
+{
+	return m_nodes.capacity() * sizeof(WideNode<W>) + m_indices.capacity() * sizeof(int);
+}
+
+template <int W>
+void WideBVH<W>::Build(const BVH &bvh)
+{
+	Clear();
+	if (bvh.Empty()) return;
+
+	m_nodes.reserve(bvh.Nodes().size() / (W / 2) + 1);
+	m_indices = bvh.Indices();
+	Collapse(bvh, 0);
+}
+
+template <int W>
+int WideBVH<W>::Collapse(const BVH &bvh, int binaryIndex)
+{
+	const vector<BVHNode> &binary = bvh.Nodes();
+
+	// gather up to W binary nodes to become the children of this node
+	vector<int> children;
+	if (binary[binaryIndex].IsLeaf())
+		children.push_back(binaryIndex);
+	else
+	{
+		children.push_back(binaryIndex + 1);
+		children.push_back(binary[binaryIndex].offset);
+	}
+	while (int(children.size()) < W)
+	{
+		int best = -1;
+		float bestArea = -1.f;
+		for (size_t i = 0; i < children.size(); ++i)
+		{
+			const BVHNode &node = binary[children[i]];
+			float area = AABB(node.lower, node.upper).SurfaceArea();
+			if (!node.IsLeaf() && area > bestArea)
+			{
+				best = int(i);
+				bestArea = area;
+			}
+		}
+		if (best < 0) break;
+
+		int opened = children[best];
+		children[best] = opened + 1;
+		children.push_back(binary[opened].offset);
+	}
+
+	int index = int(m_nodes.size());
+	m_nodes.push_back(WideNode<W>());
+
+	// empty slots get boxes at infinity, which no finite ray interval enters
+	WideNode<W> node;
+	node.occupied = 0;
+	for (int c = 0; c < W; ++c)
+	{
+		node.lowerX[c] = node.lowerY[c] = node.lowerZ[c] = INFINITY;
+		node.upperX[c] = node.upperY[c] = node.upperZ[c] = INFINITY;
+		node.child[c] = -1;
+		node.count[c] = 0;
+	}
+	for (size_t c = 0; c < children.size(); ++c)
+	{
+		const BVHNode &child = binary[children[c]];
+		node.lowerX[c] = child.lower.x;
+		node.lowerY[c] = child.lower.y;
+		node.lowerZ[c] = child.lower.z;
+		node.upperX[c] = child.upper.x;
+		node.upperY[c] = child.upper.y;
+		node.upperZ[c] = child.upper.z;
+		node.occupied |= 1 << c;
+		if (child.IsLeaf())
+		{
+			node.child[c] = child.offset;
+			node.count[c] = child.count;
+		}
+	}
+
+	// visiting order per octant: sort the child centres along the octant's
+	// diagonal, so rays heading that way meet the front children first
+	for (int octant = 0; octant < 8; ++octant)
+	{
+		vec3 direction((octant & 1) ? -1.f : 1.f, (octant & 2) ? -1.f : 1.f,
+		               (octant & 4) ? -1.f : 1.f);
+		float key[W];
+		for (int c = 0; c < W; ++c)
+		{
+			node.order[octant][c] = (unsigned char)c;
+			key[c] = c < int(children.size())
+				? dot(direction, 0.5f * vec3(node.lowerX[c] + node.upperX[c],
+				                             node.lowerY[c] + node.upperY[c],
+				                             node.lowerZ[c] + node.upperZ[c]))
+				: INFINITY;
+		}
+		std::stable_sort(node.order[octant], node.order[octant] + W,
+			[&](unsigned char a, unsigned char b) { return key[a] < key[b]; });
+	}
+
+	// children are collapsed after the parent is placed, so the root is 0
+	for (size_t c = 0; c < children.size(); ++c)
+		if (!binary[children[c]].IsLeaf())
+			node.child[c] = Collapse(bvh, children[c]);
+	m_nodes[index] = node;
+	return index;
+}
+
+template <int W>
+void WideBVH<W>::Save(BinaryWriter &writer) const
+{
+	writer.WriteVector(m_nodes);
+	writer.WriteVector(m_indices);
+}
+
+template <int W>
+bool WideBVH<W>::Load(BinaryReader &reader, size_t primitiveCount)
+{
+	Clear();
+	// trees for the layouts not in use are saved empty
+	bool valid = reader.ReadVector(m_nodes) && reader.ReadVector(m_indices) &&
+	             (m_nodes.empty() ? m_indices.empty() : m_indices.size() == primitiveCount);
+	for (size_t i = 0; valid && i < m_indices.size(); ++i)
+		valid = m_indices[i] >= 0 && size_t(m_indices[i]) < primitiveCount;
+
+	// children are collapsed after their parent, so depths fill in order
+	vector<int> depth(m_nodes.size(), 1);
+	for (size_t i = 0; valid && i < m_nodes.size(); ++i)
+	{
+		const WideNode<W> &node = m_nodes[i];
+		valid = depth[i] <= BVH::MAX_DEPTH;
+		for (int c = 0; valid && c < W; ++c)
+		{
+			for (int octant = 0; valid && octant < 8; ++octant)
+				valid = node.order[octant][c] < W;
+			if (!valid || !(node.occupied & (1 << c)))
+				continue;
+			if (node.count[c] > 0)
+				valid = node.child[c] >= 0 &&
+				        size_t(node.child[c]) + size_t(node.count[c]) <= m_indices.size();
+			else
+			{
+				valid = node.count[c] == 0 && node.child[c] > int(i) &&
+				        size_t(node.child[c]) < m_nodes.size();
+				if (valid)
+					depth[node.child[c]] = depth[i] + 1;
+			}
+		}
+	}
+	if (!valid)
+		Clear();
+	return valid;
+}
+
+template class WideBVH<4>;
+template class WideBVH<8>;
+
+// --------------------------------------------------------------------------
@@ -0,0 +1,127 @@
+// ==========================================================================
+// Wide Bounding Volume Hierarchy
+//  - 4- or 8-wide BVH made by collapsing the binary SAH tree
+//  - child bounds are stored as structure of arrays, so a single ray is
+//    tested against every child of a node with one set of SIMD operations
+//  - each node keeps a child visiting order for each of the eight ray
+//    direction octants, so traversal is front to back without sorting
+//
+// Single rays that don't travel together (shadow and reflection rays) gain
+// little from packets, but still get SIMD width out of the node tests here.
+// ==========================================================================
+#ifndef WIDEBVH_H
+#define WIDEBVH_H
+
+#include <vector>
+#include "BVH.h"
+#include "Simd.h"
+
+class BinaryWriter;
+class BinaryReader;
+
+// --------------------------------------------------------------------------
+
+template <int W> struct WideTraits;
+template <> struct WideTraits<4> { typedef vfloat4 Float; };
+template <> struct WideTraits<8> { typedef vfloat8 Float; };
+
+// nodes live in a std::vector, which doesn't honour over-alignment before
+// C++17, so the bounds are read with unaligned loads
+template <int W>
+struct WideNode
+{
+	float   lowerX[W], lowerY[W], lowerZ[W];
+	float   upperX[W], upperY[W], upperZ[W];
+	int     child[W];   // interior: node index; leaf: first entry in the
+	                    // index array; unused slot: -1
+	int     count[W];   // primitives in a leaf child, 0 otherwise
+	int     occupied;   // bit c set when slot c holds a child
+	unsigned char order[8][W];  // child slots front to back per octant
+};
+
+template <int W>
+class WideBVH
+{
+	std::vector< WideNode<W> >  m_nodes;
+	std::vector<int>            m_indices;
+
+	int Collapse(const BVH &bvh, int binaryIndex);
+
+public:
+	static const int Width = W;
+
+	// collapses a built binary hierarchy; primitive order is unchanged, so
+	// leaf offsets index the same arrays as the binary tree's leaves
+	void Build(const BVH &bvh);
+	void Clear();
+
+	bool Empty() const { return m_nodes.empty(); }
+	const std::vector< WideNode<W> > &Nodes() const { return m_nodes; }
+	size_t MemoryBytes() const;
+
+	// same contract as BVH::Save and BVH::Load
+	void Save(BinaryWriter &writer) const;
+	bool Load(BinaryReader &reader, size_t primitiveCount);
+
+	// same contract as BVH::Traverse
+	template <class Intersector>
+	int Traverse(Ray &ray, Intersector &intersect) const;
+};
+
+// --------------------------------------------------------------------------
+
+template <int W>
+template <class Intersector>
+int WideBVH<W>::Traverse(Ray &ray, Intersector &intersect) const
+{
+	typedef typename WideTraits<W>::Float F;
+	if (m_nodes.empty()) return 0;
+
+	int octant = (ray.direction.x < 0.f ? 1 : 0) | (ray.direction.y < 0.f ? 2 : 0) |
+	             (ray.direction.z < 0.f ? 4 : 0);
+	F ox(ray.origin.x), oy(ray.origin.y), oz(ray.origin.z);
+	F idx(1.f / ray.direction.x), idy(1.f / ray.direction.y), idz(1.f / ray.direction.z);
+
+	// entries >= 0 are nodes; a leaf child in slot c of node n is -(n*W+c)-1
+	int stack[BVH::MAX_DEPTH * W];
+	int top = 0;
+	int steps = 0;
+	stack[top++] = 0;
+	while (top > 0)
+	{
+		int entry = stack[--top];
+		++steps;
+		if (entry < 0)
+		{
+			int slot = -entry - 1;
+			const WideNode<W> &leaf = m_nodes[slot / W];
+			int first = leaf.child[slot % W], last = first + leaf.count[slot % W];
+			for (int i = first; i < last; ++i)
+				if (intersect(m_indices[i], ray))
+					return steps;
+			continue;
+		}
+
+		const WideNode<W> &node = m_nodes[entry];
+		F tx0 = (F::Load(node.lowerX) - ox) * idx, tx1 = (F::Load(node.upperX) - ox) * idx;
+		F ty0 = (F::Load(node.lowerY) - oy) * idy, ty1 = (F::Load(node.upperY) - oy) * idy;
+		F tz0 = (F::Load(node.lowerZ) - oz) * idz, tz1 = (F::Load(node.upperZ) - oz) * idz;
+		F tNear = Max(Max(Min(tx0, tx1), Min(ty0, ty1)), Max(Min(tz0, tz1), F(ray.tMin)));
+		F tFar = Min(Min(Max(tx0, tx1), Max(ty0, ty1)), Min(Max(tz0, tz1), F(ray.tMax)));
+		int hits = (tNear <= tFar).Movemask() & node.occupied;
+		if (!hits) continue;
+
+		// push back to front, so the nearest child is popped first
+		const unsigned char *order = node.order[octant];
+		for (int k = W - 1; k >= 0; --k)
+		{
+			int c = order[k];
+			if (!(hits & (1 << c))) continue;
+			stack[top++] = node.count[c] > 0 ? -(entry * W + c) - 1 : node.child[c];
+		}
+	}
+	return steps;
+}
+
+// --------------------------------------------------------------------------
+#endif // WIDEBVH_H
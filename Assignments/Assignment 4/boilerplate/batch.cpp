@@ -0,0 +1,466 @@
+// ==========================================================================
+// Headless Batch Renderer
+//  - renders a scene file straight to an image file, with no window and no
+//    OpenGL context, for running on machines without a display
+//  - reports wall time, rays per second, and geometry and peak memory use,
+//    and for -adaptive renders the samples saved against a uniform one
+//  - renders turntable sequences, turning the scene's instances a step
+//    further each frame and refitting the BVH rather than rebuilding it
+//  - keeps a compiled cache of the scene and its BVH beside the scene file,
+//    so later runs skip parsing and building (see SceneCache.h)
+//  - builds the BVH in the -bvh layout given, binary, wide4 or wide8, so
+//    runs can compare them; the default is the widest this build's SIMD
+//    tests suit
+//  - renders global illumination by path tracing with -path, taking -spp
+//    paths per pixel, or with -irradiancecache, interpolating the indirect
+//    light between cached records
+//  - adds caustics from a map of -photons photons, gathered within
+//    -photonradius of each shading point
+//  - traces Whitted renders as a wavefront of sorted ray queues with
+//    -wavefront, giving the same image
+//  - renders across -processes forked worker processes instead of threads,
+//    re-rendering the tiles of any that die (see ProcessRenderer.h)
+//  - checkpoints long renders to image.png.checkpoint every -checkpoint
+//    seconds, and on Ctrl-C; -resume carries on from the checkpoint and
+//    gives the image an uninterrupted render would (see Checkpoint.h)
+//
+// usage: batch scene.txt [-w width] [-h height] [-spp samples] [-adaptive]
+//                        [-threads count] [-o image.png]
+//                        [-frames count] [-spin degrees] [-rebuild]
+//                        [-nocache] [-lightsamples count] [-path] [-irradiancecache]
+//                        [-photons count] [-photonradius distance] [-wavefront]
+//                        [-processes count] [-checkpoint seconds] [-resume]
+//                        [-bvh binary|wide4|wide8]
+//
+// With more than one frame, images are numbered: image_0000.png, ...
+// ==========================================================================
+
+#include <iostream>
+#include <string>
+#include <cstdlib>
+#include <cstdio>
+#include <chrono>
+#include <csignal>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "ImageBuffer.h"
+#include "Scene.h"
+#include "RayTracer.h"
+#include "Progressive.h"
+#include "SceneCache.h"
+#include "ProcessRenderer.h"
+#include "Checkpoint.h"
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+using namespace std;
+using namespace glm;
+
+// --------------------------------------------------------------------------
+
+namespace
+{
+	const int TILE_SIZE = 32;
+
+	// seconds between checkpoints when resuming without -checkpoint
+	const double DEFAULT_CHECKPOINT_INTERVAL = 60.0;
+
+	struct BatchOptions
+	{
+		string  sceneFile;
+		string  imageFile;
+		int     width, height;
+		int     samplesPerPixel;
+		bool    adaptive;
+		int     threads;        // 0 for every hardware thread
+		int     processes;      // worker processes, 0 to render on threads here
+
+		// animation: each frame turns the instances spin degrees further
+		// about the vertical axis through their middle
+		int     frames;
+		float   spin;           // a full turn over the frames if negative
+		bool    rebuild;        // rebuild the BVH every frame instead of refitting
+
+		bool    cache;          // read and write the compiled scene cache
+		BVHLayout layout;
+		int     lightSamples;   // many-light mode shadow rays, 0 for every light
+		bool    pathTracing;
+		bool    irradianceCaching;  // implies path tracing
+		int     photons;        // caustic photons shot, 0 for no caustics
+		float   photonRadius;
+		bool    wavefront;
+
+		// checkpoints, kept beside the image
+		double  checkpoint;     // seconds between them, 0 for none
+		bool    resume;
+
+		BatchOptions()
+			: imageFile("AwesomeRayTracedImage.png"), width(1024), height(768),
+			  samplesPerPixel(1), adaptive(false), threads(0), processes(0), frames(1), spin(-1.f),
+			  rebuild(false), cache(true), layout(DEFAULT_BVH_LAYOUT), lightSamples(RenderSettings().lightSamples),
+			  pathTracing(false), irradianceCaching(false), photons(0), photonRadius(RenderSettings().causticRadius),
+			  wavefront(false), checkpoint(0.0), resume(false)
+		{}
+	};
+
+	void PrintUsage(const char *program)
+	{
+		cout << "usage: " << program << " scene.txt [-w width] [-h height]"
+		     << " [-spp samples] [-adaptive] [-threads count] [-o image.png]"
+		     << " [-frames count] [-spin degrees] [-rebuild] [-nocache]"
+		     << " [-lightsamples count] [-path] [-irradiancecache] [-photons count]"
+		     << " [-photonradius distance] [-wavefront] [-processes count]"
+		     << " [-checkpoint seconds] [-resume] [-bvh binary|wide4|wide8]" << endl;
+	}
+
+	bool ParseOptions(int argc, char *argv[], BatchOptions &options)
+	{
+		for (int i = 1; i < argc; ++i)
+		{
+			string arg = argv[i];
+			bool hasValue = i + 1 < argc;
+			if (arg == "-adaptive")
+				options.adaptive = true;
+			else if (arg == "-rebuild")
+				options.rebuild = true;
+			else if (arg == "-nocache")
+				options.cache = false;
+			else if (arg == "-path")
+				options.pathTracing = true;
+			else if (arg == "-irradiancecache")
+				options.pathTracing = options.irradianceCaching = true;
+			else if (arg == "-wavefront")
+				options.wavefront = true;
+			else if (arg == "-resume" || arg == "--resume")
+				options.resume = true;
+			else if (arg == "-checkpoint" && hasValue)
+				options.checkpoint = atof(argv[++i]);
+			else if (arg == "-bvh" && hasValue)
+			{
+				if (!ParseBVHLayout(argv[++i], options.layout))
+				{
+					cout << "ERROR: Unknown BVH layout " << argv[i] << endl;
+					return false;
+				}
+			}
+			else if (arg == "-lightsamples" && hasValue)
+				options.lightSamples = atoi(argv[++i]);
+			else if (arg == "-photons" && hasValue)
+				options.photons = atoi(argv[++i]);
+			else if (arg == "-photonradius" && hasValue)
+				options.photonRadius = float(atof(argv[++i]));
+			else if (arg == "-frames" && hasValue)
+				options.frames = atoi(argv[++i]);
+			else if (arg == "-spin" && hasValue)
+				options.spin = float(atof(argv[++i]));
+			else if (arg == "-o" && hasValue)
+				options.imageFile = argv[++i];
+			else if (arg == "-w" && hasValue)
+				options.width = atoi(argv[++i]);
+			else if (arg == "-h" && hasValue)
+				options.height = atoi(argv[++i]);
+			else if (arg == "-spp" && hasValue)
+				options.samplesPerPixel = atoi(argv[++i]);
+			else if (arg == "-threads" && hasValue)
+				options.threads = atoi(argv[++i]);
+			else if (arg == "-processes" && hasValue)
+				options.processes = atoi(argv[++i]);
+			else if (arg[0] != '-' && options.sceneFile.empty())
+				options.sceneFile = arg;
+			else
+			{
+				cout << "ERROR: Unexpected argument " << arg << endl;
+				return false;
+			}
+		}
+
+		if (options.sceneFile.empty())
+		{
+			cout << "ERROR: No scene file given" << endl;
+			return false;
+		}
+		if (options.width <= 0 || options.height <= 0 || options.samplesPerPixel <= 0 ||
+		    options.threads < 0 || options.processes < 0 || options.frames <= 0 || options.lightSamples < 0 ||
+		    options.photons < 0 || !(options.photonRadius > 0.f))
+		{
+			cout << "ERROR: Size, samples, threads, processes, frames, light samples, photons"
+			     << " and photon radius must be positive" << endl;
+			return false;
+		}
+		if (options.checkpoint < 0.0)
+		{
+			cout << "ERROR: Checkpoint interval must be positive" << endl;
+			return false;
+		}
+		if (options.resume && options.checkpoint == 0.0)
+			options.checkpoint = DEFAULT_CHECKPOINT_INTERVAL;
+		if (options.checkpoint > 0.0 && (options.frames > 1 || options.processes > 0))
+		{
+			cout << "ERROR: Only single frames rendered on threads can be checkpointed" << endl;
+			return false;
+		}
+		if (options.spin < 0.f)
+			options.spin = 360.f / options.frames;
+		return true;
+	}
+
+	// image.png becomes image_0007.png for frame 7 of a sequence
+	string FrameFileName(const string &fileName, int frame, int frames)
+	{
+		if (frames <= 1) return fileName;
+		char number[16];
+		snprintf(number, sizeof(number), "_%04d", frame);
+		size_t dot = fileName.rfind('.');
+		if (dot == string::npos || fileName.find('/', dot) != string::npos)
+			return fileName + number;
+		return fileName.substr(0, dot) + number + fileName.substr(dot);
+	}
+
+	// Turntable: every instance turned by angle about the vertical axis
+	// through the middle of their origins, from where the scene file put
+	// them. The instances keep their places relative to each other, so the
+	// refit BVH stays about as good as a new one.
+	void TurnInstances(Scene &scene, const vector<mat4> &placed, float degrees)
+	{
+		if (placed.empty()) return;
+		vec3 pivot(0.f);
+		for (size_t i = 0; i < placed.size(); ++i)
+			pivot += vec3(placed[i][3]);
+		pivot /= float(placed.size());
+
+		mat4 turn = translate(mat4(1.f), pivot) *
+		            rotate(mat4(1.f), radians(degrees), vec3(0.f, 1.f, 0.f)) *
+		            translate(mat4(1.f), -pivot);
+		for (size_t i = 0; i < placed.size(); ++i)
+			scene.SetInstanceTransform(int(i), turn * placed[i]);
+	}
+
+	// peak resident memory of the process in megabytes, or -1 if unknown
+	double PeakMemoryMB()
+	{
+	#ifdef _WIN32
+		return -1.0;
+	#else
+		struct rusage usage;
+		if (getrusage(RUSAGE_SELF, &usage) != 0)
+			return -1.0;
+		#ifdef __APPLE__
+		return usage.ru_maxrss / (1024.0 * 1024.0);    // bytes
+		#else
+		return usage.ru_maxrss / 1024.0;               // kilobytes
+		#endif
+	#endif
+	}
+
+	// Ctrl-C stops a checkpointed render, which saves what it has done; a
+	// second one ends the program at once
+	void Interrupt(int signal)
+	{
+		CheckpointedRenderer::Interrupt();
+		std::signal(signal, SIG_DFL);
+	}
+
+	double SecondsSince(chrono::steady_clock::time_point start)
+	{
+		return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	}
+}
+
+// ==========================================================================
+// PROGRAM ENTRY POINT
+
+int main(int argc, char *argv[])
+{
+	BatchOptions options;
+	if (!ParseOptions(argc, argv, options))
+	{
+		PrintUsage(argv[0]);
+		return -1;
+	}
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	Scene scene;
+	Accelerator built;
+	if (!LoadCompiledScene(options.sceneFile, scene, built, options.layout, options.cache)) {
+		cout << "Program could not load scene " << options.sceneFile << ", TERMINATING" << endl;
+		return -1;
+	}
+	RayTracer tracer;
+	tracer.SetScene(scene, built);
+	tracer.settings.samplesPerPixel = options.samplesPerPixel;
+	tracer.settings.adaptive = options.adaptive;
+	tracer.settings.lightSamples = options.lightSamples;
+	tracer.settings.pathTracing = options.pathTracing;
+	tracer.settings.irradianceCaching = options.irradianceCaching;
+	tracer.settings.wavefront = options.wavefront;
+	tracer.settings.causticPhotons = options.photons;
+	tracer.settings.causticRadius = options.photonRadius;
+	double setupTime = SecondsSince(start);
+
+	if (options.photons > 0)
+	{
+		chrono::steady_clock::time_point photonStart = chrono::steady_clock::now();
+		tracer.UpdateLights();
+		const PhotonMap &caustics = tracer.Caustics();
+		cout << "Caustic photon map: " << caustics.Size() << " photons stored of "
+		     << caustics.Emitted() << " shot in " << SecondsSince(photonStart) << " s, "
+		     << caustics.MemoryBytes() / (1024.0 * 1024.0) << " MB" << endl;
+	}
+
+	ImageBuffer image;
+	if (!image.Initialize(options.width, options.height))
+		return -1;
+
+	vector<mat4> placed;
+	for (size_t i = 0; i < scene.instances.size(); ++i)
+		placed.push_back(scene.instances[i].toWorld);
+	if (options.frames > 1 && placed.empty())
+		cout << "Scene has no instances to turn, every frame will be the same" << endl;
+
+	bool saved = true;
+	double updateTime = 0.0, totalRenderTime = 0.0;
+	int rebuilds = 0;
+	for (int frame = 0; frame < options.frames; ++frame)
+	{
+		if (frame > 0)
+		{
+			chrono::steady_clock::time_point updateStart = chrono::steady_clock::now();
+			TurnInstances(scene, placed, options.spin * frame);
+			bool refitted = false;
+			if (options.rebuild)
+				tracer.SetScene(scene, options.layout);
+			else
+				refitted = tracer.RefitScene();
+			double update = SecondsSince(updateStart);
+			updateTime += update;
+			rebuilds += refitted ? 0 : 1;
+			cout << "Frame " << frame << ": BVH " << (refitted ? "refit" : "rebuilt")
+			     << " in " << update << " s" << endl;
+		}
+
+		// a single straight pass: there is nobody to show previews to
+		chrono::steady_clock::time_point renderStart = chrono::steady_clock::now();
+		vector<TraceContext> contexts;
+		int workers, workersLost = 0, checkpoints = -1;
+		if (options.processes > 0)
+		{
+			ProcessRenderer farm;
+			if (!farm.Render(tracer, image, TILE_SIZE, options.processes))
+			{
+				saved = false;
+				continue;
+			}
+			contexts.push_back(farm.Counts());
+			workers = options.processes;
+			workersLost = farm.WorkersLost();
+		}
+		else if (options.checkpoint > 0.0)
+		{
+			string checkpointFile = options.imageFile + ".checkpoint";
+			std::signal(SIGINT, Interrupt);
+			std::signal(SIGTERM, Interrupt);
+			CheckpointedRenderer renderer;
+			bool finished = renderer.Render(tracer, scene, image, TILE_SIZE, options.threads,
+			                                checkpointFile, options.checkpoint, options.resume);
+			std::signal(SIGINT, SIG_DFL);
+			std::signal(SIGTERM, SIG_DFL);
+			if (renderer.ResumedSamples() > 0.0)
+				cout << "Resumed from " << checkpointFile << " with " << renderer.ResumedSamples()
+				     << " of " << options.samplesPerPixel << " spp done" << endl;
+			if (!finished)
+			{
+				cout << "Render interrupted, " << (renderer.CheckpointsWritten() > 0 ?
+				        "resume it from " + checkpointFile + " with -resume" :
+				        string("and no checkpoint was written")) << endl;
+				return -1;
+			}
+			if (options.irradianceCaching && renderer.ResumedSamples() > 0.0)
+				cout << "Irradiance records are not checkpointed, so a resumed render can differ"
+				     << " from an uninterrupted one" << endl;
+			contexts = renderer.Contexts();
+			workers = int(contexts.size());
+			checkpoints = renderer.CheckpointsWritten();
+		}
+		else
+		{
+			ProgressiveRenderer renderer;
+			renderer.Start(tracer, image.Width(), image.Height(), TILE_SIZE, options.threads,
+				[&](const Tile &tile, const vec3 *colours) {
+					image.SetTile(tile.x, tile.y, tile.width, tile.height, colours);
+				}, false);
+			renderer.Wait();
+			contexts = renderer.Contexts();
+			workers = renderer.Scheduler().ThreadCount();
+		}
+		double renderTime = SecondsSince(renderStart);
+		totalRenderTime += renderTime;
+
+		unsigned long long primary = 0, shadow = 0, reflection = 0, bounce = 0;
+		for (size_t i = 0; i < contexts.size(); ++i)
+		{
+			primary += contexts[i].primarySamples;
+			shadow += contexts[i].shadowRays;
+			reflection += contexts[i].reflectionRays;
+			bounce += contexts[i].bounceRays;
+		}
+		unsigned long long rays = primary + shadow + reflection + bounce;
+
+		cout << "Rendered " << image.Width() << "x" << image.Height() << " at "
+		     << options.samplesPerPixel << (options.adaptive ? " adaptive" : "") << " spp"
+		     << (options.irradianceCaching ? " path traced with irradiance caching" :
+		         options.pathTracing ? " path traced" :
+		         options.wavefront ? " as a wavefront" : "") << " with "
+		     << workers << (options.processes > 0 ? " worker processes" : " threads") << endl;
+		if (frame == 0)
+		{
+			cout << "  scene load and BVH build: " << setupTime << " s ("
+			     << BVHLayoutName(tracer.Acceleration().Layout()) << " BVH)" << endl;
+			double bytes = double(scene.GeometryBytes() + tracer.Acceleration().MemoryBytes());
+			size_t stored = std::max<size_t>(scene.StoredTriangleCount(), 1);
+			cout << "  geometry and BVH memory:  " << bytes / (1024.0 * 1024.0) << " MB ("
+			     << bytes / double(stored) << " bytes per stored triangle)" << endl;
+		}
+		cout << "  render wall time:         " << renderTime << " s" << endl;
+		cout << "  rays traced:              " << rays << " (" << primary << " primary, "
+		     << shadow << " shadow, " << reflection << " reflection, " << bounce << " bounce)"
+		     << endl;
+		cout << "  rays per second:          " << rays / std::max(renderTime, 1e-9) << endl;
+		if (options.adaptive)
+		{
+			// the primary samples a uniform render at the same budget traces
+			unsigned long long uniform = (unsigned long long)image.Width() * image.Height() *
+			                             options.samplesPerPixel;
+			cout << "  adaptive samples:         " << primary << " of " << uniform << " ("
+			     << 100.0 * (double(uniform) - double(primary)) / double(uniform)
+			     << "% saved vs " << options.samplesPerPixel << " spp uniform)" << endl;
+		}
+		if (workersLost > 0)
+			cout << "  worker processes lost:    " << workersLost << " (rays they traced"
+			     << " are not counted)" << endl;
+		if (checkpoints >= 0)
+			cout << "  checkpoints written:      " << checkpoints << endl;
+		if (options.irradianceCaching && options.processes == 0)
+			cout << "  irradiance records:       " << tracer.Irradiance().Size() << endl;
+
+		saved = image.SaveToFile(FrameFileName(options.imageFile, frame, options.frames)) && saved;
+		if (saved && checkpoints >= 0)
+			remove((options.imageFile + ".checkpoint").c_str());
+	}
+
+	if (options.frames > 1)
+	{
+		cout << options.frames << " frames: render " << totalRenderTime << " s, BVH updates "
+		     << updateTime << " s (" << rebuilds << " of " << options.frames - 1
+		     << (options.rebuild ? " rebuilt as asked)" : " rebuilt)") << endl;
+	}
+
+	double peak = PeakMemoryMB();
+	if (peak >= 0.0)
+		cout << "  peak memory:              " << peak << " MB" << endl;
+
+	return saved ? 0 : -1;
+}
+
+// ==========================================================================
@@ -0,0 +1,640 @@
+// ==========================================================================
+// Ray Tracer Benchmark
+//  - renders scene1.txt, scene2.txt and procedurally generated scenes of
+//    growing size (random spheres, wavy triangle meshes, and instances of
+//    one small wavy mesh) at fixed settings, with no window
+//  - measures BVH build time, throughput of each kind of ray query,
+//    hierarchy nodes visited per ray, and full render time from 1 up to
+//    N threads
+//  - repeats the build, query and full thread render measurements with
+//    the binary, 4-wide and 8-wide BVH layouts, to compare them
+//  - compares full renders traced as a wavefront of sorted ray queues
+//    against the recursive renders, on every thread
+//  - measures caustic photon emission, kd-tree build and nearest photon
+//    gathers on scene1.txt for growing photon counts
+//  - writes everything as JSON, for tracking regressions between builds
+//
+// usage: benchmark [-w width] [-h height] [-threads max] [-max primitives]
+//                  [-o results.json]
+// ==========================================================================
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <cstdlib>
+#include <cmath>
+#include <chrono>
+#include <random>
+#include <glm/glm.hpp>
+#include "Scene.h"
+#include "RayTracer.h"
+#include "Progressive.h"
+
+using namespace std;
+using namespace glm;
+
+// --------------------------------------------------------------------------
+
+namespace
+{
+	const int TILE_SIZE = 32;
+
+	typedef chrono::steady_clock Clock;
+
+	double SecondsSince(Clock::time_point start)
+	{
+		return chrono::duration<double>(Clock::now() - start).count();
+	}
+
+	struct BenchmarkOptions
+	{
+		int     width, height;
+		int     maxThreads;
+		int     maxPrimitives;
+		string  outputFile;
+
+		BenchmarkOptions()
+			: width(1024), height(768), maxThreads(TileScheduler::HardwareThreads()),
+			  maxPrimitives(1000000), outputFile("benchmark.json")
+		{}
+	};
+
+	bool ParseOptions(int argc, char *argv[], BenchmarkOptions &options)
+	{
+		for (int i = 1; i < argc; ++i)
+		{
+			string arg = argv[i];
+			if (i + 1 >= argc)
+			{
+				cout << "ERROR: Missing value for " << arg << endl;
+				return false;
+			}
+			if (arg == "-w")
+				options.width = atoi(argv[++i]);
+			else if (arg == "-h")
+				options.height = atoi(argv[++i]);
+			else if (arg == "-threads")
+				options.maxThreads = atoi(argv[++i]);
+			else if (arg == "-max")
+				options.maxPrimitives = atoi(argv[++i]);
+			else if (arg == "-o")
+				options.outputFile = argv[++i];
+			else
+			{
+				cout << "ERROR: Unexpected argument " << arg << endl;
+				return false;
+			}
+		}
+		if (options.width <= 0 || options.height <= 0 || options.maxThreads <= 0)
+		{
+			cout << "ERROR: Size and threads must be positive" << endl;
+			return false;
+		}
+		return true;
+	}
+
+	// ----------------------------------------------------------------------
+	// Procedural scenes, laid out in front of the default camera
+
+	// a floor, a light, and a matte and a mirror-like material
+	void AddSurroundings(Scene &scene)
+	{
+		Plane floor = { vec3(0.f, 1.f, 0.f), vec3(0.f, -3.5f, 0.f), 0 };
+		scene.planes.push_back(floor);
+
+		Light light;
+		light.position = vec3(0.f, 4.f, -2.f);
+		scene.lights.push_back(light);
+
+		Material mirror;
+		mirror.diffuse = vec3(0.3f);
+		mirror.specular = vec3(0.8f);
+		mirror.shininess = 64.f;
+		mirror.reflectance = 0.6f;
+		scene.materials.push_back(mirror);
+	}
+
+	// count random spheres in a box, filling about a tenth of its volume,
+	// every other one reflective
+	void MakeSpheres(Scene &scene, int count)
+	{
+		scene.Clear();
+		AddSurroundings(scene);
+
+		mt19937 random(453);
+		uniform_real_distribution<float> x(-4.f, 4.f), y(-3.f, 3.f), z(-14.f, -6.f);
+		float radius = std::cbrt(0.1f * 384.f * 3.f / (4.f * 3.14159265f * count));
+		for (int i = 0; i < count; ++i)
+		{
+			Sphere s = { vec3(x(random), y(random), z(random)), radius, i & 1 };
+			scene.spheres.push_back(s);
+		}
+	}
+
+	// a rippled 8 x 6 height field around (0, 0, -10), facing the camera,
+	// with about count triangles sharing their vertices
+	void MakeGrid(int count, vector<vec3> &vertices, vector<Triangle> &triangles)
+	{
+		int side = std::max(1, int(std::sqrt(count / 2.0)));
+		for (int j = 0; j <= side; ++j)
+			for (int i = 0; i <= side; ++i)
+			{
+				float u = float(i) / side, v = float(j) / side;
+				float px = -4.f + 8.f * u, py = -3.f + 6.f * v;
+				float pz = -10.f + 0.5f * std::sin(12.f * u) * std::cos(9.f * v);
+				vertices.push_back(vec3(px, py, pz));
+			}
+		for (int j = 0; j < side; ++j)
+			for (int i = 0; i < side; ++i)
+			{
+				unsigned a = j * (side + 1) + i, b = a + 1;
+				unsigned c = a + side + 1, d = c + 1;
+				Triangle lower = { { a, b, d }, 0 };
+				Triangle upper = { { a, d, c }, 0 };
+				triangles.push_back(lower);
+				triangles.push_back(upper);
+			}
+	}
+
+	// one height field of about count triangles, and a mirror sphere in
+	// front of it
+	void MakeMesh(Scene &scene, int count)
+	{
+		scene.Clear();
+		AddSurroundings(scene);
+		MakeGrid(count, scene.vertices, scene.triangles);
+
+		Sphere s = { vec3(1.5f, -1.f, -6.f), 1.f, 1 };
+		scene.spheres.push_back(s);
+	}
+
+	// about count triangles again, but as a square array of shrunken,
+	// slightly tilted instances of a single thousand triangle height field
+	void MakeInstances(Scene &scene, int count)
+	{
+		const int MESH_TRIANGLES = 1000;
+		scene.Clear();
+		AddSurroundings(scene);
+
+		Mesh mesh;
+		mesh.name = "field";
+		MakeGrid(MESH_TRIANGLES, mesh.vertices, mesh.triangles);
+		scene.meshes.push_back(mesh);
+
+		int side = std::max(1, int(std::sqrt(double(count) / mesh.triangles.size())));
+		mt19937 random(453);
+		uniform_real_distribution<float> tilt(-0.3f, 0.3f);
+		for (int j = 0; j < side; ++j)
+			for (int i = 0; i < side; ++i)
+			{
+				// centre the field on the origin, shrink it to its cell,
+				// tilt it, and move it to the cell's centre
+				vec3 cell(-4.f + 8.f * (i + 0.5f) / side, -3.f + 6.f * (j + 0.5f) / side, -10.f);
+				mat4 place(1.f);
+				place[3] = vec4(cell, 1.f);
+				float angle = tilt(random), c = std::cos(angle), s = std::sin(angle);
+				mat4 rotate(1.f);
+				rotate[0][0] = c;   rotate[2][0] = s;
+				rotate[0][2] = -s;  rotate[2][2] = c;
+				mat4 shrink(1.f / side);
+				shrink[3][3] = 1.f;
+				mat4 centre(1.f);
+				centre[3] = vec4(0.f, 0.f, 10.f, 1.f);
+				scene.AddInstance(0, place * rotate * shrink * centre);
+			}
+	}
+
+	// ----------------------------------------------------------------------
+	// Ray query measurements
+
+	struct QueryResult
+	{
+		size_t  rays;
+		double  raysPerSecond;
+		double  stepsPerRay;
+
+		QueryResult() : rays(0), raysPerSecond(0.0), stepsPerRay(0.0) {}
+	};
+
+	double Rate(size_t count, double seconds)
+	{
+		return seconds > 0.0 ? count / seconds : 0.0;
+	}
+
+	double StepsPerRay(const Accelerator &accelerator, const vector<Ray> &rays, bool anyHit)
+	{
+		double steps = 0.0;
+		for (size_t i = 0; i < rays.size(); ++i)
+			steps += accelerator.TraversalSteps(rays[i], anyHit);
+		return rays.empty() ? 0.0 : steps / rays.size();
+	}
+
+	struct QueryResults
+	{
+		QueryResult primary, primaryPacket, shadow, reflection;
+	};
+
+	// Traces the primary rays of the image, then the shadow and first-bounce
+	// reflection rays their hits spawn, timing each kind on its own
+	void MeasureQueries(const RayTracer &tracer, int width, int height,
+	                    QueryResults &results)
+	{
+		const Accelerator &accelerator = tracer.Acceleration();
+		const Scene &scene = *accelerator.GetScene();
+
+		vector<Ray> primary;
+		for (int y = 0; y < height; ++y)
+			for (int x = 0; x < width; ++x)
+				primary.push_back(tracer.camera.GenerateRay(x + 0.5f, y + 0.5f, width, height));
+
+		vector<Hit> hits(primary.size());
+		Clock::time_point start = Clock::now();
+		for (size_t i = 0; i < primary.size(); ++i)
+			accelerator.Intersect(primary[i], hits[i]);
+		results.primary.rays = primary.size();
+		results.primary.raysPerSecond = Rate(primary.size(), SecondsSince(start));
+		results.primary.stepsPerRay = StepsPerRay(accelerator, primary, false);
+
+		// packets over 4x4 pixel blocks, as the renderer traces them
+		RayPacket<16> packet;
+		Hit packetHits[16];
+		size_t packetRays = 0;
+		start = Clock::now();
+		for (int by = 0; by < height; by += 4)
+			for (int bx = 0; bx < width; bx += 4)
+			{
+				for (int k = 0; k < 16; ++k)
+				{
+					int x = bx + k % 4, y = by + k / 4;
+					if (x < width && y < height)
+					{
+						packet.Set(k, primary[y * width + x]);
+						++packetRays;
+					}
+					else
+						packet.Disable(k);
+				}
+				accelerator.IntersectPacket(packet, packetHits);
+			}
+		results.primaryPacket.rays = packetRays;
+		results.primaryPacket.raysPerSecond = Rate(packetRays, SecondsSince(start));
+		results.primaryPacket.stepsPerRay = results.primary.stepsPerRay;
+
+		vector<Ray> shadow, reflection;
+		for (size_t i = 0; i < primary.size(); ++i)
+		{
+			if (!hits[i].Valid()) continue;
+			const Ray &ray = primary[i];
+			vec3 position = ray.At(hits[i].t);
+			vec3 normal = scene.Normal(hits[i].primitive, position);
+			if (dot(normal, ray.direction) > 0.f)
+				normal = -normal;
+			vec3 origin = position + SURFACE_EPSILON * normal;
+
+			for (size_t l = 0; l < scene.lights.size(); ++l)
+			{
+				vec3 toLight = scene.lights[l].position - position;
+				float distance = length(toLight);
+				if (dot(normal, toLight) > 0.f)
+					shadow.push_back(Ray(origin, toLight / distance, 0.f, distance));
+			}
+			const Material &material = scene.materials[scene.MaterialOf(hits[i].primitive)];
+			if (material.reflectance > 0.f)
+				reflection.push_back(Ray(origin, reflect(ray.direction, normal)));
+		}
+
+		PrimitiveId occluder;
+		start = Clock::now();
+		for (size_t i = 0; i < shadow.size(); ++i)
+			accelerator.Occluded(shadow[i], occluder);
+		results.shadow.rays = shadow.size();
+		results.shadow.raysPerSecond = Rate(shadow.size(), SecondsSince(start));
+		results.shadow.stepsPerRay = StepsPerRay(accelerator, shadow, true);
+
+		Hit hit;
+		start = Clock::now();
+		for (size_t i = 0; i < reflection.size(); ++i)
+			accelerator.Intersect(reflection[i], hit);
+		results.reflection.rays = reflection.size();
+		results.reflection.raysPerSecond = Rate(reflection.size(), SecondsSince(start));
+		results.reflection.stepsPerRay = StepsPerRay(accelerator, reflection, false);
+	}
+
+	// ----------------------------------------------------------------------
+	// Full renders
+
+	struct ScalingResult
+	{
+		int     threads;
+		double  seconds;
+		double  raysPerSecond;
+	};
+
+	ScalingResult MeasureRender(const RayTracer &tracer, int width, int height, int threads)
+	{
+		Clock::time_point start = Clock::now();
+		ProgressiveRenderer renderer;
+		renderer.Start(tracer, width, height, TILE_SIZE, threads,
+		               [](const Tile &, const vec3 *) {}, false);
+		renderer.Wait();
+
+		ScalingResult result;
+		result.threads = renderer.Scheduler().ThreadCount();
+		result.seconds = SecondsSince(start);
+
+		unsigned long long rays = 0;
+		const vector<TraceContext> &contexts = renderer.Contexts();
+		for (size_t i = 0; i < contexts.size(); ++i)
+			rays += contexts[i].primarySamples + contexts[i].shadowRays +
+			        contexts[i].reflectionRays;
+		result.raysPerSecond = Rate(size_t(rays), result.seconds);
+		return result;
+	}
+
+	// ----------------------------------------------------------------------
+	// Caustic photon maps
+
+	struct PhotonResult
+	{
+		int     emitted;
+		int     stored;
+		double  emitSeconds;
+		double  buildSeconds;
+		size_t  gathers;
+		double  gathersPerSecond;
+	};
+
+	// Shoots and builds a photon map on every thread, then times density
+	// estimates at the first hits of every fourth pixel's primary ray on
+	// one thread, as a render thread would make them
+	PhotonResult MeasurePhotons(const RayTracer &tracer, int photons, int width, int height,
+	                            int threads)
+	{
+		const Accelerator &accelerator = tracer.Acceleration();
+		const Scene &scene = *accelerator.GetScene();
+		PhotonResult result;
+		result.emitted = photons;
+
+		vector<Photon> found;
+		Clock::time_point start = Clock::now();
+		EmitCausticPhotons(scene, accelerator, photons, threads, found);
+		result.emitSeconds = SecondsSince(start);
+
+		PhotonMap map;
+		start = Clock::now();
+		map.Build(found, photons, threads);
+		result.buildSeconds = SecondsSince(start);
+		result.stored = map.Size();
+
+		vector<vec3> positions, normals;
+		for (int y = 0; y < height; y += 2)
+			for (int x = 0; x < width; x += 2)
+			{
+				Ray ray = tracer.camera.GenerateRay(x + 0.5f, y + 0.5f, width, height);
+				Hit hit;
+				if (!accelerator.Intersect(ray, hit)) continue;
+				vec3 position = ray.At(hit.t);
+				vec3 normal = scene.Normal(hit.primitive, position);
+				positions.push_back(position);
+				normals.push_back(dot(normal, ray.direction) > 0.f ? -normal : normal);
+			}
+
+		const RenderSettings &settings = tracer.settings;
+		vector<NearPhoton> nearest;
+		vec3 total(0.f);
+		start = Clock::now();
+		for (size_t i = 0; i < positions.size(); ++i)
+			total += map.Density(positions[i], normals[i], settings.causticNeighbours,
+			                     settings.causticRadius, nearest);
+		result.gathers = positions.size();
+		result.gathersPerSecond = Rate(positions.size(), SecondsSince(start));
+		if (!std::isfinite(total.x))
+			cout << "  photon density estimates went wrong" << endl;
+		return result;
+	}
+
+	// ----------------------------------------------------------------------
+	// JSON output
+
+	string Quote(const string &text)
+	{
+		return "\"" + text + "\"";
+	}
+
+	string Number(double value)
+	{
+		ostringstream out;
+		out.precision(6);
+		out << (std::isfinite(value) ? value : 0.0);
+		return out.str();
+	}
+
+	string QueryJson(const QueryResult &query)
+	{
+		return "{ \"rays\": " + Number(double(query.rays)) +
+		       ", \"raysPerSecond\": " + Number(query.raysPerSecond) +
+		       ", \"stepsPerRay\": " + Number(query.stepsPerRay) + " }";
+	}
+
+	// one BVH layout's measurements for a scene
+	struct LayoutResult
+	{
+		BVHLayout       layout;
+		double          buildSeconds;
+		QueryResults    queries;
+		ScalingResult   render;     // on every thread
+	};
+
+	// benchmarks one scene, returning its JSON object
+	string BenchmarkScene(const string &name, const Scene &scene,
+	                      const BenchmarkOptions &options)
+	{
+		cout << "Benchmarking " << name << "..." << endl;
+
+		RayTracer tracer;
+		const BVHLayout layouts[] = { BVH_BINARY, BVH_WIDE4, BVH_WIDE8 };
+		vector<LayoutResult> layoutResults;
+		double buildTime = 0.0;
+		QueryResults queries;
+		for (int i = 0; i < 3; ++i)
+		{
+			LayoutResult result;
+			result.layout = layouts[i];
+			Clock::time_point start = Clock::now();
+			tracer.SetScene(scene, layouts[i]);
+			result.buildSeconds = SecondsSince(start);
+			MeasureQueries(tracer, options.width, options.height, result.queries);
+			result.render = MeasureRender(tracer, options.width, options.height,
+			                              options.maxThreads);
+			layoutResults.push_back(result);
+			if (layouts[i] == DEFAULT_BVH_LAYOUT)
+			{
+				buildTime = result.buildSeconds;
+				queries = result.queries;
+			}
+		}
+
+		// everything else runs on the default layout
+		tracer.SetScene(scene);
+		vector<ScalingResult> scaling;
+		for (int threads = 1; ; threads = std::min(threads * 2, options.maxThreads))
+		{
+			scaling.push_back(MeasureRender(tracer, options.width, options.height, threads));
+			if (threads == options.maxThreads) break;
+		}
+		tracer.settings.wavefront = true;
+		ScalingResult wavefront = MeasureRender(tracer, options.width, options.height,
+		                                        options.maxThreads);
+		tracer.settings.wavefront = false;
+
+		ostringstream json;
+		json << "    {\n";
+		json << "      \"name\": " << Quote(name) << ",\n";
+		json << "      \"primitives\": " << scene.PrimitiveCount() << ",\n";
+		json << "      \"bvhBuildSeconds\": " << Number(buildTime) << ",\n";
+		json << "      \"bvhNodes\": " << tracer.Acceleration().NodeCount() << ",\n";
+		json << "      \"instances\": " << scene.instances.size() << ",\n";
+		json << "      \"queries\": {\n";
+		json << "        \"primary\": " << QueryJson(queries.primary) << ",\n";
+		json << "        \"primaryPacket\": " << QueryJson(queries.primaryPacket) << ",\n";
+		json << "        \"shadow\": " << QueryJson(queries.shadow) << ",\n";
+		json << "        \"reflection\": " << QueryJson(queries.reflection) << "\n";
+		json << "      },\n";
+		json << "      \"render\": [\n";
+		for (size_t i = 0; i < scaling.size(); ++i)
+		{
+			json << "        { \"threads\": " << scaling[i].threads
+			     << ", \"seconds\": " << Number(scaling[i].seconds)
+			     << ", \"raysPerSecond\": " << Number(scaling[i].raysPerSecond)
+			     << ", \"speedup\": " << Number(scaling[0].seconds / scaling[i].seconds)
+			     << " }" << (i + 1 < scaling.size() ? "," : "") << "\n";
+		}
+		json << "      ],\n";
+		json << "      \"wavefront\": { \"threads\": " << wavefront.threads
+		     << ", \"seconds\": " << Number(wavefront.seconds)
+		     << ", \"raysPerSecond\": " << Number(wavefront.raysPerSecond)
+		     << ", \"speedup\": " << Number(scaling.back().seconds / wavefront.seconds) << " },\n";
+		json << "      \"layouts\": [\n";
+		for (size_t i = 0; i < layoutResults.size(); ++i)
+		{
+			const LayoutResult &l = layoutResults[i];
+			json << "        { \"bvhLayout\": " << Quote(BVHLayoutName(l.layout))
+			     << ", \"bvhBuildSeconds\": " << Number(l.buildSeconds)
+			     << ", \"primary\": " << QueryJson(l.queries.primary)
+			     << ", \"shadow\": " << QueryJson(l.queries.shadow)
+			     << ", \"reflection\": " << QueryJson(l.queries.reflection)
+			     << ", \"renderSeconds\": " << Number(l.render.seconds)
+			     << ", \"renderThreads\": " << l.render.threads
+			     << " }" << (i + 1 < layoutResults.size() ? "," : "") << "\n";
+		}
+		json << "      ]\n";
+		json << "    }";
+
+		cout << "  build " << buildTime << " s, primary " << queries.primaryPacket.raysPerSecond
+		     << " rays/s, shadow " << queries.shadow.raysPerSecond << " rays/s, "
+		     << queries.primary.stepsPerRay << " steps per primary ray" << endl;
+		cout << "  render " << scaling.back().seconds << " s recursive, "
+		     << wavefront.seconds << " s as a wavefront" << endl;
+		cout << "  layouts:";
+		for (size_t i = 0; i < layoutResults.size(); ++i)
+			cout << (i > 0 ? "," : "") << " " << BVHLayoutName(layoutResults[i].layout) << " "
+			     << layoutResults[i].render.seconds << " s";
+		cout << endl;
+		return json.str();
+	}
+}
+
+// ==========================================================================
+// PROGRAM ENTRY POINT
+
+int main(int argc, char *argv[])
+{
+	BenchmarkOptions options;
+	if (!ParseOptions(argc, argv, options))
+	{
+		cout << "usage: " << argv[0] << " [-w width] [-h height] [-threads max]"
+		     << " [-max primitives] [-o results.json]" << endl;
+		return -1;
+	}
+
+	vector<string> results;
+	const char *files[] = { "scene1.txt", "scene2.txt" };
+	for (int i = 0; i < 2; ++i)
+	{
+		Scene scene;
+		if (!scene.LoadFromFile(files[i]))
+			return -1;
+		results.push_back(BenchmarkScene(string(files[i]).substr(0, 6), scene, options));
+	}
+
+	// caustics of scene1's mirror sphere, from ten thousand photons up
+	vector<PhotonResult> photons;
+	{
+		Scene scene;
+		if (!scene.LoadFromFile("scene1.txt"))
+			return -1;
+		RayTracer tracer;
+		tracer.SetScene(scene);
+		cout << "Benchmarking caustic photon maps..." << endl;
+		for (int count = 10000; count <= 1000000; count *= 10)
+		{
+			photons.push_back(MeasurePhotons(tracer, count, options.width, options.height,
+			                                 options.maxThreads));
+			const PhotonResult &p = photons.back();
+			cout << "  " << p.emitted << " shot, " << p.stored << " stored: emit "
+			     << p.emitSeconds << " s, build " << p.buildSeconds << " s, "
+			     << p.gathersPerSecond << " gathers/s" << endl;
+		}
+	}
+
+	// procedural scenes from a thousand primitives up, ten times larger
+	// each step
+	for (int count = 1000; count <= options.maxPrimitives; count *= 10)
+	{
+		Scene scene;
+		MakeSpheres(scene, count);
+		results.push_back(BenchmarkScene("spheres" + to_string(count), scene, options));
+		MakeMesh(scene, count);
+		results.push_back(BenchmarkScene("mesh" + to_string(count), scene, options));
+		MakeInstances(scene, count);
+		results.push_back(BenchmarkScene("instances" + to_string(count), scene, options));
+		if (count > options.maxPrimitives / 10) break;
+	}
+
+	ofstream out(options.outputFile.c_str());
+	if (!out)
+	{
+		cout << "ERROR: Could not write " << options.outputFile << endl;
+		return -1;
+	}
+	out << "{\n";
+	out << "  \"settings\": { \"width\": " << options.width << ", \"height\": " << options.height
+	    << ", \"samplesPerPixel\": 1, \"maxDepth\": " << RenderSettings().maxDepth
+	    << ", \"bvhLayout\": " << Quote(BVHLayoutName(DEFAULT_BVH_LAYOUT))
+	    << ", \"hardwareThreads\": " << TileScheduler::HardwareThreads() << " },\n";
+	out << "  \"scenes\": [\n";
+	for (size_t i = 0; i < results.size(); ++i)
+		out << results[i] << (i + 1 < results.size() ? "," : "") << "\n";
+	out << "  ],\n";
+	out << "  \"causticPhotons\": { \"scene\": \"scene1\", \"neighbours\": "
+	    << RenderSettings().causticNeighbours << ", \"radius\": "
+	    << Number(RenderSettings().causticRadius) << ", \"maps\": [\n";
+	for (size_t i = 0; i < photons.size(); ++i)
+	{
+		const PhotonResult &p = photons[i];
+		out << "    { \"emitted\": " << p.emitted << ", \"stored\": " << p.stored
+		    << ", \"emitSeconds\": " << Number(p.emitSeconds)
+		    << ", \"buildSeconds\": " << Number(p.buildSeconds)
+		    << ", \"gathers\": " << p.gathers
+		    << ", \"gathersPerSecond\": " << Number(p.gathersPerSecond) << " }"
+		    << (i + 1 < photons.size() ? "," : "") << "\n";
+	}
+	out << "  ] }\n";
+	out << "}\n";
+
+	cout << "Results written to " << options.outputFile << endl;
+	return 0;
+}
+
+// ==========================================================================
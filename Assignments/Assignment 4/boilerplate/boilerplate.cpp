@@ -12,11 +12,18 @@
 
 #include <iostream>
 #include <fstream>
+#include <cstdlib>
 #include <algorithm>
 #include <string>
 #include <iterator>
 #include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
 #include "ImageBuffer.h"
+#include "Scene.h"
+#include "RayTracer.h"
+#include "Progressive.h"
+#include "SceneCache.h"
+#include "DynamicResolution.h"
 
 // Specify that we want the OpenGL core profile before including GLFW headers
 #ifndef LAB_LINUX
@@ -225,6 +232,54 @@ void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
 		glfwSetWindowShouldClose(window, GL_TRUE);
 }
 
+// how far the held arrow and page up/down keys move the light this frame
+vec3 LightMovement(GLFWwindow* window)
+{
+	const float LIGHT_STEP = 0.05f;
+	vec3 move(0.f);
+	if (glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS)      move.x -= LIGHT_STEP;
+	if (glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS)     move.x += LIGHT_STEP;
+	if (glfwGetKey(window, GLFW_KEY_DOWN) == GLFW_PRESS)      move.y -= LIGHT_STEP;
+	if (glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS)        move.y += LIGHT_STEP;
+	if (glfwGetKey(window, GLFW_KEY_PAGE_UP) == GLFW_PRESS)   move.z -= LIGHT_STEP;
+	if (glfwGetKey(window, GLFW_KEY_PAGE_DOWN) == GLFW_PRESS) move.z += LIGHT_STEP;
+	return move;
+}
+
+// camera after this frame's held W/A/S/D and Q/E keys, which move it along
+// its own axes, and any drag with the left mouse button, which turns it;
+// cursor keeps the cursor position between frames while dragging
+Camera CameraMovement(GLFWwindow* window, const Camera &camera, dvec2 &cursor)
+{
+	const float CAMERA_STEP = 0.05f;
+	const float TURN_PER_PIXEL = 0.003f;   // radians
+	vec3 move(0.f);
+	if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS) move.x -= CAMERA_STEP;
+	if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS) move.x += CAMERA_STEP;
+	if (glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS) move.y -= CAMERA_STEP;
+	if (glfwGetKey(window, GLFW_KEY_E) == GLFW_PRESS) move.y += CAMERA_STEP;
+	if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS) move.z -= CAMERA_STEP;
+	if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS) move.z += CAMERA_STEP;
+
+	Camera moved = camera;
+	moved.position += camera.orientation * move;
+
+	// turning left and right is about the vertical, up and down about the
+	// camera's own right axis, so the horizon stays level
+	dvec2 position;
+	glfwGetCursorPos(window, &position.x, &position.y);
+	if (glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS && cursor.x >= 0.0)
+	{
+		vec2 turn = -TURN_PER_PIXEL * vec2(position - cursor);
+		mat3 yaw = mat3(rotate(mat4(1.f), turn.x, vec3(0.f, 1.f, 0.f)));
+		mat3 pitch = mat3(rotate(mat4(1.f), turn.y, vec3(1.f, 0.f, 0.f)));
+		moved.orientation = yaw * camera.orientation * pitch;
+	}
+	cursor = glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS ?
+	         position : dvec2(-1.0);
+	return moved;
+}
+
 
 // --------------------------------------------------------------------------
 // --------------------------------------------------------------------------
@@ -258,6 +313,34 @@ void printVec3(const char* prefix, const vec3& v)
 
 int main(int argc, char *argv[])
 {
+	// usage: boilerplate [scene.txt] [-spp samples] [-adaptive]
+	// Uniform renders refine progressively up to the samples per pixel
+	// asked for; adaptive ones spend them where the image needs them.
+	string sceneFile = "scene1.txt";
+	int samplesPerPixel = 1;
+	bool adaptive = false;
+	for (int i = 1; i < argc; ++i)
+	{
+		string arg = argv[i];
+		if (arg == "-adaptive")
+			adaptive = true;
+		else if (arg == "-spp" && i + 1 < argc)
+			samplesPerPixel = atoi(argv[++i]);
+		else if (arg[0] != '-')
+			sceneFile = arg;
+		else
+		{
+			cout << "ERROR: Unexpected argument " << arg << endl;
+			cout << "usage: " << argv[0] << " [scene.txt] [-spp samples] [-adaptive]" << endl;
+			return -1;
+		}
+	}
+	if (samplesPerPixel <= 0)
+	{
+		cout << "ERROR: Samples per pixel must be positive" << endl;
+		return -1;
+	}
+
 	// initialize the GLFW windowing system
 	if (!glfwInit()) {
 		cout << "ERROR: GLFW failed to initialize, TERMINATING" << endl;
@@ -317,82 +400,81 @@ int main(int argc, char *argv[])
 // --------------------------------------------------------------------------
 // --------------------------------------------------------------------------
 // --------------------------------------------------------------------------
-	vec3 v(5,5,0);
-	printVec3("v", v);
-	vec3 n(5, 0, 5);
-	printVec3("n", n);
-	printVec3("n+v", n+v);
-	printVec3("n-v", n-v);
-	cout << "Length of v " << length(v) << endl;
-
-	//Unit length
-	n = normalize(n);
-	printVec3("unit length n", n);
-
-	// cros product
-	vec3 binormal = cross(v,n);
-	printVec3("v x n", binormal);
-	printVec3("n x v", cross(n,v));
-
-	// dot product
-	cout << "binormal dot v " << dot(binormal, v) << endl;
-
-	// reflect
-	printVec3("v reflected about n", reflect(v,n));
-
-	// NOTE THAT MATRICES ARE COLUMN MAJOR, SO THEY ARE ENTERED ACCORDING TO COLUMNS
+	// load the scene named on the command line and build its BVH, or take
+	// both from the scene's compiled cache
+	Scene scene;
+	Accelerator built;
+	if (!LoadCompiledScene(sceneFile, scene, built)) {
+		cout << "Program could not load scene " << sceneFile << ", TERMINATING" << endl;
+		return -1;
+	}
+	RayTracer tracer;
+	tracer.SetScene(scene, built);
+	tracer.settings.samplesPerPixel = samplesPerPixel;
+	tracer.settings.adaptive = adaptive;
 
 	ImageBuffer image;
 	image.Initialize();
 
-	float focalTheta;
-	float z = width/tan(focalTheta);
-	vector <float> viewRays;
-	for (int y = 0; y < image.Height(); y++)
-	{
-		for (int x = 0;  x < image.Width(); x++)
-		{
-			viewRays.push_back(-image.Width()/2 + x);
-			viewRays.push_back(-image.Width()/2 + y);
-			viewRays.push_back(z);
-
-			float r = float(x) /float(image.Width() - 1.f);
-			float b = float(y) /float(image.Width() - 1.f);
-			float g = (r+b)/2.f;
-
-			vec3 color = vec3(r, g, b);
-			image.SetPixel(x,y,color);
-		}
-	}
-
-
-
-	
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
+	// trace the image in tiles on every core, in the background, starting
+	// with coarse previews so the window below fills in straight away
+	const int TILE_SIZE = 32;
+	ProgressiveRenderer renderer;
+	ProgressiveRenderer::TileOutput showTile =
+		[&](const Tile &tile, const vec3 *colours) {
+			image.SetTile(tile.x, tile.y, tile.width, tile.height, colours);
+		};
+	renderer.Start(tracer, image.Width(), image.Height(), TILE_SIZE, 0, showTile);
+	cout << "Rendering " << renderer.PassCount() << " passes with "
+	     << renderer.Scheduler().ThreadCount() << " threads" << endl;
+
+	// while the camera moves, frames are traced at whatever resolution
+	// keeps them to the target time (see DynamicResolution.h)
+	const double TARGET_FRAME_TIME = 1.0 / 30.0;
+	DynamicResolution motion(TARGET_FRAME_TIME);
+	bool moving = false;
+	dvec2 cursor(-1.0);
 
 	// run an event-triggered main loop
 	while (!glfwWindowShouldClose(window))
 	{
+		// the arrow keys and page up/down move the first light
+		vec3 move = LightMovement(window);
+		bool lightMoved = move != vec3(0.f) && !scene.lights.empty();
+		Camera camera = CameraMovement(window, tracer.camera, cursor);
+		bool cameraMoved = camera.position != tracer.camera.position ||
+		                   camera.orientation != tracer.camera.orientation;
+		if (lightMoved || cameraMoved)
+		{
+			renderer.Cancel();
+			tracer.camera = camera;
+		}
+		if (lightMoved)
+		{
+			scene.lights[0].position += move;
+			tracer.UpdateLights();
+		}
+
+		// a moving camera gets a quick frame each time round; once it stops,
+		// a full render converges to the full resolution and samples
+		if (cameraMoved)
+		{
+			motion.RenderFrame(tracer, image, TILE_SIZE);
+			moving = true;
+		}
+		else if (moving)
+		{
+			moving = false;
+			renderer.Start(tracer, image.Width(), image.Height(), TILE_SIZE, 0, showTile);
+		}
+		else if (lightMoved)
+		{
+			// with the camera and geometry put, the image is shaded again
+			// from the first hits of the last render instead of being
+			// traced from scratch
+			if (!renderer.Reshade(tracer, image.Width(), image.Height(), TILE_SIZE, 0, showTile))
+				renderer.Start(tracer, image.Width(), image.Height(), TILE_SIZE, 0, showTile);
+		}
 
 // --------------------------------------------------------------------------
 // --------------------------------------------------------------------------
@@ -420,6 +502,20 @@ int main(int argc, char *argv[])
 // --------------------------------------------------------------------------
 // --------------------------------------------------------------------------
 // --------------------------------------------------------------------------
+	// closing the window early abandons the tiles that haven't started
+	renderer.Cancel();
+	if (tracer.settings.adaptive)
+	{
+		const vector<TraceContext> &contexts = renderer.Contexts();
+		long long traced = 0;
+		for (size_t i = 0; i < contexts.size(); ++i)
+			traced += contexts[i].primarySamples;
+		long long uniform = (long long)image.Width() * image.Height() *
+		                    tracer.settings.samplesPerPixel;
+		cout << "Adaptive sampling traced " << traced << " of " << uniform
+		     << " samples (" << 100.0 * (uniform - traced) / std::max(uniform, 1LL)
+		     << "% saved vs " << tracer.settings.samplesPerPixel << " spp)" << endl;
+	}
 	image.SaveToFile("AwesomeRayTracedImage.png");
 	image.Destroy();
 
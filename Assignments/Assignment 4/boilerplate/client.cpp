@@ -0,0 +1,123 @@
+// ==========================================================================
+// Render Client
+//  - sends one command to a running render server and prints its answer,
+//    following a render or load through to the end
+//  - scene and image paths are made absolute first, since the server may
+//    have been started somewhere else
+//  - exits with zero if the command succeeded
+//
+// usage: client [-socket path] render scene.txt [-o image.png] [-w width]
+//                              [-h height] [-spp samples] [-priority n]
+//                              [-eye x y z] [-target x y z] [-fov degrees] [-path]
+//        client [-socket path] load scene.txt [-priority n]
+//        client [-socket path] cancel job
+//        client [-socket path] status
+//        client [-socket path] shutdown
+// ==========================================================================
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <csignal>
+#include "LocalSocket.h"
+#include "RenderServer.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+// --------------------------------------------------------------------------
+
+namespace
+{
+	void PrintUsage(const char *program)
+	{
+		cout << "usage: " << program << " [-socket path] render scene.txt [-o image.png]"
+		     << " [-w width] [-h height] [-spp samples] [-priority n] [-eye x y z]"
+		     << " [-target x y z] [-fov degrees] [-path]" << endl;
+		cout << "       " << program << " [-socket path] load scene.txt [-priority n]" << endl;
+		cout << "       " << program << " [-socket path] cancel job | status | shutdown" << endl;
+	}
+
+	string AbsolutePath(const string &path)
+	{
+	#ifndef _WIN32
+		char directory[4096];
+		if (!path.empty() && path[0] != '/' && getcwd(directory, sizeof(directory)))
+			return string(directory) + "/" + path;
+	#endif
+		return path;
+	}
+
+	// the first word of a line
+	string Head(const string &line)
+	{
+		vector<string> words = SplitWords(line);
+		return words.empty() ? string() : words[0];
+	}
+}
+
+// ==========================================================================
+// PROGRAM ENTRY POINT
+
+int main(int argc, char *argv[])
+{
+	string socketFile = DEFAULT_RENDER_SOCKET;
+	int first = 1;
+	if (argc > 2 && string(argv[1]) == "-socket")
+	{
+		socketFile = argv[2];
+		first = 3;
+	}
+	if (first >= argc)
+	{
+		PrintUsage(argv[0]);
+		return -1;
+	}
+
+	string command = argv[first];
+	bool job = command == "render" || command == "load";
+	string line = command;
+	for (int i = first + 1; i < argc; ++i)
+	{
+		string word = argv[i];
+		if (job && (i == first + 1 || string(argv[i - 1]) == "-o"))
+			word = AbsolutePath(word);
+		line += " " + QuoteWord(word);
+	}
+
+#ifdef SIGPIPE
+	signal(SIGPIPE, SIG_IGN);
+#endif
+
+	LocalSocket server;
+	if (!server.Connect(socketFile))
+	{
+		cout << "ERROR: No render server is listening on " << socketFile << endl;
+		return -1;
+	}
+	if (!server.WriteLine(line))
+	{
+		cout << "ERROR: Could not send to the render server" << endl;
+		return -1;
+	}
+
+	// a job's answer ends with how it went, anything else's with ok, error
+	// or end
+	string answer;
+	while (server.ReadLine(answer))
+	{
+		cout << answer << endl;
+		string head = Head(answer);
+		if (head == "done" || head == "ok" || head == "end")
+			return 0;
+		if (head == "failed" || head == "cancelled" || head == "error")
+			return -1;
+	}
+	cout << "ERROR: The render server closed the connection" << endl;
+	return -1;
+}
+
+// ==========================================================================
@@ -0,0 +1,92 @@
+// ==========================================================================
+// Render Server
+//  - runs in the background, keeping the scenes it loads warm, and renders
+//    the jobs clients send it on a local socket (see RenderServer.h for
+//    what they can send, and client.cpp for a client)
+//  - stops when a client sends shutdown
+//
+// usage: server [-socket path] [-threads count] [-scenes count]
+// ==========================================================================
+
+#include <iostream>
+#include <string>
+#include <cstdlib>
+#include <csignal>
+#include "RenderServer.h"
+
+using namespace std;
+
+// --------------------------------------------------------------------------
+
+namespace
+{
+	// scenes kept loaded before the one used longest ago is dropped
+	const int DEFAULT_MAX_SCENES = 4;
+
+	struct ServerOptions
+	{
+		string  socketFile;
+		int     threads;        // 0 for every hardware thread
+		int     scenes;
+
+		ServerOptions()
+			: socketFile(DEFAULT_RENDER_SOCKET), threads(0), scenes(DEFAULT_MAX_SCENES)
+		{}
+	};
+
+	void PrintUsage(const char *program)
+	{
+		cout << "usage: " << program << " [-socket path] [-threads count] [-scenes count]"
+		     << endl;
+	}
+
+	bool ParseOptions(int argc, char *argv[], ServerOptions &options)
+	{
+		for (int i = 1; i < argc; ++i)
+		{
+			string arg = argv[i];
+			bool hasValue = i + 1 < argc;
+			if (arg == "-socket" && hasValue)
+				options.socketFile = argv[++i];
+			else if (arg == "-threads" && hasValue)
+				options.threads = atoi(argv[++i]);
+			else if (arg == "-scenes" && hasValue)
+				options.scenes = atoi(argv[++i]);
+			else
+			{
+				cout << "ERROR: Unexpected argument " << arg << endl;
+				return false;
+			}
+		}
+
+		if (options.threads < 0 || options.scenes <= 0)
+		{
+			cout << "ERROR: Threads and scenes must be positive" << endl;
+			return false;
+		}
+		return true;
+	}
+}
+
+// ==========================================================================
+// PROGRAM ENTRY POINT
+
+int main(int argc, char *argv[])
+{
+	ServerOptions options;
+	if (!ParseOptions(argc, argv, options))
+	{
+		PrintUsage(argv[0]);
+		return -1;
+	}
+
+#ifdef SIGPIPE
+	// a client hanging up mid-answer must not take the server down with it
+	signal(SIGPIPE, SIG_IGN);
+#endif
+
+	RenderServer server(options.threads, options.scenes);
+	return server.Run(options.socketFile) ? 0 : -1;
+}
+
+// ==========================================================================